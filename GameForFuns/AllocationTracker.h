@@ -0,0 +1,195 @@
+//
+//  AllocationTracker.h
+//  GameForFuns
+//
+//  Counts every global operator new, on any thread, and checks that the
+//  frame loop stops allocating once it has warmed up. Frames that are
+//  expected to allocate (trace capture, path recording, a growing world) call
+//  allowFrame(). Work that allocates by design on whatever thread runs it,
+//  such as file I/O in a job, holds an AllocationTracker::Exempt, and what it
+//  allocates is counted apart.
+//
+//  Define ALLOCATION_TRACKER_IMPLEMENTATION in exactly one source file before
+//  including this header to install the counting operator new/delete. That
+//  must be the file's first inclusion of it, directly or through another
+//  header, since later ones are skipped.
+//  Build with ALLOCATION_TRACKING=0 to leave the global allocator alone.
+//
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Profiler.h"
+
+#ifndef ALLOCATION_TRACKING
+#define ALLOCATION_TRACKING PROFILER_ENABLED
+#endif
+
+const GLuint ALLOCATION_WARMUP_FRAMES = 120; // Containers grow to their high-water mark in these
+
+class AllocationTracker {
+public:
+    static AllocationTracker &get() {
+        static AllocationTracker instance;
+        return instance;
+    }
+
+    // Allocations on this thread while one is alive are not the frame's
+    class Exempt {
+    public:
+        Exempt() {
+            exemptDepth()++;
+        }
+
+        ~Exempt() {
+            exemptDepth()--;
+        }
+
+        Exempt(const Exempt &) = delete;
+        Exempt &operator=(const Exempt &) = delete;
+    };
+
+    // Called from operator new, must not allocate
+    static void record(size_t bytes) {
+        if (exemptDepth() > 0) {
+            exemptCounter().fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        counter().fetch_add(1, std::memory_order_relaxed);
+        byteCounter().fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    static uint64_t getAllocationCount() {
+        return counter().load(std::memory_order_relaxed);
+    }
+
+    static uint64_t getAllocatedBytes() {
+        return byteCounter().load(std::memory_order_relaxed);
+    }
+
+    // Allocations made inside Exempt scopes
+    static uint64_t getExemptCount() {
+        return exemptCounter().load(std::memory_order_relaxed);
+    }
+
+    void beginFrame() {
+        this->frameStart = getAllocationCount();
+        this->frameStartBytes = getAllocatedBytes();
+        this->allowed = false;
+    }
+
+    // Asserts that a steady-state frame made no heap allocations
+    void endFrame() {
+        uint64_t allocations = getAllocationCount() - this->frameStart;
+        this->lastFrameAllocations = allocations;
+
+        if (this->frameIndex++ < ALLOCATION_WARMUP_FRAMES || this->allowed || allocations == 0) {
+            return;
+        }
+
+        this->violations++;
+        if (this->violations == 1) {
+            std::cout << "ERROR::ALLOCATION_TRACKER::FRAME_ALLOCATED " << allocations << " allocations, "
+                      << (getAllocatedBytes() - this->frameStartBytes) << " bytes in frame " << this->frameIndex << std::endl;
+        }
+        assert(allocations == 0 && "Heap allocation in the steady-state frame loop");
+    }
+
+    void allowFrame() {
+        this->allowed = true;
+    }
+
+    uint64_t getLastFrameAllocations() const {
+        return this->lastFrameAllocations;
+    }
+
+    GLuint getViolationCount() const {
+        return this->violations;
+    }
+
+private:
+    uint64_t frameStart = 0;
+    uint64_t frameStartBytes = 0;
+    uint64_t lastFrameAllocations = 0;
+    GLuint frameIndex = 0;
+    GLuint violations = 0;
+    bool allowed = false;
+
+    AllocationTracker() {}
+
+    static std::atomic<uint64_t> &counter() {
+        static std::atomic<uint64_t> count{0};
+        return count;
+    }
+
+    static std::atomic<uint64_t> &byteCounter() {
+        static std::atomic<uint64_t> bytes{0};
+        return bytes;
+    }
+
+    static std::atomic<uint64_t> &exemptCounter() {
+        static std::atomic<uint64_t> count{0};
+        return count;
+    }
+
+    static GLuint &exemptDepth() {
+        static thread_local GLuint depth = 0;
+        return depth;
+    }
+};
+
+#if ALLOCATION_TRACKING && defined(ALLOCATION_TRACKER_IMPLEMENTATION)
+void *operator new(size_t size) {
+    AllocationTracker::record(size);
+    void *memory = std::malloc(size ? size : 1);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void *operator new[](size_t size) {
+    return ::operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    AllocationTracker::record(size);
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return ::operator new(size, std::nothrow);
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, const std::nothrow_t &) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, const std::nothrow_t &) noexcept {
+    std::free(memory);
+}
+#endif
@@ -0,0 +1,326 @@
+//
+//  AsyncTextureLoader.h
+//  GameForFuns
+//
+//  Texture loading that never blocks a frame on a decode. load() returns a
+//  texture at once, holding a 1x1 white placeholder, and queues the read and
+//  decode on the job system. update() runs on the context thread each frame
+//  and uploads finished images, a few per frame. PNG, JPEG and the other
+//  formats SOIL reads are decoded to RGBA8. KTX2 files are parsed in place and
+//  their levels uploaded as stored, including BC1/BC3/BC7 blocks where the
+//  driver supports them; Basis supercompressed KTX2 would need a transcoder
+//  and is rejected.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "SOIL2/SOIL2.h"
+
+#include "Profiler.h"
+#include "JobSystem.h"
+#include "GpuResources.h"
+
+const GLuint ASYNC_TEXTURE_UPLOADS_PER_FRAME = 2;
+
+// Image ready for upload, each level pointing into memory owned by whoever decoded it
+struct DecodedTexture {
+    GLuint width = 0, height = 0;
+    GLenum internalFormat = GL_RGBA8;
+    GLenum format = GL_RGBA;       // Uncompressed formats only
+    bool compressed = false;
+    bool generateMips = false;     // Only level 0 was stored
+    GLuint faces = 1;              // Six for a cubemap, each level holding +X -X +Y -Y +Z -Z back to back
+    std::vector<const unsigned char *> levels; // Level 0 first
+    std::vector<size_t> levelSizes;
+};
+
+// KTX2 container without supercompression. Levels point into data, which must outlive texture.
+inline bool parseKtx2(const unsigned char *data, size_t size, DecodedTexture &texture) {
+    static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    const size_t headerSize = 80, levelEntrySize = 24;
+    if (size < headerSize || std::memcmp(data, identifier, sizeof(identifier)) != 0) {
+        return false;
+    }
+    auto read32 = [data](size_t offset) {
+        uint32_t value;
+        std::memcpy(&value, data + offset, sizeof(value));
+        return value;
+    };
+    auto read64 = [data](size_t offset) {
+        uint64_t value;
+        std::memcpy(&value, data + offset, sizeof(value));
+        return value;
+    };
+
+    uint32_t vkFormat = read32(12);
+    texture.width = read32(20);
+    texture.height = read32(24);
+    uint32_t depth = read32(28), layers = read32(32), faces = read32(36), levelCount = read32(40);
+    uint32_t supercompression = read32(44);
+    if (supercompression != 0) {
+        std::cout << "ERROR::KTX2::SUPERCOMPRESSION_UNSUPPORTED scheme " << supercompression << std::endl;
+        return false;
+    }
+    if (depth > 1 || layers > 1 || (faces != 1 && faces != 6)) {
+        std::cout << "ERROR::KTX2::ONLY_2D_AND_CUBE_TEXTURES_SUPPORTED" << std::endl;
+        return false;
+    }
+    texture.faces = faces;
+
+    // Vulkan formats with an OpenGL equivalent
+    struct Format {
+        uint32_t vkFormat;
+        GLenum internalFormat, format;
+        bool compressed;
+    };
+    static const Format formats[] = {
+        { 23, GL_RGB8, GL_RGB, false },                                          // R8G8B8_UNORM
+        { 29, GL_SRGB8, GL_RGB, false },                                         // R8G8B8_SRGB
+        { 37, GL_RGBA8, GL_RGBA, false },                                        // R8G8B8A8_UNORM
+        { 43, GL_SRGB8_ALPHA8, GL_RGBA, false },                                 // R8G8B8A8_SRGB
+        { 131, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 0, true },                       // BC1_RGB_UNORM
+        { 132, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, 0, true },                      // BC1_RGB_SRGB
+        { 133, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 0, true },                      // BC1_RGBA_UNORM
+        { 134, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 0, true },                // BC1_RGBA_SRGB
+        { 137, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 0, true },                      // BC3_UNORM
+        { 138, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 0, true },                // BC3_SRGB
+        { 145, GL_COMPRESSED_RGBA_BPTC_UNORM_ARB, 0, true },                     // BC7_UNORM
+        { 146, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB, 0, true },               // BC7_SRGB
+    };
+    const Format *found = nullptr;
+    for (const Format &candidate : formats) {
+        if (candidate.vkFormat == vkFormat) {
+            found = &candidate;
+        }
+    }
+    if (!found) {
+        std::cout << "ERROR::KTX2::FORMAT_UNSUPPORTED vkFormat " << vkFormat << std::endl;
+        return false;
+    }
+    texture.internalFormat = found->internalFormat;
+    texture.format = found->format;
+    texture.compressed = found->compressed;
+
+    // A level count of 0 asks the loader to generate the chain from level 0
+    texture.generateMips = levelCount == 0;
+    levelCount = std::max(levelCount, 1u);
+    if (size < headerSize + levelCount * levelEntrySize) {
+        return false;
+    }
+    for (uint32_t level = 0; level < levelCount; level++) {
+        uint64_t offset = read64(headerSize + level * levelEntrySize);
+        uint64_t length = read64(headerSize + level * levelEntrySize + 8);
+        if (offset + length > size) {
+            std::cout << "ERROR::KTX2::TRUNCATED" << std::endl;
+            return false;
+        }
+        texture.levels.push_back(data + offset);
+        texture.levelSizes.push_back((size_t) length);
+    }
+    return true;
+}
+
+class AsyncTextureLoader {
+public:
+    static AsyncTextureLoader &get() {
+        static AsyncTextureLoader instance;
+        return instance;
+    }
+
+    // The job system is created first so it outlives the loader, whose destructor waits on it
+    AsyncTextureLoader(): jobs(JobSystem::get()) {}
+
+    ~AsyncTextureLoader() {
+        this->jobs.wait(this->counter);
+        for (std::unique_ptr<Request> &request : this->requests) {
+            SOIL_free_image_data(request->pixels);
+        }
+    }
+
+    AsyncTextureLoader(const AsyncTextureLoader &) = delete;
+    AsyncTextureLoader &operator=(const AsyncTextureLoader &) = delete;
+
+    // Returns a tracked texture, owned by the caller, that shows a placeholder until the file is decoded
+    GLuint load(const std::string &path) {
+        std::unique_ptr<Request> request(new Request());
+        request->path = path;
+        return this->submit(std::move(request));
+    }
+
+    // As load, decoding a copy of an encoded image held in memory, e.g. inside a .glb
+    GLuint loadFromMemory(const unsigned char *bytes, size_t size, const std::string &label) {
+        std::unique_ptr<Request> request(new Request());
+        request->path = label;
+        request->encoded.assign(bytes, bytes + size);
+        return this->submit(std::move(request));
+    }
+
+    // Drops the upload of a texture its owner releases before the decode finished
+    void cancel(GLuint texture) {
+        for (std::unique_ptr<Request> &request : this->requests) {
+            if (request->texture == texture) {
+                request->cancelled = true;
+            }
+        }
+    }
+
+    // Uploads up to ASYNC_TEXTURE_UPLOADS_PER_FRAME finished decodes; call once a frame on the context thread
+    void update() {
+        if (this->requests.empty()) {
+            return;
+        }
+        PROFILE_SCOPE("AsyncTextureLoader::update");
+        if (this->jobs.getThreadCount() == 1) {
+            this->jobs.runPending(); // No workers, decode one image per frame here
+        }
+        this->uploadFinished(ASYNC_TEXTURE_UPLOADS_PER_FRAME);
+    }
+
+    // Waits for every decode and uploads them all, e.g. behind a loading screen
+    void finish() {
+        this->jobs.wait(this->counter);
+        this->uploadFinished((GLuint) this->requests.size());
+    }
+
+    GLuint getPendingCount() const {
+        return (GLuint) this->requests.size();
+    }
+
+private:
+    struct Request {
+        GLuint texture = 0;
+        std::string path;                   // File to read, or a label when encoded is filled in
+        std::vector<unsigned char> encoded; // File contents; KTX2 levels point into it
+        unsigned char *pixels = nullptr;    // Decoded by SOIL
+        DecodedTexture decoded;
+        bool failed = false;
+        bool cancelled = false;
+        std::atomic<bool> done{false};
+    };
+
+    JobSystem &jobs;
+    JobCounter counter{0};
+    std::vector<std::unique_ptr<Request>> requests; // In submission order
+
+    GLuint submit(std::unique_ptr<Request> request) {
+        // Placeholder texel; sampling state set here survives the real upload, so owners may override it
+        const unsigned char white[4] = { 255, 255, 255, 255 };
+        glGenTextures(1, &request->texture);
+        glBindTexture(GL_TEXTURE_2D, request->texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        GpuResourceRegistry::get().track(GPU_TEXTURE, request->texture, GPU_MEMORY_TEXTURES, 4, request->path);
+
+        Request *pending = request.get();
+        GLuint texture = request->texture;
+        this->requests.push_back(std::move(request));
+        this->jobs.run(this->counter, [pending]() { decode(*pending); });
+        return texture;
+    }
+
+    // Runs on a worker
+    static void decode(Request &request) {
+        PROFILE_SCOPE("Texture decode");
+        if (request.encoded.empty()) {
+            std::ifstream file(request.path, std::ios::binary);
+            request.encoded.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+
+        DecodedTexture &decoded = request.decoded;
+        if (request.encoded.size() >= 12 && request.encoded[1] == 'K' && request.encoded[5] == '2') {
+            request.failed = !parseKtx2(request.encoded.data(), request.encoded.size(), decoded) || decoded.faces != 1; // Cubemaps load through Skybox
+        } else {
+            int width = 0, height = 0, channels = 0;
+            request.pixels = SOIL_load_image_from_memory(request.encoded.data(), (int) request.encoded.size(),
+                                                         &width, &height, &channels, SOIL_LOAD_RGBA);
+            request.failed = !request.pixels;
+            decoded.width = (GLuint) width;
+            decoded.height = (GLuint) height;
+            decoded.generateMips = true;
+            decoded.levels.push_back(request.pixels);
+            decoded.levelSizes.push_back((size_t) width * height * 4);
+            std::vector<unsigned char>().swap(request.encoded);
+        }
+        request.done.store(true, std::memory_order_release);
+    }
+
+    void uploadFinished(GLuint budget) {
+        GLuint uploads = 0;
+        for (size_t i = 0; i < this->requests.size();) {
+            Request &request = *this->requests[i];
+            if (!request.done.load(std::memory_order_acquire)) {
+                i++;
+                continue;
+            }
+            if (!request.cancelled) {
+                if (uploads == budget) {
+                    break;
+                }
+                upload(request);
+                uploads++;
+            }
+            SOIL_free_image_data(request.pixels);
+            this->requests.erase(this->requests.begin() + i);
+        }
+    }
+
+    static void upload(const Request &request) {
+        const DecodedTexture &decoded = request.decoded;
+        if (request.failed) {
+            std::cout << "ERROR::TEXTURE::DECODE_FAILED " << request.path << std::endl;
+            return;
+        }
+        bool bptc = decoded.internalFormat == GL_COMPRESSED_RGBA_BPTC_UNORM_ARB || decoded.internalFormat == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB;
+        if (decoded.compressed && !(bptc ? (GLEW_ARB_texture_compression_bptc || GLEW_VERSION_4_2) : GLEW_EXT_texture_compression_s3tc)) {
+            std::cout << "ERROR::TEXTURE::COMPRESSED_FORMAT_UNSUPPORTED " << request.path << std::endl;
+            return;
+        }
+        PROFILE_SCOPE("Texture upload");
+
+        glBindTexture(GL_TEXTURE_2D, request.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        size_t bytes = 0;
+        for (GLuint level = 0; level < decoded.levels.size(); level++) {
+            GLsizei width = std::max(decoded.width >> level, 1u), height = std::max(decoded.height >> level, 1u);
+            if (decoded.compressed) {
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, decoded.internalFormat, width, height, 0,
+                                       (GLsizei) decoded.levelSizes[level], decoded.levels[level]);
+            } else {
+                glTexImage2D(GL_TEXTURE_2D, level, decoded.internalFormat, width, height, 0, decoded.format, GL_UNSIGNED_BYTE, decoded.levels[level]);
+            }
+            bytes += decoded.levelSizes[level];
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        GLuint levelCount = (GLuint) decoded.levels.size();
+        if (decoded.generateMips && !decoded.compressed) {
+            glGenerateMipmap(GL_TEXTURE_2D);
+            levelCount = 1;
+            while ((decoded.width | decoded.height) >> levelCount) {
+                levelCount++;
+            }
+            bytes = bytes * 4 / 3;
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        GpuResourceRegistry::get().setSize(GPU_TEXTURE, request.texture, bytes);
+    }
+};
@@ -0,0 +1,475 @@
+//
+//  Benchmark.h
+//  GameForFuns
+//
+//  Frame-time regression benchmark. Replays a recorded camera path through each
+//  demo scene in a hidden window and reports frame time percentiles, draw calls,
+//  state changes, triangles and peak RSS as JSON. Results can be compared against
+//  a stored baseline; a regression beyond the tolerance fails the run, as does a
+//  scene or metric the baseline lacks unless --allow-missing is given. The draw,
+//  state and triangle counts and the GPU times are the profiler's, so a build with
+//  PROFILER_ENABLED=0 refuses to run it rather than report zeros.
+//
+//  Usage: GameForFuns --benchmark [--out results.json] [--baseline baseline.json]
+//                                 [--tolerance 0.10] [--allow-missing] [--warmup 60] [--gltf model.glb]
+//
+//  The headless benchmarks of the job system, model import, voxels, broadphase and
+//  entities live in JobSystemBenchmark.h, ImportBenchmark.h, VoxelBenchmark.h,
+//  BroadphaseBenchmark.h and EntitiesBenchmark.h, and share the options, thread
+//  counts and statistics here.
+//
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <glm/glm.hpp>
+
+#include "Camera.h"
+#include "Profiler.h"
+#include "Scenes.h"
+#include "TextureResidency.h"
+#include "AsyncTextureLoader.h"
+#include "HdrPipeline.h"
+#include "PostProcess.h"
+#include "RenderGraph.h"
+
+const GLfloat BENCHMARK_TIMESTEP = 1.0f / 60.0f;
+
+struct CameraKey {
+    GLfloat time;
+    glm::vec3 position;
+    GLfloat yaw;
+    GLfloat pitch;
+};
+
+// Keyframed camera path, one "time x y z yaw pitch" line per key. Lines starting with # are comments.
+class CameraPath {
+public:
+    bool load(const std::string &path) {
+        std::ifstream in(path);
+        if (!in) {
+            std::cout << "ERROR::BENCHMARK::CAMERA_PATH_NOT_FOUND " << path << std::endl;
+            return false;
+        }
+
+        this->keys.clear();
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::istringstream fields(line);
+            CameraKey key;
+            if (fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch) {
+                this->keys.push_back(key);
+            }
+        }
+        return !this->keys.empty();
+    }
+
+    bool save(const std::string &path) const {
+        std::ofstream out(path);
+        if (!out) {
+            return false;
+        }
+        out << "# time x y z yaw pitch\n";
+        for (const CameraKey &key : this->keys) {
+            out << key.time << " " << key.position.x << " " << key.position.y << " " << key.position.z
+                << " " << key.yaw << " " << key.pitch << "\n";
+        }
+        return true;
+    }
+
+    void record(GLfloat time, Camera &camera) {
+        CameraKey key;
+        key.time = time;
+        key.position = camera.getPosition();
+        key.yaw = camera.getYaw();
+        key.pitch = camera.getPitch();
+        this->keys.push_back(key);
+    }
+
+    void clear() {
+        this->keys.clear();
+    }
+
+    // Moves the camera to the linearly interpolated key at time
+    void apply(GLfloat time, Camera &camera) const {
+        if (this->keys.empty()) {
+            return;
+        }
+
+        GLuint next = 0;
+        while (next < this->keys.size() && this->keys[next].time < time) {
+            next++;
+        }
+
+        const CameraKey &b = this->keys[std::min<size_t>(next, this->keys.size() - 1)];
+        const CameraKey &a = this->keys[next > 0 ? next - 1 : 0];
+        GLfloat span = b.time - a.time;
+        GLfloat t = span > 0.0f ? glm::clamp((time - a.time) / span, 0.0f, 1.0f) : 0.0f;
+
+        camera.setPosition(glm::mix(a.position, b.position, t));
+        camera.setOrientation(glm::mix(a.yaw, b.yaw, t), glm::mix(a.pitch, b.pitch, t));
+    }
+
+    GLfloat getDuration() const {
+        return this->keys.empty() ? 0.0f : this->keys.back().time;
+    }
+
+private:
+    std::vector<CameraKey> keys;
+};
+
+struct BenchmarkOptions {
+    std::string output = "benchmark.json";
+    std::string baseline;
+    GLfloat tolerance = 0.10f; // Allowed relative growth of each metric over the baseline
+    bool allowMissing = false; // Scenes and metrics the baseline lacks are skipped rather than failing the run
+    GLuint warmupFrames = 60;
+    bool jobScaling = false;
+    bool importScaling = false;
+    std::string importModel; // Empty for the synthetic OBJ
+    bool objComparison = false;
+    bool voxelMeshing = false;
+    bool voxelStreaming = false;
+    bool broadphase = false;
+    bool entities = false;
+    std::string objModel;    // Empty for the nanosuit and the synthetic OBJ
+    GLuint objTriangles = 10000000;
+    bool virtualTexturing = false; // Nanosuit diffuse maps through the virtual texture cache
+    std::string gltfModel;   // Also benchmarked when set
+};
+
+struct BenchmarkResult {
+    std::string scene;
+    GLuint frames = 0;
+    GLfloat p50Ms = 0.0f;
+    GLfloat p95Ms = 0.0f;
+    GLfloat p99Ms = 0.0f;
+    GLfloat gpuMs = 0.0f;        // Mean GPU time reported by the profiler
+    GLuint drawCalls = 0;        // Per frame, the maximum seen along the path
+    GLuint stateChanges = 0;
+    GLuint triangles = 0;
+    long peakRssKb = 0;
+};
+
+class Benchmark {
+public:
+    static long peakRssKb() {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss / 1024; // Bytes on macOS
+#else
+        return usage.ru_maxrss;        // Kilobytes on Linux
+#endif
+    }
+
+    // Nearest-rank percentile of an unsorted sample
+    static GLfloat percentile(std::vector<GLfloat> samples, GLfloat p) {
+        if (samples.empty()) {
+            return 0.0f;
+        }
+        std::sort(samples.begin(), samples.end());
+        size_t rank = (size_t) std::ceil(p / 100.0f * samples.size());
+        return samples[std::min(std::max<size_t>(rank, 1), samples.size()) - 1];
+    }
+
+    // Frames are timed from the start of the draw to glFinish so GPU-bound scenes are measured too
+    static BenchmarkResult runScene(GLFWwindow *window, Scene &scene, HdrPipeline &hdr, PostProcessChain &post,
+                                    const CameraPath &path, const glm::mat4 &projection, const BenchmarkOptions &options) {
+        BenchmarkResult result;
+        result.scene = scene.getName();
+
+        Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+        GLuint pathFrames = (GLuint) (path.getDuration() / BENCHMARK_TIMESTEP) + 1;
+        std::vector<GLfloat> frameTimes;
+        frameTimes.reserve(pathFrames);
+        GLfloat gpuTotal = 0.0f;
+
+        // The scene into HDR, then the game's exposure and post passes
+        RenderGraph graph;
+        RenderResource color, depth;
+        hdr.importScene(graph, color, depth);
+        RenderGraph::PassBuilder draw = graph.addPass("Scene", [&scene, &camera, &projection](RenderGraph &) {
+            scene.draw(camera, projection);
+        });
+        draw.setState(RENDER_STATE_SCENE).clearColor(glm::vec4(0.1f, 0.1f, 0.1f, 1.0f)).clearDepth();
+        color = draw.write(color);
+        depth = draw.write(depth, ACCESS_DEPTH);
+        RenderResource exposure = hdr.addExposurePass(graph, color, BENCHMARK_TIMESTEP);
+        post.addPasses(graph, hdr, color, exposure, graph.importOutput("Screen"));
+        graph.compile();
+        graph.realize();
+
+        for (GLuint frame = 0; frame < options.warmupFrames + pathFrames; frame++) {
+            bool measured = frame >= options.warmupFrames;
+            GLuint pathFrame = measured ? frame - options.warmupFrames : 0;
+            path.apply(pathFrame * BENCHMARK_TIMESTEP, camera);
+
+            Profiler &profiler = Profiler::get();
+            double start = profiler.nowUs();
+            PROFILE_BEGIN_FRAME();
+            FrameArena::get().beginFrame();
+            scene.prepare(camera, projection);
+            graph.execute();
+            TextureResidency::get().update();
+            AsyncTextureLoader::get().update();
+            glFinish();
+            PROFILE_END_FRAME();
+            GLfloat frameMs = (GLfloat) ((profiler.nowUs() - start) / 1000.0);
+
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+            GpuResourceRegistry::get().endFrame();
+
+            if (measured) {
+                const FrameStats &stats = profiler.getLastFrame();
+                frameTimes.push_back(frameMs);
+                gpuTotal += stats.gpuMs;
+                result.drawCalls = std::max(result.drawCalls, stats.drawCalls);
+                result.stateChanges = std::max(result.stateChanges, stats.stateChanges);
+                result.triangles = std::max(result.triangles, stats.triangles);
+            }
+        }
+
+        result.frames = (GLuint) frameTimes.size();
+        result.p50Ms = percentile(frameTimes, 50.0f);
+        result.p95Ms = percentile(frameTimes, 95.0f);
+        result.p99Ms = percentile(frameTimes, 99.0f);
+        result.gpuMs = result.frames ? gpuTotal / result.frames : 0.0f;
+        result.peakRssKb = peakRssKb();
+        return result;
+    }
+
+    static bool writeJson(const std::vector<BenchmarkResult> &results, const std::string &path) {
+        std::ofstream out(path);
+        if (!out) {
+            std::cout << "ERROR::BENCHMARK::COULD_NOT_WRITE " << path << std::endl;
+            return false;
+        }
+
+        out << "{\n  \"scenes\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchmarkResult &r = results[i];
+            out << "    {\"name\": \"" << r.scene << "\""
+                << ", \"frames\": " << r.frames
+                << ", \"p50_ms\": " << r.p50Ms
+                << ", \"p95_ms\": " << r.p95Ms
+                << ", \"p99_ms\": " << r.p99Ms
+                << ", \"gpu_ms\": " << r.gpuMs
+                << ", \"draw_calls\": " << r.drawCalls
+                << ", \"state_changes\": " << r.stateChanges
+                << ", \"triangles\": " << r.triangles
+                << ", \"peak_rss_kb\": " << r.peakRssKb
+                << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        return true;
+    }
+
+    // Reads a metric of a scene back from a file written by writeJson. Returns false if it is missing.
+    static bool readBaselineValue(const std::string &json, const std::string &scene, const std::string &key, GLfloat &value) {
+        size_t entry = json.find("\"name\": \"" + scene + "\"");
+        if (entry == std::string::npos) {
+            return false;
+        }
+        size_t end = json.find('}', entry);
+        size_t field = json.find("\"" + key + "\":", entry);
+        if (field == std::string::npos || field > end) {
+            return false;
+        }
+        value = std::strtof(json.c_str() + field + key.size() + 3, nullptr);
+        return true;
+    }
+
+    // Frame times and draw/state/triangle counts may not grow by more than the tolerance. A scene or
+    // metric the baseline lacks fails the comparison too, unless allowMissing, so a renamed scene or
+    // a truncated baseline cannot pass unchecked.
+    static bool compareBaseline(const std::vector<BenchmarkResult> &results, const std::string &path, GLfloat tolerance,
+                                bool allowMissing) {
+        std::ifstream in(path);
+        if (!in) {
+            std::cout << "ERROR::BENCHMARK::BASELINE_NOT_FOUND " << path << std::endl;
+            return false;
+        }
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        std::string json = buffer.str();
+
+        bool passed = true;
+        for (const BenchmarkResult &r : results) {
+            if (json.find("\"name\": \"" + r.scene + "\"") == std::string::npos) {
+                std::cout << (allowMissing ? "WARNING" : "ERROR") << "::BENCHMARK::BASELINE_MISSING_SCENE "
+                          << r.scene << " in " << path << std::endl;
+                passed = passed && allowMissing;
+                continue;
+            }
+            const std::pair<const char *, GLfloat> metrics[] = {
+                {"p50_ms", r.p50Ms}, {"p95_ms", r.p95Ms}, {"p99_ms", r.p99Ms},
+                {"draw_calls", (GLfloat) r.drawCalls}, {"state_changes", (GLfloat) r.stateChanges},
+                {"triangles", (GLfloat) r.triangles}
+            };
+            for (const auto &metric : metrics) {
+                GLfloat baseline;
+                if (!readBaselineValue(json, r.scene, metric.first, baseline)) {
+                    std::cout << (allowMissing ? "WARNING" : "ERROR") << "::BENCHMARK::BASELINE_MISSING_METRIC "
+                              << r.scene << " " << metric.first << " in " << path << std::endl;
+                    passed = passed && allowMissing;
+                    continue;
+                }
+                if (metric.second > baseline * (1.0f + tolerance)) {
+                    std::cout << "REGRESSION " << r.scene << " " << metric.first << ": "
+                              << metric.second << " > baseline " << baseline << std::endl;
+                    passed = false;
+                }
+            }
+        }
+        return passed;
+    }
+
+    // Returns the process exit code
+    static int run(GLFWwindow *window, GLint screenWidth, GLint screenHeight, const BenchmarkOptions &options) {
+#if !PROFILER_ENABLED
+        std::cout << "ERROR::BENCHMARK::PROFILER_DISABLED draw calls, state changes, triangles and GPU times "
+                  << "come from the profiler; build with PROFILER_ENABLED=1" << std::endl;
+        return EXIT_FAILURE;
+#endif
+        glfwSwapInterval(0);
+
+        glm::mat4 projection = glm::perspective(ZOOM, (GLfloat) screenWidth / (GLfloat) screenHeight, 0.1f, 1000.0f);
+        std::vector<BenchmarkResult> results;
+        HdrPipeline hdr(screenWidth, screenHeight);
+        PostProcessChain post;
+
+        {
+            CubeGridScene scene;
+            results.push_back(runPath(window, scene, hdr, post, projection, options));
+        }
+        {
+            VoxelScene scene;
+            results.push_back(runPath(window, scene, hdr, post, projection, options));
+        }
+        {
+            LitContainersScene scene;
+            results.push_back(runPath(window, scene, hdr, post, projection, options));
+        }
+        {
+            NanosuitScene scene(options.virtualTexturing);
+            results.push_back(runPath(window, scene, hdr, post, projection, options));
+        }
+        {
+            ParticleScene scene;
+            results.push_back(runPath(window, scene, hdr, post, projection, options));
+        }
+        if (!options.gltfModel.empty()) {
+            GltfScene scene(options.gltfModel);
+            results.push_back(runPath(window, scene, hdr, post, projection, options));
+        }
+
+        for (const BenchmarkResult &r : results) {
+            std::cout << r.scene << ": p50 " << r.p50Ms << " ms, p95 " << r.p95Ms << " ms, p99 " << r.p99Ms
+                      << " ms, " << r.drawCalls << " draws, " << r.triangles << " triangles" << std::endl;
+        }
+
+        if (!writeJson(results, options.output)) {
+            return EXIT_FAILURE;
+        }
+        if (!options.baseline.empty() && !compareBaseline(results, options.baseline, options.tolerance, options.allowMissing)) {
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    static bool parseOptions(int argc, char **argv, BenchmarkOptions &options) {
+        bool enabled = false;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--benchmark") {
+                enabled = true;
+            } else if (arg == "--benchmark-jobs") {
+                options.jobScaling = true;
+            } else if (arg == "--benchmark-import") {
+                options.importScaling = true;
+                if (hasValue && argv[i + 1][0] != '-') {
+                    options.importModel = argv[++i];
+                }
+            } else if (arg == "--benchmark-obj") {
+                options.objComparison = true;
+                if (hasValue && argv[i + 1][0] != '-') {
+                    options.objModel = argv[++i];
+                }
+            } else if (arg == "--benchmark-voxel") {
+                options.voxelMeshing = true;
+            } else if (arg == "--benchmark-streaming") {
+                options.voxelStreaming = true;
+            } else if (arg == "--benchmark-broadphase") {
+                options.broadphase = true;
+            } else if (arg == "--benchmark-entities") {
+                options.entities = true;
+            } else if (arg == "--triangles" && hasValue) {
+                options.objTriangles = (GLuint) std::strtoul(argv[++i], nullptr, 10);
+            } else if (arg == "--gltf" && hasValue) {
+                options.gltfModel = argv[++i];
+            } else if (arg == "--virtual-texturing") {
+                options.virtualTexturing = true;
+            } else if (arg == "--out" && hasValue) {
+                options.output = argv[++i];
+            } else if (arg == "--baseline" && hasValue) {
+                options.baseline = argv[++i];
+            } else if (arg == "--allow-missing") {
+                options.allowMissing = true;
+            } else if (arg == "--tolerance" && hasValue) {
+                options.tolerance = std::strtof(argv[++i], nullptr);
+            } else if (arg == "--warmup" && hasValue) {
+                options.warmupFrames = (GLuint) std::strtoul(argv[++i], nullptr, 10);
+            }
+        }
+        return enabled;
+    }
+
+    // 1, 2, 4, ... threads and finally every hardware thread
+    static std::vector<GLuint> threadCounts() {
+        GLuint maxThreads = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<GLuint> counts;
+        for (GLuint threads = 1; threads < maxThreads; threads *= 2) {
+            counts.push_back(threads);
+        }
+        counts.push_back(maxThreads);
+        return counts;
+    }
+
+    // FNV-1a
+    static uint64_t hashBytes(const void *bytes, size_t size) {
+        uint64_t hash = 14695981039346656037ull;
+        const unsigned char *p = (const unsigned char *) bytes;
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ p[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+private:
+    static BenchmarkResult runPath(GLFWwindow *window, Scene &scene, HdrPipeline &hdr, PostProcessChain &post,
+                                   const glm::mat4 &projection, const BenchmarkOptions &options) {
+        CameraPath path;
+        path.load(std::string("res/benchmarks/") + scene.getName() + ".path");
+        return runScene(window, scene, hdr, post, path, projection, options);
+    }
+};
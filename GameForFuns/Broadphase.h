@@ -0,0 +1,337 @@
+//
+//  Broadphase.h
+//  GameForFuns
+//
+//  A loose octree over moving boxes, for culling, picking and physics to find
+//  the objects near a box, along a ray or inside the view frustum without
+//  testing every one. Each node's bounds are twice its cell, so a box belongs
+//  to the deepest node whose cell is at least as large as the box and holds
+//  the box's center; it then always lies within that node's loose bounds, and
+//  a query visits only nodes whose loose bounds it touches. Boxes whose
+//  center leaves the root's cell stay in the root, which every query visits.
+//
+//  Bodies are kept as a structure of arrays, with their bounds packed apart
+//  from the bookkeeping, and referred to by ids that stay valid until the
+//  body is removed. Moving a body rewrites its bounds in place unless its
+//  center leaves its node's cell or its size changes level, which for a body
+//  moving a few units a frame is rare; only then is it relinked. Nodes left
+//  empty are returned to a free list.
+//
+//  Queries only read, so any number can run at once between updates.
+//
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+
+const GLuint BROADPHASE_NONE = 0xFFFFFFFF;
+const GLuint BROADPHASE_MAX_DEPTH = 10;
+
+// Distance along the ray, whose direction has inverse components invDirection, to where it enters box; false if it misses
+// the box or enters past maxDistance
+inline bool rayIntersectsAABB(const glm::vec3 &origin, const glm::vec3 &invDirection, GLfloat maxDistance, const AABB &box,
+                              GLfloat &distance) {
+    GLfloat tNear = 0.0f, tFar = maxDistance;
+    for (GLint axis = 0; axis < 3; axis++) {
+        GLfloat t0 = (box.min[axis] - origin[axis]) * invDirection[axis];
+        GLfloat t1 = (box.max[axis] - origin[axis]) * invDirection[axis];
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        // NaN from a zero direction component lying on a face compares false and leaves the range alone
+        tNear = t0 > tNear ? t0 : tNear;
+        tFar = t1 < tFar ? t1 : tFar;
+        if (tNear > tFar) {
+            return false;
+        }
+    }
+    distance = tNear;
+    return true;
+}
+
+inline bool overlapsAABB(const AABB &a, const AABB &b) {
+    return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y && a.max.y >= b.min.y
+        && a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+class LooseOctree {
+public:
+    // Cells halve up to maxDepth (at most BROADPHASE_MAX_DEPTH) times from a root cell of halfSize around center
+    LooseOctree(const glm::vec3 &center, GLfloat halfSize, GLuint maxDepth = BROADPHASE_MAX_DEPTH):
+        maxDepth(std::min(maxDepth, BROADPHASE_MAX_DEPTH)) {
+        this->nodes.push_back(Node());
+        this->nodes[0].center = center;
+        this->nodes[0].halfSize = halfSize;
+    }
+
+    GLuint insert(const AABB &bounds) {
+        GLuint id;
+        if (!this->freeBodies.empty()) {
+            id = this->freeBodies.back();
+            this->freeBodies.pop_back();
+        } else {
+            id = (GLuint) this->mins.size();
+            this->mins.push_back(glm::vec3(0.0f));
+            this->maxs.push_back(glm::vec3(0.0f));
+            this->bodyNodes.push_back(BROADPHASE_NONE);
+            this->bodySlots.push_back(0);
+        }
+        this->mins[id] = bounds.min;
+        this->maxs[id] = bounds.max;
+        this->link(id, this->findNode(bounds));
+        this->count++;
+        return id;
+    }
+
+    // Moves a body; relinks it only if it no longer belongs to its node
+    void update(GLuint id, const AABB &bounds) {
+        this->mins[id] = bounds.min;
+        this->maxs[id] = bounds.max;
+        GLuint node = this->bodyNodes[id];
+        if (this->belongsTo(bounds, node)) {
+            return;
+        }
+        this->unlink(id);
+        this->link(id, this->findNode(bounds));
+        this->relinks++;
+    }
+
+    void remove(GLuint id) {
+        this->unlink(id);
+        this->bodyNodes[id] = BROADPHASE_NONE;
+        this->freeBodies.push_back(id);
+        this->count--;
+    }
+
+    AABB getBounds(GLuint id) const {
+        return { this->mins[id], this->maxs[id] };
+    }
+
+    // Appends the bodies overlapping box
+    void queryAABB(const AABB &box, std::vector<GLuint> &out) const {
+        this->visit([&box](const AABB &bounds) { return overlapsAABB(box, bounds); },
+                    [&box](const AABB &bounds) { return encloses(box, bounds); }, out);
+    }
+
+    // Appends the bodies the frustum may contain, as conservatively as Frustum::containsAABB
+    void queryFrustum(const Frustum &frustum, std::vector<GLuint> &out) const {
+        this->visit([&frustum](const AABB &bounds) { return frustum.containsAABB(bounds); },
+                    [&frustum](const AABB &bounds) { return frustum.enclosesAABB(bounds); }, out);
+    }
+
+    // Appends the bodies the ray enters within maxDistance of its origin, in no particular order
+    void queryRay(const glm::vec3 &origin, const glm::vec3 &direction, GLfloat maxDistance, std::vector<GLuint> &out) const {
+        glm::vec3 inv = glm::vec3(1.0f) / glm::normalize(direction);
+        this->visit([&origin, &inv, maxDistance](const AABB &bounds) {
+            GLfloat distance;
+            return rayIntersectsAABB(origin, inv, maxDistance, bounds, distance);
+        }, [](const AABB &) { return false; }, out);
+    }
+
+    // The nearest body the ray enters within maxDistance, for picking
+    bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, GLfloat maxDistance, GLuint &id, GLfloat &distance) const {
+        std::vector<GLuint> hits;
+        this->queryRay(origin, direction, maxDistance, hits);
+        glm::vec3 inv = glm::vec3(1.0f) / glm::normalize(direction);
+        id = BROADPHASE_NONE;
+        distance = maxDistance;
+        for (GLuint hit : hits) {
+            GLfloat t;
+            if (rayIntersectsAABB(origin, inv, distance, this->getBounds(hit), t) && (id == BROADPHASE_NONE || t < distance)) {
+                id = hit;
+                distance = t;
+            }
+        }
+        return id != BROADPHASE_NONE;
+    }
+
+    size_t getCount() const {
+        return this->count;
+    }
+
+    size_t getNodeCount() const {
+        return this->nodes.size() - this->freeNodes.size();
+    }
+
+    // Updates that had to move a body to another node, since construction
+    size_t getRelinkCount() const {
+        return this->relinks;
+    }
+
+private:
+    struct Node {
+        glm::vec3 center;
+        GLfloat halfSize = 0.0f; // Of the cell; the loose bounds reach twice as far
+        GLuint depth = 0;
+        GLuint parent = BROADPHASE_NONE;
+        GLuint children[8] = { BROADPHASE_NONE, BROADPHASE_NONE, BROADPHASE_NONE, BROADPHASE_NONE,
+                               BROADPHASE_NONE, BROADPHASE_NONE, BROADPHASE_NONE, BROADPHASE_NONE };
+        GLuint subtreeCount = 0; // Bodies here and below; a node other than the root is freed at 0
+        std::vector<GLuint> bodies;
+    };
+
+    GLuint maxDepth;
+    std::vector<Node> nodes;
+    std::vector<GLuint> freeNodes;
+    size_t count = 0, relinks = 0;
+
+    // Bodies, indexed by id
+    std::vector<glm::vec3> mins, maxs;
+    std::vector<GLuint> bodyNodes;  // BROADPHASE_NONE once removed
+    std::vector<GLuint> bodySlots;  // Index in the node's bodies
+    std::vector<GLuint> freeBodies;
+
+    static bool encloses(const AABB &outer, const AABB &inner) {
+        return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z
+            && outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+    }
+
+    static GLfloat extentOf(const AABB &bounds) {
+        glm::vec3 half = (bounds.max - bounds.min) * 0.5f;
+        return std::max(half.x, std::max(half.y, half.z));
+    }
+
+    bool insideCell(const glm::vec3 &point, const Node &node) const {
+        return std::fabs(point.x - node.center.x) <= node.halfSize && std::fabs(point.y - node.center.y) <= node.halfSize
+            && std::fabs(point.z - node.center.z) <= node.halfSize;
+    }
+
+    // Whether findNode would stop at node for bounds, or at least node still holds them
+    bool belongsTo(const AABB &bounds, GLuint index) const {
+        const Node &node = this->nodes[index];
+        glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+        GLfloat extent = extentOf(bounds);
+        if (index == 0) {
+            return !this->insideCell(center, node) || extent > node.halfSize * 0.5f || this->maxDepth == 0;
+        }
+        bool deepest = node.depth == this->maxDepth || extent > node.halfSize * 0.5f;
+        return extent <= node.halfSize && deepest && this->insideCell(center, node);
+    }
+
+    // The deepest node, created if need be, whose cell holds the center of bounds and is no smaller than them
+    GLuint findNode(const AABB &bounds) {
+        glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+        GLfloat extent = extentOf(bounds);
+        GLuint index = 0;
+        if (!this->insideCell(center, this->nodes[0])) {
+            return 0;
+        }
+        while (this->nodes[index].depth < this->maxDepth && extent <= this->nodes[index].halfSize * 0.5f) {
+            const Node &node = this->nodes[index];
+            GLuint octant = (center.x >= node.center.x ? 1 : 0) | (center.y >= node.center.y ? 2 : 0) | (center.z >= node.center.z ? 4 : 0);
+            GLuint child = node.children[octant];
+            if (child == BROADPHASE_NONE) {
+                child = this->createNode(index, octant);
+            }
+            index = child;
+        }
+        return index;
+    }
+
+    GLuint createNode(GLuint parent, GLuint octant) {
+        GLuint index;
+        if (!this->freeNodes.empty()) {
+            index = this->freeNodes.back();
+            this->freeNodes.pop_back();
+        } else {
+            index = (GLuint) this->nodes.size();
+            this->nodes.push_back(Node());
+        }
+        Node &node = this->nodes[index];
+        const Node &up = this->nodes[parent];
+        GLfloat quarter = up.halfSize * 0.5f;
+        node.center = up.center + glm::vec3(octant & 1 ? quarter : -quarter, octant & 2 ? quarter : -quarter, octant & 4 ? quarter : -quarter);
+        node.halfSize = quarter;
+        node.depth = up.depth + 1;
+        node.parent = parent;
+        std::fill(node.children, node.children + 8, BROADPHASE_NONE);
+        node.subtreeCount = 0;
+        node.bodies.clear();
+        this->nodes[parent].children[octant] = index;
+        return index;
+    }
+
+    void link(GLuint id, GLuint index) {
+        Node &node = this->nodes[index];
+        this->bodyNodes[id] = index;
+        this->bodySlots[id] = (GLuint) node.bodies.size();
+        node.bodies.push_back(id);
+        for (GLuint at = index; at != BROADPHASE_NONE; at = this->nodes[at].parent) {
+            this->nodes[at].subtreeCount++;
+        }
+    }
+
+    void unlink(GLuint id) {
+        GLuint index = this->bodyNodes[id];
+        std::vector<GLuint> &bodies = this->nodes[index].bodies;
+        GLuint slot = this->bodySlots[id];
+        bodies[slot] = bodies.back();
+        this->bodySlots[bodies[slot]] = slot;
+        bodies.pop_back();
+
+        for (GLuint at = index; at != BROADPHASE_NONE;) {
+            Node &node = this->nodes[at];
+            GLuint parent = node.parent;
+            if (--node.subtreeCount == 0 && at != 0) {
+                Node &up = this->nodes[parent];
+                std::replace(up.children, up.children + 8, at, BROADPHASE_NONE);
+                this->freeNodes.push_back(at);
+            }
+            at = parent;
+        }
+    }
+
+    // Walks the nodes whose loose bounds pass test, appending their bodies that pass it too; a
+    // node whose loose bounds pass encloses, so every body below passes test, is appended whole
+    template <typename Test, typename Encloses>
+    void visit(const Test &test, const Encloses &encloses, std::vector<GLuint> &out) const {
+        if (this->count == 0) {
+            return;
+        }
+        GLuint stack[8 * (BROADPHASE_MAX_DEPTH + 1) + 1];
+        GLuint size = 0;
+        stack[size++] = 0;
+        while (size > 0) {
+            const Node &node = this->nodes[stack[--size]];
+            for (GLuint id : node.bodies) {
+                if (test(AABB{ this->mins[id], this->maxs[id] })) {
+                    out.push_back(id);
+                }
+            }
+            for (GLuint child : node.children) {
+                if (child == BROADPHASE_NONE) {
+                    continue;
+                }
+                const Node &next = this->nodes[child];
+                glm::vec3 loose(next.halfSize * 2.0f);
+                AABB bounds = { next.center - loose, next.center + loose };
+                if (!test(bounds)) {
+                    continue;
+                }
+                if (encloses(bounds)) {
+                    this->appendAll(child, out);
+                } else {
+                    stack[size++] = child;
+                }
+            }
+        }
+    }
+
+    void appendAll(GLuint index, std::vector<GLuint> &out) const {
+        const Node &node = this->nodes[index];
+        out.insert(out.end(), node.bodies.begin(), node.bodies.end());
+        for (GLuint child : node.children) {
+            if (child != BROADPHASE_NONE) {
+                this->appendAll(child, out);
+            }
+        }
+    }
+};
@@ -0,0 +1,235 @@
+//
+//  BroadphaseBenchmark.h
+//  GameForFuns
+//
+//  Broadphase benchmark, headless. Moves 100k boxes through the loose octree
+//  every frame and times the update and box, ray and frustum queries against
+//  testing every box.
+//
+//  Usage: GameForFuns --benchmark-broadphase [--out broadphase.json]
+//
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Benchmark.h"
+#include "Broadphase.h"
+#include "Frustum.h"
+#include "Profiler.h"
+
+const GLuint BENCHMARK_BROADPHASE_BODIES = 100000;
+const GLfloat BENCHMARK_BROADPHASE_HALF_SIZE = 512.0f; // Of the cube the bodies move in
+const GLuint BENCHMARK_BROADPHASE_FRAMES = 60;
+const GLuint BENCHMARK_BROADPHASE_QUERIES = 1000;     // Box and ray queries per frame
+const GLuint BENCHMARK_BROADPHASE_VIEWS = 8;          // Frustum queries per frame, all compared against testing every box
+const GLuint BENCHMARK_BROADPHASE_CHECKED = 50;       // Box and ray queries per frame compared against testing every box
+
+// Per frame medians over BENCHMARK_BROADPHASE_FRAMES frames; the brute force times test every box
+struct BroadphaseResult {
+    GLfloat updateMs = 0.0f;
+    GLfloat aabbUs = 0.0f;       // Per query
+    GLfloat rayUs = 0.0f;
+    GLfloat frustumUs = 0.0f;
+    GLfloat bruteAabbUs = 0.0f;
+    GLfloat bruteRayUs = 0.0f;
+    GLfloat bruteFrustumUs = 0.0f;
+    GLfloat relinksPerFrame = 0.0f;
+    size_t nodes = 0;
+    GLfloat aabbHits = 0.0f;     // Per query, on average
+    GLfloat rayHits = 0.0f;
+    GLfloat frustumHits = 0.0f;
+};
+
+// Appends the ids of the bodies whose box passes test
+template <typename Test>
+inline void testEveryBox(const std::vector<AABB> &bodies, const std::vector<GLuint> &ids, const Test &test, std::vector<GLuint> &out) {
+    out.clear();
+    for (size_t i = 0; i < bodies.size(); i++) {
+        if (test(bodies[i])) {
+            out.push_back(ids[i]);
+        }
+    }
+}
+
+inline bool sameBodies(std::vector<GLuint> a, std::vector<GLuint> b) {
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    return a == b;
+}
+
+// Moves BENCHMARK_BROADPHASE_BODIES boxes of 1 to 8 units through a loose octree for
+// BENCHMARK_BROADPHASE_FRAMES frames, bouncing off the walls of the cube they start in, and
+// times the update and the box, ray and frustum queries of each frame. Each frame the first
+// BENCHMARK_BROADPHASE_CHECKED box and ray queries and every frustum query are repeated by
+// testing every box, and the run fails if any finds different bodies.
+inline int benchmarkBroadphase(const BenchmarkOptions &options) {
+    const GLfloat half = BENCHMARK_BROADPHASE_HALF_SIZE;
+    std::mt19937 random(44);
+    std::uniform_real_distribution<GLfloat> position(-half, half), size(0.5f, 4.0f), speed(-8.0f, 8.0f), unit(-1.0f, 1.0f);
+
+    std::vector<AABB> bodies(BENCHMARK_BROADPHASE_BODIES);
+    std::vector<glm::vec3> velocities(BENCHMARK_BROADPHASE_BODIES);
+    LooseOctree octree(glm::vec3(0.0f), half);
+    std::vector<GLuint> ids(BENCHMARK_BROADPHASE_BODIES);
+    for (GLuint i = 0; i < BENCHMARK_BROADPHASE_BODIES; i++) {
+        glm::vec3 center(position(random), position(random), position(random));
+        glm::vec3 extent(size(random), size(random), size(random));
+        bodies[i] = { center - extent, center + extent };
+        velocities[i] = glm::vec3(speed(random), speed(random), speed(random));
+        ids[i] = octree.insert(bodies[i]);
+    }
+
+    std::vector<GLfloat> updateTimes, aabbTimes, rayTimes, frustumTimes, bruteAabbTimes, bruteRayTimes, bruteFrustumTimes;
+    size_t aabbHits = 0, rayHits = 0, frustumHits = 0, relinks = 0;
+    bool identical = true;
+    std::vector<GLuint> found;
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+    for (GLuint frame = 0; frame < BENCHMARK_BROADPHASE_FRAMES; frame++) {
+        for (GLuint i = 0; i < BENCHMARK_BROADPHASE_BODIES; i++) {
+            glm::vec3 move = velocities[i] * BENCHMARK_TIMESTEP;
+            for (GLint axis = 0; axis < 3; axis++) {
+                if (bodies[i].min[axis] + move[axis] < -half || bodies[i].max[axis] + move[axis] > half) {
+                    velocities[i][axis] = -velocities[i][axis];
+                    move[axis] = 0.0f;
+                }
+            }
+            bodies[i].min += move;
+            bodies[i].max += move;
+        }
+        size_t relinksBefore = octree.getRelinkCount();
+        double start = Profiler::get().nowUs();
+        for (GLuint i = 0; i < BENCHMARK_BROADPHASE_BODIES; i++) {
+            octree.update(ids[i], bodies[i]);
+        }
+        updateTimes.push_back((GLfloat) ((Profiler::get().nowUs() - start) / 1000.0));
+        relinks += octree.getRelinkCount() - relinksBefore;
+
+        // Boxes of 16 to 64 units, rays of 200 units and views 300 units deep, from random points
+        std::vector<AABB> boxes(BENCHMARK_BROADPHASE_QUERIES);
+        std::vector<glm::vec3> origins(BENCHMARK_BROADPHASE_QUERIES), directions(BENCHMARK_BROADPHASE_QUERIES);
+        for (GLuint q = 0; q < BENCHMARK_BROADPHASE_QUERIES; q++) {
+            glm::vec3 center(position(random), position(random), position(random));
+            glm::vec3 extent(8.0f + 24.0f * (unit(random) + 1.0f) * 0.5f);
+            boxes[q] = { center - extent, center + extent };
+            origins[q] = glm::vec3(position(random), position(random), position(random));
+            directions[q] = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(1e-3f));
+        }
+        std::vector<Frustum> views(BENCHMARK_BROADPHASE_VIEWS);
+        for (GLuint v = 0; v < BENCHMARK_BROADPHASE_VIEWS; v++) {
+            glm::vec3 eye(position(random), position(random), position(random));
+            views[v] = Frustum(projection * glm::lookAt(eye, eye + directions[v], glm::vec3(0.0f, 1.0f, 0.0f)));
+        }
+
+        found.clear();
+        start = Profiler::get().nowUs();
+        for (const AABB &box : boxes) {
+            octree.queryAABB(box, found);
+        }
+        aabbTimes.push_back((GLfloat) ((Profiler::get().nowUs() - start) / BENCHMARK_BROADPHASE_QUERIES));
+        aabbHits += found.size();
+
+        found.clear();
+        start = Profiler::get().nowUs();
+        for (GLuint q = 0; q < BENCHMARK_BROADPHASE_QUERIES; q++) {
+            octree.queryRay(origins[q], directions[q], 200.0f, found);
+        }
+        rayTimes.push_back((GLfloat) ((Profiler::get().nowUs() - start) / BENCHMARK_BROADPHASE_QUERIES));
+        rayHits += found.size();
+
+        found.clear();
+        start = Profiler::get().nowUs();
+        for (const Frustum &view : views) {
+            octree.queryFrustum(view, found);
+        }
+        frustumTimes.push_back((GLfloat) ((Profiler::get().nowUs() - start) / BENCHMARK_BROADPHASE_VIEWS));
+        frustumHits += found.size();
+
+        // The first queries of each kind again, testing every box
+        std::vector<std::vector<GLuint>> expected(BENCHMARK_BROADPHASE_CHECKED);
+        start = Profiler::get().nowUs();
+        for (GLuint q = 0; q < BENCHMARK_BROADPHASE_CHECKED; q++) {
+            testEveryBox(bodies, ids, [&](const AABB &b) { return overlapsAABB(boxes[q], b); }, expected[q]);
+        }
+        bruteAabbTimes.push_back((GLfloat) ((Profiler::get().nowUs() - start) / BENCHMARK_BROADPHASE_CHECKED));
+        for (GLuint q = 0; q < BENCHMARK_BROADPHASE_CHECKED; q++) {
+            found.clear();
+            octree.queryAABB(boxes[q], found);
+            identical = identical && sameBodies(found, expected[q]);
+        }
+
+        start = Profiler::get().nowUs();
+        for (GLuint q = 0; q < BENCHMARK_BROADPHASE_CHECKED; q++) {
+            glm::vec3 inv = glm::vec3(1.0f) / directions[q];
+            GLfloat t;
+            testEveryBox(bodies, ids, [&](const AABB &b) { return rayIntersectsAABB(origins[q], inv, 200.0f, b, t); }, expected[q]);
+        }
+        bruteRayTimes.push_back((GLfloat) ((Profiler::get().nowUs() - start) / BENCHMARK_BROADPHASE_CHECKED));
+        for (GLuint q = 0; q < BENCHMARK_BROADPHASE_CHECKED; q++) {
+            found.clear();
+            octree.queryRay(origins[q], directions[q], 200.0f, found);
+            identical = identical && sameBodies(found, expected[q]);
+        }
+
+        start = Profiler::get().nowUs();
+        for (GLuint v = 0; v < BENCHMARK_BROADPHASE_VIEWS; v++) {
+            testEveryBox(bodies, ids, [&](const AABB &b) { return views[v].containsAABB(b); }, expected[v]);
+        }
+        bruteFrustumTimes.push_back((GLfloat) ((Profiler::get().nowUs() - start) / BENCHMARK_BROADPHASE_VIEWS));
+        for (GLuint v = 0; v < BENCHMARK_BROADPHASE_VIEWS; v++) {
+            found.clear();
+            octree.queryFrustum(views[v], found);
+            identical = identical && sameBodies(found, expected[v]);
+        }
+    }
+
+    BroadphaseResult result;
+    result.updateMs = Benchmark::percentile(updateTimes, 50.0f);
+    result.aabbUs = Benchmark::percentile(aabbTimes, 50.0f);
+    result.rayUs = Benchmark::percentile(rayTimes, 50.0f);
+    result.frustumUs = Benchmark::percentile(frustumTimes, 50.0f);
+    result.bruteAabbUs = Benchmark::percentile(bruteAabbTimes, 50.0f);
+    result.bruteRayUs = Benchmark::percentile(bruteRayTimes, 50.0f);
+    result.bruteFrustumUs = Benchmark::percentile(bruteFrustumTimes, 50.0f);
+    result.relinksPerFrame = (GLfloat) relinks / BENCHMARK_BROADPHASE_FRAMES;
+    result.nodes = octree.getNodeCount();
+    result.aabbHits = (GLfloat) aabbHits / (BENCHMARK_BROADPHASE_FRAMES * BENCHMARK_BROADPHASE_QUERIES);
+    result.rayHits = (GLfloat) rayHits / (BENCHMARK_BROADPHASE_FRAMES * BENCHMARK_BROADPHASE_QUERIES);
+    result.frustumHits = (GLfloat) frustumHits / (BENCHMARK_BROADPHASE_FRAMES * BENCHMARK_BROADPHASE_VIEWS);
+
+    std::cout << BENCHMARK_BROADPHASE_BODIES << " bodies, " << result.nodes << " nodes: update " << result.updateMs << " ms ("
+              << result.relinksPerFrame << " relinked per frame)" << std::endl;
+    std::cout << "box query " << result.aabbUs << " us (" << result.bruteAabbUs << " us testing every box), "
+              << result.aabbHits << " bodies found" << std::endl;
+    std::cout << "ray query " << result.rayUs << " us (" << result.bruteRayUs << " us testing every box), "
+              << result.rayHits << " bodies found" << std::endl;
+    std::cout << "frustum query " << result.frustumUs << " us (" << result.bruteFrustumUs << " us testing every box), "
+              << result.frustumHits << " bodies found" << std::endl;
+    if (!identical) {
+        std::cout << "ERROR::BENCHMARK::BROADPHASE_MISMATCH the octree and testing every box found different bodies" << std::endl;
+    }
+
+    std::ofstream out(options.output);
+    if (!out) {
+        std::cout << "ERROR::BENCHMARK::COULD_NOT_WRITE " << options.output << std::endl;
+        return EXIT_FAILURE;
+    }
+    out << "{\n  \"bodies\": " << BENCHMARK_BROADPHASE_BODIES << ",\n  \"frames\": " << BENCHMARK_BROADPHASE_FRAMES
+        << ",\n  \"nodes\": " << result.nodes << ",\n  \"update_ms\": " << result.updateMs
+        << ",\n  \"relinks_per_frame\": " << result.relinksPerFrame << ",\n";
+    auto writeQuery = [&out](const char *name, GLfloat us, GLfloat bruteUs, GLfloat hits, bool last) {
+        out << "  \"" << name << "\": {\"query_us\": " << us << ", \"brute_force_us\": " << bruteUs << ", \"speedup\": " << bruteUs / us
+            << ", \"bodies_found\": " << hits << "}" << (last ? "\n" : ",\n");
+    };
+    writeQuery("aabb", result.aabbUs, result.bruteAabbUs, result.aabbHits, false);
+    writeQuery("ray", result.rayUs, result.bruteRayUs, result.rayHits, false);
+    writeQuery("frustum", result.frustumUs, result.bruteFrustumUs, result.frustumHits, false);
+    out << "  \"identical\": " << (identical ? "true" : "false") << "\n}\n";
+    return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
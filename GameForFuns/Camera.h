@@ -16,6 +16,10 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "Entities.h"
+#include "VoxelWorld.h"
+#include "VoxelCollision.h"
+
 enum Camera_Movement {
     FORWARD,
     BACKWARD,
@@ -29,6 +33,8 @@ const GLfloat PITCH = 0.0f;
 const GLfloat SPEED = 6.0f;
 const GLfloat SENSITIVITY = 0.15f;
 const GLfloat ZOOM = 45.0f; // FOV
+const GLfloat GRAVITY = 6.0f; // Units per second squared
+const GLfloat JUMP_ACCELERATION = 10.8f; // Upwards while UP is held, gravity included this nets 4.8
 
 
 class Camera {
@@ -40,7 +46,9 @@ public:
            GLfloat pitch = PITCH
        ): front(glm::vec3(0.0f, 0.0f, -1.0f)), movementSpeed(SPEED), mouseSensitivity(SENSITIVITY), zoom(ZOOM) {
         
-        this->position = position;
+        this->body.position = position;
+        this->previousPosition = position;
+        this->motion.gravity = GRAVITY;
         this->worldUp = up;
         this->yaw = yaw;
         this->pitch = pitch;
@@ -57,7 +65,9 @@ public:
            GLfloat pitch
        ): front(glm::vec3(0.0f, 0.0f, -1.0f)), movementSpeed(SPEED), mouseSensitivity(SENSITIVITY), zoom(ZOOM) {
         
-        this->position = glm::vec3(posX, posY, posZ);
+        this->body.position = glm::vec3(posX, posY, posZ);
+        this->previousPosition = this->body.position;
+        this->motion.gravity = GRAVITY;
         this->worldUp = glm::vec3(upX, upY, upZ);
         this->yaw = yaw;
         this->pitch = pitch;
@@ -65,41 +75,61 @@ public:
     }
     
     glm::mat4 getViewMatrix() {
-        return glm::lookAt(this->position, this->position + this->front, this->up);
+        return glm::lookAt(this->body.position, this->body.position + this->front, this->up);
     }
     
     void processKeyboard(Camera_Movement direction, GLfloat deltaTime) {
         GLfloat velocity = this->movementSpeed * deltaTime;
         if (direction == UP) {
-            this->acceleration.y += 0.003f;
+            this->motion.acceleration.y += JUMP_ACCELERATION;
         }
         if (direction == FORWARD) {
-            this->position += this->front * velocity;
+            this->body.position += this->front * velocity;
         }
         if (direction == BACKWARD) {
-            this->position -= this->front * velocity;
+            this->body.position -= this->front * velocity;
         }
         if (direction == LEFT) {
-            this->position -= this->right * velocity;
+            this->body.position -= this->right * velocity;
         }
         if (direction == RIGHT) {
-            this->position += this->right * velocity;
+            this->body.position += this->right * velocity;
         }
     }
     
+    // Integrates one simulation step the way updateMotion integrates entities
     void update(GLfloat deltaTime) {
-        this->acceleration += glm::vec3(0.0f, -0.1f * deltaTime, 0.0f); // Gravity
-        this->position += this->velocity;
-        this->velocity += this->acceleration;
-        this->acceleration = glm::vec3(0.0f);
+        integrateMotion(this->body, this->motion, deltaTime);
     }
     
-    void intersect() {
-        if (this->position.y <= 0.0f) {
-            this->position.y = 0.0f;
+    // Sweeps the player's body from where the step started, as stored by storePreviousState,
+    // to where update left it, stopping at blocks; velocity into a block is dropped
+    void intersect(const VoxelWorld &world) {
+        VoxelSweep sweep = sweepBox(world, playerBody(this->previousPosition), this->body.position - this->previousPosition);
+        this->body.position = this->previousPosition + sweep.motion;
+        for (GLint axis = 0; axis < 3; axis++) {
+            if (sweep.blocked[axis]) {
+                this->motion.linear[axis] = 0.0f;
+            }
         }
     }
     
+    // Remembers the state at the start of a simulation step for render interpolation
+    void storePreviousState() {
+        this->previousPosition = this->body.position;
+    }
+    
+    // Copy of the camera blended between the previous and current simulation step
+    Camera interpolated(GLfloat alpha) const {
+        Camera camera = *this;
+        camera.body.position = glm::mix(this->previousPosition, this->body.position, alpha);
+        return camera;
+    }
+    
+    glm::vec3 getVelocity() {
+        return this->motion.linear;
+    }
+    
     void processMouseMovement(GLfloat xOffset, GLfloat yOffset, GLboolean constrainPitch = true) {
         xOffset *= this->mouseSensitivity;
         yOffset *= this->mouseSensitivity;
@@ -135,26 +165,40 @@ public:
     }
     
     glm::vec3 getPosition() {
-        return this->position;
+        return this->body.position;
     }
     
     void setPosition(glm::vec3 position) {
-        this->position = position;
+        this->body.position = position;
+        this->previousPosition = position;
     }
     
     glm::vec3 getFront() {
         return this->front;
     }
     
+    GLfloat getYaw() {
+        return this->yaw;
+    }
+    
+    GLfloat getPitch() {
+        return this->pitch;
+    }
+    
+    void setOrientation(GLfloat yaw, GLfloat pitch) {
+        this->yaw = yaw;
+        this->pitch = pitch;
+        this->updateCameraVectors();
+    }
+    
 private:
-    glm::vec3 position;
+    Transform body;   // Only the position is used; orientation is yaw and pitch
+    Velocity motion;
     glm::vec3 front;
     glm::vec3 up;
     glm::vec3 right;
     glm::vec3 worldUp;
-    GLfloat gravity = 0.9f;
-    glm::vec3 acceleration = glm::vec3(0.0f, 0.0f, 0.0f);
-    glm::vec3 velocity = glm::vec3(0.0f, 0.0f, 0.0f);
+    glm::vec3 previousPosition = glm::vec3(0.0f, 0.0f, 0.0f);
     
     GLfloat yaw;
     GLfloat pitch;
@@ -0,0 +1,439 @@
+//
+//  CommandBuffer.h
+//  GameForFuns
+//
+//  Deferred render commands. Any thread records binds, uniform updates and draws
+//  into its own CommandBuffer, packed back to back in a linear byte buffer that is
+//  reused every frame. Commands are grouped under a 64-bit sort key; the context
+//  thread merges the groups of all buffers, sorts them by key and replays them
+//  through a CommandBackend. GLCommandBackend issues the GL calls and drops
+//  redundant binds, TraceCommandBackend prints one line per command so recorded
+//  frames can be compared without a GPU.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Profiler.h"
+
+enum CommandType {
+    COMMAND_USE_PROGRAM,
+    COMMAND_BIND_VERTEX_ARRAY,
+    COMMAND_BIND_TEXTURE,
+    COMMAND_UNIFORM_1I,
+    COMMAND_UNIFORM_1F,
+    COMMAND_UNIFORM_3F,
+    COMMAND_UNIFORM_MATRIX_4F,
+    COMMAND_BIND_INSTANCE_TRANSFORMS,
+    COMMAND_DRAW_ARRAYS,
+    COMMAND_DRAW_ARRAYS_INSTANCED,
+    COMMAND_DRAW_ELEMENTS
+};
+
+struct CommandHeader {
+    GLuint type;
+    GLuint size; // Payload bytes following the header
+};
+
+struct BindTextureCommand { GLuint unit; GLenum target; GLuint texture; };
+struct Uniform1iCommand { GLint location; GLint value; };
+struct Uniform1fCommand { GLint location; GLfloat value; };
+struct Uniform3fCommand { GLint location; GLfloat x, y, z; };
+struct UniformMatrix4fCommand { GLint location; GLfloat value[16]; };
+struct BindInstanceTransformsCommand { GLuint buffer; GLuint offset; GLuint location; }; // mat4 per instance in location..location + 3
+struct DrawArraysCommand { GLenum mode; GLint first; GLsizei count; };
+struct DrawArraysInstancedCommand { GLenum mode; GLint first; GLsizei count; GLsizei instances; };
+struct DrawElementsCommand { GLenum mode; GLsizei count; GLenum type; GLuint offset; };
+
+// Layer in the top byte, then material (program, texture...) and a 24-bit depth
+inline uint64_t makeSortKey(GLuint layer, GLuint material, GLuint depth) {
+    return ((uint64_t) (layer & 0xFF) << 56) | ((uint64_t) material << 24) | (depth & 0xFFFFFF);
+}
+
+class CommandBuffer {
+public:
+    struct Group {
+        uint64_t key;
+        GLuint offset;
+        GLuint size;
+    };
+
+    explicit CommandBuffer(GLuint capacity = 64 * 1024) {
+        this->data.resize(capacity);
+        this->groups.reserve(capacity / 256);
+    }
+
+    // Keeps the memory, only rewinds
+    void reset() {
+        this->used = 0;
+        this->groups.clear();
+    }
+
+    // Starts a group; every following command replays together under this key
+    void begin(uint64_t key) {
+        Group group = { key, this->used, 0 };
+        this->groups.push_back(group);
+    }
+
+    void useProgram(GLuint program) {
+        this->push(COMMAND_USE_PROGRAM, program);
+    }
+
+    void bindVertexArray(GLuint vertexArray) {
+        this->push(COMMAND_BIND_VERTEX_ARRAY, vertexArray);
+    }
+
+    void bindTexture(GLuint unit, GLenum target, GLuint texture) {
+        BindTextureCommand command = { unit, target, texture };
+        this->push(COMMAND_BIND_TEXTURE, command);
+    }
+
+    void uniform1i(GLint location, GLint value) {
+        Uniform1iCommand command = { location, value };
+        this->push(COMMAND_UNIFORM_1I, command);
+    }
+
+    void uniform1f(GLint location, GLfloat value) {
+        Uniform1fCommand command = { location, value };
+        this->push(COMMAND_UNIFORM_1F, command);
+    }
+
+    void uniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z) {
+        Uniform3fCommand command = { location, x, y, z };
+        this->push(COMMAND_UNIFORM_3F, command);
+    }
+
+    void uniformMatrix4fv(GLint location, const GLfloat *value) {
+        UniformMatrix4fCommand command;
+        command.location = location;
+        std::memcpy(command.value, value, sizeof(command.value));
+        this->push(COMMAND_UNIFORM_MATRIX_4F, command);
+    }
+
+    void bindInstanceTransforms(GLuint buffer, GLuint offset, GLuint location) {
+        BindInstanceTransformsCommand command = { buffer, offset, location };
+        this->push(COMMAND_BIND_INSTANCE_TRANSFORMS, command);
+    }
+
+    void drawArrays(GLenum mode, GLint first, GLsizei count) {
+        DrawArraysCommand command = { mode, first, count };
+        this->push(COMMAND_DRAW_ARRAYS, command);
+    }
+
+    void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) {
+        DrawArraysInstancedCommand command = { mode, first, count, instances };
+        this->push(COMMAND_DRAW_ARRAYS_INSTANCED, command);
+    }
+
+    void drawElements(GLenum mode, GLsizei count, GLenum type, GLuint offset) {
+        DrawElementsCommand command = { mode, count, type, offset };
+        this->push(COMMAND_DRAW_ELEMENTS, command);
+    }
+
+    const std::vector<Group> &getGroups() const {
+        return this->groups;
+    }
+
+    const unsigned char *getData() const {
+        return this->data.data();
+    }
+
+    GLuint getUsedBytes() const {
+        return this->used;
+    }
+
+private:
+    std::vector<unsigned char> data;
+    GLuint used = 0;
+    std::vector<Group> groups;
+
+    template <typename T>
+    void push(CommandType type, const T &payload) {
+        if (this->groups.empty()) {
+            this->begin(0);
+        }
+
+        GLuint bytes = sizeof(CommandHeader) + sizeof(T);
+        if (this->used + bytes > this->data.size()) {
+            this->data.resize(std::max<size_t>(this->data.size() * 2, this->used + bytes)); // Only until the frame's high-water mark
+        }
+
+        CommandHeader header = { (GLuint) type, (GLuint) sizeof(T) };
+        std::memcpy(&this->data[this->used], &header, sizeof(header));
+        std::memcpy(&this->data[this->used + sizeof(header)], &payload, sizeof(T));
+        this->used += bytes;
+        this->groups.back().size += bytes;
+    }
+};
+
+class CommandBackend {
+public:
+    virtual ~CommandBackend() {}
+
+    virtual void useProgram(GLuint program) = 0;
+    virtual void bindVertexArray(GLuint vertexArray) = 0;
+    virtual void bindTexture(const BindTextureCommand &command) = 0;
+    virtual void uniform1i(const Uniform1iCommand &command) = 0;
+    virtual void uniform1f(const Uniform1fCommand &command) = 0;
+    virtual void uniform3f(const Uniform3fCommand &command) = 0;
+    virtual void uniformMatrix4f(const UniformMatrix4fCommand &command) = 0;
+    virtual void bindInstanceTransforms(const BindInstanceTransformsCommand &command) = 0;
+    virtual void drawArrays(const DrawArraysCommand &command) = 0;
+    virtual void drawArraysInstanced(const DrawArraysInstancedCommand &command) = 0;
+    virtual void drawElements(const DrawElementsCommand &command) = 0;
+};
+
+class GLCommandBackend : public CommandBackend {
+public:
+    // Forget cached bindings, call whenever GL state was changed outside the backend
+    void invalidate() {
+        this->program = 0;
+        this->vertexArray = 0;
+        this->activeUnit = 0;
+        std::fill(this->textures, this->textures + 16, 0u);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void useProgram(GLuint program) {
+        if (program != this->program) {
+            glUseProgram(program);
+            this->program = program;
+            PROFILE_STATE_CHANGE();
+        }
+    }
+
+    void bindVertexArray(GLuint vertexArray) {
+        if (vertexArray != this->vertexArray) {
+            glBindVertexArray(vertexArray);
+            this->vertexArray = vertexArray;
+            PROFILE_STATE_CHANGE();
+        }
+    }
+
+    void bindTexture(const BindTextureCommand &command) {
+        if (command.unit < 16 && this->textures[command.unit] == command.texture) {
+            return;
+        }
+        if (command.unit != this->activeUnit) {
+            glActiveTexture(GL_TEXTURE0 + command.unit);
+            this->activeUnit = command.unit;
+        }
+        glBindTexture(command.target, command.texture);
+        if (command.unit < 16) {
+            this->textures[command.unit] = command.texture;
+        }
+        PROFILE_STATE_CHANGE();
+    }
+
+    void uniform1i(const Uniform1iCommand &command) {
+        glUniform1i(command.location, command.value);
+    }
+
+    void uniform1f(const Uniform1fCommand &command) {
+        glUniform1f(command.location, command.value);
+    }
+
+    void uniform3f(const Uniform3fCommand &command) {
+        glUniform3f(command.location, command.x, command.y, command.z);
+    }
+
+    void uniformMatrix4f(const UniformMatrix4fCommand &command) {
+        glUniformMatrix4fv(command.location, 1, GL_FALSE, command.value);
+    }
+
+    // Points the bound VAO's instanced mat4 attribute at an offset into buffer
+    void bindInstanceTransforms(const BindInstanceTransformsCommand &command) {
+        glBindBuffer(GL_ARRAY_BUFFER, command.buffer);
+        for (GLuint column = 0; column < 4; column++) {
+            glVertexAttribPointer(command.location + column, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat),
+                                  (GLvoid *) (uintptr_t) (command.offset + column * 4 * sizeof(GLfloat)));
+        }
+        PROFILE_STATE_CHANGE();
+    }
+
+    void drawArrays(const DrawArraysCommand &command) {
+        glDrawArrays(command.mode, command.first, command.count);
+        PROFILE_DRAW(command.mode == GL_TRIANGLES ? command.count / 3 : 0);
+    }
+
+    void drawArraysInstanced(const DrawArraysInstancedCommand &command) {
+        glDrawArraysInstanced(command.mode, command.first, command.count, command.instances);
+        PROFILE_DRAW(command.mode == GL_TRIANGLES ? command.count / 3 * command.instances : 0);
+    }
+
+    void drawElements(const DrawElementsCommand &command) {
+        glDrawElements(command.mode, command.count, command.type, (GLvoid *) (uintptr_t) command.offset);
+        PROFILE_DRAW(command.mode == GL_TRIANGLES ? command.count / 3 : 0);
+    }
+
+private:
+    GLuint program = 0;
+    GLuint vertexArray = 0;
+    GLuint activeUnit = 0;
+    GLuint textures[16] = {};
+};
+
+// Writes every replayed command as a line of text
+class TraceCommandBackend : public CommandBackend {
+public:
+    void useProgram(GLuint program) {
+        this->out << "useProgram " << program << "\n";
+    }
+
+    void bindVertexArray(GLuint vertexArray) {
+        this->out << "bindVertexArray " << vertexArray << "\n";
+    }
+
+    void bindTexture(const BindTextureCommand &command) {
+        this->out << "bindTexture " << command.unit << " " << command.target << " " << command.texture << "\n";
+    }
+
+    void uniform1i(const Uniform1iCommand &command) {
+        this->out << "uniform1i " << command.location << " " << command.value << "\n";
+    }
+
+    void uniform1f(const Uniform1fCommand &command) {
+        this->out << "uniform1f " << command.location << " " << command.value << "\n";
+    }
+
+    void uniform3f(const Uniform3fCommand &command) {
+        this->out << "uniform3f " << command.location << " " << command.x << " " << command.y << " " << command.z << "\n";
+    }
+
+    void uniformMatrix4f(const UniformMatrix4fCommand &command) {
+        this->out << "uniformMatrix4f " << command.location;
+        for (GLuint i = 0; i < 16; i++) {
+            this->out << " " << command.value[i];
+        }
+        this->out << "\n";
+    }
+
+    void bindInstanceTransforms(const BindInstanceTransformsCommand &command) {
+        this->out << "bindInstanceTransforms " << command.buffer << " " << command.offset << " " << command.location << "\n";
+    }
+
+    void drawArraysInstanced(const DrawArraysInstancedCommand &command) {
+        this->out << "drawArraysInstanced " << command.mode << " " << command.first << " " << command.count << " " << command.instances << "\n";
+    }
+
+    void drawArrays(const DrawArraysCommand &command) {
+        this->out << "drawArrays " << command.mode << " " << command.first << " " << command.count << "\n";
+    }
+
+    void drawElements(const DrawElementsCommand &command) {
+        this->out << "drawElements " << command.mode << " " << command.count << " " << command.type << " " << command.offset << "\n";
+    }
+
+    std::string str() const {
+        return this->out.str();
+    }
+
+private:
+    std::ostringstream out;
+};
+
+// Merges the groups of several buffers and replays them in key order. Groups with equal
+// keys keep their buffer order, so the result does not depend on which thread recorded what.
+// std::sort on the full (key, buffer, group) tuple instead of std::stable_sort, which allocates.
+class CommandQueue {
+public:
+    // Up front, so a frame with more groups than any before it does not allocate
+    void reserve(GLuint groupCount) {
+        this->sorted.reserve(groupCount);
+    }
+
+    void submit(CommandBuffer *const *buffers, GLuint bufferCount, CommandBackend &backend) {
+        PROFILE_SCOPE("CommandQueue::submit");
+        this->sorted.clear();
+        for (GLuint i = 0; i < bufferCount; i++) {
+            const std::vector<CommandBuffer::Group> &groups = buffers[i]->getGroups();
+            for (GLuint j = 0; j < groups.size(); j++) {
+                GroupRef ref = { groups[j].key, i, j };
+                this->sorted.push_back(ref);
+            }
+        }
+
+        std::sort(this->sorted.begin(), this->sorted.end(), [](const GroupRef &a, const GroupRef &b) {
+            if (a.key != b.key) {
+                return a.key < b.key;
+            }
+            return a.buffer != b.buffer ? a.buffer < b.buffer : a.group < b.group;
+        });
+
+        for (const GroupRef &ref : this->sorted) {
+            const CommandBuffer &buffer = *buffers[ref.buffer];
+            const CommandBuffer::Group &group = buffer.getGroups()[ref.group];
+            replay(buffer.getData() + group.offset, group.size, backend);
+        }
+    }
+
+    static void replay(const unsigned char *data, GLuint size, CommandBackend &backend) {
+        GLuint offset = 0;
+        while (offset < size) {
+            CommandHeader header;
+            std::memcpy(&header, data + offset, sizeof(header));
+            const unsigned char *payload = data + offset + sizeof(header);
+            offset += sizeof(header) + header.size;
+
+            switch (header.type) {
+                case COMMAND_USE_PROGRAM:
+                    backend.useProgram(read<GLuint>(payload));
+                    break;
+                case COMMAND_BIND_VERTEX_ARRAY:
+                    backend.bindVertexArray(read<GLuint>(payload));
+                    break;
+                case COMMAND_BIND_TEXTURE:
+                    backend.bindTexture(read<BindTextureCommand>(payload));
+                    break;
+                case COMMAND_UNIFORM_1I:
+                    backend.uniform1i(read<Uniform1iCommand>(payload));
+                    break;
+                case COMMAND_UNIFORM_1F:
+                    backend.uniform1f(read<Uniform1fCommand>(payload));
+                    break;
+                case COMMAND_UNIFORM_3F:
+                    backend.uniform3f(read<Uniform3fCommand>(payload));
+                    break;
+                case COMMAND_UNIFORM_MATRIX_4F:
+                    backend.uniformMatrix4f(read<UniformMatrix4fCommand>(payload));
+                    break;
+                case COMMAND_BIND_INSTANCE_TRANSFORMS:
+                    backend.bindInstanceTransforms(read<BindInstanceTransformsCommand>(payload));
+                    break;
+                case COMMAND_DRAW_ARRAYS:
+                    backend.drawArrays(read<DrawArraysCommand>(payload));
+                    break;
+                case COMMAND_DRAW_ARRAYS_INSTANCED:
+                    backend.drawArraysInstanced(read<DrawArraysInstancedCommand>(payload));
+                    break;
+                case COMMAND_DRAW_ELEMENTS:
+                    backend.drawElements(read<DrawElementsCommand>(payload));
+                    break;
+            }
+        }
+    }
+
+private:
+    struct GroupRef {
+        uint64_t key;
+        GLuint buffer;
+        GLuint group;
+    };
+
+    std::vector<GroupRef> sorted;
+
+    template <typename T>
+    static T read(const unsigned char *payload) {
+        T value;
+        std::memcpy(&value, payload, sizeof(T));
+        return value;
+    }
+};
@@ -0,0 +1,345 @@
+//
+//  DynamicResolution.h
+//  GameForFuns
+//
+//  Dynamic resolution. The scene is drawn into the lower left corner of its
+//  full size target, scaled on both axes, and the Upscale pass stretches that
+//  corner over a full size target, sharpening to make up for the blur, before
+//  exposure and post-processing. Only the target's extent in the RenderGraph
+//  changes, so a new scale allocates and recompiles nothing.
+//
+//  The scale comes from a PID controller on GPU frame time. Timestamps around
+//  the frame are read back a few frames later without stalling, and the
+//  controller takes the median of the last three, so a lone hitch, which no
+//  resolution would have saved, does not make it drop. It controls the share
+//  of pixels drawn, scale squared, which GPU time is close to linear in. It
+//  moves that share by the change in its terms (the velocity form), so while
+//  it is pinned at either end there is no integral to wind up.
+//
+//  ResolutionController is plain C++: --resolution-check runs it against a
+//  simulated GPU, with latency, on synthetic timing traces.
+//
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "GpuResources.h"
+#include "Profiler.h"
+#include "RenderGraph.h"
+#include "Shader.h"
+
+const GLuint RESOLUTION_TIMER_FRAMES = 4;   // Timestamp pairs in flight
+const GLuint RESOLUTION_HISTORY = 3;        // Frame times the controller takes the median of
+const GLuint RESOLUTION_CHECK_FRAMES = 600;
+const GLuint RESOLUTION_CHECK_LATENCY = 3;  // Frames before a frame's time reaches the controller
+const GLuint RESOLUTION_CHECK_SETTLE = 120; // Frames the controller gets to settle before it is judged
+
+struct ResolutionSettings {
+    GLfloat budgetMs = 1000.0f / 60.0f;  // GPU time a frame should stay under; 0 keeps the full resolution
+    GLfloat headroom = 0.1f;             // Share of the budget aimed below it, for the spikes the latency hides
+    GLfloat minScale = 0.5f;
+    GLfloat maxScale = 1.0f;
+    GLfloat kp = 0.2f;                   // Gains on the error in budgets, moving the share of pixels drawn
+    GLfloat ki = 0.1f;
+    GLfloat kd = 0.02f;
+    GLfloat sharpness = 0.5f;            // At minScale, fading to none at full resolution
+};
+
+class ResolutionController {
+public:
+    explicit ResolutionController(const ResolutionSettings &settings = ResolutionSettings()): settings(settings) {
+        this->reset();
+    }
+
+    void reset() {
+        this->pixels = this->settings.maxScale * this->settings.maxScale;
+        this->samples = 0;
+        this->errors[0] = this->errors[1] = 0.0f;
+    }
+
+    // Takes the GPU time of a finished frame and returns the scale to draw the next one at
+    GLfloat update(GLfloat gpuMs) {
+        if (this->settings.budgetMs <= 0.0f) {
+            return this->getScale();
+        }
+        this->history[this->samples % RESOLUTION_HISTORY] = gpuMs;
+        this->samples++;
+        GLuint count = std::min(this->samples, RESOLUTION_HISTORY);
+        GLfloat sorted[RESOLUTION_HISTORY];
+        std::copy(this->history, this->history + count, sorted);
+        std::sort(sorted, sorted + count);
+        GLfloat measured = sorted[count / 2];
+
+        GLfloat target = this->settings.budgetMs * (1.0f - this->settings.headroom);
+        GLfloat error = (target - measured) / this->settings.budgetMs;
+        if (this->samples == 1) {
+            this->errors[0] = this->errors[1] = error; // Starts without a kick from the proportional and derivative terms
+        }
+        GLfloat delta = this->settings.kp * (error - this->errors[0]) + this->settings.ki * error
+                      + this->settings.kd * (error - 2.0f * this->errors[0] + this->errors[1]);
+        this->errors[1] = this->errors[0];
+        this->errors[0] = error;
+
+        GLfloat low = this->settings.minScale * this->settings.minScale;
+        GLfloat high = this->settings.maxScale * this->settings.maxScale;
+        this->pixels = std::min(std::max(this->pixels + delta, low), high);
+        return this->getScale();
+    }
+
+    GLfloat getScale() const {
+        return std::sqrt(this->pixels);
+    }
+
+    ResolutionSettings &getSettings() {
+        return this->settings;
+    }
+
+private:
+    ResolutionSettings settings;
+    GLfloat pixels = 1.0f;           // The share of the target's pixels drawn
+    GLfloat history[RESOLUTION_HISTORY] = {};
+    GLuint samples = 0;
+    GLfloat errors[2];               // The last two, newest first
+};
+
+class DynamicResolution {
+public:
+    explicit DynamicResolution(const ResolutionSettings &settings = ResolutionSettings()): controller(settings) {
+        this->upscaleProgram = linkProgram({ { GL_VERTEX_SHADER, "res/shaders/fullscreen.vs" },
+                                             { GL_FRAGMENT_SHADER, "res/shaders/upscale.frag" } });
+        this->sceneLoc = glGetUniformLocation(this->upscaleProgram, "scene");
+        this->uvScaleLoc = glGetUniformLocation(this->upscaleProgram, "uvScale");
+        this->uvMaxLoc = glGetUniformLocation(this->upscaleProgram, "uvMax");
+        this->texelSizeLoc = glGetUniformLocation(this->upscaleProgram, "texelSize");
+        this->sharpnessLoc = glGetUniformLocation(this->upscaleProgram, "sharpness");
+        glGenQueries(RESOLUTION_TIMER_FRAMES * 2, this->queries);
+    }
+
+    ~DynamicResolution() {
+        glDeleteQueries(RESOLUTION_TIMER_FRAMES * 2, this->queries);
+    }
+
+    DynamicResolution(const DynamicResolution &) = delete;
+    DynamicResolution &operator=(const DynamicResolution &) = delete;
+
+    // Adds the pass stretching the drawn corner of color over a full size target, and returns that
+    // target. Depth is scaled along with color
+    RenderResource addUpscalePass(RenderGraph &graph, RenderResource color, RenderResource depth) {
+        this->color = color;
+        this->depth = depth;
+        return describeUpscale(graph, color, this);
+    }
+
+    // Adds the upscale pass and its target to graph. Only executing the graph touches resolution,
+    // so a null one describes the same pass without a context, for checks
+    static RenderResource describeUpscale(RenderGraph &graph, RenderResource color, DynamicResolution *resolution) {
+        RenderResource upscaled = graph.createTexture("Upscaled scene", graph.getDesc(color));
+        return graph.addPass("Upscale", [resolution, color](RenderGraph &g) {
+            resolution->upscale(g, color);
+        }).read(color).write(upscaled);
+    }
+
+    // Feeds the GPU times that have arrived to the controller, scales the scene for this frame and
+    // starts timing it. Call before executing the graph
+    void beginFrame(RenderGraph &graph) {
+        GLfloat gpuMs;
+        while (this->collect(gpuMs)) {
+            this->controller.update(gpuMs);
+        }
+        const RenderTargetDesc &desc = graph.getDesc(this->color);
+        GLfloat scale = this->controller.getScale();
+        GLint width = (GLint) std::lround(desc.width * scale), height = (GLint) std::lround(desc.height * scale);
+        graph.setExtent(this->color, width, height);
+        graph.setExtent(this->depth, width, height);
+
+        // With every pair still in flight this frame goes untimed rather than waiting on the GPU
+        this->timing = this->written - this->read < RESOLUTION_TIMER_FRAMES;
+        if (this->timing) {
+            glQueryCounter(this->queries[(this->written % RESOLUTION_TIMER_FRAMES) * 2], GL_TIMESTAMP);
+        }
+    }
+
+    void endFrame() {
+        if (this->timing) {
+            glQueryCounter(this->queries[(this->written % RESOLUTION_TIMER_FRAMES) * 2 + 1], GL_TIMESTAMP);
+            this->written++;
+        }
+    }
+
+    GLfloat getScale() const {
+        return this->controller.getScale();
+    }
+
+    ResolutionSettings &getSettings() {
+        return this->controller.getSettings();
+    }
+
+private:
+    ResolutionController controller;
+    RenderResource color, depth;
+    ProgramHandle upscaleProgram;
+    GLint sceneLoc, uvScaleLoc, uvMaxLoc, texelSizeLoc, sharpnessLoc;
+    GLuint queries[RESOLUTION_TIMER_FRAMES * 2];
+    GLuint written = 0, read = 0;   // Timestamp pairs issued and collected
+    bool timing = false;
+
+    // The oldest frame time, once the GPU has it
+    bool collect(GLfloat &gpuMs) {
+        if (this->read == this->written) {
+            return false;
+        }
+        GLuint slot = (this->read % RESOLUTION_TIMER_FRAMES) * 2;
+        GLint available = 0;
+        glGetQueryObjectiv(this->queries[slot + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return false;
+        }
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(this->queries[slot], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(this->queries[slot + 1], GL_QUERY_RESULT, &end);
+        gpuMs = (GLfloat) ((end - start) / 1.0e6);
+        this->read++;
+        return true;
+    }
+
+    void upscale(RenderGraph &g, RenderResource scene) {
+        const RenderTargetDesc &desc = g.getDesc(scene);
+        glm::ivec2 extent = g.getExtent(scene);
+        ResolutionSettings &settings = this->controller.getSettings();
+        GLfloat scale = (GLfloat) extent.x / desc.width;
+        GLfloat fade = settings.minScale < 1.0f ? (1.0f - scale) / (1.0f - settings.minScale) : 0.0f;
+
+        glUseProgram(this->upscaleProgram);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, g.getTexture(scene));
+        glUniform1i(this->sceneLoc, 0);
+        glUniform2f(this->uvScaleLoc, (GLfloat) extent.x / desc.width, (GLfloat) extent.y / desc.height);
+        glUniform2f(this->uvMaxLoc, (extent.x - 0.5f) / desc.width, (extent.y - 0.5f) / desc.height);
+        glUniform2f(this->texelSizeLoc, 1.0f / desc.width, 1.0f / desc.height);
+        glUniform1f(this->sharpnessLoc, settings.sharpness * std::min(std::max(fade, 0.0f), 1.0f));
+        PROFILE_STATE_CHANGE();
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        PROFILE_DRAW(1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
+
+struct ResolutionRun {
+    std::vector<GLfloat> scales;  // The scale each frame was drawn at
+    std::vector<GLfloat> gpuMs;   // And the time it took
+};
+
+// Drives a controller with a simulated GPU: frame f, drawn at a share p of the pixels, takes
+// cost(f, p) ms, which the controller hears about RESOLUTION_CHECK_LATENCY frames later
+inline ResolutionRun simulateResolution(const ResolutionSettings &settings, GLuint frames,
+                                        const std::function<GLfloat(GLuint, GLfloat)> &cost) {
+    ResolutionController controller(settings);
+    ResolutionRun run;
+    GLfloat scale = controller.getScale();
+    for (GLuint frame = 0; frame < frames; frame++) {
+        run.scales.push_back(scale);
+        run.gpuMs.push_back(cost(frame, scale * scale));
+        if (frame >= RESOLUTION_CHECK_LATENCY) {
+            scale = controller.update(run.gpuMs[frame - RESOLUTION_CHECK_LATENCY]);
+        }
+    }
+    return run;
+}
+
+// Runs the controller on synthetic traces: a scene too heavy for the budget must settle near it,
+// steadily and without going over; a light one must stay at full resolution; a spike must be
+// brought back under the budget within a few frames and the resolution recovered after it; noisy
+// times must not shake the scale; and an impossible budget must pin it at the minimum.
+// Run with GameForFuns --resolution-check.
+inline bool checkDynamicResolution() {
+    bool passed = true;
+    auto report = [&passed](bool ok, const std::string &what) {
+        std::cout << (ok ? "OK       " : "FAILED   ") << what << std::endl;
+        passed = passed && ok;
+    };
+    ResolutionSettings settings;
+    GLfloat budget = settings.budgetMs;
+    GLfloat target = budget * (1.0f - settings.headroom);
+    auto overBudget = [budget](const ResolutionRun &run, GLuint begin, GLuint end) {
+        GLuint count = 0;
+        for (GLuint i = begin; i < end; i++) {
+            count += run.gpuMs[i] > budget ? 1 : 0;
+        }
+        return count;
+    };
+    auto maxStep = [](const ResolutionRun &run, GLuint begin, GLuint end) {
+        GLfloat step = 0.0f;
+        for (GLuint i = begin + 1; i < end; i++) {
+            step = std::max(step, std::abs(run.scales[i] - run.scales[i - 1]));
+        }
+        return step;
+    };
+    auto mean = [](const std::vector<GLfloat> &values, GLuint begin, GLuint end) {
+        GLfloat sum = 0.0f;
+        for (GLuint i = begin; i < end; i++) {
+            sum += values[i];
+        }
+        return sum / (end - begin);
+    };
+    const GLuint frames = RESOLUTION_CHECK_FRAMES;
+    const GLuint settled = RESOLUTION_CHECK_SETTLE;
+
+    // 2 ms of fixed work and 22 ms of pixels at full resolution
+    ResolutionRun heavy = simulateResolution(settings, frames, [](GLuint, GLfloat p) { return 2.0f + 22.0f * p; });
+    GLfloat heavyMs = mean(heavy.gpuMs, settled, frames);
+    report(std::abs(heavyMs - target) < 0.05f * target && overBudget(heavy, settled, frames) == 0
+           && maxStep(heavy, settled, frames) < 0.005f,
+           "heavy: settles at scale " + std::to_string(heavy.scales.back()) + ", " + std::to_string(heavyMs) + " ms for a "
+           + std::to_string(target) + " ms target");
+
+    ResolutionRun light = simulateResolution(settings, frames, [](GLuint, GLfloat p) { return 1.0f + 7.0f * p; });
+    report(*std::min_element(light.scales.begin(), light.scales.end()) == settings.maxScale,
+           "light: stays at full resolution");
+
+    // The pixels cost 2.5 times as much for 200 frames
+    const GLuint spikeStart = 200, spikeEnd = 400;
+    ResolutionRun spike = simulateResolution(settings, frames, [](GLuint f, GLfloat p) {
+        return 1.0f + 11.0f * p * (f >= spikeStart && f < spikeEnd ? 2.5f : 1.0f);
+    });
+    GLuint spikeOver = overBudget(spike, spikeStart, spikeEnd);
+    GLuint recovered = spikeEnd;
+    while (recovered < frames && spike.scales[recovered] < settings.maxScale - 0.01f) {
+        recovered++;
+    }
+    report(spikeOver <= 12 && overBudget(spike, spikeStart + 30, spikeEnd) == 0 && recovered - spikeEnd <= 90,
+           "spike: " + std::to_string(spikeOver) + " frames over budget, down to scale "
+           + std::to_string(*std::min_element(spike.scales.begin() + spikeStart, spike.scales.begin() + spikeEnd))
+           + ", full resolution again " + std::to_string(recovered - spikeEnd) + " frames after");
+
+    // Each frame up to 8% off its cost, inside the headroom; seeded so the check is repeatable
+    std::mt19937 random(7);
+    std::uniform_real_distribution<GLfloat> jitter(0.92f, 1.08f);
+    ResolutionRun noisy = simulateResolution(settings, frames, [&random, &jitter](GLuint, GLfloat p) {
+        return (2.0f + 22.0f * p) * jitter(random);
+    });
+    GLuint noisyOver = overBudget(noisy, settled, frames);
+    report(noisyOver < (frames - settled) / 20 && maxStep(noisy, settled, frames) < 0.025f,
+           "noisy: " + std::to_string(noisyOver) + " of " + std::to_string(frames - settled) + " frames over budget, "
+           + "largest step " + std::to_string(maxStep(noisy, settled, frames)));
+
+    ResolutionRun impossible = simulateResolution(settings, frames, [](GLuint, GLfloat p) { return 20.0f + 10.0f * p; });
+    report(impossible.scales.back() == settings.minScale && !std::isnan(mean(impossible.scales, 0, frames)),
+           "impossible: pinned at scale " + std::to_string(impossible.scales.back()));
+
+    ResolutionSettings off;
+    off.budgetMs = 0.0f;
+    ResolutionRun fixed = simulateResolution(off, frames, [](GLuint, GLfloat p) { return 2.0f + 22.0f * p; });
+    report(*std::min_element(fixed.scales.begin(), fixed.scales.end()) == off.maxScale, "no budget: full resolution");
+    return passed;
+}
@@ -0,0 +1,413 @@
+//
+//  Entities.h
+//  GameForFuns
+//
+//  Scene objects as entities made of components. Entities are grouped by the
+//  set of components they have: each distinct set is an Archetype holding one
+//  contiguous array per component, so a system that reads positions and
+//  velocities walks two dense arrays and touches nothing else. An Entity is a
+//  slot index plus the generation of that slot; the generation goes up when
+//  the slot is reused, so a stale handle is detected instead of naming a newer
+//  entity. Adding or removing a component moves the entity's row to the
+//  matching archetype, and removing a row moves the archetype's last row into
+//  the hole.
+//
+//  Systems visit the archetypes that have every component they need, split
+//  into ranges of rows on the job system. Entities must not be created,
+//  destroyed or change components while a system runs.
+//
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Profiler.h"
+#include "JobSystem.h"
+
+typedef GLuint ComponentMask;
+
+const ComponentMask COMPONENT_TRANSFORM = 1 << 0;
+const ComponentMask COMPONENT_MESH = 1 << 1;
+const ComponentMask COMPONENT_LIGHT = 1 << 2;
+const ComponentMask COMPONENT_VELOCITY = 1 << 3;
+const GLuint ENTITY_GRAIN = 4096;       // Rows per job when a system fans out
+const GLuint ENTITY_NONE = 0xFFFFFFFF;
+
+// Placement; the model matrix is translate(position) * rotate(angle, axis) * scale
+struct Transform {
+    static const ComponentMask MASK = COMPONENT_TRANSFORM;
+    glm::vec3 position = glm::vec3(0.0f);
+    GLfloat angle = 0.0f;                         // Radians about axis
+    glm::vec3 axis = glm::vec3(0.0f, 1.0f, 0.0f); // Normalized by the rotation
+    GLfloat scale = 1.0f;
+
+    glm::mat4 getMatrix() const {
+        glm::mat4 model = glm::translate(glm::mat4(1), this->position);
+        model = glm::rotate(model, this->angle, this->axis);
+        return glm::scale(model, glm::vec3(this->scale));
+    }
+};
+
+// What to draw, as indices into the drawing scene's own mesh and material tables
+struct MeshRef {
+    static const ComponentMask MASK = COMPONENT_MESH;
+    GLuint mesh = 0;
+    GLuint material = 0;
+};
+
+// A point light at the entity's position, with the attenuation terms lighting.frag uses
+struct Light {
+    static const ComponentMask MASK = COMPONENT_LIGHT;
+    glm::vec3 ambient = glm::vec3(0.05f);
+    glm::vec3 diffuse = glm::vec3(0.8f);
+    glm::vec3 specular = glm::vec3(1.0f);
+    GLfloat constant = 1.0f;
+    GLfloat linear = 0.09f;
+    GLfloat quadratic = 0.032f;
+};
+
+// Motion integrated by integrateMotion; acceleration gathers one step's forces and is then cleared
+struct Velocity {
+    static const ComponentMask MASK = COMPONENT_VELOCITY;
+    glm::vec3 linear = glm::vec3(0.0f);
+    GLfloat spin = 0.0f;                          // Radians per second about the transform's axis
+    glm::vec3 acceleration = glm::vec3(0.0f);
+    GLfloat gravity = 0.0f;                       // Downwards, units per second squared
+};
+
+struct Entity {
+    GLuint index = ENTITY_NONE;
+    GLuint generation = 0;
+
+    bool operator==(const Entity &other) const {
+        return this->index == other.index && this->generation == other.generation;
+    }
+
+    bool operator!=(const Entity &other) const {
+        return !(*this == other);
+    }
+};
+
+// One step of semi-implicit Euler, so results only depend on dt
+inline void integrateMotion(Transform &transform, Velocity &velocity, GLfloat dt) {
+    velocity.acceleration.y -= velocity.gravity;
+    velocity.linear += velocity.acceleration * dt;
+    transform.position += velocity.linear * dt;
+    velocity.acceleration = glm::vec3(0.0f);
+    transform.angle += velocity.spin * dt;
+}
+
+// The entities with one set of components, a row each; row i of every array is the same entity
+class Archetype {
+public:
+    explicit Archetype(ComponentMask mask) : mask(mask) {}
+
+    Archetype(const Archetype &) = delete;
+    Archetype &operator=(const Archetype &) = delete;
+
+    ComponentMask getMask() const {
+        return this->mask;
+    }
+
+    GLuint size() const {
+        return (GLuint) this->entities.size();
+    }
+
+    const Entity *getEntities() const {
+        return this->entities.data();
+    }
+
+    // The component array, nullptr when this archetype lacks T
+    template <typename T>
+    T *get() {
+        return (this->mask & T::MASK) ? this->column<T>().data() : nullptr;
+    }
+
+private:
+    friend class EntityWorld;
+
+    ComponentMask mask;
+    std::vector<Entity> entities;
+    std::vector<Transform> transforms;
+    std::vector<MeshRef> meshes;
+    std::vector<Light> lights;
+    std::vector<Velocity> velocities;
+
+    template <typename T>
+    std::vector<T> &column() {
+        return this->columnOf((T *) nullptr);
+    }
+
+    std::vector<Transform> &columnOf(Transform *) {
+        return this->transforms;
+    }
+
+    std::vector<MeshRef> &columnOf(MeshRef *) {
+        return this->meshes;
+    }
+
+    std::vector<Light> &columnOf(Light *) {
+        return this->lights;
+    }
+
+    std::vector<Velocity> &columnOf(Velocity *) {
+        return this->velocities;
+    }
+
+    // Appends a row of default components
+    GLuint push(Entity entity) {
+        this->entities.push_back(entity);
+        this->pushDefault<Transform>();
+        this->pushDefault<MeshRef>();
+        this->pushDefault<Light>();
+        this->pushDefault<Velocity>();
+        return (GLuint) this->entities.size() - 1;
+    }
+
+    // Copies the components both archetypes have from row of source into row of this
+    void copyRow(GLuint row, Archetype &source, GLuint sourceRow) {
+        this->copyComponent<Transform>(row, source, sourceRow);
+        this->copyComponent<MeshRef>(row, source, sourceRow);
+        this->copyComponent<Light>(row, source, sourceRow);
+        this->copyComponent<Velocity>(row, source, sourceRow);
+    }
+
+    // Fills row with the last row and drops the last; returns the entity now at row, if any moved
+    Entity removeRow(GLuint row) {
+        GLuint last = (GLuint) this->entities.size() - 1;
+        Entity moved;
+        if (row != last) {
+            moved = this->entities[last];
+            this->entities[row] = moved;
+            this->copyRow(row, *this, last);
+        }
+        this->entities.pop_back();
+        this->popComponent<Transform>();
+        this->popComponent<MeshRef>();
+        this->popComponent<Light>();
+        this->popComponent<Velocity>();
+        return moved;
+    }
+
+    template <typename T>
+    void pushDefault() {
+        if (this->mask & T::MASK) {
+            this->column<T>().emplace_back();
+        }
+    }
+
+    template <typename T>
+    void copyComponent(GLuint row, Archetype &source, GLuint sourceRow) {
+        if (this->mask & source.mask & T::MASK) {
+            this->column<T>()[row] = source.column<T>()[sourceRow];
+        }
+    }
+
+    template <typename T>
+    void popComponent() {
+        if (this->mask & T::MASK) {
+            this->column<T>().pop_back();
+        }
+    }
+};
+
+// Rows [begin, end) of one archetype. offset numbers begin among every entity the query
+// visits, in visiting order, so per entity results can go into one flat array.
+struct EntityRange {
+    Archetype *archetype;
+    GLuint begin, end;
+    GLuint offset;
+};
+
+class EntityWorld {
+public:
+    EntityWorld() {}
+
+    EntityWorld(const EntityWorld &) = delete;
+    EntityWorld &operator=(const EntityWorld &) = delete;
+
+    // A new entity with default values for the components in mask
+    Entity create(ComponentMask mask) {
+        GLuint index;
+        if (!this->freeSlots.empty()) {
+            index = this->freeSlots.back();
+            this->freeSlots.pop_back();
+        } else {
+            index = (GLuint) this->slots.size();
+            this->slots.push_back(Slot());
+        }
+        Slot &slot = this->slots[index];
+        Entity entity = { index, slot.generation };
+        slot.archetype = this->findArchetype(mask);
+        slot.row = this->archetypes[slot.archetype]->push(entity);
+        this->alive++;
+        return entity;
+    }
+
+    void destroy(Entity entity) {
+        if (!this->isAlive(entity)) {
+            return;
+        }
+        Slot &slot = this->slots[entity.index];
+        this->removeRow(slot.archetype, slot.row);
+        slot.archetype = ENTITY_NONE;
+        slot.generation++;
+        this->freeSlots.push_back(entity.index);
+        this->alive--;
+    }
+
+    bool isAlive(Entity entity) const {
+        return entity.index < this->slots.size() && this->slots[entity.index].generation == entity.generation
+            && this->slots[entity.index].archetype != ENTITY_NONE;
+    }
+
+    // 0 for a dead entity
+    ComponentMask getMask(Entity entity) const {
+        return this->isAlive(entity) ? this->archetypes[this->slots[entity.index].archetype]->getMask() : 0;
+    }
+
+    // The entity's component, nullptr if it is dead or lacks one; invalidated by any structural change
+    template <typename T>
+    T *get(Entity entity) {
+        if (!this->isAlive(entity)) {
+            return nullptr;
+        }
+        const Slot &slot = this->slots[entity.index];
+        T *column = this->archetypes[slot.archetype]->template get<T>();
+        return column ? column + slot.row : nullptr;
+    }
+
+    // Sets the entity's T, first moving it to the archetype with T if it has none
+    template <typename T>
+    T *add(Entity entity, const T &value = T()) {
+        if (!this->isAlive(entity)) {
+            return nullptr;
+        }
+        ComponentMask mask = this->getMask(entity);
+        if (!(mask & T::MASK)) {
+            this->move(entity, mask | T::MASK);
+        }
+        T *component = this->get<T>(entity);
+        *component = value;
+        return component;
+    }
+
+    template <typename T>
+    void remove(Entity entity) {
+        ComponentMask mask = this->getMask(entity);
+        if (mask & T::MASK) {
+            this->move(entity, mask & ~T::MASK);
+        }
+    }
+
+    GLuint getCount() const {
+        return this->alive;
+    }
+
+    GLuint getArchetypeCount() const {
+        return (GLuint) this->archetypes.size();
+    }
+
+    // Entities with every component in mask
+    GLuint count(ComponentMask mask) const {
+        GLuint total = 0;
+        for (const std::unique_ptr<Archetype> &archetype : this->archetypes) {
+            if ((archetype->getMask() & mask) == mask) {
+                total += archetype->size();
+            }
+        }
+        return total;
+    }
+
+    // Calls fn(EntityRange) for the rows of every archetype with all of mask, in order, on this thread
+    template <typename Fn>
+    void forEach(ComponentMask mask, const Fn &fn) {
+        GLuint offset = 0;
+        for (const std::unique_ptr<Archetype> &archetype : this->archetypes) {
+            if ((archetype->getMask() & mask) == mask && archetype->size() > 0) {
+                fn(EntityRange{ archetype.get(), 0, archetype->size(), offset });
+                offset += archetype->size();
+            }
+        }
+    }
+
+    // forEach split into ranges of at most grain rows on jobs; returns once all have run.
+    // Ranges get the same offsets forEach would give. One call at a time per world.
+    template <typename Fn>
+    void parallelForEach(ComponentMask mask, const Fn &fn, JobSystem &jobs = JobSystem::get(), GLuint grain = ENTITY_GRAIN) {
+        this->ranges.clear();
+        this->forEach(mask, [this, grain](const EntityRange &whole) {
+            for (GLuint begin = whole.begin; begin < whole.end; begin += grain) {
+                GLuint end = std::min(begin + grain, whole.end);
+                this->ranges.push_back(EntityRange{ whole.archetype, begin, end, whole.offset + begin });
+            }
+        });
+        const EntityRange *ranges = this->ranges.data();
+        jobs.parallelForWait((GLuint) this->ranges.size(), 1, [ranges, &fn](GLuint begin, GLuint end) {
+            for (GLuint i = begin; i < end; i++) {
+                fn(ranges[i]);
+            }
+        });
+    }
+
+private:
+    struct Slot {
+        GLuint archetype = ENTITY_NONE;
+        GLuint row = 0;
+        GLuint generation = 0;
+    };
+
+    std::vector<std::unique_ptr<Archetype>> archetypes; // Never removed, so indices stay valid
+    std::vector<Slot> slots;
+    std::vector<GLuint> freeSlots;
+    std::vector<EntityRange> ranges;                    // Reused so systems do not allocate
+    GLuint alive = 0;
+
+    GLuint findArchetype(ComponentMask mask) {
+        for (GLuint i = 0; i < this->archetypes.size(); i++) {
+            if (this->archetypes[i]->getMask() == mask) {
+                return i;
+            }
+        }
+        this->archetypes.push_back(std::unique_ptr<Archetype>(new Archetype(mask)));
+        return (GLuint) this->archetypes.size() - 1;
+    }
+
+    void removeRow(GLuint archetype, GLuint row) {
+        Entity moved = this->archetypes[archetype]->removeRow(row);
+        if (moved.index != ENTITY_NONE) {
+            this->slots[moved.index].row = row;
+        }
+    }
+
+    // Moves entity's row to the archetype for mask, keeping the components both have
+    void move(Entity entity, ComponentMask mask) {
+        Slot &slot = this->slots[entity.index];
+        GLuint target = this->findArchetype(mask);
+        Archetype &to = *this->archetypes[target];
+        GLuint row = to.push(entity);
+        to.copyRow(row, *this->archetypes[slot.archetype], slot.row);
+        this->removeRow(slot.archetype, slot.row);
+        slot.archetype = target;
+        slot.row = row;
+    }
+};
+
+// Integrates every entity with a transform and a velocity over one step
+inline void updateMotion(EntityWorld &world, GLfloat dt, JobSystem &jobs = JobSystem::get()) {
+    PROFILE_SCOPE("updateMotion");
+    world.parallelForEach(COMPONENT_TRANSFORM | COMPONENT_VELOCITY, [dt](const EntityRange &range) {
+        Transform *transforms = range.archetype->get<Transform>();
+        Velocity *velocities = range.archetype->get<Velocity>();
+        for (GLuint row = range.begin; row < range.end; row++) {
+            integrateMotion(transforms[row], velocities[row], dt);
+        }
+    }, jobs);
+}
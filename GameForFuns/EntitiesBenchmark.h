@@ -0,0 +1,176 @@
+//
+//  EntitiesBenchmark.h
+//  GameForFuns
+//
+//  Entity benchmark, headless. Runs the motion and model matrix systems over 1M
+//  entities with 1 to N threads, against the same work on one struct per object,
+//  and times moving entities between archetypes.
+//
+//  Usage: GameForFuns --benchmark-entities [--out entities.json]
+//
+#pragma once
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Benchmark.h"
+#include "Entities.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+
+const GLuint BENCHMARK_ENTITY_COUNT = 1000000;
+const GLuint BENCHMARK_ENTITY_REPEATS = 10;
+const GLuint BENCHMARK_ENTITY_CHURN = 10000;          // Entities that lose and regain their velocity per repeat
+
+// The baseline layout for benchmarkEntities: every component inline, whether the object has it or not
+struct BaselineObject {
+    ComponentMask mask = 0;
+    Transform transform;
+    MeshRef mesh;
+    Light light;
+    Velocity velocity;
+};
+
+// Medians over BENCHMARK_ENTITY_REPEATS runs of each system; the object times do the same work
+// on one struct per object holding every component
+struct EntityScalingResult {
+    GLuint threads;
+    GLfloat motionMs;
+    GLfloat matrixMs;
+    GLfloat objectMotionMs;
+    GLfloat objectMatrixMs;
+};
+
+// BENCHMARK_ENTITY_COUNT entities in three archetypes: moving meshes, static meshes and moving
+// lights. The motion and model matrix systems run over them with 1 to N threads, and the same
+// loops over one struct per object, skipping objects without the components, as the baseline.
+// Both are integrated the same number of times, so must end bit-identical.
+inline int benchmarkEntities(const BenchmarkOptions &options) {
+    EntityWorld world;
+    std::vector<BaselineObject> objects(BENCHMARK_ENTITY_COUNT);
+    std::vector<Entity> entities(BENCHMARK_ENTITY_COUNT);
+    GLuint moving = 0;
+
+    double start = Profiler::get().nowUs();
+    for (GLuint i = 0; i < BENCHMARK_ENTITY_COUNT; i++) {
+        BaselineObject &object = objects[i];
+        object.mask = i % 10 == 0 ? COMPONENT_TRANSFORM | COMPONENT_VELOCITY | COMPONENT_LIGHT
+                    : i % 10 < 3 ? COMPONENT_TRANSFORM | COMPONENT_MESH
+                    : COMPONENT_TRANSFORM | COMPONENT_MESH | COMPONENT_VELOCITY;
+        object.transform.position = glm::vec3((GLfloat) (i % 100), (GLfloat) ((i / 100) % 100), -(GLfloat) (i / 10000));
+        object.transform.axis = glm::vec3(0.3f, 1.0f, 0.2f);
+        object.velocity.linear = glm::vec3((GLfloat) (i % 7) - 3.0f, 0.5f, (GLfloat) (i % 5) - 2.0f);
+        object.velocity.spin = 0.001f * (i % 13);
+        object.velocity.gravity = i % 10 == 0 ? 0.0f : GRAVITY;
+
+        Entity entity = world.create(object.mask);
+        *world.get<Transform>(entity) = object.transform;
+        if (object.mask & COMPONENT_VELOCITY) {
+            *world.get<Velocity>(entity) = object.velocity;
+        }
+        entities[i] = entity;
+        moving += (object.mask & COMPONENT_VELOCITY) ? 1 : 0;
+    }
+    GLfloat createMs = (GLfloat) ((Profiler::get().nowUs() - start) / 1000.0);
+
+    GLuint drawable = world.count(COMPONENT_TRANSFORM | COMPONENT_MESH);
+    std::vector<glm::mat4> matrices(drawable), objectMatrices(BENCHMARK_ENTITY_COUNT);
+    std::vector<EntityScalingResult> results;
+    for (GLuint threads : Benchmark::threadCounts()) {
+        JobSystem jobs(threads - 1);
+        std::vector<GLfloat> motionTimes, matrixTimes, objectMotionTimes, objectMatrixTimes;
+
+        for (GLuint repeat = 0; repeat < BENCHMARK_ENTITY_REPEATS; repeat++) {
+            start = Profiler::get().nowUs();
+            updateMotion(world, BENCHMARK_TIMESTEP, jobs);
+            double middle = Profiler::get().nowUs();
+            glm::mat4 *out = matrices.data();
+            world.parallelForEach(COMPONENT_TRANSFORM | COMPONENT_MESH, [out](const EntityRange &range) {
+                const Transform *transforms = range.archetype->get<Transform>();
+                for (GLuint row = range.begin, i = range.offset; row < range.end; row++, i++) {
+                    out[i] = transforms[row].getMatrix();
+                }
+            }, jobs);
+            double end = Profiler::get().nowUs();
+            motionTimes.push_back((GLfloat) ((middle - start) / 1000.0));
+            matrixTimes.push_back((GLfloat) ((end - middle) / 1000.0));
+
+            start = Profiler::get().nowUs();
+            jobs.parallelForWait(BENCHMARK_ENTITY_COUNT, ENTITY_GRAIN, [&objects](GLuint begin, GLuint end) {
+                for (GLuint i = begin; i < end; i++) {
+                    BaselineObject &object = objects[i];
+                    if ((object.mask & (COMPONENT_TRANSFORM | COMPONENT_VELOCITY)) == (COMPONENT_TRANSFORM | COMPONENT_VELOCITY)) {
+                        integrateMotion(object.transform, object.velocity, BENCHMARK_TIMESTEP);
+                    }
+                }
+            });
+            middle = Profiler::get().nowUs();
+            jobs.parallelForWait(BENCHMARK_ENTITY_COUNT, ENTITY_GRAIN, [&objects, &objectMatrices](GLuint begin, GLuint end) {
+                for (GLuint i = begin; i < end; i++) {
+                    const BaselineObject &object = objects[i];
+                    if ((object.mask & (COMPONENT_TRANSFORM | COMPONENT_MESH)) == (COMPONENT_TRANSFORM | COMPONENT_MESH)) {
+                        objectMatrices[i] = object.transform.getMatrix();
+                    }
+                }
+            });
+            end = Profiler::get().nowUs();
+            objectMotionTimes.push_back((GLfloat) ((middle - start) / 1000.0));
+            objectMatrixTimes.push_back((GLfloat) ((end - middle) / 1000.0));
+        }
+
+        EntityScalingResult result = { threads, Benchmark::percentile(motionTimes, 50.0f), Benchmark::percentile(matrixTimes, 50.0f),
+                                       Benchmark::percentile(objectMotionTimes, 50.0f), Benchmark::percentile(objectMatrixTimes, 50.0f) };
+        std::cout << threads << " threads: motion " << result.motionMs << " ms (objects " << result.objectMotionMs
+                  << " ms), matrices " << result.matrixMs << " ms (objects " << result.objectMatrixMs << " ms)" << std::endl;
+        results.push_back(result);
+    }
+
+    // Structural changes: entities leave their archetype for the one without Velocity and come back
+    std::vector<GLfloat> churnTimes;
+    for (GLuint repeat = 0; repeat < BENCHMARK_ENTITY_REPEATS; repeat++) {
+        start = Profiler::get().nowUs();
+        for (GLuint i = 0; i < BENCHMARK_ENTITY_CHURN; i++) {
+            Entity entity = entities[(i * 7919u) % (BENCHMARK_ENTITY_COUNT / 10) * 10 + 5]; // A moving mesh
+            Velocity velocity = *world.get<Velocity>(entity);
+            world.remove<Velocity>(entity);
+            world.add<Velocity>(entity, velocity);
+        }
+        churnTimes.push_back((GLfloat) (Profiler::get().nowUs() - start) / (2 * BENCHMARK_ENTITY_CHURN));
+    }
+    GLfloat changeUs = Benchmark::percentile(churnTimes, 50.0f);
+
+    bool identical = world.getCount() == BENCHMARK_ENTITY_COUNT && world.count(COMPONENT_VELOCITY) == moving;
+    for (GLuint i = 0; i < BENCHMARK_ENTITY_COUNT && identical; i++) {
+        const Transform *transform = world.get<Transform>(entities[i]);
+        identical = transform && std::memcmp(&transform->position, &objects[i].transform.position, sizeof(glm::vec3)) == 0
+                 && transform->angle == objects[i].transform.angle;
+    }
+    std::cout << BENCHMARK_ENTITY_COUNT << " entities in " << world.getArchetypeCount() << " archetypes created in " << createMs
+              << " ms, " << changeUs << " us per component added or removed" << std::endl;
+    if (!identical) {
+        std::cout << "ERROR::BENCHMARK::ENTITY_MISMATCH the entities and the objects moved differently" << std::endl;
+    }
+
+    std::ofstream out(options.output);
+    if (!out) {
+        std::cout << "ERROR::BENCHMARK::COULD_NOT_WRITE " << options.output << std::endl;
+        return EXIT_FAILURE;
+    }
+    out << "{\n  \"entities\": " << BENCHMARK_ENTITY_COUNT << ",\n  \"archetypes\": " << world.getArchetypeCount()
+        << ",\n  \"create_ms\": " << createMs << ",\n  \"component_change_us\": " << changeUs
+        << ",\n  \"identical\": " << (identical ? "true" : "false") << ",\n  \"systems\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const EntityScalingResult &r = results[i];
+        out << "    {\"threads\": " << r.threads << ", \"motion_ms\": " << r.motionMs << ", \"matrix_ms\": " << r.matrixMs
+            << ", \"object_motion_ms\": " << r.objectMotionMs << ", \"object_matrix_ms\": " << r.objectMatrixMs
+            << ", \"motion_speedup\": " << results[0].motionMs / r.motionMs
+            << ", \"matrix_speedup\": " << results[0].matrixMs / r.matrixMs
+            << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
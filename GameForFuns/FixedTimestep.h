@@ -0,0 +1,137 @@
+//
+//  FixedTimestep.h
+//  GameForFuns
+//
+//  Runs the simulation at a fixed rate independent of the render rate. Frame
+//  time is accumulated and consumed in whole steps; the leftover fraction is
+//  returned as the alpha to interpolate render state between the last two steps.
+//
+#pragma once
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Camera.h"
+#include "VoxelWorld.h"
+
+const GLfloat SIMULATION_RATE = 120.0f;
+const GLuint SIMULATION_MAX_STEPS = 12; // Per frame, drops time instead of spiralling after a long hitch
+
+class FixedTimestep {
+public:
+    FixedTimestep(GLfloat rate = SIMULATION_RATE, GLuint maxSteps = SIMULATION_MAX_STEPS):
+        step(1.0 / rate), maxSteps(maxSteps) {
+    }
+
+    // Calls stepFn(stepSeconds) once per whole step contained in the accumulated time.
+    // Returns the render interpolation factor in [0, 1).
+    template <typename StepFn>
+    GLfloat advance(double frameSeconds, StepFn stepFn) {
+        this->accumulator += frameSeconds;
+
+        GLuint steps = 0;
+        while (this->accumulator >= this->step && steps < this->maxSteps) {
+            stepFn((GLfloat) this->step);
+            this->accumulator -= this->step;
+            this->stepCount++;
+            steps++;
+        }
+
+        if (steps == this->maxSteps && this->accumulator >= this->step) {
+            this->accumulator = 0.0;
+        }
+
+        return (GLfloat) (this->accumulator / this->step);
+    }
+
+    GLfloat getStep() const {
+        return (GLfloat) this->step;
+    }
+
+    unsigned long getStepCount() const {
+        return this->stepCount;
+    }
+
+private:
+    double step;
+    GLuint maxSteps;
+    double accumulator = 0.0;
+    unsigned long stepCount = 0;
+};
+
+// Scripted input for step i of the determinism replay: jump, then walk forward while strafing
+inline void replayInput(Camera &camera, unsigned long step, GLfloat dt) {
+    if (step < 60) {
+        camera.processKeyboard(UP, dt);
+    }
+    if (step >= 30 && step < 400) {
+        camera.processKeyboard(FORWARD, dt);
+    }
+    if (step >= 200 && step < 300) {
+        camera.processKeyboard(LEFT, dt);
+    }
+}
+
+// One simulation step of the game: input, physics, then collision
+inline void simulateCamera(Camera &camera, const VoxelWorld &world, unsigned long step, GLfloat dt) {
+    camera.storePreviousState();
+    replayInput(camera, step, dt);
+    camera.update(dt);
+    camera.intersect(world);
+}
+
+// Replays the scripted input for stepCount steps under a repeating list of frame
+// times and returns the final camera position. The camera lands on a floor and
+// walks into a wall, then slides along it.
+inline glm::vec3 replayCamera(const std::vector<double> &frameTimes, unsigned long stepCount) {
+    VoxelWorld world;
+    for (GLint z = -32; z < 8; z++) {
+        for (GLint x = -16; x < 16; x++) {
+            world.setBlock(x, -3, z, BLOCK_GRASS);
+        }
+    }
+    for (GLint y = -2; y < 8; y++) {
+        for (GLint x = -16; x < 16; x++) {
+            world.setBlock(x, y, -10, BLOCK_CONTAINER);
+        }
+    }
+    Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+    FixedTimestep timestep;
+
+    for (size_t frame = 0; timestep.getStepCount() < stepCount; frame++) {
+        double frameSeconds = frameTimes[frame % frameTimes.size()];
+        // Never run past stepCount so every frame rate ends on the same step
+        double remaining = (stepCount - timestep.getStepCount()) * (double) timestep.getStep();
+        timestep.advance(std::min(frameSeconds, remaining), [&](GLfloat dt) {
+            simulateCamera(camera, world, timestep.getStepCount(), dt);
+        });
+    }
+    return camera.getPosition();
+}
+
+// Replays the same input at 30, 60, 144 Hz and with jittery unlocked frame times; every
+// run must end bit-identical. Run with GameForFuns --determinism-check.
+inline bool checkDeterminism() {
+    const unsigned long steps = 6 * (unsigned long) SIMULATION_RATE;
+    const std::vector<std::vector<double>> rates = {
+        {1.0 / 30.0},
+        {1.0 / 60.0},
+        {1.0 / 144.0},
+        {0.0041, 0.0213, 0.0007, 0.0166, 0.0502, 0.0093}
+    };
+
+    glm::vec3 reference = replayCamera(rates[0], steps);
+    bool identical = true;
+    for (size_t i = 0; i < rates.size(); i++) {
+        glm::vec3 position = replayCamera(rates[i], steps);
+        bool same = std::memcmp(&position, &reference, sizeof(glm::vec3)) == 0;
+        std::cout << "Replay " << i << ": " << position.x << " " << position.y << " " << position.z
+                  << (same ? " OK" : " MISMATCH") << std::endl;
+        identical = identical && same;
+    }
+    return identical;
+}
@@ -0,0 +1,188 @@
+//
+//  FrameArena.h
+//  GameForFuns
+//
+//  Bump allocator for data that only lives for one frame: draw lists,
+//  transforms, job data. Allocation is an atomic add so jobs can allocate too,
+//  and nothing is ever freed individually; the whole arena is rewound when
+//  its frame comes around again. There is one arena per frame the GPU may
+//  still be working on, so memory handed to GL stays untouched until the GPU is done with it.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <type_traits>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Profiler.h"
+
+const GLuint FRAME_ARENA_SIZE = 8 * 1024 * 1024;                    // Bytes per frame
+const GLuint FRAME_ARENA_COUNT = PROFILER_FRAMES_IN_FLIGHT + 1;     // The frame being recorded plus those in flight
+
+class LinearArena {
+public:
+    explicit LinearArena(size_t capacity) {
+        this->memory = (unsigned char *) std::malloc(capacity);
+        this->capacity = this->memory ? capacity : 0;
+    }
+
+    ~LinearArena() {
+        std::free(this->memory);
+    }
+
+    LinearArena(const LinearArena &) = delete;
+    LinearArena &operator=(const LinearArena &) = delete;
+
+    // Returns nullptr when the arena is exhausted
+    void *allocate(size_t bytes, size_t alignment = 16) {
+        size_t offset = this->used.fetch_add(bytes + alignment - 1, std::memory_order_relaxed);
+        if (offset + bytes + alignment - 1 > this->capacity) {
+            this->overflowed.store(true, std::memory_order_relaxed);
+            return nullptr;
+        }
+        uintptr_t address = (uintptr_t) (this->memory + offset);
+        address = (address + alignment - 1) & ~(uintptr_t) (alignment - 1);
+        return (void *) address;
+    }
+
+    template <typename T>
+    T *allocateArray(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena memory is never destructed");
+        return (T *) this->allocate(count * sizeof(T), alignof(T) > 16 ? alignof(T) : 16);
+    }
+
+    void reset() {
+        size_t used = std::min(this->used.load(std::memory_order_relaxed), this->capacity);
+        this->highWater = std::max(this->highWater, used);
+        if (this->overflowed.exchange(false)) {
+            std::cout << "ERROR::FRAME_ARENA::OUT_OF_MEMORY capacity " << this->capacity << std::endl;
+        }
+        this->used.store(0, std::memory_order_relaxed);
+    }
+
+    size_t getUsed() const {
+        return std::min(this->used.load(std::memory_order_relaxed), this->capacity);
+    }
+
+    size_t getHighWater() const {
+        return this->highWater;
+    }
+
+    size_t getCapacity() const {
+        return this->capacity;
+    }
+
+private:
+    unsigned char *memory;
+    size_t capacity;
+    std::atomic<size_t> used{0};
+    std::atomic<bool> overflowed{false};
+    size_t highWater = 0;
+};
+
+class FrameArena {
+public:
+    static FrameArena &get() {
+        static FrameArena instance;
+        return instance;
+    }
+
+    // Switches to the next arena and rewinds it; call once at the start of every frame
+    void beginFrame() {
+        this->index = (this->index + 1) % FRAME_ARENA_COUNT;
+        this->arenas[this->index]->reset();
+    }
+
+    LinearArena &current() {
+        return *this->arenas[this->index];
+    }
+
+    template <typename T>
+    T *allocateArray(size_t count) {
+        return this->current().template allocateArray<T>(count);
+    }
+
+    ~FrameArena() {
+        for (GLuint i = 0; i < FRAME_ARENA_COUNT; i++) {
+            delete this->arenas[i];
+        }
+    }
+
+private:
+    LinearArena *arenas[FRAME_ARENA_COUNT];
+    GLuint index = 0;
+
+    FrameArena() {
+        for (GLuint i = 0; i < FRAME_ARENA_COUNT; i++) {
+            this->arenas[i] = new LinearArena(FRAME_ARENA_SIZE);
+        }
+    }
+};
+
+// Fixed capacity array in arena memory. Elements are not constructed or destructed,
+// so T should be plain data.
+template <typename T>
+class ArenaArray {
+public:
+    static_assert(std::is_trivially_destructible<T>::value, "Arena memory is never destructed");
+
+    ArenaArray() {}
+
+    ArenaArray(LinearArena &arena, GLuint capacity) {
+        this->data = arena.allocateArray<T>(capacity);
+        this->capacity = this->data ? capacity : 0;
+    }
+
+    // Returns false once full
+    bool push_back(const T &value) {
+        if (this->count == this->capacity) {
+            return false;
+        }
+        this->data[this->count++] = value;
+        return true;
+    }
+
+    // For filling by index, e.g. from parallel jobs
+    void resize(GLuint count) {
+        this->count = std::min(count, this->capacity);
+    }
+
+    void clear() {
+        this->count = 0;
+    }
+
+    T &operator[](GLuint i) {
+        return this->data[i];
+    }
+
+    const T &operator[](GLuint i) const {
+        return this->data[i];
+    }
+
+    T *begin() {
+        return this->data;
+    }
+
+    T *end() {
+        return this->data + this->count;
+    }
+
+    GLuint size() const {
+        return this->count;
+    }
+
+    GLuint getCapacity() const {
+        return this->capacity;
+    }
+
+private:
+    T *data = nullptr;
+    GLuint count = 0;
+    GLuint capacity = 0;
+};
@@ -0,0 +1,92 @@
+//
+//  Frustum.h
+//  GameForFuns
+//
+//  View frustum planes extracted from a projection * view matrix, with
+//  point-radius and axis aligned box tests for culling.
+//
+#pragma once
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+struct AABB {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+class Frustum {
+public:
+    Frustum() {}
+
+    explicit Frustum(const glm::mat4 &viewProjection) {
+        // Rows of the matrix; glm is column major so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+        glm::vec4 rows[4];
+        for (GLuint i = 0; i < 4; i++) {
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        }
+
+        this->planes[0] = rows[3] + rows[0]; // Left
+        this->planes[1] = rows[3] - rows[0]; // Right
+        this->planes[2] = rows[3] + rows[1]; // Bottom
+        this->planes[3] = rows[3] - rows[1]; // Top
+        this->planes[4] = rows[3] + rows[2]; // Near
+        this->planes[5] = rows[3] - rows[2]; // Far
+
+        for (GLuint i = 0; i < 6; i++) {
+            GLfloat length = glm::length(glm::vec3(this->planes[i].x, this->planes[i].y, this->planes[i].z));
+            this->planes[i] = this->planes[i] / length;
+        }
+    }
+
+    bool containsSphere(const glm::vec3 &center, GLfloat radius) const {
+        for (GLuint i = 0; i < 6; i++) {
+            const glm::vec4 &plane = this->planes[i];
+            if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Tests the box corner furthest along each plane normal; conservative near frustum edges
+    bool containsAABB(const AABB &box) const {
+        for (GLuint i = 0; i < 6; i++) {
+            const glm::vec4 &plane = this->planes[i];
+            glm::vec3 positive(
+                plane.x >= 0.0f ? box.max.x : box.min.x,
+                plane.y >= 0.0f ? box.max.y : box.min.y,
+                plane.z >= 0.0f ? box.max.z : box.min.z
+            );
+            if (plane.x * positive.x + plane.y * positive.y + plane.z * positive.z + plane.w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Whether the box lies wholly inside, so everything within it is visible too
+    bool enclosesAABB(const AABB &box) const {
+        for (GLuint i = 0; i < 6; i++) {
+            const glm::vec4 &plane = this->planes[i];
+            glm::vec3 negative(
+                plane.x >= 0.0f ? box.min.x : box.max.x,
+                plane.y >= 0.0f ? box.min.y : box.max.y,
+                plane.z >= 0.0f ? box.min.z : box.max.z
+            );
+            if (plane.x * negative.x + plane.y * negative.y + plane.z * negative.z + plane.w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const glm::vec4 &getPlane(GLuint i) const {
+        return this->planes[i];
+    }
+
+private:
+    glm::vec4 planes[6];
+};
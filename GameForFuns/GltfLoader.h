@@ -0,0 +1,491 @@
+//
+//  GltfLoader.h
+//  GameForFuns
+//
+//  glTF 2.0 models, as .gltf with .bin files or data URIs, or as a single .glb.
+//  Binary buffers are memory mapped, and each bufferView a primitive reads is
+//  uploaded to its own GL buffer straight from the mapping, so vertex data
+//  reaches the driver without being unpacked into Vertex structs. Accessors
+//  become vertex attribute formats on one VAO per primitive, normalized and
+//  KHR_mesh_quantization integer types included, at the locations Mesh uses:
+//  position 0, normal 1, texture coords 2. Base color images, PNG/JPEG or KTX2
+//  (KHR_texture_basisu), come from TextureCache, so models sharing a file
+//  share its texture, and decode through AsyncTextureLoader, appearing when
+//  ready.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "Json.h"
+#include "MappedFile.h"
+#include "Profiler.h"
+#include "GpuResources.h"
+#include "TextureCache.h"
+
+const uint32_t GLTF_GLB_MAGIC = 0x46546C67;  // "glTF"
+const uint32_t GLTF_CHUNK_JSON = 0x4E4F534A; // "JSON"
+const uint32_t GLTF_CHUNK_BIN = 0x004E4942;  // "BIN\0"
+
+struct GltfPrimitive {
+    VertexArrayHandle vertexArray;
+    GLenum mode;
+    GLsizei count;       // Indices, or vertices when not indexed
+    GLenum indexType;    // 0 when not indexed
+    size_t indexOffset;
+    GLint texture;       // Base color, into GltfModel::textures, -1 for none
+};
+
+// A primitive placed by a node of the scene
+struct GltfDraw {
+    GLuint primitive;
+    glm::mat4 transform;
+};
+
+class GltfModel {
+public:
+    explicit GltfModel(const std::string &path) {
+        PROFILE_SCOPE("GltfModel::load");
+        this->loaded = this->load(path);
+    }
+
+    ~GltfModel() {
+        for (GLuint texture : this->textures) {
+            TextureCache::get().release(texture);
+        }
+    }
+
+    GltfModel(const GltfModel &) = delete;
+    GltfModel &operator=(const GltfModel &) = delete;
+
+    bool isLoaded() const {
+        return this->loaded;
+    }
+
+    // Draws every node's primitives with the base color bound as texture_diffuse1
+    void draw(Shader &shader, const glm::mat4 &transform) {
+        GLint modelLoc = glGetUniformLocation(shader.Program, "model");
+        glUniform1i(glGetUniformLocation(shader.Program, "texture_diffuse1"), 0);
+        glActiveTexture(GL_TEXTURE0);
+
+        for (const GltfDraw &draw : this->draws) {
+            const GltfPrimitive &primitive = this->primitives[draw.primitive];
+            glm::mat4 model = transform * draw.transform;
+            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+            glBindTexture(GL_TEXTURE_2D, primitive.texture >= 0 ? this->textures[primitive.texture] : 0);
+            glBindVertexArray(primitive.vertexArray);
+            if (primitive.indexType) {
+                glDrawElements(primitive.mode, primitive.count, primitive.indexType, (GLvoid *) primitive.indexOffset);
+            } else {
+                glDrawArrays(primitive.mode, 0, primitive.count);
+            }
+            PROFILE_DRAW(primitive.mode == GL_TRIANGLES ? primitive.count / 3 : 0);
+        }
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+private:
+    // Bytes of one glTF buffer: inside a mapped file, or decoded from a data URI
+    struct BufferSource {
+        const unsigned char *data = nullptr;
+        size_t size = 0;
+        std::unique_ptr<MappedFile> file;
+        std::vector<unsigned char> decoded;
+    };
+
+    bool loaded = false;
+    std::string directory;
+    std::string canonical;                    // Of the file, names its embedded images in TextureCache
+    std::vector<BufferSource> sources;        // Only while loading
+    std::vector<BufferHandle> buffers;        // One per bufferView, empty if no primitive reads it
+    std::vector<GltfPrimitive> primitives;
+    std::vector<std::vector<GLuint>> meshPrimitives;
+    std::vector<GltfDraw> draws;
+    std::vector<GLuint> textures;             // One per glTF texture, 0 until a material uses it; each holds a TextureCache reference
+
+    bool load(const std::string &path) {
+        this->directory = path.substr(0, path.find_last_of('/') + 1);
+        this->canonical = TextureCache::canonicalPath(path);
+        MappedFile file;
+        if (!file.open(path)) {
+            std::cout << "ERROR::GLTF::COULD_NOT_OPEN " << path << std::endl;
+            return false;
+        }
+
+        // A .glb is a JSON chunk followed by an optional binary chunk, which is buffer 0
+        const unsigned char *bytes = (const unsigned char *) file.getData();
+        const char *json = file.getData();
+        size_t jsonSize = file.getSize();
+        const unsigned char *binary = nullptr;
+        size_t binarySize = 0;
+        if (file.getSize() >= 20 && read32(bytes) == GLTF_GLB_MAGIC) {
+            size_t length = std::min((size_t) read32(bytes + 8), file.getSize());
+            size_t offset = 12;
+            json = nullptr;
+            while (offset + 8 <= length) {
+                size_t chunkSize = read32(bytes + offset);
+                uint32_t chunkType = read32(bytes + offset + 4);
+                if (offset + 8 + chunkSize > length) {
+                    break;
+                }
+                if (chunkType == GLTF_CHUNK_JSON && !json) {
+                    json = (const char *) bytes + offset + 8;
+                    jsonSize = chunkSize;
+                } else if (chunkType == GLTF_CHUNK_BIN && !binary) {
+                    binary = bytes + offset + 8;
+                    binarySize = chunkSize;
+                }
+                offset += 8 + ((chunkSize + 3) & ~(size_t) 3);
+            }
+            if (!json) {
+                std::cout << "ERROR::GLTF::NO_JSON_CHUNK " << path << std::endl;
+                return false;
+            }
+        }
+
+        JsonValue document;
+        if (!JsonValue::parse(json, jsonSize, document)) {
+            std::cout << "ERROR::GLTF::INVALID_JSON " << path << std::endl;
+            return false;
+        }
+        for (const JsonValue &extension : document["extensionsRequired"].elements) {
+            const std::string &name = extension.asString();
+            if (name != "KHR_mesh_quantization" && name != "KHR_texture_basisu") {
+                std::cout << "ERROR::GLTF::EXTENSION_UNSUPPORTED " << name << std::endl;
+                return false;
+            }
+        }
+
+        if (!this->openBuffers(document, binary, binarySize)) {
+            return false;
+        }
+        this->textures.resize(document["textures"].size(), 0);
+        this->uploadBufferViews(document);
+        this->buildPrimitives(document);
+        this->buildDraws(document);
+        this->sources.clear(); // Unmaps the .bin files; the .glb mapping closes on return
+        return true;
+    }
+
+    static uint32_t read32(const unsigned char *p) {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static bool decodeBase64(const std::string &text, size_t start, std::vector<unsigned char> &out) {
+        uint32_t bits = 0;
+        GLint count = 0;
+        for (size_t i = start; i < text.size() && text[i] != '='; i++) {
+            char c = text[i];
+            GLint value = c >= 'A' && c <= 'Z' ? c - 'A' : c >= 'a' && c <= 'z' ? c - 'a' + 26 : c >= '0' && c <= '9' ? c - '0' + 52
+                        : c == '+' ? 62 : c == '/' ? 63 : -1;
+            if (value < 0) {
+                return false;
+            }
+            bits = (bits << 6) | (GLuint) value;
+            count += 6;
+            if (count >= 8) {
+                count -= 8;
+                out.push_back((unsigned char) (bits >> count));
+            }
+        }
+        return true;
+    }
+
+    static bool isDataUri(const std::string &uri) {
+        return uri.compare(0, 5, "data:") == 0;
+    }
+
+    bool openBuffers(const JsonValue &document, const unsigned char *binary, size_t binarySize) {
+        const JsonValue &buffers = document["buffers"];
+        this->sources.resize(buffers.size());
+        for (size_t i = 0; i < buffers.size(); i++) {
+            BufferSource &source = this->sources[i];
+            const std::string &uri = buffers[i]["uri"].asString();
+            if (uri.empty()) {
+                source.data = binary;
+                source.size = binarySize;
+            } else if (isDataUri(uri)) {
+                size_t comma = uri.find(',');
+                if (comma == std::string::npos || !decodeBase64(uri, comma + 1, source.decoded)) {
+                    std::cout << "ERROR::GLTF::INVALID_DATA_URI buffer " << i << std::endl;
+                    return false;
+                }
+                source.data = source.decoded.data();
+                source.size = source.decoded.size();
+            } else {
+                source.file.reset(new MappedFile());
+                if (!source.file->open(this->directory + uri)) {
+                    std::cout << "ERROR::GLTF::COULD_NOT_OPEN " << this->directory + uri << std::endl;
+                    return false;
+                }
+                source.data = (const unsigned char *) source.file->getData();
+                source.size = source.file->getSize();
+            }
+            if (source.size < (size_t) buffers[i]["byteLength"].asInt()) {
+                std::cout << "ERROR::GLTF::BUFFER_TOO_SHORT buffer " << i << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Bytes of a bufferView, nullptr if it lies outside its buffer
+    const unsigned char *viewData(const JsonValue &document, size_t view, size_t &size) const {
+        const JsonValue &bufferView = document["bufferViews"][view];
+        size_t buffer = (size_t) bufferView["buffer"].asInt(-1);
+        size_t offset = (size_t) bufferView["byteOffset"].asInt();
+        size = (size_t) bufferView["byteLength"].asInt();
+        if (buffer >= this->sources.size() || offset + size > this->sources[buffer].size) {
+            return nullptr;
+        }
+        return this->sources[buffer].data + offset;
+    }
+
+    // Uploads each bufferView an attribute or index accessor of a primitive reads, as it is stored
+    void uploadBufferViews(const JsonValue &document) {
+        const JsonValue &accessors = document["accessors"];
+        std::vector<bool> used(document["bufferViews"].size(), false);
+        for (const JsonValue &mesh : document["meshes"].elements) {
+            for (const JsonValue &primitive : mesh["primitives"].elements) {
+                for (const auto &attribute : primitive["attributes"].members) {
+                    size_t view = (size_t) accessors[(size_t) attribute.second.asInt(-1)]["bufferView"].asInt(-1);
+                    if (view < used.size()) {
+                        used[view] = true;
+                    }
+                }
+                size_t view = (size_t) accessors[(size_t) primitive["indices"].asInt(-1)]["bufferView"].asInt(-1);
+                if (view < used.size()) {
+                    used[view] = true;
+                }
+            }
+        }
+
+        this->buffers.resize(used.size());
+        for (size_t i = 0; i < used.size(); i++) {
+            size_t size;
+            const unsigned char *data = this->viewData(document, i, size);
+            if (!used[i] || !data) {
+                continue;
+            }
+            this->buffers[i] = BufferHandle::create(GPU_MEMORY_GEOMETRY, "glTF bufferView");
+            glBindBuffer(GL_ARRAY_BUFFER, this->buffers[i]);
+            glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+            this->buffers[i].setSize(size);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    static GLint componentCount(const std::string &type) {
+        if (type == "SCALAR") {
+            return 1;
+        }
+        if (type == "VEC2") {
+            return 2;
+        }
+        if (type == "VEC3") {
+            return 3;
+        }
+        return type == "VEC4" ? 4 : 0;
+    }
+
+    // Points attribute location at accessor; false if the accessor cannot be read from a buffer
+    bool bindAttribute(const JsonValue &document, const JsonValue &accessor, GLuint location) {
+        size_t view = (size_t) accessor["bufferView"].asInt(-1);
+        GLint components = componentCount(accessor["type"].asString());
+        if (view >= this->buffers.size() || !this->buffers[view].get() || components == 0 || accessor.has("sparse")) {
+            return false;
+        }
+        // glTF component types are the GL enums; integer types without normalized are quantized
+        // values the shader reads as plain floats
+        GLenum componentType = (GLenum) accessor["componentType"].asInt(GL_FLOAT);
+        GLboolean normalized = accessor["normalized"].asBool() ? GL_TRUE : GL_FALSE;
+        GLsizei stride = (GLsizei) document["bufferViews"][view]["byteStride"].asInt();
+        size_t offset = (size_t) accessor["byteOffset"].asInt();
+
+        glBindBuffer(GL_ARRAY_BUFFER, this->buffers[view]);
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, components, componentType, normalized, stride, (GLvoid *) offset);
+        return true;
+    }
+
+    void buildPrimitives(const JsonValue &document) {
+        static const std::pair<const char *, GLuint> attributes[] = {
+            { "POSITION", 0 }, { "NORMAL", 1 }, { "TEXCOORD_0", 2 }
+        };
+        const JsonValue &accessors = document["accessors"];
+        const JsonValue &meshes = document["meshes"];
+
+        this->meshPrimitives.resize(meshes.size());
+        for (size_t m = 0; m < meshes.size(); m++) {
+            for (const JsonValue &source : meshes[m]["primitives"].elements) {
+                GltfPrimitive primitive;
+                primitive.vertexArray = VertexArrayHandle::create(GPU_MEMORY_GEOMETRY, "glTF primitive");
+                primitive.mode = (GLenum) source["mode"].asInt(GL_TRIANGLES);
+                primitive.indexType = 0;
+                primitive.indexOffset = 0;
+                primitive.count = (GLsizei) accessors[(size_t) source["attributes"]["POSITION"].asInt(-1)]["count"].asInt();
+
+                glBindVertexArray(primitive.vertexArray);
+                bool valid = true;
+                for (const auto &attribute : attributes) {
+                    const JsonValue &index = source["attributes"][attribute.first];
+                    if (!index.isNull() && !this->bindAttribute(document, accessors[(size_t) index.asInt(-1)], attribute.second)) {
+                        valid = false;
+                    }
+                }
+                if (source.has("indices")) {
+                    const JsonValue &accessor = accessors[(size_t) source["indices"].asInt(-1)];
+                    size_t view = (size_t) accessor["bufferView"].asInt(-1);
+                    if (view < this->buffers.size() && this->buffers[view].get()) {
+                        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers[view]); // Recorded in the VAO
+                        primitive.indexType = (GLenum) accessor["componentType"].asInt(GL_UNSIGNED_INT);
+                        primitive.indexOffset = (size_t) accessor["byteOffset"].asInt();
+                        primitive.count = (GLsizei) accessor["count"].asInt();
+                    } else {
+                        valid = false;
+                    }
+                }
+                glBindVertexArray(0);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+                if (!valid || !source["attributes"].has("POSITION")) {
+                    std::cout << "ERROR::GLTF::PRIMITIVE_SKIPPED mesh " << m << ", unreadable or sparse accessor" << std::endl;
+                    continue;
+                }
+                primitive.texture = this->baseColorTexture(document, source["material"]);
+                this->meshPrimitives[m].push_back((GLuint) this->primitives.size());
+                this->primitives.push_back(std::move(primitive));
+            }
+        }
+    }
+
+    // Starts decoding a material's base color texture the first time one uses it
+    GLint baseColorTexture(const JsonValue &document, const JsonValue &materialIndex) {
+        if (materialIndex.isNull()) {
+            return -1;
+        }
+        const JsonValue &material = document["materials"][(size_t) materialIndex.asInt(-1)];
+        const JsonValue &textureIndex = material["pbrMetallicRoughness"]["baseColorTexture"]["index"];
+        size_t index = (size_t) textureIndex.asInt(-1);
+        if (textureIndex.isNull() || index >= this->textures.size()) {
+            return -1;
+        }
+        if (this->textures[index]) {
+            return (GLint) index;
+        }
+
+        // A PNG or JPEG source when there is one, else the KTX2 one
+        const JsonValue &texture = document["textures"][index];
+        const JsonValue &sourceIndex = texture.has("source") ? texture["source"] : texture["extensions"]["KHR_texture_basisu"]["source"];
+        const JsonValue &image = document["images"][(size_t) sourceIndex.asInt(-1)];
+        const std::string &uri = image["uri"].asString();
+        std::string embeddedKey = this->canonical + "#image" + std::to_string(sourceIndex.asInt());
+        GLuint id = 0;
+        if (image.has("bufferView")) {
+            size_t size;
+            const unsigned char *data = this->viewData(document, (size_t) image["bufferView"].asInt(-1), size);
+            if (data) {
+                id = TextureCache::get().acquireFromMemory(embeddedKey, data, size);
+            }
+        } else if (isDataUri(uri)) {
+            std::vector<unsigned char> bytes;
+            if (decodeBase64(uri, uri.find(',') + 1, bytes)) {
+                id = TextureCache::get().acquireFromMemory(embeddedKey, bytes.data(), bytes.size());
+            }
+        } else if (!uri.empty()) {
+            id = TextureCache::get().acquire(this->directory + uri, TEXTURE_LOAD_ASYNC);
+        }
+        if (!id) {
+            std::cout << "ERROR::GLTF::IMAGE_UNREADABLE texture " << index << std::endl;
+            return -1;
+        }
+        this->textures[index] = id;
+
+        // Sampler values are GL enums; the placeholder keeps them through the upload. A texture
+        // shared through the cache takes the sampler of whichever model set it last.
+        const JsonValue &sampler = document["samplers"][(size_t) texture["sampler"].asInt(-1)];
+        glBindTexture(GL_TEXTURE_2D, id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (GLint) sampler["wrapS"].asInt(GL_REPEAT));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (GLint) sampler["wrapT"].asInt(GL_REPEAT));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (GLint) sampler["minFilter"].asInt(GL_LINEAR_MIPMAP_LINEAR));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (GLint) sampler["magFilter"].asInt(GL_LINEAR));
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return (GLint) index;
+    }
+
+    static glm::mat4 nodeTransform(const JsonValue &node) {
+        glm::mat4 transform(1);
+        if (node.has("matrix")) {
+            const JsonValue &matrix = node["matrix"];
+            for (GLuint i = 0; i < 16; i++) {
+                transform[i / 4][i % 4] = (GLfloat) matrix[(size_t) i].asNumber(i % 5 == 0 ? 1.0 : 0.0); // Column major, as glm
+            }
+            return transform;
+        }
+        const JsonValue &t = node["translation"], &r = node["rotation"], &s = node["scale"];
+        glm::quat rotation((GLfloat) r[3].asNumber(1.0), (GLfloat) r[0].asNumber(), (GLfloat) r[1].asNumber(), (GLfloat) r[2].asNumber());
+        transform = glm::translate(transform, glm::vec3((GLfloat) t[0].asNumber(), (GLfloat) t[1].asNumber(), (GLfloat) t[2].asNumber()));
+        transform = transform * glm::mat4_cast(rotation);
+        return glm::scale(transform, glm::vec3((GLfloat) s[0].asNumber(1.0), (GLfloat) s[1].asNumber(1.0), (GLfloat) s[2].asNumber(1.0)));
+    }
+
+    // Walks the default scene's node trees; a file without scenes draws each mesh once, untransformed
+    void buildDraws(const JsonValue &document) {
+        const JsonValue &nodes = document["nodes"];
+        const JsonValue &scene = document["scenes"][(size_t) document["scene"].asInt(0)];
+        if (scene.isNull()) {
+            for (const std::vector<GLuint> &mesh : this->meshPrimitives) {
+                for (GLuint primitive : mesh) {
+                    this->draws.push_back(GltfDraw{primitive, glm::mat4(1)});
+                }
+            }
+            return;
+        }
+
+        std::vector<std::pair<size_t, glm::mat4>> stack;
+        for (const JsonValue &root : scene["nodes"].elements) {
+            stack.push_back(std::make_pair((size_t) root.asInt(-1), glm::mat4(1)));
+        }
+        std::vector<bool> visited(nodes.size(), false); // Guards against cycles in a broken file
+        while (!stack.empty()) {
+            size_t index = stack.back().first;
+            glm::mat4 parent = stack.back().second;
+            stack.pop_back();
+            if (index >= nodes.size() || visited[index]) {
+                continue;
+            }
+            visited[index] = true;
+
+            const JsonValue &node = nodes[index];
+            glm::mat4 transform = parent * nodeTransform(node);
+            size_t mesh = (size_t) node["mesh"].asInt(-1);
+            if (mesh < this->meshPrimitives.size()) {
+                for (GLuint primitive : this->meshPrimitives[mesh]) {
+                    this->draws.push_back(GltfDraw{primitive, transform});
+                }
+            }
+            for (const JsonValue &child : node["children"].elements) {
+                stack.push_back(std::make_pair((size_t) child.asInt(-1), transform));
+            }
+        }
+    }
+};
@@ -0,0 +1,302 @@
+//
+//  GpuResources.h
+//  GameForFuns
+//
+//  Ownership of GL objects. GpuResourceRegistry records every tracked buffer,
+//  vertex array, texture, program and framebuffer with a memory category and size, so the
+//  VRAM in use per category can be read at any time and anything still alive
+//  at shutdown is reported as a leak. Released objects are not deleted at
+//  once: they wait behind a fence until the GPU has finished the frame that
+//  released them. GLHandle is the move-only owner that releases on destruction.
+//
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+enum GpuResourceType {
+    GPU_BUFFER,
+    GPU_VERTEX_ARRAY,
+    GPU_TEXTURE,
+    GPU_PROGRAM,
+    GPU_FRAMEBUFFER
+};
+
+enum GpuMemoryCategory {
+    GPU_MEMORY_GEOMETRY,
+    GPU_MEMORY_TEXTURES,
+    GPU_MEMORY_STREAMING,
+    GPU_MEMORY_RENDER_TARGETS,
+    GPU_MEMORY_OTHER,
+    GPU_MEMORY_CATEGORY_COUNT
+};
+
+inline const char *gpuMemoryCategoryName(GpuMemoryCategory category) {
+    static const char *names[GPU_MEMORY_CATEGORY_COUNT] = { "geometry", "textures", "streaming", "render targets", "other" };
+    return names[category];
+}
+
+inline const char *gpuResourceTypeName(GpuResourceType type) {
+    static const char *names[] = { "buffer", "vertex array", "texture", "program", "framebuffer" };
+    return names[type];
+}
+
+class GpuResourceRegistry {
+public:
+    static GpuResourceRegistry &get() {
+        static GpuResourceRegistry instance;
+        return instance;
+    }
+
+    void track(GpuResourceType type, GLuint handle, GpuMemoryCategory category, size_t bytes, const std::string &label) {
+        if (handle == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(this->mutex);
+        Entry &entry = this->entries[key(type, handle)];
+        this->bytes[entry.category] -= entry.bytes; // Re-tracking a handle replaces the old entry
+        entry.category = category;
+        entry.bytes = bytes;
+        entry.label = label;
+        this->bytes[category] += bytes;
+    }
+
+    // For storage that is (re)specified after creation
+    void setSize(GpuResourceType type, GLuint handle, size_t bytes) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto found = this->entries.find(key(type, handle));
+        if (found == this->entries.end()) {
+            return;
+        }
+        this->bytes[found->second.category] += bytes - found->second.bytes;
+        found->second.bytes = bytes;
+    }
+
+    // Stops tracking now and deletes once the GPU is done with the current frame
+    void release(GpuResourceType type, GLuint handle) {
+        if (handle == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto found = this->entries.find(key(type, handle));
+        if (found != this->entries.end()) {
+            this->bytes[found->second.category] -= found->second.bytes;
+            this->entries.erase(found);
+        }
+        this->released.push_back(std::make_pair(type, handle));
+    }
+
+    // Fences this frame's releases and deletes those whose frame the GPU has finished.
+    // Call on the context thread after swapping buffers.
+    void endFrame() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->released.empty()) {
+            RetiredFrame frame;
+            frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            frame.handles.swap(this->released);
+            this->retired.push_back(std::move(frame));
+        }
+
+        while (!this->retired.empty()) {
+            RetiredFrame &frame = this->retired.front();
+            GLenum status = glClientWaitSync(frame.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                break;
+            }
+            this->destroy(frame);
+            this->retired.pop_front();
+        }
+    }
+
+    // Waits for the GPU and deletes everything released, then reports what is still alive.
+    // Call before the context is destroyed.
+    void shutdown() {
+        glFinish();
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            for (RetiredFrame &frame : this->retired) {
+                this->destroy(frame);
+            }
+            this->retired.clear();
+            RetiredFrame last;
+            last.fence = 0;
+            last.handles.swap(this->released);
+            this->destroy(last);
+        }
+        this->reportLeaks();
+    }
+
+    // Returns the number of live resources
+    size_t reportLeaks() const {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (const auto &entry : this->entries) {
+            std::cout << "LEAK::GPU_RESOURCE " << gpuResourceTypeName((GpuResourceType) (entry.first >> 32)) << " "
+                      << (GLuint) entry.first << " " << entry.second.bytes << " bytes "
+                      << gpuMemoryCategoryName(entry.second.category) << " " << entry.second.label << std::endl;
+        }
+        return this->entries.size();
+    }
+
+    size_t getBytes(GpuMemoryCategory category) const {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->bytes[category];
+    }
+
+    size_t getTotalBytes() const {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        size_t total = 0;
+        for (GLuint i = 0; i < GPU_MEMORY_CATEGORY_COUNT; i++) {
+            total += this->bytes[i];
+        }
+        return total;
+    }
+
+    size_t getLiveCount() const {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->entries.size();
+    }
+
+private:
+    struct Entry {
+        GpuMemoryCategory category = GPU_MEMORY_OTHER;
+        size_t bytes = 0;
+        std::string label;
+    };
+
+    struct RetiredFrame {
+        GLsync fence;
+        std::vector<std::pair<GpuResourceType, GLuint>> handles;
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, Entry> entries;
+    size_t bytes[GPU_MEMORY_CATEGORY_COUNT] = {};
+    std::vector<std::pair<GpuResourceType, GLuint>> released;
+    std::deque<RetiredFrame> retired;
+
+    GpuResourceRegistry() {}
+
+    static uint64_t key(GpuResourceType type, GLuint handle) {
+        return ((uint64_t) type << 32) | handle;
+    }
+
+    static void destroy(RetiredFrame &frame) {
+        for (const auto &released : frame.handles) {
+            GLuint handle = released.second;
+            switch (released.first) {
+                case GPU_BUFFER:
+                    glDeleteBuffers(1, &handle);
+                    break;
+                case GPU_VERTEX_ARRAY:
+                    glDeleteVertexArrays(1, &handle);
+                    break;
+                case GPU_TEXTURE:
+                    glDeleteTextures(1, &handle);
+                    break;
+                case GPU_PROGRAM:
+                    glDeleteProgram(handle);
+                    break;
+                case GPU_FRAMEBUFFER:
+                    glDeleteFramebuffers(1, &handle);
+                    break;
+            }
+        }
+        frame.handles.clear();
+        if (frame.fence) {
+            glDeleteSync(frame.fence);
+        }
+    }
+};
+
+// Move-only owner of one GL object; converts to GLuint so it drops into GL calls
+template <GpuResourceType TYPE>
+class GLHandle {
+public:
+    GLHandle() {}
+
+    // Generates a new object and starts tracking it
+    static GLHandle create(GpuMemoryCategory category, const std::string &label) {
+        GLuint handle = 0;
+        switch (TYPE) {
+            case GPU_BUFFER:
+                glGenBuffers(1, &handle);
+                break;
+            case GPU_VERTEX_ARRAY:
+                glGenVertexArrays(1, &handle);
+                break;
+            case GPU_TEXTURE:
+                glGenTextures(1, &handle);
+                break;
+            case GPU_PROGRAM:
+                handle = glCreateProgram();
+                break;
+            case GPU_FRAMEBUFFER:
+                glGenFramebuffers(1, &handle);
+                break;
+        }
+        GpuResourceRegistry::get().track(TYPE, handle, category, 0, label);
+        return adopt(handle);
+    }
+
+    // Takes ownership of an object created and tracked elsewhere, e.g. by a loader
+    static GLHandle adopt(GLuint handle) {
+        GLHandle result;
+        result.handle = handle;
+        return result;
+    }
+
+    ~GLHandle() {
+        this->reset();
+    }
+
+    GLHandle(GLHandle &&other) noexcept: handle(other.handle) {
+        other.handle = 0;
+    }
+
+    GLHandle &operator=(GLHandle &&other) noexcept {
+        if (this != &other) {
+            this->reset();
+            this->handle = other.handle;
+            other.handle = 0;
+        }
+        return *this;
+    }
+
+    GLHandle(const GLHandle &) = delete;
+    GLHandle &operator=(const GLHandle &) = delete;
+
+    void reset() {
+        GpuResourceRegistry::get().release(TYPE, this->handle);
+        this->handle = 0;
+    }
+
+    void setSize(size_t bytes) {
+        GpuResourceRegistry::get().setSize(TYPE, this->handle, bytes);
+    }
+
+    GLuint get() const {
+        return this->handle;
+    }
+
+    operator GLuint() const {
+        return this->handle;
+    }
+
+private:
+    GLuint handle = 0;
+};
+
+typedef GLHandle<GPU_BUFFER> BufferHandle;
+typedef GLHandle<GPU_VERTEX_ARRAY> VertexArrayHandle;
+typedef GLHandle<GPU_TEXTURE> TextureHandle;
+typedef GLHandle<GPU_PROGRAM> ProgramHandle;
+typedef GLHandle<GPU_FRAMEBUFFER> FramebufferHandle;
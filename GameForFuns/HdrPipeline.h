@@ -0,0 +1,577 @@
+//
+//  HdrPipeline.h
+//  GameForFuns
+//
+//  High dynamic range rendering. The scene is drawn into an RGBA16F target, so
+//  lights can sum past 1 without clipping. Two passes then measure it: a
+//  histogram of log2 luminance, and an exposure pass that averages the middle
+//  of the histogram and eases the adapted luminance towards it over time. The
+//  filmic tonemap that exposes the scene by it is a pass of PostProcessChain.
+//  In the frame's RenderGraph the scene target is imported for the scene
+//  passes to draw into, and the measuring is the Exposure pass.
+//
+//  A pixel's bin comes straight from the bits of its luminance: the exponent
+//  and the top four mantissa bits, so 16 bins per stop over 16 stops, with
+//  everything darker than HDR_LUMINANCE_MIN in bin 0. That is integer work
+//  only, so the GPU and both CPU versions agree on every pixel they compute
+//  the same luminance for.
+//
+//  With GL 4.3 the histogram is a parallel reduction in a compute shader: each
+//  16x16 tile counts into shared memory, one invocation per bin, and adds its
+//  totals to a storage buffer with one atomic per bin. On GL 3.3 every
+//  HDR_HISTOGRAM_STRIDE-th pixel each way is drawn as a point onto its bin of a
+//  256x1 float target with additive blending, which does the same sums in the
+//  blending hardware.
+//
+//  luminanceHistogram is the CPU reference, four pixels at a time with SSE2 or
+//  NEON; luminanceHistogramScalar is the one-pixel version of the same steps.
+//  --hdr-check compares the two and both GPU paths against them.
+//
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HDR_HISTOGRAM_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HDR_HISTOGRAM_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include "GpuResources.h"
+#include "Profiler.h"
+#include "RenderGraph.h"
+#include "Shader.h"
+
+#if HDR_HISTOGRAM_SSE2
+const char *const HDR_HISTOGRAM_BACKEND = "sse2";
+#elif HDR_HISTOGRAM_NEON
+const char *const HDR_HISTOGRAM_BACKEND = "neon";
+#else
+const char *const HDR_HISTOGRAM_BACKEND = "scalar";
+#endif
+
+const GLuint HDR_HISTOGRAM_BINS = 256;
+const GLint HDR_LUMINANCE_MIN_LOG = -8;
+const GLuint HDR_BINS_PER_STOP = 16;               // The top four mantissa bits
+const GLuint HDR_MANTISSA_SHIFT = 23 - 4;
+const GLfloat HDR_LUMINANCE_MIN = 1.0f / 256.0f;   // 2^HDR_LUMINANCE_MIN_LOG, the bottom of bin 0
+const GLfloat HDR_LUMINANCE_MAX = 255.99f;         // Just under 2^8, the top of bin 255
+const uint32_t HDR_BIN_BASE = (127 + HDR_LUMINANCE_MIN_LOG) * HDR_BINS_PER_STOP; // HDR_LUMINANCE_MIN's bits, shifted
+const GLfloat HDR_LUMA_R = 0.2126f, HDR_LUMA_G = 0.7152f, HDR_LUMA_B = 0.0722f; // Rec. 709
+const GLuint HDR_HISTOGRAM_TILE = 16;              // Compute tile side: 256 invocations, one per bin
+const GLuint HDR_HISTOGRAM_STRIDE = 4;             // GL 3.3: one point per 4x4 pixels
+const GLuint HDR_CHECK_WIDTH = 640, HDR_CHECK_HEIGHT = 360;
+const GLfloat HDR_CHECK_AGREEMENT = 0.999f;        // Share of pixels the GPU must bin as the reference does; it rounds luminance its own way
+const GLfloat HDR_CHECK_EPSILON = 1e-3f;           // Stops
+const GLfloat HDR_CHECK_FRAME_TIME = 1.0f / 60.0f;
+
+struct HdrSettings {
+    GLfloat lowPercent = 0.5f;     // The darker half of the histogram is left out of the average,
+    GLfloat highPercent = 0.95f;   // and so is the brightest 5%, so a lamp in view does not darken the room
+    GLfloat key = 0.18f;           // The average is exposed to middle grey
+    GLfloat compensation = 0.0f;   // Stops on top of the automatic exposure
+    GLfloat adaptBrighter = 3.0f;  // Rates per second at which the exposure follows a brighter or darker scene
+    GLfloat adaptDarker = 1.0f;
+    GLfloat whitePoint = 11.2f;    // Exposed value the filmic curve maps to white
+    GLfloat gamma = 2.2f;
+};
+
+// The bin of one pixel. The luminance is summed in separate statements, so no compiler fuses
+// them into multiply-adds that the wide version does not have
+inline GLuint luminanceBin(GLfloat r, GLfloat g, GLfloat b) {
+    GLfloat red = r * HDR_LUMA_R;
+    GLfloat green = g * HDR_LUMA_G;
+    GLfloat blue = b * HDR_LUMA_B;
+    GLfloat luminance = red + green;
+    luminance = luminance + blue;
+    luminance = luminance > HDR_LUMINANCE_MIN ? luminance : HDR_LUMINANCE_MIN; // NaN lands in bin 0 too
+    luminance = luminance < HDR_LUMINANCE_MAX ? luminance : HDR_LUMINANCE_MAX;
+    uint32_t bits;
+    std::memcpy(&bits, &luminance, sizeof(bits));
+    return (bits >> HDR_MANTISSA_SHIFT) - HDR_BIN_BASE;
+}
+
+// Counts RGBA float pixels into HDR_HISTOGRAM_BINS bins, one pixel at a time
+inline void luminanceHistogramScalar(const GLfloat *rgba, size_t pixels, GLuint *bins) {
+    std::fill(bins, bins + HDR_HISTOGRAM_BINS, 0u);
+    for (size_t i = 0; i < pixels; i++) {
+        const GLfloat *pixel = rgba + i * 4;
+        bins[luminanceBin(pixel[0], pixel[1], pixel[2])]++;
+    }
+}
+
+// Counts RGBA float pixels into HDR_HISTOGRAM_BINS bins, four at a time. Each lane counts into
+// its own copy of the bins, so neighbouring pixels in one bin do not wait on each other's
+// increments, and the copies are summed at the end
+inline void luminanceHistogram(const GLfloat *rgba, size_t pixels, GLuint *bins) {
+#if HDR_HISTOGRAM_SSE2 || HDR_HISTOGRAM_NEON
+    GLuint lanes[4][HDR_HISTOGRAM_BINS] = {};
+    uint32_t index[4];
+    size_t i = 0;
+#if HDR_HISTOGRAM_SSE2
+    const __m128 lumaR = _mm_set1_ps(HDR_LUMA_R), lumaG = _mm_set1_ps(HDR_LUMA_G), lumaB = _mm_set1_ps(HDR_LUMA_B);
+    const __m128 low = _mm_set1_ps(HDR_LUMINANCE_MIN), high = _mm_set1_ps(HDR_LUMINANCE_MAX);
+    const __m128i base = _mm_set1_epi32((int) HDR_BIN_BASE);
+    for (; i + 4 <= pixels; i += 4) {
+        const GLfloat *pixel = rgba + i * 4;
+        __m128 r = _mm_loadu_ps(pixel), g = _mm_loadu_ps(pixel + 4), b = _mm_loadu_ps(pixel + 8), a = _mm_loadu_ps(pixel + 12);
+        _MM_TRANSPOSE4_PS(r, g, b, a);
+        __m128 luminance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, lumaR), _mm_mul_ps(g, lumaG)), _mm_mul_ps(b, lumaB));
+        luminance = _mm_max_ps(luminance, low);  // Returns the second operand for NaN, as the scalar comparison does
+        luminance = _mm_min_ps(luminance, high);
+        __m128i bin = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(luminance), HDR_MANTISSA_SHIFT), base);
+        _mm_storeu_si128((__m128i *) index, bin);
+        lanes[0][index[0]]++;
+        lanes[1][index[1]]++;
+        lanes[2][index[2]]++;
+        lanes[3][index[3]]++;
+    }
+#else
+    const float32x4_t lumaR = vdupq_n_f32(HDR_LUMA_R), lumaG = vdupq_n_f32(HDR_LUMA_G), lumaB = vdupq_n_f32(HDR_LUMA_B);
+    const float32x4_t low = vdupq_n_f32(HDR_LUMINANCE_MIN), high = vdupq_n_f32(HDR_LUMINANCE_MAX);
+    const uint32x4_t base = vdupq_n_u32(HDR_BIN_BASE);
+    for (; i + 4 <= pixels; i += 4) {
+        float32x4x4_t pixel = vld4q_f32(rgba + i * 4); // Deinterleaves into r, g, b and a
+        float32x4_t luminance = vaddq_f32(vaddq_f32(vmulq_f32(pixel.val[0], lumaR), vmulq_f32(pixel.val[1], lumaG)),
+                                          vmulq_f32(pixel.val[2], lumaB));
+        luminance = vbslq_f32(vcgtq_f32(luminance, low), luminance, low); // vmaxq would keep NaN
+        luminance = vbslq_f32(vcltq_f32(luminance, high), luminance, high);
+        vst1q_u32(index, vsubq_u32(vshrq_n_u32(vreinterpretq_u32_f32(luminance), HDR_MANTISSA_SHIFT), base));
+        lanes[0][index[0]]++;
+        lanes[1][index[1]]++;
+        lanes[2][index[2]]++;
+        lanes[3][index[3]]++;
+    }
+#endif
+    for (GLuint bin = 0; bin < HDR_HISTOGRAM_BINS; bin++) {
+        bins[bin] = lanes[0][bin] + lanes[1][bin] + lanes[2][bin] + lanes[3][bin];
+    }
+    for (; i < pixels; i++) {
+        const GLfloat *pixel = rgba + i * 4;
+        bins[luminanceBin(pixel[0], pixel[1], pixel[2])]++;
+    }
+#else
+    luminanceHistogramScalar(rgba, pixels, bins);
+#endif
+}
+
+// The exposure pass's average in C++: the mean log2 luminance of the pixels between the
+// lowPercent and highPercent points of the histogram, leaving out bin 0. Each bin stands for
+// the middle of its sixteenth of a stop. Returns fallback for an empty histogram
+inline GLfloat histogramLogLuminance(const GLuint *bins, GLfloat lowPercent, GLfloat highPercent, GLfloat fallback) {
+    GLfloat total = 0.0f;
+    for (GLuint bin = 1; bin < HDR_HISTOGRAM_BINS; bin++) {
+        total += (GLfloat) bins[bin];
+    }
+    GLfloat low = total * lowPercent, high = total * highPercent;
+    GLfloat below = 0.0f, weight = 0.0f, sum = 0.0f;
+    for (GLuint bin = 1; bin < HDR_HISTOGRAM_BINS; bin++) {
+        GLfloat count = (GLfloat) bins[bin];
+        GLfloat inside = std::max(std::min(below + count, high) - std::max(below, low), 0.0f);
+        sum += inside * (HDR_LUMINANCE_MIN_LOG + (bin + 0.5f) / HDR_BINS_PER_STOP);
+        weight += inside;
+        below += count;
+    }
+    return weight > 0.0f ? sum / weight : fallback;
+}
+
+// Eases the adapted log2 luminance towards the target; a negative dt jumps straight there
+inline GLfloat adaptLogLuminance(GLfloat previous, GLfloat target, GLfloat dt, const HdrSettings &settings) {
+    if (dt < 0.0f) {
+        return target;
+    }
+    GLfloat rate = target > previous ? settings.adaptBrighter : settings.adaptDarker;
+    return previous + (target - previous) * (1.0f - std::exp(-dt * rate));
+}
+
+class HdrPipeline {
+public:
+    // Uses the compute histogram when the context has GL 4.3 and allowCompute is set
+    HdrPipeline(GLint width, GLint height, bool allowCompute = true) {
+        this->compute = allowCompute && GLEW_VERSION_4_3;
+        this->fullscreenVAO = VertexArrayHandle::create(GPU_MEMORY_GEOMETRY, "HDR fullscreen");
+        this->sceneFramebuffer = FramebufferHandle::create(GPU_MEMORY_RENDER_TARGETS, "HDR scene");
+
+        GLfloat zeros[HDR_HISTOGRAM_BINS] = {};
+        this->histogram = TextureHandle::create(GPU_MEMORY_RENDER_TARGETS, "Luminance histogram");
+        this->createTexture(this->histogram, GL_R32F, HDR_HISTOGRAM_BINS, 1, GL_RED, GL_FLOAT, zeros, HDR_HISTOGRAM_BINS * 4);
+        for (GLuint i = 0; i < 2; i++) {
+            this->luminance[i] = TextureHandle::create(GPU_MEMORY_RENDER_TARGETS, "Adapted luminance");
+            this->createTexture(this->luminance[i], GL_R32F, 1, 1, GL_RED, GL_FLOAT, zeros, 4);
+            this->luminanceFramebuffers[i] = FramebufferHandle::create(GPU_MEMORY_RENDER_TARGETS, "Adapted luminance");
+            this->attach(this->luminanceFramebuffers[i], this->luminance[i], 0);
+        }
+
+        if (this->compute) {
+            this->histogramBuffer = BufferHandle::create(GPU_MEMORY_RENDER_TARGETS, "Luminance histogram");
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->histogramBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, HDR_HISTOGRAM_BINS * sizeof(GLuint), zeros, GL_DYNAMIC_COPY); // 0.0f is 0u
+            this->histogramBuffer.setSize(HDR_HISTOGRAM_BINS * sizeof(GLuint));
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            this->histogramProgram = linkProgram({ { GL_COMPUTE_SHADER, "res/shaders/histogram.comp" } });
+            this->resolveProgram = linkProgram({ { GL_COMPUTE_SHADER, "res/shaders/histogramResolve.comp" } });
+        } else {
+            this->histogramFramebuffer = FramebufferHandle::create(GPU_MEMORY_RENDER_TARGETS, "Luminance histogram");
+            this->attach(this->histogramFramebuffer, this->histogram, 0);
+            this->histogramProgram = linkProgram({ { GL_VERTEX_SHADER, "res/shaders/histogram.vs" },
+                                                   { GL_FRAGMENT_SHADER, "res/shaders/histogram.frag" } });
+        }
+        this->exposureProgram = linkProgram({ { GL_VERTEX_SHADER, "res/shaders/fullscreen.vs" },
+                                              { GL_FRAGMENT_SHADER, "res/shaders/exposure.frag" } });
+
+        this->histogramSceneLoc = glGetUniformLocation(this->histogramProgram, "scene");
+        this->strideLoc = glGetUniformLocation(this->histogramProgram, "stride");
+        this->histogramLoc = glGetUniformLocation(this->exposureProgram, "histogram");
+        this->previousLoc = glGetUniformLocation(this->exposureProgram, "previous");
+        this->percentLoc = glGetUniformLocation(this->exposureProgram, "percent");
+        this->adaptationLoc = glGetUniformLocation(this->exposureProgram, "adaptation");
+
+        this->resize(width, height);
+    }
+
+    HdrPipeline(const HdrPipeline &) = delete;
+    HdrPipeline &operator=(const HdrPipeline &) = delete;
+
+    // (Re)creates the scene target; keeps the adapted exposure
+    void resize(GLint width, GLint height) {
+        this->width = std::max(width, 1);
+        this->height = std::max(height, 1);
+        size_t pixels = (size_t) this->width * this->height;
+        this->sceneColor = TextureHandle::create(GPU_MEMORY_RENDER_TARGETS, "HDR scene color");
+        this->createTexture(this->sceneColor, GL_RGBA16F, this->width, this->height, GL_RGBA, GL_FLOAT, nullptr, pixels * 8);
+        this->sceneDepth = TextureHandle::create(GPU_MEMORY_RENDER_TARGETS, "HDR scene depth");
+        this->createTexture(this->sceneDepth, GL_DEPTH_COMPONENT24, this->width, this->height, GL_DEPTH_COMPONENT, GL_FLOAT,
+                            nullptr, pixels * 4);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, this->sceneFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->sceneColor, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->sceneDepth, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "ERROR::HDR::FRAMEBUFFER_INCOMPLETE " << this->width << "x" << this->height << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Redirects drawing into the scene target until end
+    void begin() {
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &this->target);
+        glGetIntegerv(GL_VIEWPORT, this->viewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->sceneFramebuffer);
+        glViewport(0, 0, this->width, this->height);
+    }
+
+    // Measures the scene, then rebinds the framebuffer and viewport that were bound at begin
+    void end(GLfloat dt) {
+        this->measure(dt);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->target);
+        glViewport(this->viewport[0], this->viewport[1], this->viewport[2], this->viewport[3]);
+    }
+
+    // Bins the scene, or another texture of its size, and adapts the exposure by dt seconds. Leaves its
+    // own framebuffer bound
+    void measure(GLfloat dt, GLuint scene = 0) {
+        PROFILE_SCOPE("HdrPipeline::measure");
+        GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+        GLboolean blend = glIsEnabled(GL_BLEND);
+        glDisable(GL_DEPTH_TEST);
+        glBindVertexArray(this->fullscreenVAO);
+
+        this->buildHistogram(scene ? scene : this->sceneColor);
+        this->adapt(this->adapted ? dt : -1.0f);
+
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (depthTest) {
+            glEnable(GL_DEPTH_TEST);
+        }
+        if (blend) {
+            glEnable(GL_BLEND);
+        } else {
+            glDisable(GL_BLEND);
+        }
+    }
+
+    // Imports the scene target into graph, for the scene passes to write. Import again after resize
+    void importScene(RenderGraph &graph, RenderResource &color, RenderResource &depth) {
+        color = graph.importTexture("HDR scene color", this->sceneColor, { this->width, this->height, GL_RGBA16F });
+        depth = graph.importTexture("HDR scene depth", this->sceneDepth, { this->width, this->height, GL_DEPTH_COMPONENT24 });
+    }
+
+    // Adds the pass measuring color, a texture of the scene target's size, adapting by whatever dt
+    // holds when it runs. Returns the adapted luminance for the tonemap to read
+    RenderResource addExposurePass(RenderGraph &graph, RenderResource color, const GLfloat &dt) {
+        RenderResource adapted = graph.importTexture("Adapted luminance", 0, { 1, 1, GL_R32F });
+        return graph.addPass("Exposure", [this, &dt, color](RenderGraph &g) {
+            this->measure(dt, g.getTexture(color));
+        }).read(color).write(adapted, ACCESS_FRAMEBUFFER);
+    }
+
+    bool usesCompute() const {
+        return this->compute;
+    }
+
+    // Every pixel is binned with compute, every HDR_HISTOGRAM_STRIDE-th each way without
+    GLuint getHistogramStride() const {
+        return this->compute ? 1 : HDR_HISTOGRAM_STRIDE;
+    }
+
+    GLuint getSceneTexture() const {
+        return this->sceneColor;
+    }
+
+    GLuint getSceneDepth() const {
+        return this->sceneDepth;
+    }
+
+    // A 1x1 R32F texture holding the adapted log2 luminance, for the tonemap to expose by
+    GLuint getAdaptedLuminance() const {
+        return this->luminance[this->current];
+    }
+
+    GLint getWidth() const {
+        return this->width;
+    }
+
+    GLint getHeight() const {
+        return this->height;
+    }
+
+    HdrSettings &getSettings() {
+        return this->settings;
+    }
+
+    // Copies the last histogram back; stalls until the GPU has finished, so only for checks
+    void readHistogram(std::vector<GLuint> &bins) {
+        std::vector<GLfloat> counts(HDR_HISTOGRAM_BINS);
+        glBindTexture(GL_TEXTURE_2D, this->histogram);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, counts.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        bins.resize(HDR_HISTOGRAM_BINS);
+        for (GLuint i = 0; i < HDR_HISTOGRAM_BINS; i++) {
+            bins[i] = (GLuint) counts[i];
+        }
+    }
+
+    // The adapted log2 luminance; stalls like readHistogram
+    GLfloat readLogLuminance() {
+        GLfloat value = 0.0f;
+        glBindTexture(GL_TEXTURE_2D, this->luminance[this->current]);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, &value);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return value;
+    }
+
+private:
+    HdrSettings settings;
+    GLint width = 0, height = 0;
+    bool compute = false;
+    bool adapted = false;   // Set after the first frame, which takes its exposure as it is
+    GLuint current = 0;     // The luminance texture holding the latest adapted value
+    GLint target = 0;
+    GLint viewport[4] = {};
+
+    VertexArrayHandle fullscreenVAO; // Attributeless, the passes make their own triangle
+    FramebufferHandle sceneFramebuffer, histogramFramebuffer, luminanceFramebuffers[2];
+    TextureHandle sceneColor, sceneDepth, histogram, luminance[2];
+    BufferHandle histogramBuffer;
+    ProgramHandle histogramProgram, resolveProgram, exposureProgram;
+
+    GLint histogramSceneLoc, strideLoc, histogramLoc, previousLoc, percentLoc, adaptationLoc;
+
+    void buildHistogram(GLuint scene) {
+        glUseProgram(this->histogramProgram);
+        this->bindTexture(0, scene, this->histogramSceneLoc);
+        if (this->compute) {
+            // Tiles add into the buffer, then the resolve copies it into the texture and clears it
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->histogramBuffer);
+            glDispatchCompute((this->width + HDR_HISTOGRAM_TILE - 1) / HDR_HISTOGRAM_TILE,
+                              (this->height + HDR_HISTOGRAM_TILE - 1) / HDR_HISTOGRAM_TILE, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            glUseProgram(this->resolveProgram);
+            glBindImageTexture(0, this->histogram, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glDispatchCompute(1, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+        } else {
+            GLuint columns = (this->width + HDR_HISTOGRAM_STRIDE - 1) / HDR_HISTOGRAM_STRIDE;
+            GLuint rows = (this->height + HDR_HISTOGRAM_STRIDE - 1) / HDR_HISTOGRAM_STRIDE;
+            glBindFramebuffer(GL_FRAMEBUFFER, this->histogramFramebuffer);
+            glViewport(0, 0, HDR_HISTOGRAM_BINS, 1);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glUniform1i(this->strideLoc, (GLint) HDR_HISTOGRAM_STRIDE);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+            glDrawArrays(GL_POINTS, 0, columns * rows);
+            PROFILE_DRAW(0);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
+        PROFILE_STATE_CHANGE();
+    }
+
+    // Renders the next adapted luminance from the histogram and the last one, into the other texture
+    void adapt(GLfloat dt) {
+        GLuint next = 1 - this->current;
+        glBindFramebuffer(GL_FRAMEBUFFER, this->luminanceFramebuffers[next]);
+        glViewport(0, 0, 1, 1);
+        glDisable(GL_BLEND);
+        glUseProgram(this->exposureProgram);
+        this->bindTexture(0, this->histogram, this->histogramLoc);
+        this->bindTexture(1, this->luminance[this->current], this->previousLoc);
+        glUniform2f(this->percentLoc, this->settings.lowPercent, this->settings.highPercent);
+        glUniform3f(this->adaptationLoc, dt, this->settings.adaptBrighter, this->settings.adaptDarker);
+        PROFILE_STATE_CHANGE();
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        PROFILE_DRAW(1);
+        this->current = next;
+        this->adapted = true;
+    }
+
+    static void bindTexture(GLuint unit, GLuint texture, GLint location) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glUniform1i(location, (GLint) unit);
+    }
+
+    static void createTexture(TextureHandle &texture, GLint internalFormat, GLint width, GLint height, GLenum format,
+                              GLenum type, const void *data, size_t bytes) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, data);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        texture.setSize(bytes);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    static void attach(GLuint framebuffer, GLuint texture, GLuint level) {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, level);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "ERROR::HDR::FRAMEBUFFER_INCOMPLETE " << texture << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+
+// Bins a synthetic frame spanning 22 stops, with black, negative and NaN pixels, with the wide
+// and one-pixel histograms, which must agree exactly. Then uploads it into the scene target of
+// each GPU path and checks the histogram against the reference, the exposure pass's average
+// against histogramLogLuminance, and one step of adaptation after the frame brightens by two
+// stops against adaptLogLuminance. Run with GameForFuns --hdr-check.
+inline bool checkHdr() {
+    const GLuint width = HDR_CHECK_WIDTH, height = HDR_CHECK_HEIGHT;
+    std::vector<GLfloat> frame((size_t) width * height * 4);
+    for (GLuint y = 0; y < height; y++) {
+        for (GLuint x = 0; x < width; x++) {
+            GLfloat *pixel = &frame[((size_t) y * width + x) * 4];
+            GLfloat value = std::exp2(-12.0f + 22.0f * x / (width - 1));
+            pixel[0] = value * (0.5f + 0.5f * (y % 7) / 6.0f);
+            pixel[1] = value;
+            pixel[2] = value * (1.0f - 0.5f * (y % 5) / 4.0f);
+            pixel[3] = 1.0f;
+            if (y % 37 == 0) {
+                pixel[0] = pixel[1] = pixel[2] = 0.0f;
+            } else if (y % 41 == 0) {
+                pixel[1] = -value;
+            } else if (x == y) {
+                pixel[2] = NAN;
+            }
+        }
+    }
+
+    GLuint wide[HDR_HISTOGRAM_BINS], scalar[HDR_HISTOGRAM_BINS];
+    double start = Profiler::get().nowUs();
+    luminanceHistogram(frame.data(), (size_t) width * height, wide);
+    double middle = Profiler::get().nowUs();
+    luminanceHistogramScalar(frame.data(), (size_t) width * height, scalar);
+    double end = Profiler::get().nowUs();
+    bool passed = std::equal(wide, wide + HDR_HISTOGRAM_BINS, scalar);
+    std::cout << (passed ? "OK       " : "FAILED   ") << HDR_HISTOGRAM_BACKEND << " histogram: " << (middle - start) / 1000.0
+              << " ms, scalar " << (end - middle) / 1000.0 << " ms, " << (passed ? "identical" : "different") << std::endl;
+
+    for (GLuint path = 0; path < 2; path++) {
+        if (path == 1 && !GLEW_VERSION_4_3) {
+            std::cout << "SKIPPED  compute: the context has no GL 4.3" << std::endl;
+            break;
+        }
+        const char *name = path == 1 ? "compute" : "blended points";
+        HdrPipeline hdr(width, height, path == 1);
+        HdrSettings &settings = hdr.getSettings();
+
+        // The reference bins the values as stored in half floats, and only the pixels the path samples
+        glBindTexture(GL_TEXTURE_2D, hdr.getSceneTexture());
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, frame.data());
+        std::vector<GLfloat> stored(frame.size());
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, stored.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        std::vector<GLfloat> sampled;
+        GLuint stride = hdr.getHistogramStride();
+        for (GLuint y = 0; y < height; y += stride) {
+            for (GLuint x = 0; x < width; x += stride) {
+                const GLfloat *pixel = &stored[((size_t) y * width + x) * 4];
+                sampled.insert(sampled.end(), pixel, pixel + 4);
+            }
+        }
+        GLuint reference[HDR_HISTOGRAM_BINS];
+        luminanceHistogram(sampled.data(), sampled.size() / 4, reference);
+
+        hdr.begin();
+        hdr.end(HDR_CHECK_FRAME_TIME);
+        std::vector<GLuint> bins;
+        hdr.readHistogram(bins);
+        GLuint total = 0, moved = 0;
+        for (GLuint i = 0; i < HDR_HISTOGRAM_BINS; i++) {
+            total += bins[i];
+            moved += (GLuint) std::abs((GLint) bins[i] - (GLint) reference[i]);
+        }
+        moved /= 2; // A pixel in the wrong bin counts once too many there and once too few in its own
+        GLuint count = (GLuint) (sampled.size() / 4);
+        bool ok = total == count && moved <= (1.0f - HDR_CHECK_AGREEMENT) * count;
+        std::cout << (ok ? "OK       " : "FAILED   ") << name << " histogram: " << total << " of " << count << " pixels, "
+                  << moved << " in another bin than the reference" << std::endl;
+        passed = passed && ok;
+
+        GLfloat expected = histogramLogLuminance(bins.data(), settings.lowPercent, settings.highPercent, 0.0f);
+        GLfloat first = hdr.readLogLuminance();
+        ok = std::fabs(first - expected) <= HDR_CHECK_EPSILON;
+        std::cout << (ok ? "OK       " : "FAILED   ") << name << " exposure: log2 luminance " << first << ", reference " << expected
+                  << std::endl;
+        passed = passed && ok;
+
+        for (GLfloat &value : frame) {
+            value *= 4.0f;
+        }
+        glBindTexture(GL_TEXTURE_2D, hdr.getSceneTexture());
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, frame.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        for (GLfloat &value : frame) {
+            value /= 4.0f;
+        }
+        hdr.begin();
+        hdr.end(HDR_CHECK_FRAME_TIME);
+        hdr.readHistogram(bins);
+        GLfloat brighter = histogramLogLuminance(bins.data(), settings.lowPercent, settings.highPercent, first);
+        expected = adaptLogLuminance(first, brighter, HDR_CHECK_FRAME_TIME, settings);
+        GLfloat second = hdr.readLogLuminance();
+        ok = brighter > first && std::fabs(second - expected) <= HDR_CHECK_EPSILON;
+        std::cout << (ok ? "OK       " : "FAILED   ") << name << " adaptation: " << first << " towards " << brighter << " reached "
+                  << second << ", reference " << expected << std::endl;
+        passed = passed && ok;
+    }
+    return passed;
+}
@@ -0,0 +1,282 @@
+//
+//  ImportBenchmark.h
+//  GameForFuns
+//
+//  Model import benchmarks, both headless. --benchmark-import times converting an
+//  imported model's meshes on the job system with 1 to N threads. --benchmark-obj
+//  loads OBJ files through Assimp and through ObjLoader and checks that both give
+//  the same triangles; without a model it runs the nanosuit and a synthetic OBJ
+//  (10M triangles by default, about 1 GB on disk and several GB of memory while
+//  Assimp holds it).
+//
+//  Usage: GameForFuns --benchmark-import [model.obj] [--out import.json]
+//         GameForFuns --benchmark-obj [model.obj] [--triangles 10000000] [--out obj.json]
+//
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "Benchmark.h"
+#include "JobSystemBenchmark.h"
+#include "Model.h"
+#include "ObjLoader.h"
+#include "Profiler.h"
+
+const GLuint BENCHMARK_IMPORT_PARTS = 32;  // Objects, so meshes, in the synthetic OBJ
+const GLuint BENCHMARK_IMPORT_GRID = 125;  // Quads along a part: 32 * 125 * 125 * 2 = 1M triangles
+const char *const BENCHMARK_IMPORT_OBJ = "import_benchmark.obj";
+const GLuint BENCHMARK_OBJ_REPEATS = 3;
+const GLfloat BENCHMARK_OBJ_EPSILON = 1e-5f; // Relative; the two parsers may round the last bit differently
+const char *const BENCHMARK_OBJ_FILE = "obj_benchmark.obj";
+
+struct ImportScalingResult {
+    GLuint threads;
+    GLfloat convertMs; // Median over BENCHMARK_JOB_REPEATS runs
+};
+
+struct ObjComparisonResult {
+    std::string model;
+    size_t triangles;
+    GLfloat assimpMs;  // Median over BENCHMARK_OBJ_REPEATS loads
+    GLfloat nativeMs;
+    bool identical;
+};
+
+// Rippled grids as separate objects, 2 * BENCHMARK_IMPORT_GRID^2 triangles each, with texture coords and normals
+inline bool writeSyntheticObj(const std::string &path, GLuint parts) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cout << "ERROR::BENCHMARK::COULD_NOT_WRITE " << path << std::endl;
+        return false;
+    }
+    const GLuint side = BENCHMARK_IMPORT_GRID + 1;
+    out << "vn 0 1 0\n";
+    for (GLuint part = 0; part < parts; part++) {
+        out << "o part" << part << "\n";
+        for (GLuint z = 0; z < side; z++) {
+            for (GLuint x = 0; x < side; x++) {
+                out << "v " << part * BENCHMARK_IMPORT_GRID + x << " " << std::sin(x * 0.3f) * std::cos(z * 0.2f) << " " << z << "\n";
+                out << "vt " << (GLfloat) x / BENCHMARK_IMPORT_GRID << " " << (GLfloat) z / BENCHMARK_IMPORT_GRID << "\n";
+            }
+        }
+        GLuint base = part * side * side + 1; // OBJ indices are global and start at 1
+        for (GLuint z = 0; z < BENCHMARK_IMPORT_GRID; z++) {
+            for (GLuint x = 0; x < BENCHMARK_IMPORT_GRID; x++) {
+                GLuint a = base + z * side + x, b = a + 1, c = a + side, d = c + 1;
+                out << "f " << a << "/" << a << "/1 " << c << "/" << c << "/1 " << b << "/" << b << "/1\n";
+                out << "f " << b << "/" << b << "/1 " << c << "/" << c << "/1 " << d << "/" << d << "/1\n";
+            }
+        }
+    }
+    return (bool) out;
+}
+
+// Walks the triangles of a and b in order and compares their corners, which holds however
+// either loader shared vertices; triangles is set to the count in a
+inline bool sameTriangles(const std::vector<const MeshData *> &a, const std::vector<const MeshData *> &b, size_t &triangles) {
+    auto close = [](GLfloat x, GLfloat y) {
+        return std::fabs(x - y) <= BENCHMARK_OBJ_EPSILON * std::max(1.0f, std::max(std::fabs(x), std::fabs(y)));
+    };
+    std::vector<const Vertex *> cornersA, cornersB;
+    for (const MeshData *mesh : a) {
+        for (GLuint index : mesh->indices) {
+            cornersA.push_back(&mesh->vertices[index]);
+        }
+    }
+    for (const MeshData *mesh : b) {
+        for (GLuint index : mesh->indices) {
+            cornersB.push_back(&mesh->vertices[index]);
+        }
+    }
+    triangles = cornersA.size() / 3;
+    if (cornersA.size() != cornersB.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < cornersA.size(); i++) {
+        const Vertex &va = *cornersA[i], &vb = *cornersB[i];
+        for (GLuint c = 0; c < 3; c++) {
+            if (!close(va.position[c], vb.position[c]) || !close(va.normal[c], vb.normal[c])
+                || (c < 2 && !close(va.texCoords[c], vb.texCoords[c]))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// FNV-1a over every converted vertex and index
+inline uint64_t hashMeshData(const std::vector<MeshData> &data) {
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const void *bytes, size_t size) {
+        const unsigned char *p = (const unsigned char *) bytes;
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ p[i]) * 1099511628211ull;
+        }
+    };
+    for (const MeshData &mesh : data) {
+        add(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+        add(mesh.indices.data(), mesh.indices.size() * sizeof(GLuint));
+    }
+    return hash;
+}
+
+// Assimp parses the model once, then its meshes are converted with 1 to N threads. Without a
+// model a 1M triangle OBJ is written first. Fails if any thread count converts differently.
+inline int benchmarkImportScaling(const BenchmarkOptions &options) {
+    std::string path = options.importModel.empty() ? BENCHMARK_IMPORT_OBJ : options.importModel;
+    if (options.importModel.empty() && !std::ifstream(path) && !writeSyntheticObj(path, BENCHMARK_IMPORT_PARTS)) {
+        return EXIT_FAILURE;
+    }
+
+    Assimp::Importer importer;
+    double start = Profiler::get().nowUs();
+    const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+    GLfloat parseMs = (GLfloat) ((Profiler::get().nowUs() - start) / 1000.0);
+    if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<const aiMesh *> meshes;
+    flattenMeshes(scene, meshes);
+    size_t triangles = 0;
+    for (const aiMesh *mesh : meshes) {
+        triangles += mesh->mNumFaces;
+    }
+    std::cout << path << ": " << meshes.size() << " meshes, " << triangles << " triangles, parsed in " << parseMs << " ms" << std::endl;
+
+    std::vector<ImportScalingResult> results;
+    uint64_t reference = 0;
+    bool identical = true;
+    for (GLuint threads : Benchmark::threadCounts()) {
+        JobSystem jobs(threads - 1);
+        std::vector<GLfloat> times;
+        for (GLuint repeat = 0; repeat < BENCHMARK_JOB_REPEATS; repeat++) {
+            std::vector<MeshData> data;
+            double begin = Profiler::get().nowUs();
+            convertMeshes(jobs, meshes, data);
+            times.push_back((GLfloat) ((Profiler::get().nowUs() - begin) / 1000.0));
+            if (repeat == 0) {
+                uint64_t hash = hashMeshData(data);
+                reference = results.empty() ? hash : reference;
+                identical = identical && hash == reference;
+            }
+        }
+
+        ImportScalingResult result = { threads, Benchmark::percentile(times, 50.0f) };
+        std::cout << threads << " threads: convert " << result.convertMs << " ms" << std::endl;
+        results.push_back(result);
+    }
+    if (!identical) {
+        std::cout << "ERROR::BENCHMARK::IMPORT_MISMATCH converted meshes differ between thread counts" << std::endl;
+    }
+
+    std::ofstream out(options.output);
+    if (!out) {
+        std::cout << "ERROR::BENCHMARK::COULD_NOT_WRITE " << options.output << std::endl;
+        return EXIT_FAILURE;
+    }
+    out << "{\n  \"model\": \"" << path << "\",\n  \"meshes\": " << meshes.size() << ",\n  \"triangles\": " << triangles
+        << ",\n  \"parse_ms\": " << parseMs << ",\n  \"convert\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const ImportScalingResult &r = results[i];
+        out << "    {\"threads\": " << r.threads << ", \"convert_ms\": " << r.convertMs
+            << ", \"speedup\": " << results[0].convertMs / r.convertMs
+            << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Each OBJ is loaded by Assimp, meshes converted on the job system as Model does, and by
+// ObjLoader. Fails if the two disagree on any triangle.
+inline int benchmarkObjComparison(const BenchmarkOptions &options) {
+    std::vector<std::string> paths;
+    if (options.objModel.empty()) {
+        GLuint parts = std::max(1u, options.objTriangles / (BENCHMARK_IMPORT_GRID * BENCHMARK_IMPORT_GRID * 2));
+        if (!writeSyntheticObj(BENCHMARK_OBJ_FILE, parts)) {
+            return EXIT_FAILURE;
+        }
+        paths.push_back("res/models/nanosuit.obj");
+        paths.push_back(BENCHMARK_OBJ_FILE);
+    } else {
+        paths.push_back(options.objModel);
+    }
+
+    std::vector<ObjComparisonResult> results;
+    for (const std::string &path : paths) {
+        ObjComparisonResult result = { path, 0, 0.0f, 0.0f, false };
+        std::vector<GLfloat> assimpTimes, nativeTimes;
+        std::vector<MeshData> assimpData;
+        ObjModel native;
+        for (GLuint repeat = 0; repeat < BENCHMARK_OBJ_REPEATS; repeat++) {
+            assimpData.clear();
+            double start = Profiler::get().nowUs();
+            {
+                Assimp::Importer importer;
+                const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+                if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+                    std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
+                    return EXIT_FAILURE;
+                }
+                std::vector<const aiMesh *> meshes;
+                flattenMeshes(scene, meshes);
+                convertMeshes(JobSystem::get(), meshes, assimpData);
+            }
+            assimpTimes.push_back((GLfloat) ((Profiler::get().nowUs() - start) / 1000.0));
+
+            native = ObjModel();
+            start = Profiler::get().nowUs();
+            if (!ObjLoader::load(path, JobSystem::get(), native)) {
+                return EXIT_FAILURE;
+            }
+            nativeTimes.push_back((GLfloat) ((Profiler::get().nowUs() - start) / 1000.0));
+        }
+        result.assimpMs = Benchmark::percentile(assimpTimes, 50.0f);
+        result.nativeMs = Benchmark::percentile(nativeTimes, 50.0f);
+
+        std::vector<const MeshData *> nativeData;
+        for (const ObjMesh &mesh : native.meshes) {
+            nativeData.push_back(&mesh.data);
+        }
+        std::vector<const MeshData *> assimpMeshes;
+        for (const MeshData &mesh : assimpData) {
+            assimpMeshes.push_back(&mesh);
+        }
+        result.identical = sameTriangles(assimpMeshes, nativeData, result.triangles);
+
+        std::cout << path << ": " << result.triangles << " triangles, Assimp " << result.assimpMs << " ms, ObjLoader "
+                  << result.nativeMs << " ms (" << result.assimpMs / result.nativeMs << "x)"
+                  << (result.identical ? "" : ", GEOMETRY DIFFERS") << std::endl;
+        results.push_back(result);
+    }
+
+    std::ofstream out(options.output);
+    if (!out) {
+        std::cout << "ERROR::BENCHMARK::COULD_NOT_WRITE " << options.output << std::endl;
+        return EXIT_FAILURE;
+    }
+    bool identical = true;
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const ObjComparisonResult &r = results[i];
+        out << "  {\"model\": \"" << r.model << "\", \"triangles\": " << r.triangles << ", \"assimp_ms\": " << r.assimpMs
+            << ", \"obj_loader_ms\": " << r.nativeMs << ", \"speedup\": " << r.assimpMs / r.nativeMs
+            << ", \"identical\": " << (r.identical ? "true" : "false") << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        identical = identical && r.identical;
+    }
+    out << "]\n";
+    if (!identical) {
+        std::cout << "ERROR::BENCHMARK::OBJ_MISMATCH ObjLoader and Assimp load different geometry" << std::endl;
+    }
+    return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,243 @@
+//
+//  JobSystem.h
+//  GameForFuns
+//
+//  Work-stealing job scheduler. Every worker owns a deque: it pushes and pops
+//  its own work at the back while idle workers steal from the front. Jobs are
+//  grouped by a JobCounter that is incremented on submit and decremented on
+//  completion; waiting on a counter runs other jobs instead of blocking, which
+//  is how one job depends on another.
+//
+//  Jobs are small trivially copyable lambdas stored inline, so submitting never allocates.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Profiler.h"
+
+const GLuint JOB_QUEUE_CAPACITY = 4096; // Per worker, a full queue runs the job inline
+const GLuint JOB_STORAGE_SIZE = 64;     // Bytes of lambda capture stored in a job
+
+typedef std::atomic<GLint> JobCounter;
+
+struct Job {
+    void (*invoke)(const void *storage);
+    JobCounter *counter;
+    alignas(16) unsigned char storage[JOB_STORAGE_SIZE];
+};
+
+class JobQueue {
+public:
+    bool push(const Job &job) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->size == JOB_QUEUE_CAPACITY) {
+            return false;
+        }
+        this->jobs[(this->head + this->size) % JOB_QUEUE_CAPACITY] = job;
+        this->size++;
+        return true;
+    }
+
+    // Owner end, newest first for cache locality
+    bool pop(Job &job) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->size == 0) {
+            return false;
+        }
+        this->size--;
+        job = this->jobs[(this->head + this->size) % JOB_QUEUE_CAPACITY];
+        return true;
+    }
+
+    // Thief end, oldest first since those tend to be the largest pieces of work
+    bool steal(Job &job) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->size == 0) {
+            return false;
+        }
+        job = this->jobs[this->head];
+        this->head = (this->head + 1) % JOB_QUEUE_CAPACITY;
+        this->size--;
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    Job jobs[JOB_QUEUE_CAPACITY];
+    GLuint head = 0;
+    GLuint size = 0;
+};
+
+class JobSystem {
+public:
+    // Shared scheduler with one worker per hardware thread besides the main thread
+    static JobSystem &get() {
+        static JobSystem instance(std::max(1u, std::thread::hardware_concurrency()) - 1);
+        return instance;
+    }
+
+    // workerCount background threads; the thread that waits on counters also runs jobs
+    explicit JobSystem(GLuint workerCount) {
+        this->queues.resize(workerCount + 1);
+        for (GLuint i = 0; i < this->queues.size(); i++) {
+            this->queues[i] = new JobQueue();
+        }
+        for (GLuint i = 1; i <= workerCount; i++) {
+            this->threads.emplace_back(&JobSystem::workerLoop, this, i);
+        }
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(this->sleepMutex);
+            this->running = false;
+        }
+        this->wake.notify_all();
+        for (std::thread &thread : this->threads) {
+            thread.join();
+        }
+        for (JobQueue *queue : this->queues) {
+            delete queue;
+        }
+    }
+
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    GLuint getThreadCount() const {
+        return (GLuint) this->queues.size();
+    }
+
+    template <typename Fn>
+    void run(JobCounter &counter, const Fn &fn) {
+        static_assert(sizeof(Fn) <= JOB_STORAGE_SIZE, "Job capture too large, capture by reference");
+        static_assert(std::is_trivially_copyable<Fn>::value, "Job captures must be trivially copyable");
+
+        Job job;
+        job.invoke = [](const void *storage) { (*reinterpret_cast<const Fn *>(storage))(); };
+        job.counter = &counter;
+        new (job.storage) Fn(fn);
+
+        counter.fetch_add(1, std::memory_order_relaxed);
+        this->pending.fetch_add(1, std::memory_order_release);
+        if (!this->queues[this->queueIndex()]->push(job)) {
+            this->pending.fetch_sub(1, std::memory_order_relaxed);
+            execute(job);
+            return;
+        }
+        this->wake.notify_one();
+    }
+
+    // Splits [0, count) into ranges of at most grainSize and calls fn(begin, end) for each
+    template <typename Fn>
+    void parallelFor(JobCounter &counter, GLuint count, GLuint grainSize, const Fn &fn) {
+        grainSize = std::max(grainSize, 1u);
+        const Fn *body = &fn;
+        for (GLuint begin = 0; begin < count; begin += grainSize) {
+            GLuint end = std::min(begin + grainSize, count);
+            this->run(counter, [body, begin, end]() { (*body)(begin, end); });
+        }
+    }
+
+    // parallelFor that returns once every range has run; fn may live on the caller's stack
+    template <typename Fn>
+    void parallelForWait(GLuint count, GLuint grainSize, const Fn &fn) {
+        JobCounter counter(0);
+        this->parallelFor(counter, count, grainSize, fn);
+        this->wait(counter);
+    }
+
+    // Runs queued jobs until counter drops to zero
+    void wait(JobCounter &counter) {
+        GLuint index = this->queueIndex();
+        while (counter.load(std::memory_order_acquire) > 0) {
+            Job job;
+            if (this->findJob(index, job)) {
+                execute(job);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Runs one queued job if there is one. Lets a thread that polls for asynchronous work,
+    // rather than waiting on it, keep that work moving when there are no workers.
+    bool runPending() {
+        Job job;
+        if (!this->findJob(this->queueIndex(), job)) {
+            return false;
+        }
+        execute(job);
+        return true;
+    }
+
+private:
+    std::vector<JobQueue *> queues;
+    std::vector<std::thread> threads;
+    std::atomic<GLint> pending{0};
+    bool running = true;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    static GLuint &threadQueue() {
+        thread_local GLuint index = 0; // Threads the system did not create share queue 0
+        return index;
+    }
+
+    GLuint queueIndex() const {
+        return std::min<GLuint>(threadQueue(), (GLuint) this->queues.size() - 1);
+    }
+
+    static void execute(const Job &job) {
+        job.invoke(job.storage);
+        job.counter->fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    bool findJob(GLuint index, Job &job) {
+        if (this->queues[index]->pop(job)) {
+            this->pending.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        for (GLuint i = 1; i < this->queues.size(); i++) {
+            if (this->queues[(index + i) % this->queues.size()]->steal(job)) {
+                this->pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(GLuint index) {
+        threadQueue() = index;
+        while (true) {
+            Job job;
+            if (this->findJob(index, job)) {
+                PROFILE_SCOPE("Job");
+                execute(job);
+                continue;
+            }
+
+            // The timeout covers a notify that lands between the check and the wait
+            std::unique_lock<std::mutex> lock(this->sleepMutex);
+            this->wake.wait_for(lock, std::chrono::milliseconds(1), [this]() {
+                return !this->running || this->pending.load(std::memory_order_acquire) > 0;
+            });
+            if (!this->running) {
+                return;
+            }
+        }
+    }
+};
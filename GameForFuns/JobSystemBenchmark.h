@@ -0,0 +1,97 @@
+//
+//  JobSystemBenchmark.h
+//  GameForFuns
+//
+//  Job system scaling benchmark. Times building the transforms of 1M objects and
+//  frustum culling them with 1 to N threads, and writes the times and the speedup
+//  over one thread as JSON. Needs no GL context.
+//
+//  Usage: GameForFuns --benchmark-jobs [--out jobs.json]
+//
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Benchmark.h"
+#include "Camera.h"
+#include "Frustum.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+
+const GLuint BENCHMARK_JOB_OBJECTS = 1000000;
+const GLuint BENCHMARK_JOB_REPEATS = 10;
+
+struct JobScalingResult {
+    GLuint threads;
+    GLfloat transformMs; // Median over BENCHMARK_JOB_REPEATS runs
+    GLfloat cullingMs;
+};
+
+// Transform building and frustum culling of BENCHMARK_JOB_OBJECTS objects with 1 to N threads
+inline int benchmarkJobScaling(const BenchmarkOptions &options) {
+    std::vector<glm::vec3> positions(BENCHMARK_JOB_OBJECTS);
+    std::vector<glm::mat4> transforms(BENCHMARK_JOB_OBJECTS);
+    std::vector<GLubyte> visible(BENCHMARK_JOB_OBJECTS);
+    for (GLuint i = 0; i < BENCHMARK_JOB_OBJECTS; i++) {
+        positions[i] = glm::vec3((GLfloat) (i % 100), (GLfloat) ((i / 100) % 100), -(GLfloat) (i / 10000));
+    }
+
+    Camera camera(glm::vec3(50.0f, 50.0f, 10.0f));
+    glm::mat4 projection = glm::perspective(ZOOM, 1.5f, 0.1f, 1000.0f);
+    Frustum frustum(projection * camera.getViewMatrix());
+
+    std::vector<JobScalingResult> results;
+    for (GLuint threads : Benchmark::threadCounts()) {
+        JobSystem jobs(threads - 1);
+        std::vector<GLfloat> transformTimes, cullingTimes;
+
+        for (GLuint repeat = 0; repeat < BENCHMARK_JOB_REPEATS; repeat++) {
+            double start = Profiler::get().nowUs();
+            jobs.parallelForWait(BENCHMARK_JOB_OBJECTS, 4096, [&](GLuint begin, GLuint end) {
+                for (GLuint i = begin; i < end; i++) {
+                    glm::mat4 model = glm::translate(glm::mat4(1), positions[i]);
+                    transforms[i] = glm::rotate(model, 0.001f * i, glm::vec3(0.0f, 1.0f, 0.0f));
+                }
+            });
+            double middle = Profiler::get().nowUs();
+            jobs.parallelForWait(BENCHMARK_JOB_OBJECTS, 4096, [&](GLuint begin, GLuint end) {
+                for (GLuint i = begin; i < end; i++) {
+                    glm::vec3 center(transforms[i][3].x, transforms[i][3].y, transforms[i][3].z);
+                    AABB bounds = { center - glm::vec3(0.5f), center + glm::vec3(0.5f) };
+                    visible[i] = frustum.containsAABB(bounds);
+                }
+            });
+            double end = Profiler::get().nowUs();
+
+            transformTimes.push_back((GLfloat) ((middle - start) / 1000.0));
+            cullingTimes.push_back((GLfloat) ((end - middle) / 1000.0));
+        }
+
+        JobScalingResult result = { threads, Benchmark::percentile(transformTimes, 50.0f), Benchmark::percentile(cullingTimes, 50.0f) };
+        std::cout << threads << " threads: transforms " << result.transformMs << " ms, culling "
+                  << result.cullingMs << " ms" << std::endl;
+        results.push_back(result);
+    }
+
+    std::ofstream out(options.output);
+    if (!out) {
+        std::cout << "ERROR::BENCHMARK::COULD_NOT_WRITE " << options.output << std::endl;
+        return EXIT_FAILURE;
+    }
+    out << "{\n  \"objects\": " << BENCHMARK_JOB_OBJECTS << ",\n  \"jobs\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const JobScalingResult &r = results[i];
+        out << "    {\"threads\": " << r.threads << ", \"transform_ms\": " << r.transformMs
+            << ", \"culling_ms\": " << r.cullingMs
+            << ", \"transform_speedup\": " << results[0].transformMs / r.transformMs
+            << ", \"culling_speedup\": " << results[0].cullingMs / r.cullingMs
+            << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,317 @@
+//
+//  Json.h
+//  GameForFuns
+//
+//  Small JSON reader for asset descriptions such as glTF. A document is parsed
+//  whole into a tree of JsonValues. Objects keep their members in file order
+//  and are searched linearly, which suits the handful of keys they hold.
+//  Missing keys and out of range indices yield a shared null value, so lookups
+//  chain without checks: json["meshes"][0]["primitives"].
+//
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class JsonValue {
+public:
+    enum Type {
+        JSON_NULL,
+        JSON_BOOL,
+        JSON_NUMBER,
+        JSON_STRING,
+        JSON_ARRAY,
+        JSON_OBJECT
+    };
+
+    Type type = JSON_NULL;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<JsonValue> elements;
+    std::vector<std::pair<std::string, JsonValue>> members;
+
+    // Parses text into out; returns false, having printed where, on malformed input
+    static bool parse(const char *text, size_t length, JsonValue &out) {
+        Parser parser = { text, text + length, text };
+        parser.skipSpace();
+        if (!parser.parseValue(out, 0)) {
+            std::cout << "ERROR::JSON::PARSE_FAILED at byte " << (parser.p - parser.begin) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    const JsonValue &operator[](const char *key) const {
+        for (const auto &member : this->members) {
+            if (member.first == key) {
+                return member.second;
+            }
+        }
+        return null();
+    }
+
+    const JsonValue &operator[](size_t index) const {
+        return index < this->elements.size() ? this->elements[index] : null();
+    }
+
+    // Literal indices; negative ones yield null like any other out of range index
+    const JsonValue &operator[](int index) const {
+        return (*this)[(size_t) index];
+    }
+
+    bool has(const char *key) const {
+        return &(*this)[key] != &null();
+    }
+
+    bool isNull() const {
+        return this->type == JSON_NULL;
+    }
+
+    // Elements of an array, members of an object
+    size_t size() const {
+        return this->type == JSON_OBJECT ? this->members.size() : this->elements.size();
+    }
+
+    double asNumber(double fallback = 0.0) const {
+        return this->type == JSON_NUMBER ? this->number : fallback;
+    }
+
+    int64_t asInt(int64_t fallback = 0) const {
+        return this->type == JSON_NUMBER ? (int64_t) this->number : fallback;
+    }
+
+    bool asBool(bool fallback = false) const {
+        return this->type == JSON_BOOL ? this->boolean : fallback;
+    }
+
+    const std::string &asString() const {
+        return this->string;
+    }
+
+private:
+    static const JsonValue &null() {
+        static const JsonValue value;
+        return value;
+    }
+
+    struct Parser {
+        const char *p, *end, *begin;
+
+        static const int MAX_DEPTH = 256;
+
+        void skipSpace() {
+            while (this->p < this->end && (*this->p == ' ' || *this->p == '\t' || *this->p == '\n' || *this->p == '\r')) {
+                this->p++;
+            }
+        }
+
+        bool literal(const char *word) {
+            size_t length = std::strlen(word);
+            if ((size_t) (this->end - this->p) < length || std::strncmp(this->p, word, length) != 0) {
+                return false;
+            }
+            this->p += length;
+            return true;
+        }
+
+        bool parseValue(JsonValue &value, int depth) {
+            if (this->p >= this->end || depth > MAX_DEPTH) {
+                return false;
+            }
+            bool parsed;
+            switch (*this->p) {
+                case '{':
+                    value.type = JSON_OBJECT;
+                    parsed = this->parseObject(value, depth);
+                    break;
+                case '[':
+                    value.type = JSON_ARRAY;
+                    parsed = this->parseArray(value, depth);
+                    break;
+                case '"':
+                    value.type = JSON_STRING;
+                    parsed = this->parseString(value.string);
+                    break;
+                case 't':
+                    value.type = JSON_BOOL;
+                    value.boolean = true;
+                    parsed = this->literal("true");
+                    break;
+                case 'f':
+                    value.type = JSON_BOOL;
+                    parsed = this->literal("false");
+                    break;
+                case 'n':
+                    parsed = this->literal("null");
+                    break;
+                default:
+                    value.type = JSON_NUMBER;
+                    parsed = this->parseNumber(value.number);
+                    break;
+            }
+            this->skipSpace();
+            return parsed;
+        }
+
+        bool parseObject(JsonValue &value, int depth) {
+            this->p++;
+            this->skipSpace();
+            if (this->p < this->end && *this->p == '}') {
+                this->p++;
+                return true;
+            }
+            while (this->p < this->end) {
+                value.members.emplace_back();
+                if (*this->p != '"' || !this->parseString(value.members.back().first)) {
+                    return false;
+                }
+                this->skipSpace();
+                if (this->p >= this->end || *this->p != ':') {
+                    return false;
+                }
+                this->p++;
+                this->skipSpace();
+                if (!this->parseValue(value.members.back().second, depth + 1) || this->p >= this->end) {
+                    return false;
+                }
+                if (*this->p == '}') {
+                    this->p++;
+                    return true;
+                }
+                if (*this->p != ',') {
+                    return false;
+                }
+                this->p++;
+                this->skipSpace();
+            }
+            return false;
+        }
+
+        bool parseArray(JsonValue &value, int depth) {
+            this->p++;
+            this->skipSpace();
+            if (this->p < this->end && *this->p == ']') {
+                this->p++;
+                return true;
+            }
+            while (this->p < this->end) {
+                value.elements.emplace_back();
+                if (!this->parseValue(value.elements.back(), depth + 1) || this->p >= this->end) {
+                    return false;
+                }
+                if (*this->p == ']') {
+                    this->p++;
+                    return true;
+                }
+                if (*this->p != ',') {
+                    return false;
+                }
+                this->p++;
+                this->skipSpace();
+            }
+            return false;
+        }
+
+        bool parseHex(uint32_t &code) {
+            if (this->end - this->p < 4) {
+                return false;
+            }
+            code = 0;
+            for (int i = 0; i < 4; i++, this->p++) {
+                char c = *this->p;
+                uint32_t digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : 16;
+                if (digit == 16) {
+                    return false;
+                }
+                code = code * 16 + digit;
+            }
+            return true;
+        }
+
+        bool parseString(std::string &out) {
+            this->p++;
+            while (this->p < this->end && *this->p != '"') {
+                if (*this->p != '\\') {
+                    out.push_back(*this->p++);
+                    continue;
+                }
+                if (++this->p >= this->end) {
+                    return false;
+                }
+                char escape = *this->p++;
+                switch (escape) {
+                    case 'b': out.push_back('\b'); break;
+                    case 'f': out.push_back('\f'); break;
+                    case 'n': out.push_back('\n'); break;
+                    case 'r': out.push_back('\r'); break;
+                    case 't': out.push_back('\t'); break;
+                    case 'u': {
+                        uint32_t code;
+                        if (!this->parseHex(code)) {
+                            return false;
+                        }
+                        // A high surrogate followed by a low one is a single code point
+                        if (code >= 0xD800 && code < 0xDC00 && this->end - this->p >= 6 && this->p[0] == '\\' && this->p[1] == 'u') {
+                            this->p += 2;
+                            uint32_t low;
+                            if (!this->parseHex(low)) {
+                                return false;
+                            }
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        }
+                        appendUtf8(out, code);
+                        break;
+                    }
+                    default: out.push_back(escape); break; // \" \\ and \/
+                }
+            }
+            if (this->p >= this->end) {
+                return false;
+            }
+            this->p++;
+            return true;
+        }
+
+        bool parseNumber(double &number) {
+            // The text need not be null terminated, so strtod reads a bounded copy
+            char buffer[64];
+            size_t length = 0;
+            while (this->p + length < this->end && length < sizeof(buffer) - 1 && std::strchr("+-0123456789.eE", this->p[length])) {
+                length++;
+            }
+            if (length == 0) {
+                return false;
+            }
+            std::memcpy(buffer, this->p, length);
+            buffer[length] = 0;
+            char *parsedEnd;
+            number = std::strtod(buffer, &parsedEnd);
+            this->p += parsedEnd - buffer;
+            return parsedEnd != buffer;
+        }
+
+        static void appendUtf8(std::string &out, uint32_t code) {
+            if (code < 0x80) {
+                out.push_back((char) code);
+            } else if (code < 0x800) {
+                out.push_back((char) (0xC0 | (code >> 6)));
+                out.push_back((char) (0x80 | (code & 0x3F)));
+            } else if (code < 0x10000) {
+                out.push_back((char) (0xE0 | (code >> 12)));
+                out.push_back((char) (0x80 | ((code >> 6) & 0x3F)));
+                out.push_back((char) (0x80 | (code & 0x3F)));
+            } else {
+                out.push_back((char) (0xF0 | (code >> 18)));
+                out.push_back((char) (0x80 | ((code >> 12) & 0x3F)));
+                out.push_back((char) (0x80 | ((code >> 6) & 0x3F)));
+                out.push_back((char) (0x80 | (code & 0x3F)));
+            }
+        }
+    };
+};
@@ -0,0 +1,74 @@
+//
+//  MappedFile.h
+//  GameForFuns
+//
+//  Read-only view of a whole file for loaders that parse large assets in
+//  place. The file is memory mapped where the platform allows, so pages are
+//  read on demand and never copied into the heap; otherwise it is read into
+//  memory.
+//
+#pragma once
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class MappedFile {
+public:
+    MappedFile() {}
+
+    ~MappedFile() {
+        if (this->mapped) {
+            munmap((void *) this->data, this->size);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &path) {
+        int descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) == 0 && info.st_size > 0) {
+            void *view = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (view != MAP_FAILED) {
+                madvise(view, (size_t) info.st_size, MADV_SEQUENTIAL);
+                this->data = (const char *) view;
+                this->size = (size_t) info.st_size;
+                this->mapped = true;
+            }
+        }
+        ::close(descriptor);
+
+        if (!this->mapped) {
+            std::ifstream file(path, std::ios::binary);
+            this->buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            this->data = this->buffer.data();
+            this->size = this->buffer.size();
+        }
+        return true;
+    }
+
+    const char *getData() const {
+        return this->data;
+    }
+
+    size_t getSize() const {
+        return this->size;
+    }
+
+private:
+    const char *data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+    std::vector<char> buffer;
+};
@@ -7,7 +7,9 @@
 //
 #pragma once
 
+#include <cstdio>
 #include <string>
+#include <utility>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -17,6 +19,9 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "Profiler.h"
+#include "GpuResources.h"
+
 using namespace std;
 
 struct Vertex {
@@ -25,6 +30,12 @@ struct Vertex {
     glm::vec2 texCoords;
 };
 
+// Geometry in the engine's vertex layout, built by a loader before it is uploaded
+struct MeshData {
+    vector<Vertex> vertices;
+    vector<GLuint> indices;
+};
+
 struct Texture {
     GLuint id;
     string type;
@@ -38,40 +49,39 @@ public:
     vector<Texture> textures;
     
     Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures) {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->textures = std::move(textures);
         
         this->setupMesh();
     }
     
-    void draw(Shader shader) {
+    void draw(Shader &shader) {
         GLuint diffuseNr = 1;
         GLuint specularNr = 1;
         
         for (GLuint i = 0; i < this->textures.size(); i++) {
             glActiveTexture(GL_TEXTURE0 + i);
             
-            stringstream ss;
-            string number;
-            string name = this->textures[i].type;
+            // Uniform name built on the stack, this runs for every mesh every frame
+            char name[64];
+            const string &type = this->textures[i].type;
             
-            if (name == "texture_diffuse") {
-                ss << diffuseNr++;
-            } else if (name == "texture_specular") {
-                ss << specularNr++;
+            if (type == "texture_diffuse") {
+                snprintf(name, sizeof(name), "%s%u", type.c_str(), diffuseNr++);
+            } else if (type == "texture_specular") {
+                snprintf(name, sizeof(name), "%s%u", type.c_str(), specularNr++);
+            } else {
+                snprintf(name, sizeof(name), "%s", type.c_str());
             }
             
-            number = ss.str();
-            glUniform1i(glGetUniformLocation(shader.Program, (name + number).c_str()), i);
+            glUniform1i(glGetUniformLocation(shader.Program, name), i);
             glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
         }
         
         // Default shininess values
         glUniform1f(glGetUniformLocation(shader.Program, "material.shininess"), 16.0f);
-        glBindVertexArray(this->VAO);
-        glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        this->drawGeometry();
         
         for (GLuint i = 0; i < this->textures.size(); i++) {
             glActiveTexture(GL_TEXTURE0 + i);
@@ -79,21 +89,33 @@ public:
         }
     }
     
+    // Draws with whatever textures and uniforms are bound, e.g. by a virtual texture
+    void drawGeometry() {
+        glBindVertexArray(this->VAO);
+        glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
+        PROFILE_DRAW(this->indices.size() / 3);
+        glBindVertexArray(0);
+    }
+    
 private:
-    GLuint VAO, VBO, EBO;
+    // Move-only, so a Mesh is moved into Model::meshes rather than copied
+    VertexArrayHandle VAO;
+    BufferHandle VBO, EBO;
     
     void setupMesh() {
-        glGenVertexArrays(1, &this->VAO);
-        glGenBuffers(1, &this->VBO);
-        glGenBuffers(1, &this->EBO);
+        this->VAO = VertexArrayHandle::create(GPU_MEMORY_GEOMETRY, "Mesh");
+        this->VBO = BufferHandle::create(GPU_MEMORY_GEOMETRY, "Mesh vertices");
+        this->EBO = BufferHandle::create(GPU_MEMORY_GEOMETRY, "Mesh indices");
         
         glBindVertexArray(this->VAO);
         
         glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
         glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+        this->VBO.setSize(this->vertices.size() * sizeof(Vertex));
         
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+        this->EBO.setSize(this->indices.size() * sizeof(GLuint));
         
         // Vertex position
         glEnableVertexAttribArray(0);
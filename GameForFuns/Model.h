@@ -1,10 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 #include <GL/glew.h>
@@ -18,10 +21,111 @@
 #include <assimp/postprocess.h>
 
 #include "Mesh.h"
+#include "JobSystem.h"
+#include "ObjLoader.h"
+#include "TextureCache.h"
 
 using namespace std;
 
-GLint textureFromFile(const char* path, string directory);
+const GLuint IMPORT_GRAIN = 65536; // Vertices or faces converted per job
+
+// The meshes of the node tree in the order a depth first walk reaches them
+inline void flattenMeshes(const aiScene *scene, vector<const aiMesh *> &meshes) {
+    vector<const aiNode *> stack(1, scene->mRootNode);
+    while (!stack.empty()) {
+        const aiNode *node = stack.back();
+        stack.pop_back();
+        for (GLuint i = 0; i < node->mNumMeshes; i++) {
+            meshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+        }
+        // Pushed in reverse so the first child is walked first
+        for (GLuint i = node->mNumChildren; i > 0; i--) {
+            stack.push_back(node->mChildren[i - 1]);
+        }
+    }
+}
+
+// Vertices [begin, end) of mesh. The branches are the same for every vertex, so the loop
+// stays a straight run of loads and stores.
+inline void convertVertices(const aiMesh *mesh, GLuint begin, GLuint end, Vertex *out) {
+    const aiVector3D *positions = mesh->mVertices;
+    const aiVector3D *normals = mesh->mNormals;
+    const aiVector3D *texCoords = mesh->mTextureCoords[0]; // Only the first set is used
+    
+    for (GLuint i = begin; i < end; i++) {
+        Vertex &vertex = out[i];
+        vertex.position = glm::vec3(positions[i].x, positions[i].y, positions[i].z);
+        if (normals) {
+            vertex.normal = glm::vec3(normals[i].x, normals[i].y, normals[i].z);
+        } else {
+            vertex.normal = glm::vec3(0.0f);
+        }
+        if (texCoords) {
+            vertex.texCoords = glm::vec2(texCoords[i].x, texCoords[i].y);
+        } else {
+            vertex.texCoords = glm::vec2(0.0f);
+        }
+    }
+}
+
+// Indices of faces [begin, end) of mesh, written from out on
+inline void convertFaces(const aiMesh *mesh, GLuint begin, GLuint end, GLuint *out) {
+    for (GLuint i = begin; i < end; i++) {
+        const aiFace &face = mesh->mFaces[i];
+        std::memcpy(out, face.mIndices, face.mNumIndices * sizeof(GLuint));
+        out += face.mNumIndices;
+    }
+}
+
+// Converts meshes into data with one job per IMPORT_GRAIN vertices or faces, so many small
+// meshes and one huge mesh both spread over the workers. Arrays are sized up front and every
+// job writes its own range of them.
+inline void convertMeshes(JobSystem &jobs, const vector<const aiMesh *> &meshes, vector<MeshData> &data) {
+    struct Range {
+        const aiMesh *mesh;
+        MeshData *data;
+        GLuint begin, end;
+        size_t firstIndex; // Faces only
+        bool faces;
+    };
+    
+    data.resize(meshes.size());
+    vector<Range> ranges;
+    for (GLuint m = 0; m < meshes.size(); m++) {
+        const aiMesh *mesh = meshes[m];
+        MeshData &target = data[m];
+        target.vertices.resize(mesh->mNumVertices);
+        for (GLuint begin = 0; begin < mesh->mNumVertices; begin += IMPORT_GRAIN) {
+            ranges.push_back(Range{mesh, &target, begin, std::min(begin + IMPORT_GRAIN, mesh->mNumVertices), 0, false});
+        }
+        
+        if (mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE) {
+            target.indices.resize((size_t) mesh->mNumFaces * 3);
+            for (GLuint begin = 0; begin < mesh->mNumFaces; begin += IMPORT_GRAIN) {
+                ranges.push_back(Range{mesh, &target, begin, std::min(begin + IMPORT_GRAIN, mesh->mNumFaces), (size_t) begin * 3, true});
+            }
+        } else {
+            // Points or lines survive triangulation, so faces vary in size; one job does them all
+            size_t count = 0;
+            for (GLuint i = 0; i < mesh->mNumFaces; i++) {
+                count += mesh->mFaces[i].mNumIndices;
+            }
+            target.indices.resize(count);
+            ranges.push_back(Range{mesh, &target, 0, mesh->mNumFaces, 0, true});
+        }
+    }
+    
+    jobs.parallelForWait((GLuint) ranges.size(), 1, [&ranges](GLuint first, GLuint last) {
+        for (GLuint i = first; i < last; i++) {
+            const Range &range = ranges[i];
+            if (range.faces) {
+                convertFaces(range.mesh, range.begin, range.end, range.data->indices.data() + range.firstIndex);
+            } else {
+                convertVertices(range.mesh, range.begin, range.end, range.data->vertices.data());
+            }
+        }
+    });
+}
 
 class Model {
 public:
@@ -30,18 +134,48 @@ public:
         this->loadModel(path);
     }
     
-    void draw(Shader shader) {
+    ~Model() {
+        for (GLuint i = 0; i < this->textures_loaded.size(); i++) {
+            TextureCache::get().release(this->textures_loaded[i].id);
+        }
+    }
+    
+    void draw(Shader &shader) {
         for (GLuint i = 0; i < this->meshes.size(); i++) {
             this->meshes[i].draw(shader);
         }
     }
     
+    const vector<Texture> &getTextures() const {
+        return this->textures_loaded;
+    }
+    
+    vector<Mesh> &getMeshes() {
+        return this->meshes;
+    }
+    
+    // Texture paths are relative to this
+    const string &getDirectory() const {
+        return this->directory;
+    }
+    
 private:
     vector<Mesh> meshes;
     string directory;
-    vector<Texture> textures_loaded;
+    vector<Texture> textures_loaded;      // Each holds one TextureCache reference, meshes share them
+    unordered_map<string, GLuint> textureIndex; // File to its place in textures_loaded
     
     void loadModel(string path) {
+        // OBJ files take the native loader; other formats, or an OBJ it rejects, go through Assimp
+        if (path.size() > 4 && path.compare(path.size() - 4, 4, ".obj") == 0) {
+            ObjModel model;
+            if (ObjLoader::load(path, JobSystem::get(), model)) {
+                this->directory = path.substr(0, path.find_last_of('/'));
+                this->loadObjModel(model);
+                return;
+            }
+        }
+        
         Assimp::Importer importer;
         const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
         
@@ -51,70 +185,40 @@ private:
         }
         
         this->directory = path.substr(0, path.find_last_of('/'));
-        this->processNode(scene->mRootNode, scene);
-    }
-    
-    void processNode(aiNode *node, const aiScene *scene) {
-        for (GLuint i = 0; i < node->mNumMeshes; i++) {
-            aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-            this->meshes.push_back(this->processMesh(mesh, scene));
-        }
         
-        // Children
-        for (GLuint i = 0; i < node->mNumChildren; i++) {
-            this->processNode(node->mChildren[i], scene);
+        vector<const aiMesh *> meshes;
+        flattenMeshes(scene, meshes);
+        vector<MeshData> data;
+        convertMeshes(JobSystem::get(), meshes, data);
+        
+        // Textures and buffers are created here, on the context thread
+        this->meshes.reserve(meshes.size());
+        for (GLuint i = 0; i < meshes.size(); i++) {
+            this->meshes.push_back(Mesh(std::move(data[i].vertices), std::move(data[i].indices), this->processMaterial(meshes[i], scene)));
         }
     }
     
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene) {
-        // Data to fill
-        vector<Vertex> vertices;
-        vector<GLuint> indices;
-        vector<Texture> textures;
-        
-        // Walk through each of the mesh's vertices
-        for (GLuint i = 0; i < mesh->mNumVertices; i++) {
-            Vertex vertex;
-            glm::vec3 vector(1); // We declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
-            
-            // Positions
-            vector.x = mesh->mVertices[i].x;
-            vector.y = mesh->mVertices[i].y;
-            vector.z = mesh->mVertices[i].z;
-            vertex.position = vector;
-            
-            // Normals
-            vector.x = mesh->mNormals[i].x;
-            vector.y = mesh->mNormals[i].y;
-            vector.z = mesh->mNormals[i].z;
-            vertex.normal = vector;
-            
-            // Texture Coordinates
-            // Does the mesh contain texture coordinates?
-            if(mesh->mTextureCoords[0]) {
-                glm::vec2 vec;
-                // A vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't
-                // use models where a vertex can have multiple texture coordinates so we always take the first set (0).
-                vec.x = mesh->mTextureCoords[0][i].x;
-                vec.y = mesh->mTextureCoords[0][i].y;
-                vertex.texCoords = vec;
-            } else {
-                vertex.texCoords = glm::vec2(0.0f, 0.0f);
-            }
-            
-            vertices.push_back(vertex);
-        }
-        
-        // Mesh faces
-        for (GLuint i = 0; i < mesh->mNumFaces; i++) {
-            aiFace face = mesh->mFaces[i];
-            // Retrieve all indices of the face and store them in the indices vector
-            for (GLuint j = 0; j < face.mNumIndices; j++) {
-                indices.push_back(face.mIndices[j]);
+    void loadObjModel(ObjModel &model) {
+        this->meshes.reserve(model.meshes.size());
+        for (GLuint i = 0; i < model.meshes.size(); i++) {
+            vector<Texture> textures;
+            if (model.meshes[i].material >= 0) {
+                const ObjMaterial &material = model.materials[model.meshes[i].material];
+                if (!material.diffuseMap.empty()) {
+                    textures.push_back(this->loadTexture(material.diffuseMap, "texture_diffuse"));
+                }
+                if (!material.specularMap.empty()) {
+                    textures.push_back(this->loadTexture(material.specularMap, "texture_specular"));
+                }
             }
+            MeshData &data = model.meshes[i].data;
+            this->meshes.push_back(Mesh(std::move(data.vertices), std::move(data.indices), textures));
         }
+    }
+    
+    vector<Texture> processMaterial(const aiMesh *mesh, const aiScene *scene) {
+        vector<Texture> textures;
         
-        // Process materials
         if(mesh->mMaterialIndex >= 0) {
             aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
             // 1. Diffuse maps
@@ -126,7 +230,7 @@ private:
             textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
         }
         
-        return Mesh(vertices, indices, textures);
+        return textures;
     }
     
     vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName) {
@@ -136,64 +240,26 @@ private:
             aiString str;
             mat->GetTexture(type, i, &str);
             
-            GLboolean skip = false;
-            
-            for (GLuint j = 0; j < this->textures_loaded.size(); j++) {
-                if (this->textures_loaded[j].path == str) {
-                    textures.push_back(this->textures_loaded[j]);
-                    skip = true;
-                    
-                    break;
-                }
-            }
-            
-            if (!skip) {
-                Texture texture;
-                texture.id = textureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str;
-                textures.push_back(texture);
-                
-                this->textures_loaded.push_back(texture);
-            }
+            textures.push_back(this->loadTexture(str.C_Str(), typeName));
         }
         
         return textures;
     }
-};
-
-GLint textureFromFile(const char* path, string directory) {
-    string filename = string(path);
-    filename = directory + '/' + filename;
-    GLuint textureId;
-    glGenTextures(1, &textureId);
     
-    int width, height;
-    
-    unsigned char *image = SOIL_load_image(filename.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
-    glBindTexture(GL_TEXTURE_2D, textureId);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    
-    glBindTexture(GL_TEXTURE_2D, 0);
-    
-    SOIL_free_image_data(image);
-    
-    return textureId;
-}
-
-
-
-
-
-
-
-
-
-
-
+    // Meshes of a model share a texture through textures_loaded, models share it through TextureCache
+    Texture loadTexture(const string &file, const string &typeName) {
+        auto found = this->textureIndex.find(file);
+        if (found != this->textureIndex.end()) {
+            return this->textures_loaded[found->second];
+        }
+        
+        Texture texture;
+        texture.id = TextureCache::get().acquire(this->directory + '/' + file, TEXTURE_LOAD_BLOCKING);
+        texture.type = typeName;
+        texture.path = aiString(file);
+        
+        this->textureIndex[file] = (GLuint) this->textures_loaded.size();
+        this->textures_loaded.push_back(texture);
+        return texture;
+    }
+};
@@ -0,0 +1,96 @@
+//
+//  NodePool.h
+//  GameForFuns
+//
+//  Spare nodes for a node based container, std::unordered_map or set. Entries
+//  erased through the pool keep their node, and new entries are inserted into
+//  one, so a container that shrinks and grows back stops allocating. A map's
+//  recycled node keeps the value it held, so a map of GL objects reuses them.
+//  The pool holds at most the nodes it was made for and frees the rest, so
+//  recycling never grows it. Inserting with no node to spare allocates, and
+//  declares it with AllocationTracker::allowFrame: the container is growing
+//  past its high-water mark, not churning.
+//
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "AllocationTracker.h"
+
+template <typename Container>
+class NodePool {
+public:
+    typedef typename Container::node_type Node;
+
+    explicit NodePool(size_t capacity) {
+        this->spare.reserve(capacity);
+    }
+
+    // Inserts value into a set unless it is there; true if it was not
+    bool insert(Container &set, const typename Container::value_type &value) {
+        if (set.count(value)) {
+            return false;
+        }
+        if (this->spare.empty()) {
+            AllocationTracker::get().allowFrame();
+            set.insert(value);
+            return true;
+        }
+        Node node = std::move(this->spare.back());
+        this->spare.pop_back();
+        node.value() = value;
+        set.insert(std::move(node));
+        return true;
+    }
+
+    // The value for key in a map, as operator[], taken from a spare node if the key is new
+    template <typename Map = Container>
+    typename Map::mapped_type &entry(Map &map, const typename Map::key_type &key) {
+        auto found = map.find(key);
+        if (found != map.end()) {
+            return found->second;
+        }
+        if (this->spare.empty()) {
+            AllocationTracker::get().allowFrame();
+            return map[key];
+        }
+        Node node = std::move(this->spare.back());
+        this->spare.pop_back();
+        node.key() = key;
+        return map.insert(std::move(node)).position->second;
+    }
+
+    // Erases the entry at position, keeping its node if there is room
+    void erase(Container &container, typename Container::const_iterator position) {
+        this->recycle(container.extract(position));
+    }
+
+    // Erases key if it is there; true if it was
+    bool erase(Container &container, const typename Container::key_type &key) {
+        auto found = container.find(key);
+        if (found == container.end()) {
+            return false;
+        }
+        this->erase(container, found);
+        return true;
+    }
+
+    void recycle(Node node) {
+        if (node && this->spare.size() < this->spare.capacity()) {
+            this->spare.push_back(std::move(node));
+        }
+    }
+
+    // Whether erasing now frees the node rather than keeping it
+    bool isFull() const {
+        return this->spare.size() == this->spare.capacity();
+    }
+
+    size_t getSpareCount() const {
+        return this->spare.size();
+    }
+
+private:
+    std::vector<Node> spare;
+};
@@ -0,0 +1,478 @@
+//
+//  ObjLoader.h
+//  GameForFuns
+//
+//  Wavefront OBJ/MTL loader, the fast path for .obj models beside Assimp. The
+//  file is memory mapped and cut at line breaks into chunks that are parsed
+//  in parallel on the job system: a first pass counts each chunk's v, vt and
+//  vn lines so the second knows where its elements land in the shared arrays
+//  and can resolve negative indices on the spot. Meshes (one per object,
+//  group or material change) are then built in parallel, deduplicating
+//  v/vt/vn corners through a hash table, fanning polygons into triangles and
+//  flipping V like aiProcess_FlipUVs, straight into the MeshData that Mesh
+//  uploads.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <assimp/scene.h>
+
+#include "Shader.h"
+#include "Mesh.h"
+#include "Profiler.h"
+#include "JobSystem.h"
+#include "MappedFile.h"
+
+const size_t OBJ_CHUNK_SIZE = 1 << 20;      // Bytes parsed per job
+const uint32_t OBJ_NO_INDEX = 0xFFFFFFFF;   // Corner without a texture coord or normal
+
+struct ObjMaterial {
+    std::string name;
+    std::string diffuseMap;  // map_Kd, relative to the model
+    std::string specularMap; // map_Ks
+};
+
+struct ObjMesh {
+    std::string name;
+    GLint material = -1;     // Into ObjModel::materials
+    MeshData data;
+};
+
+struct ObjModel {
+    std::vector<ObjMesh> meshes;
+    std::vector<ObjMaterial> materials;
+};
+
+class ObjLoader {
+public:
+    // Returns false, having printed why, if the file cannot be read or refers to elements it
+    // does not have; the caller can fall back to Assimp
+    static bool load(const std::string &path, JobSystem &jobs, ObjModel &model) {
+        PROFILE_SCOPE("ObjLoader::load");
+        MappedFile file;
+        if (!file.open(path)) {
+            std::cout << "ERROR::OBJ::COULD_NOT_OPEN " << path << std::endl;
+            return false;
+        }
+
+        // Chunks end on line breaks
+        std::vector<Chunk> chunks;
+        const char *data = file.getData(), *end = data + file.getSize();
+        for (const char *begin = data; begin < end;) {
+            const char *split = begin + std::min(OBJ_CHUNK_SIZE, (size_t) (end - begin));
+            const char *newline = split < end ? (const char *) std::memchr(split, '\n', end - split) : nullptr;
+            Chunk chunk;
+            chunk.begin = begin;
+            chunk.end = newline ? newline + 1 : end;
+            chunks.push_back(std::move(chunk));
+            begin = chunks.back().end;
+        }
+
+        jobs.parallelForWait((GLuint) chunks.size(), 1, [&chunks](GLuint first, GLuint last) {
+            for (GLuint i = first; i < last; i++) {
+                countChunk(chunks[i]);
+            }
+        });
+
+        // Where each chunk's elements start in the shared arrays
+        Elements totals;
+        for (Chunk &chunk : chunks) {
+            Elements count = chunk.first;
+            chunk.first = totals;
+            totals.positions += count.positions;
+            totals.texCoords += count.texCoords;
+            totals.normals += count.normals;
+        }
+        Arrays arrays;
+        arrays.positions.resize(totals.positions);
+        arrays.texCoords.resize(totals.texCoords);
+        arrays.normals.resize(totals.normals);
+
+        jobs.parallelForWait((GLuint) chunks.size(), 1, [&chunks, &arrays](GLuint first, GLuint last) {
+            for (GLuint i = first; i < last; i++) {
+                parseChunk(chunks[i], arrays);
+            }
+        });
+        for (const Chunk &chunk : chunks) {
+            if (!chunk.valid) {
+                std::cout << "ERROR::OBJ::INDEX_OUT_OF_RANGE " << path << std::endl;
+                return false;
+            }
+        }
+
+        // Meshes in file order, from the object, group and material changes
+        std::string directory = path.substr(0, path.find_last_of('/') + 1);
+        std::vector<MeshSource> sources(1);
+        for (const Chunk &chunk : chunks) {
+            GLuint face = 0, corner = 0;
+            for (const Event &event : chunk.events) {
+                sources.back().segments.push_back(Segment{&chunk, face, event.face, corner});
+                face = event.face;
+                corner = event.corner;
+                if (event.type == 'm') {
+                    loadMtl(directory + event.name, model.materials);
+                    continue;
+                }
+                if (event.type == 'o' || hasFaces(sources.back())) {
+                    sources.push_back(MeshSource());
+                    sources.back().name = sources[sources.size() - 2].name;
+                    sources.back().material = sources[sources.size() - 2].material;
+                }
+                if (event.type == 'o') {
+                    sources.back().name = event.name;
+                } else {
+                    sources.back().material = event.name;
+                }
+            }
+            sources.back().segments.push_back(Segment{&chunk, face, (GLuint) chunk.faces.size(), corner});
+        }
+        sources.erase(std::remove_if(sources.begin(), sources.end(), [](const MeshSource &source) {
+            return !hasFaces(source);
+        }), sources.end());
+
+        model.meshes.resize(sources.size());
+        jobs.parallelForWait((GLuint) sources.size(), 1, [&sources, &arrays, &model](GLuint first, GLuint last) {
+            for (GLuint i = first; i < last; i++) {
+                buildMesh(sources[i], arrays, model.meshes[i].data);
+            }
+        });
+        for (GLuint i = 0; i < sources.size(); i++) {
+            model.meshes[i].name = sources[i].name;
+            for (GLuint m = 0; m < model.materials.size(); m++) {
+                if (model.materials[m].name == sources[i].material) {
+                    model.meshes[i].material = (GLint) m;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Decimal to float without locale or allocation. Up to 19 significant digits with a power
+    // of ten double represents exactly take the fast path, which is correctly rounded to double;
+    // anything longer falls back to strtod.
+    static GLfloat parseFloat(const char *&p, const char *end) {
+        static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        const char *start = p;
+        bool negative = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) {
+            p++;
+        }
+
+        uint64_t mantissa = 0;
+        GLint digits = 0, exponent = 0;
+        bool exact = true;
+        for (; p < end && (GLuint) (*p - '0') < 10; p++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+            } else {
+                exponent++;
+                exact = false;
+            }
+        }
+        if (p < end && *p == '.') {
+            for (p++; p < end && (GLuint) (*p - '0') < 10; p++) {
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    digits += mantissa != 0;
+                    exponent--;
+                } else {
+                    exact = false;
+                }
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            bool negativeExponent = p < end && *p == '-';
+            if (p < end && (*p == '-' || *p == '+')) {
+                p++;
+            }
+            GLint value = 0;
+            for (; p < end && (GLuint) (*p - '0') < 10; p++) {
+                value = std::min(value * 10 + (*p - '0'), 100000);
+            }
+            exponent += negativeExponent ? -value : value;
+        }
+
+        if (exact && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22) {
+            double value = exponent < 0 ? mantissa / powers[-exponent] : mantissa * powers[exponent];
+            return (GLfloat) (negative ? -value : value);
+        }
+        char buffer[64];
+        size_t length = std::min((size_t) (p - start), sizeof(buffer) - 1);
+        std::memcpy(buffer, start, length);
+        buffer[length] = 0;
+        return (GLfloat) std::strtod(buffer, nullptr);
+    }
+
+private:
+    struct Corner {
+        uint32_t position, texCoord, normal; // 0-based, texCoord and normal may be OBJ_NO_INDEX
+    };
+
+    struct Event {
+        char type;          // 'o' for o and g, 'u' for usemtl, 'm' for mtllib
+        GLuint face;        // The first face after it
+        GLuint corner;
+        std::string name;
+    };
+
+    struct Elements {
+        uint32_t positions = 0, texCoords = 0, normals = 0;
+    };
+
+    struct Chunk {
+        const char *begin, *end;
+        Elements first;                 // Counts after countChunk, then the first global index of each
+        std::vector<Corner> corners;
+        std::vector<GLuint> faces;      // Corner count of each face
+        std::vector<Event> events;
+        bool valid = true;
+    };
+
+    struct Arrays {
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> texCoords;
+        std::vector<glm::vec3> normals;
+    };
+
+    struct Segment {
+        const Chunk *chunk;
+        GLuint faceBegin, faceEnd;
+        GLuint cornerBegin;
+    };
+
+    struct MeshSource {
+        std::string name;
+        std::string material;
+        std::vector<Segment> segments;
+    };
+
+    static bool hasFaces(const MeshSource &source) {
+        for (const Segment &segment : source.segments) {
+            if (segment.faceEnd > segment.faceBegin) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static const char *nextLine(const char *p, const char *end) {
+        const char *newline = (const char *) std::memchr(p, '\n', end - p);
+        return newline ? newline + 1 : end;
+    }
+
+    static const char *skipSpaces(const char *p, const char *end) {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        return p;
+    }
+
+    // Rest of the line without surrounding white space
+    static std::string restOfLine(const char *p, const char *end) {
+        p = skipSpaces(p, end);
+        const char *last = p;
+        while (last < end && *last != '\n' && *last != '\r') {
+            last++;
+        }
+        while (last > p && (last[-1] == ' ' || last[-1] == '\t')) {
+            last--;
+        }
+        return std::string(p, last);
+    }
+
+    static void countChunk(Chunk &chunk) {
+        for (const char *p = chunk.begin; p < chunk.end; p = nextLine(p, chunk.end)) {
+            if (p + 1 < chunk.end && p[0] == 'v') {
+                chunk.first.positions += p[1] == ' ' || p[1] == '\t';
+                chunk.first.texCoords += p[1] == 't';
+                chunk.first.normals += p[1] == 'n';
+            }
+        }
+    }
+
+    // One index of a face corner. Negative indices count back from the elements read so far.
+    static uint32_t parseIndex(const char *&p, const char *end, uint32_t readSoFar, uint32_t total, bool &valid) {
+        bool negative = p < end && *p == '-';
+        if (negative) {
+            p++;
+        }
+        int64_t value = 0;
+        const char *start = p;
+        for (; p < end && (GLuint) (*p - '0') < 10; p++) {
+            value = value * 10 + (*p - '0');
+        }
+        if (p == start) {
+            return OBJ_NO_INDEX;
+        }
+        int64_t index = negative ? (int64_t) readSoFar - value : value - 1;
+        if (index < 0 || index >= total) {
+            valid = false;
+            return 0;
+        }
+        return (uint32_t) index;
+    }
+
+    static void parseChunk(Chunk &chunk, Arrays &arrays) {
+        Elements read = chunk.first;
+        const Elements totals = { (uint32_t) arrays.positions.size(), (uint32_t) arrays.texCoords.size(), (uint32_t) arrays.normals.size() };
+        chunk.corners.reserve((chunk.end - chunk.begin) / 16);
+        chunk.faces.reserve((chunk.end - chunk.begin) / 48);
+
+        for (const char *line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end)) {
+            const char *p = line, *end = chunk.end;
+            if (end - p < 2) {
+                continue;
+            }
+            if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+                glm::vec3 &position = arrays.positions[read.positions++];
+                for (GLuint i = 0; i < 3; i++) {
+                    p = skipSpaces(p + (i == 0), end);
+                    position[i] = parseFloat(p, end);
+                }
+            } else if (p[0] == 'v' && p[1] == 't') {
+                glm::vec2 &texCoord = arrays.texCoords[read.texCoords++];
+                p += 2;
+                for (GLuint i = 0; i < 2; i++) {
+                    p = skipSpaces(p, end);
+                    texCoord[i] = parseFloat(p, end);
+                }
+                texCoord.y = 1.0f - texCoord.y; // As aiProcess_FlipUVs
+            } else if (p[0] == 'v' && p[1] == 'n') {
+                glm::vec3 &normal = arrays.normals[read.normals++];
+                p += 2;
+                for (GLuint i = 0; i < 3; i++) {
+                    p = skipSpaces(p, end);
+                    normal[i] = parseFloat(p, end);
+                }
+            } else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+                GLuint count = 0;
+                for (p = skipSpaces(p + 1, end); p < end && *p != '\n' && *p != '\r'; p = skipSpaces(p, end)) {
+                    Corner corner = { 0, OBJ_NO_INDEX, OBJ_NO_INDEX };
+                    corner.position = parseIndex(p, end, read.positions, totals.positions, chunk.valid);
+                    if (p < end && *p == '/') {
+                        p++;
+                        corner.texCoord = parseIndex(p, end, read.texCoords, totals.texCoords, chunk.valid);
+                        if (p < end && *p == '/') {
+                            p++;
+                            corner.normal = parseIndex(p, end, read.normals, totals.normals, chunk.valid);
+                        }
+                    }
+                    if (corner.position == OBJ_NO_INDEX) {
+                        break; // Not an index, the rest of the line is ignored
+                    }
+                    chunk.corners.push_back(corner);
+                    count++;
+                }
+                if (count < 3) {
+                    chunk.corners.resize(chunk.corners.size() - count); // Points and lines are not drawn
+                } else {
+                    chunk.faces.push_back(count);
+                }
+            } else if ((p[0] == 'o' || p[0] == 'g') && (p[1] == ' ' || p[1] == '\t')) {
+                chunk.events.push_back(Event{'o', (GLuint) chunk.faces.size(), (GLuint) chunk.corners.size(), restOfLine(p + 1, end)});
+            } else if (end - p > 7 && std::strncmp(p, "usemtl", 6) == 0) {
+                chunk.events.push_back(Event{'u', (GLuint) chunk.faces.size(), (GLuint) chunk.corners.size(), restOfLine(p + 6, end)});
+            } else if (end - p > 7 && std::strncmp(p, "mtllib", 6) == 0) {
+                chunk.events.push_back(Event{'m', (GLuint) chunk.faces.size(), (GLuint) chunk.corners.size(), restOfLine(p + 6, end)});
+            }
+        }
+    }
+
+    // Fans every face into triangles, giving each distinct v/vt/vn corner one vertex
+    static void buildMesh(const MeshSource &source, const Arrays &arrays, MeshData &data) {
+        size_t corners = 0, triangles = 0;
+        for (const Segment &segment : source.segments) {
+            for (GLuint face = segment.faceBegin; face < segment.faceEnd; face++) {
+                corners += segment.chunk->faces[face];
+                triangles += segment.chunk->faces[face] - 2;
+            }
+        }
+
+        struct Slot {
+            uint32_t position, texCoord, normal, vertex;
+        };
+        size_t tableSize = 16;
+        while (tableSize < corners * 2) {
+            tableSize <<= 1;
+        }
+        std::vector<Slot> table(tableSize, Slot{OBJ_NO_INDEX, 0, 0, 0});
+        size_t mask = tableSize - 1;
+
+        data.vertices.reserve(std::min(corners, (size_t) arrays.positions.size() * 2));
+        data.indices.resize(triangles * 3);
+        GLuint *out = data.indices.data();
+
+        for (const Segment &segment : source.segments) {
+            const Corner *corner = segment.chunk->corners.data() + segment.cornerBegin;
+            for (GLuint face = segment.faceBegin; face < segment.faceEnd; face++) {
+                GLuint count = segment.chunk->faces[face];
+                GLuint first = 0, previous = 0;
+                for (GLuint i = 0; i < count; i++, corner++) {
+                    size_t hash = (corner->position * 73856093u) ^ (corner->texCoord * 19349663u) ^ (corner->normal * 83492791u);
+                    size_t slot = (hash * 0x9E3779B97F4A7C15ull >> 20) & mask;
+                    while (table[slot].position != OBJ_NO_INDEX && (table[slot].position != corner->position
+                           || table[slot].texCoord != corner->texCoord || table[slot].normal != corner->normal)) {
+                        slot = (slot + 1) & mask;
+                    }
+                    if (table[slot].position == OBJ_NO_INDEX) {
+                        Vertex vertex;
+                        vertex.position = arrays.positions[corner->position];
+                        vertex.normal = corner->normal != OBJ_NO_INDEX ? arrays.normals[corner->normal] : glm::vec3(0.0f);
+                        vertex.texCoords = corner->texCoord != OBJ_NO_INDEX ? arrays.texCoords[corner->texCoord] : glm::vec2(0.0f);
+                        table[slot] = Slot{corner->position, corner->texCoord, corner->normal, (uint32_t) data.vertices.size()};
+                        data.vertices.push_back(vertex);
+                    }
+
+                    GLuint index = table[slot].vertex;
+                    if (i == 0) {
+                        first = index;
+                    } else if (i >= 2) {
+                        *out++ = first;
+                        *out++ = previous;
+                        *out++ = index;
+                    }
+                    previous = index;
+                }
+            }
+        }
+    }
+
+    static void loadMtl(const std::string &path, std::vector<ObjMaterial> &materials) {
+        std::ifstream file(path);
+        if (!file) {
+            std::cout << "ERROR::OBJ::COULD_NOT_OPEN_MTL " << path << std::endl;
+            return;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            const char *p = skipSpaces(line.c_str(), line.c_str() + line.size());
+            const char *end = line.c_str() + line.size();
+            std::string keyword(p, std::find_if(p, end, [](char c) { return c == ' ' || c == '\t'; }));
+            p += keyword.size();
+            if (keyword == "newmtl") {
+                materials.push_back(ObjMaterial());
+                materials.back().name = restOfLine(p, end);
+            } else if (!materials.empty() && (keyword == "map_Kd" || keyword == "map_Ks")) {
+                // Options such as -bm come first, the file name is last
+                std::string value = restOfLine(p, end);
+                std::string name = value.substr(value.find_last_of(" \t") + 1);
+                (keyword == "map_Kd" ? materials.back().diffuseMap : materials.back().specularMap) = name;
+            }
+        }
+    }
+};
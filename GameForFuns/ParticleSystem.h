@@ -0,0 +1,487 @@
+//
+//  ParticleSystem.h
+//  GameForFuns
+//
+//  Particles that live on the GPU. A fixed pool of slots is emitted into as a
+//  ring: each step the CPU only works out which run of slots the emitter
+//  fills, and the update shader respawns those while it integrates gravity and
+//  drag and bounces the rest off a heightfield. Nothing per particle touches
+//  the CPU, so the per frame cost does not depend on the particle count.
+//
+//  With GL 4.3 the update is a compute shader on a storage buffer, then a
+//  second pass culls against the view frustum and keys the visible particles
+//  by distance, a bitonic sort orders them back to front, and an indirect draw
+//  blends exactly the visible ones. On GL 3.3 the update is a vertex shader
+//  captured by transform feedback into the other of two buffers, and the
+//  whole pool is drawn additively, which needs no sort; dead particles are
+//  moved outside the clip volume by the vertex shader so they are dropped
+//  before rasterization.
+//
+//  simulateParticle is the same update in C++; --particle-check runs both
+//  paths against it.
+//
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "GpuResources.h"
+#include "Profiler.h"
+#include "Shader.h"
+#include "VoxelWorld.h"
+
+const GLuint PARTICLE_GROUP_SIZE = 256;         // local_size_x of the particle compute shaders
+const GLuint PARTICLE_CHECK_CAPACITY = 4096;
+const GLuint PARTICLE_CHECK_STEPS = 120;
+const GLfloat PARTICLE_CHECK_EPSILON = 1e-3f;    // Relative; GPU trigonometry and fused multiply-adds round differently
+const GLfloat PARTICLE_CHECK_AGREEMENT = 0.999f; // Share of particles that must agree; a bounce rounded the other way diverges
+
+// The layout of both the transform feedback buffers and the storage buffer
+struct Particle {
+    glm::vec3 position = glm::vec3(0.0f);
+    GLfloat age = 0.0f;      // Seconds since emission
+    glm::vec3 velocity = glm::vec3(0.0f);
+    GLfloat lifetime = 0.0f; // Alive while age < lifetime, so a slot never emitted is dead
+
+    bool isAlive() const {
+        return this->age < this->lifetime;
+    }
+};
+
+struct ParticleSettings {
+    glm::vec3 emitter = glm::vec3(0.0f);
+    GLfloat emitRate = 60000.0f;         // Particles per second
+    GLfloat speed = 9.0f;                // At emission
+    GLfloat spread = 0.3f;               // Half angle of the emission cone around +y, radians
+    GLfloat lifetimeMin = 3.0f;          // Seconds
+    GLfloat lifetimeMax = 5.0f;
+    GLfloat gravity = 9.81f;             // Units per second squared
+    GLfloat drag = 0.3f;                 // Velocity is divided by 1 + drag * dt each step
+    GLfloat restitution = 0.4f;          // Vertical speed kept by a bounce
+    GLfloat friction = 0.8f;             // Horizontal speed kept by a bounce
+    GLfloat size = 0.08f;                // Diameter in world units
+    glm::vec3 color = glm::vec3(1.0f, 0.55f, 0.2f);
+};
+
+// Ground heights on a grid of square cells; particles outside it fall forever
+struct ParticleHeightfield {
+    glm::vec2 origin = glm::vec2(0.0f);  // x and z of the corner of cell (0, 0)
+    GLfloat cellSize = 1.0f;
+    GLuint width = 0, depth = 0;
+    std::vector<GLfloat> heights;        // width * depth, x fastest
+
+    GLfloat heightAt(GLfloat x, GLfloat z) const {
+        GLint cellX = (GLint) std::floor((x - this->origin.x) / this->cellSize);
+        GLint cellZ = (GLint) std::floor((z - this->origin.y) / this->cellSize);
+        if (cellX < 0 || cellZ < 0 || cellX >= (GLint) this->width || cellZ >= (GLint) this->depth) {
+            return -1e30f;
+        }
+        return this->heights[cellZ * this->width + cellX];
+    }
+};
+
+// The run of slots one step emits into, and the seed their random numbers come from
+struct ParticleEmission {
+    GLuint start = 0;
+    GLuint count = 0;
+    uint32_t seed = 0;
+};
+
+// Hands out slots round the pool at the emit rate, carrying fractions of a particle between steps
+class ParticleEmitter {
+public:
+    ParticleEmission emit(GLfloat dt, GLfloat rate, GLuint capacity) {
+        this->owed += rate * dt;
+        ParticleEmission emission;
+        emission.start = this->cursor;
+        emission.count = (GLuint) std::min(this->owed, (GLfloat) capacity);
+        emission.seed = this->step++;
+        this->owed -= (GLfloat) emission.count;
+        this->owed = std::min(this->owed, 1.0f);
+        this->cursor = (this->cursor + emission.count) % capacity;
+        return emission;
+    }
+
+private:
+    GLuint cursor = 0;
+    GLfloat owed = 0.0f;
+    uint32_t step = 0;
+};
+
+// The shaders' PCG hash and their random number in [0, 1)
+inline uint32_t particleHash(uint32_t v) {
+    uint32_t state = v * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+inline GLfloat particleRandom(uint32_t id, uint32_t seed, uint32_t stream) {
+    return (GLfloat) (particleHash(id ^ particleHash(seed + stream)) >> 8u) / 16777216.0f;
+}
+
+// particleUpdate.vs and particleUpdate.comp for one particle; keep the three in step
+inline void simulateParticle(Particle &particle, GLuint id, const ParticleSettings &settings, const ParticleEmission &emission,
+                             GLuint capacity, const ParticleHeightfield &heightfield, GLfloat dt) {
+    GLuint offset = id >= emission.start ? id - emission.start : id + capacity - emission.start;
+    if (offset < emission.count) {
+        GLfloat angle = 6.2831853f * particleRandom(id, emission.seed, 0);
+        GLfloat y = glm::mix(std::cos(settings.spread), 1.0f, particleRandom(id, emission.seed, 1));
+        GLfloat radius = std::sqrt(std::max(1.0f - y * y, 0.0f));
+        particle.position = settings.emitter;
+        particle.velocity = glm::vec3(radius * std::cos(angle), y, radius * std::sin(angle)) * settings.speed;
+        particle.age = 0.0f;
+        particle.lifetime = glm::mix(settings.lifetimeMin, settings.lifetimeMax, particleRandom(id, emission.seed, 2));
+    } else if (particle.isAlive()) {
+        particle.age += dt;
+        particle.velocity.y -= settings.gravity * dt;
+        particle.velocity /= 1.0f + settings.drag * dt;
+        particle.position += particle.velocity * dt;
+        GLfloat ground = heightfield.heightAt(particle.position.x, particle.position.z);
+        if (particle.position.y < ground) {
+            particle.position.y = ground;
+            if (particle.velocity.y < 0.0f) {
+                particle.velocity.y = -particle.velocity.y * settings.restitution;
+                particle.velocity.x *= settings.friction;
+                particle.velocity.z *= settings.friction;
+            }
+        }
+    }
+}
+
+// Heights of the highest solid block of each column, size x size cells centered on (centerX, centerZ),
+// searching down from top to bottom; columns with no block get bottom
+inline ParticleHeightfield voxelHeightfield(const VoxelWorld &world, GLint centerX, GLint centerZ, GLuint size, GLint top, GLint bottom) {
+    ParticleHeightfield field;
+    field.origin = glm::vec2((GLfloat) (centerX - (GLint) size / 2), (GLfloat) (centerZ - (GLint) size / 2));
+    field.cellSize = 1.0f;
+    field.width = size;
+    field.depth = size;
+    field.heights.assign(size * size, (GLfloat) bottom);
+    for (GLuint z = 0; z < size; z++) {
+        for (GLuint x = 0; x < size; x++) {
+            GLint worldX = (GLint) field.origin.x + (GLint) x, worldZ = (GLint) field.origin.y + (GLint) z;
+            for (GLint y = top; y >= bottom; y--) {
+                if (world.getBlock(worldX, y, worldZ) != BLOCK_AIR) {
+                    field.heights[z * size + x] = (GLfloat) (y + 1);
+                    break;
+                }
+            }
+        }
+    }
+    return field;
+}
+
+class ParticleSystem {
+public:
+    // Uses the compute path when the context has GL 4.3 and allowCompute is set
+    ParticleSystem(GLuint capacity, const ParticleSettings &settings, bool allowCompute = true):
+        settings(settings), capacity(std::max(capacity, 1u)) {
+        this->compute = allowCompute && GLEW_VERSION_4_3;
+        this->heightfield = TextureHandle::create(GPU_MEMORY_OTHER, "Particle heightfield");
+        this->setHeightfield(ParticleHeightfield());
+        this->drawVAO = VertexArrayHandle::create(GPU_MEMORY_GEOMETRY, "Particles");
+
+        std::vector<Particle> empty(this->capacity);
+        size_t bytes = this->capacity * sizeof(Particle);
+        if (this->compute) {
+            this->sortSize = PARTICLE_GROUP_SIZE;
+            while (this->sortSize < this->capacity) {
+                this->sortSize *= 2;
+            }
+            this->createBuffer(this->buffers[0], GL_SHADER_STORAGE_BUFFER, empty.data(), bytes, "Particles");
+            this->createBuffer(this->keys, GL_SHADER_STORAGE_BUFFER, nullptr, this->sortSize * 2 * sizeof(GLuint), "Particle sort keys");
+            const GLuint command[4] = { 0, 1, 0, 0 };
+            this->createBuffer(this->indirect, GL_DRAW_INDIRECT_BUFFER, command, sizeof(command), "Particle draw");
+
+            this->updateProgram = linkProgram({ { GL_COMPUTE_SHADER, "res/shaders/particleUpdate.comp" } });
+            this->cullProgram = linkProgram({ { GL_COMPUTE_SHADER, "res/shaders/particleCull.comp" } });
+            this->sortProgram = linkProgram({ { GL_COMPUTE_SHADER, "res/shaders/particleSort.comp" } });
+            this->drawProgram = linkProgram({ { GL_VERTEX_SHADER, "res/shaders/particleSorted.vs" },
+                                              { GL_FRAGMENT_SHADER, "res/shaders/particle.frag" } });
+        } else {
+            for (GLuint i = 0; i < 2; i++) {
+                this->createBuffer(this->buffers[i], GL_ARRAY_BUFFER, empty.data(), bytes, "Particles");
+                this->vertexArrays[i] = VertexArrayHandle::create(GPU_MEMORY_GEOMETRY, "Particles");
+                glBindVertexArray(this->vertexArrays[i]);
+                glBindBuffer(GL_ARRAY_BUFFER, this->buffers[i]);
+                glEnableVertexAttribArray(0);
+                glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *) 0);
+                glEnableVertexAttribArray(1);
+                glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *) offsetof(Particle, velocity));
+            }
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            this->updateProgram = linkProgram({ { GL_VERTEX_SHADER, "res/shaders/particleUpdate.vs" } },
+                                              { "outPositionAge", "outVelocityLife" }); // Interleaved, so they land in Particle layout
+            this->drawProgram = linkProgram({ { GL_VERTEX_SHADER, "res/shaders/particle.vs" },
+                                              { GL_FRAGMENT_SHADER, "res/shaders/particle.frag" } });
+        }
+
+        GLuint program = this->updateProgram;
+        this->deltaTimeLoc = glGetUniformLocation(program, "deltaTime");
+        this->emitterLoc = glGetUniformLocation(program, "emitter");
+        this->emitShapeLoc = glGetUniformLocation(program, "emitShape");
+        this->emissionLoc = glGetUniformLocation(program, "emission");
+        this->forcesLoc = glGetUniformLocation(program, "forces");
+        this->heightfieldLoc = glGetUniformLocation(program, "heightfield");
+        this->heightfieldOriginLoc = glGetUniformLocation(program, "heightfieldOrigin");
+        this->heightfieldSizeLoc = glGetUniformLocation(program, "heightfieldSize");
+        program = this->drawProgram;
+        this->viewLoc = glGetUniformLocation(program, "view");
+        this->projLoc = glGetUniformLocation(program, "projection");
+        this->sizeLoc = glGetUniformLocation(program, "particleSize");
+        this->viewportHeightLoc = glGetUniformLocation(program, "viewportHeight");
+        this->colorLoc = glGetUniformLocation(program, "particleColor");
+        if (this->compute) {
+            this->viewProjectionLoc = glGetUniformLocation(this->cullProgram, "viewProjection");
+            this->cameraPositionLoc = glGetUniformLocation(this->cullProgram, "cameraPosition");
+            this->cullCapacityLoc = glGetUniformLocation(this->cullProgram, "capacity");
+            this->sortSizeLoc = glGetUniformLocation(this->cullProgram, "sortSize");
+            this->blockSizeLoc = glGetUniformLocation(this->sortProgram, "blockSize");
+            this->strideLoc = glGetUniformLocation(this->sortProgram, "stride");
+        }
+    }
+
+    ParticleSystem(const ParticleSystem &) = delete;
+    ParticleSystem &operator=(const ParticleSystem &) = delete;
+
+    bool usesCompute() const {
+        return this->compute;
+    }
+
+    GLuint getCapacity() const {
+        return this->capacity;
+    }
+
+    ParticleSettings &getSettings() {
+        return this->settings;
+    }
+
+    // Replaces the ground particles bounce off
+    void setHeightfield(const ParticleHeightfield &field) {
+        this->field = field;
+        glBindTexture(GL_TEXTURE_2D, this->heightfield);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        GLfloat none = -1e30f;
+        bool empty = field.width == 0 || field.depth == 0;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, empty ? 1 : field.width, empty ? 1 : field.depth, 0, GL_RED, GL_FLOAT,
+                     empty ? &none : field.heights.data());
+        this->heightfield.setSize((empty ? 1 : field.width * field.depth) * sizeof(GLfloat));
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Emits and simulates one step on the GPU; returns the emission for a reference to replay
+    ParticleEmission update(GLfloat dt) {
+        PROFILE_SCOPE("ParticleSystem::update");
+        ParticleEmission emission = this->emitter.emit(dt, this->settings.emitRate, this->capacity);
+        const ParticleSettings &s = this->settings;
+
+        glUseProgram(this->updateProgram);
+        glUniform1f(this->deltaTimeLoc, dt);
+        glUniform4f(this->emitterLoc, s.emitter.x, s.emitter.y, s.emitter.z, s.speed);
+        glUniform3f(this->emitShapeLoc, std::cos(s.spread), s.lifetimeMin, s.lifetimeMax);
+        glUniform4ui(this->emissionLoc, emission.start, emission.count, this->capacity, emission.seed);
+        glUniform4f(this->forcesLoc, s.gravity, s.drag, s.restitution, s.friction);
+        glUniform3f(this->heightfieldOriginLoc, this->field.origin.x, this->field.origin.y, this->field.cellSize);
+        glUniform2i(this->heightfieldSizeLoc, (GLint) this->field.width, (GLint) this->field.depth);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, this->heightfield);
+        glUniform1i(this->heightfieldLoc, 0);
+
+        if (this->compute) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->buffers[0]);
+            glDispatchCompute((this->capacity + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        } else {
+            glEnable(GL_RASTERIZER_DISCARD);
+            glBindVertexArray(this->vertexArrays[this->current]);
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, this->buffers[1 - this->current]);
+            glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS, 0, this->capacity);
+            glEndTransformFeedback();
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+            glBindVertexArray(0);
+            glDisable(GL_RASTERIZER_DISCARD);
+            this->current = 1 - this->current;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return emission;
+    }
+
+    // Draws after the opaque scene: depth tested, not written
+    void draw(const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &cameraPosition) {
+        PROFILE_SCOPE("ParticleSystem::draw");
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+
+        if (this->compute) {
+            // Cull and key, then sort back to front, all without reading anything back
+            const GLuint command[4] = { 0, 1, 0, 0 };
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->indirect);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(command), command);
+            glm::mat4 viewProjection = projection * view;
+            glUseProgram(this->cullProgram);
+            glUniformMatrix4fv(this->viewProjectionLoc, 1, GL_FALSE, glm::value_ptr(viewProjection));
+            glUniform3f(this->cameraPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+            glUniform1ui(this->cullCapacityLoc, this->capacity);
+            glUniform1ui(this->sortSizeLoc, this->sortSize);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->buffers[0]);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->keys);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, this->indirect);
+            glDispatchCompute(this->sortSize / PARTICLE_GROUP_SIZE, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+            glUseProgram(this->sortProgram);
+            for (GLuint blockSize = 2; blockSize <= this->sortSize; blockSize *= 2) {
+                glUniform1ui(this->blockSizeLoc, blockSize);
+                for (GLuint stride = blockSize / 2; stride > 0; stride /= 2) {
+                    glUniform1ui(this->strideLoc, stride);
+                    glDispatchCompute(this->sortSize / PARTICLE_GROUP_SIZE, 1, 1);
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                }
+            }
+            glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+        }
+
+        glUseProgram(this->drawProgram);
+        glUniformMatrix4fv(this->viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(this->projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        glUniform1f(this->sizeLoc, this->settings.size);
+        glUniform1f(this->viewportHeightLoc, (GLfloat) viewport[3]);
+        glUniform3f(this->colorLoc, this->settings.color.x, this->settings.color.y, this->settings.color.z);
+        PROFILE_STATE_CHANGE();
+
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        glDepthMask(GL_FALSE);
+        if (this->compute) {
+            glBindVertexArray(this->drawVAO);
+            glDrawArraysIndirect(GL_POINTS, 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        } else {
+            // Additive blending is order independent, so the pool is drawn unsorted
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+            glBindVertexArray(this->vertexArrays[this->current]);
+            glDrawArrays(GL_POINTS, 0, this->capacity);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
+        PROFILE_DRAW(0);
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_PROGRAM_POINT_SIZE);
+    }
+
+    // Copies the pool back; stalls until the GPU has finished, so only for checks
+    void readBack(std::vector<Particle> &particles) {
+        particles.resize(this->capacity);
+        GLenum target = this->compute ? GL_SHADER_STORAGE_BUFFER : GL_ARRAY_BUFFER;
+        glBindBuffer(target, this->buffers[this->compute ? 0 : this->current]);
+        glGetBufferSubData(target, 0, this->capacity * sizeof(Particle), particles.data());
+        glBindBuffer(target, 0);
+    }
+
+    const ParticleHeightfield &getHeightfield() const {
+        return this->field;
+    }
+
+private:
+    ParticleSettings settings;
+    GLuint capacity;
+    GLuint sortSize = 0;
+    bool compute = false;
+    ParticleEmitter emitter;
+    ParticleHeightfield field;
+
+    BufferHandle buffers[2];            // Compute uses the first only
+    VertexArrayHandle vertexArrays[2];  // Transform feedback reads buffer i through vertex array i
+    GLuint current = 0;                 // Transform feedback: the buffer holding the latest state
+    BufferHandle keys, indirect;
+    VertexArrayHandle drawVAO;          // Attributeless, for the indirect draw
+    TextureHandle heightfield;
+    ProgramHandle updateProgram, cullProgram, sortProgram, drawProgram;
+
+    GLint deltaTimeLoc, emitterLoc, emitShapeLoc, emissionLoc, forcesLoc;
+    GLint heightfieldLoc, heightfieldOriginLoc, heightfieldSizeLoc;
+    GLint viewLoc, projLoc, sizeLoc, viewportHeightLoc, colorLoc;
+    GLint viewProjectionLoc = -1, cameraPositionLoc = -1, cullCapacityLoc = -1, sortSizeLoc = -1;
+    GLint blockSizeLoc = -1, strideLoc = -1;
+
+    static void createBuffer(BufferHandle &buffer, GLenum target, const void *data, size_t bytes, const char *label) {
+        buffer = BufferHandle::create(GPU_MEMORY_GEOMETRY, label);
+        glBindBuffer(target, buffer);
+        glBufferData(target, bytes, data, GL_DYNAMIC_COPY);
+        buffer.setSize(bytes);
+        glBindBuffer(target, 0);
+    }
+};
+
+// Steps a small pool on the GPU and with simulateParticle side by side, on a bumpy heightfield,
+// and compares the pools after PARTICLE_CHECK_STEPS steps; once for transform feedback and
+// once for compute when the context has it. Run with GameForFuns --particle-check.
+inline bool checkParticles() {
+    ParticleSettings settings;
+    settings.emitter = glm::vec3(0.5f, 2.0f, -0.5f);
+    settings.emitRate = PARTICLE_CHECK_CAPACITY / 2.0f;
+
+    ParticleHeightfield field;
+    field.origin = glm::vec2(-16.0f, -16.0f);
+    field.cellSize = 1.0f;
+    field.width = 32;
+    field.depth = 32;
+    for (GLuint z = 0; z < field.depth; z++) {
+        for (GLuint x = 0; x < field.width; x++) {
+            field.heights.push_back((GLfloat) ((x * 7 + z * 3) % 5) * 0.25f - 1.0f);
+        }
+    }
+
+    bool passed = true;
+    for (GLuint path = 0; path < 2; path++) {
+        if (path == 1 && !GLEW_VERSION_4_3) {
+            std::cout << "SKIPPED  compute: the context has no GL 4.3" << std::endl;
+            break;
+        }
+        ParticleSystem system(PARTICLE_CHECK_CAPACITY, settings, path == 1);
+        system.setHeightfield(field);
+        std::vector<Particle> reference(PARTICLE_CHECK_CAPACITY);
+        GLfloat dt = 1.0f / 60.0f;
+        for (GLuint step = 0; step < PARTICLE_CHECK_STEPS; step++) {
+            ParticleEmission emission = system.update(dt);
+            for (GLuint i = 0; i < PARTICLE_CHECK_CAPACITY; i++) {
+                simulateParticle(reference[i], i, settings, emission, PARTICLE_CHECK_CAPACITY, field, dt);
+            }
+        }
+
+        std::vector<Particle> gpu;
+        system.readBack(gpu);
+        GLuint agreeing = 0, alive = 0;
+        GLfloat maxError = 0.0f;
+        for (GLuint i = 0; i < PARTICLE_CHECK_CAPACITY; i++) {
+            const Particle &a = gpu[i], &b = reference[i];
+            GLfloat error = std::max(glm::length(a.position - b.position) / (1.0f + glm::length(b.position)),
+                                     std::fabs(a.lifetime - b.lifetime) / (1.0f + b.lifetime));
+            maxError = std::max(maxError, error);
+            agreeing += error <= PARTICLE_CHECK_EPSILON && a.isAlive() == b.isAlive() ? 1 : 0;
+            alive += b.isAlive() ? 1 : 0;
+        }
+        bool ok = alive > 0 && agreeing >= PARTICLE_CHECK_AGREEMENT * PARTICLE_CHECK_CAPACITY;
+        std::cout << (ok ? "OK       " : "FAILED   ") << (path == 1 ? "compute" : "transform feedback") << ": " << agreeing << " of "
+                  << PARTICLE_CHECK_CAPACITY << " particles agree with the reference, " << alive << " alive, largest error " << maxError
+                  << std::endl;
+        passed = passed && ok;
+    }
+    return passed;
+}
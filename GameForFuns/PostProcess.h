@@ -0,0 +1,324 @@
+//
+//  PostProcess.h
+//  GameForFuns
+//
+//  Fullscreen passes between the HDR scene and the screen, added to the
+//  frame's RenderGraph:
+//
+//    scene -> bloom downsample 0..n -> bloom upsample n-1..0
+//          -> tonemap (scene, bloom, exposure) -> color grading (3D LUT) -> FXAA -> screen
+//
+//  Every target is a transient texture of the graph, so the LDR targets share
+//  the pool with each other and with whatever else the frame draws.
+//
+//  Bloom runs down a mip chain of targets, each half the size of the one
+//  before, with the 13-tap filter from Call of Duty: Advanced Warfare (a Karis
+//  average on the first level keeps single bright pixels from flickering),
+//  then back up with a 3x3 tent blended onto each level. The levels are
+//  separate targets rather than one texture's mips, so no pass ever samples
+//  the texture it draws into.
+//
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "DynamicResolution.h"
+#include "GpuResources.h"
+#include "HdrPipeline.h"
+#include "Profiler.h"
+#include "RenderGraph.h"
+#include "Shader.h"
+
+const GLuint BLOOM_LEVELS = 6;
+const GLuint GRADING_LUT_SIZE = 32;
+
+struct PostSettings {
+    GLfloat bloomStrength = 0.04f;  // Share of the blurred scene mixed into the scene
+    GLfloat bloomRadius = 1.0f;     // Of the upsampling tent, in texels of the smaller level
+    GLuint bloomLevels = BLOOM_LEVELS;
+    bool fxaa = true;
+};
+
+// A display space grade: gain and lift, then saturation around Rec. 709 luma, then contrast around middle grey
+struct GradingSettings {
+    glm::vec3 lift = glm::vec3(0.0f);
+    glm::vec3 gain = glm::vec3(1.0f);
+    GLfloat saturation = 1.0f;
+    GLfloat contrast = 1.0f;
+};
+
+// Bakes a grade into size^3 RGB texels, red varying fastest as in a 3D texture
+inline std::vector<GLfloat> bakeGradingLut(const GradingSettings &settings, GLuint size) {
+    std::vector<GLfloat> texels;
+    texels.reserve(size * size * size * 3);
+    for (GLuint b = 0; b < size; b++) {
+        for (GLuint g = 0; g < size; g++) {
+            for (GLuint r = 0; r < size; r++) {
+                glm::vec3 color = glm::vec3((GLfloat) r, (GLfloat) g, (GLfloat) b) / (GLfloat) (size - 1);
+                color = color * settings.gain + settings.lift * (glm::vec3(1.0f) - color);
+                GLfloat luma = color.x * HDR_LUMA_R + color.y * HDR_LUMA_G + color.z * HDR_LUMA_B;
+                color = glm::vec3(luma) + (color - glm::vec3(luma)) * settings.saturation;
+                color = (color - glm::vec3(0.5f)) * settings.contrast + glm::vec3(0.5f);
+                texels.push_back(std::min(std::max(color.x, 0.0f), 1.0f));
+                texels.push_back(std::min(std::max(color.y, 0.0f), 1.0f));
+                texels.push_back(std::min(std::max(color.z, 0.0f), 1.0f));
+            }
+        }
+    }
+    return texels;
+}
+
+// Reads an Adobe .cube 3D LUT, as exported by most grading tools
+inline bool loadCubeLut(const std::string &path, GLuint &size, std::vector<GLfloat> &texels) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "ERROR::POST::LUT_NOT_READ " << path << std::endl;
+        return false;
+    }
+    size = 0;
+    texels.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream words(line);
+        std::string first;
+        if (!(words >> first) || first[0] == '#') {
+            continue;
+        }
+        if (first == "LUT_3D_SIZE") {
+            words >> size;
+        } else if ((first[0] >= '0' && first[0] <= '9') || first[0] == '-' || first[0] == '.') {
+            GLfloat g, b;
+            words >> g >> b;
+            texels.push_back(std::stof(first));
+            texels.push_back(g);
+            texels.push_back(b);
+        } // TITLE, DOMAIN_MIN and DOMAIN_MAX are ignored
+    }
+    if (size < 2 || texels.size() != (size_t) size * size * size * 3) {
+        std::cout << "ERROR::POST::LUT_INVALID " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+class PostProcessChain {
+public:
+    PostProcessChain(const PostSettings &settings = PostSettings()): settings(settings) {
+        this->downsampleProgram = linkProgram({ { GL_VERTEX_SHADER, "res/shaders/fullscreen.vs" },
+                                                { GL_FRAGMENT_SHADER, "res/shaders/bloomDownsample.frag" } });
+        this->upsampleProgram = linkProgram({ { GL_VERTEX_SHADER, "res/shaders/fullscreen.vs" },
+                                              { GL_FRAGMENT_SHADER, "res/shaders/bloomUpsample.frag" } });
+        this->tonemapProgram = linkProgram({ { GL_VERTEX_SHADER, "res/shaders/fullscreen.vs" },
+                                             { GL_FRAGMENT_SHADER, "res/shaders/tonemap.frag" } });
+        this->gradingProgram = linkProgram({ { GL_VERTEX_SHADER, "res/shaders/fullscreen.vs" },
+                                             { GL_FRAGMENT_SHADER, "res/shaders/grading.frag" } });
+        this->fxaaProgram = linkProgram({ { GL_VERTEX_SHADER, "res/shaders/fullscreen.vs" },
+                                          { GL_FRAGMENT_SHADER, "res/shaders/fxaa.frag" } });
+        this->lut = TextureHandle::create(GPU_MEMORY_TEXTURES, "Grading LUT");
+        GradingSettings grade;
+        this->setGradingLut(GRADING_LUT_SIZE, bakeGradingLut(grade, GRADING_LUT_SIZE));
+    }
+
+    PostProcessChain(const PostProcessChain &) = delete;
+    PostProcessChain &operator=(const PostProcessChain &) = delete;
+
+    // Replaces the grade with size^3 RGB texels, red varying fastest
+    void setGradingLut(GLuint size, const std::vector<GLfloat> &texels) {
+        this->lutSize = size;
+        glBindTexture(GL_TEXTURE_3D, this->lut);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, size, size, size, 0, GL_RGB, GL_FLOAT, texels.data());
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        this->lut.setSize((size_t) size * size * size * 6);
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+
+    // Adds bloom, tonemapping, grading and FXAA from hdr's scene, exposed by the Exposure pass's
+    // result, into output. Returns the version of output they leave
+    RenderResource addPasses(RenderGraph &graph, HdrPipeline &hdr, RenderResource scene, RenderResource exposure,
+                             RenderResource output) {
+        this->hdr = &hdr;
+        return describe(graph, scene, exposure, output, this->settings, this);
+    }
+
+    PostSettings &getSettings() {
+        return this->settings;
+    }
+
+    // Adds the chain's targets and passes to graph, at the scene's size. Only executing the graph
+    // touches chain, so a null chain describes the same passes without a context, for checks
+    static RenderResource describe(RenderGraph &graph, RenderResource scene, RenderResource exposure, RenderResource output,
+                                   const PostSettings &settings, PostProcessChain *chain) {
+        GLint width = graph.getDesc(scene).width, height = graph.getDesc(scene).height;
+        std::vector<RenderResource> bloom;
+        RenderTargetDesc level = { width, height, GL_R11F_G11F_B10F };
+        while (bloom.size() < settings.bloomLevels && std::min(level.width, level.height) > 1) {
+            level.width = std::max(level.width / 2, 1);
+            level.height = std::max(level.height / 2, 1);
+            bloom.push_back(graph.createTexture("Bloom", level));
+        }
+        RenderTargetDesc ldr = { width, height, GL_RGBA8 };
+
+        for (size_t i = 0; i < bloom.size(); i++) {
+            RenderResource source = i == 0 ? scene : bloom[i - 1];
+            bool karisAverage = i == 0;
+            bloom[i] = graph.addPass("Bloom downsample", [chain, source, karisAverage](RenderGraph &g) {
+                chain->downsample(g, source, karisAverage);
+            }).read(source).write(bloom[i]);
+        }
+        RenderState additive;
+        additive.blend = RENDER_BLEND_ADDITIVE;
+        for (size_t i = bloom.size(); i-- > 1;) {
+            RenderResource source = bloom[i];
+            bloom[i - 1] = graph.addPass("Bloom upsample", [chain, source](RenderGraph &g) {
+                chain->upsample(g, source);
+            }).setState(additive).read(source).write(bloom[i - 1]);
+        }
+        RenderResource blurred = bloom.empty() ? scene : bloom[0];
+        RenderResource tonemapped = graph.addPass("Tonemap", [chain, scene, blurred](RenderGraph &g) {
+            chain->tonemap(g, scene, blurred);
+        }).read(scene).read(blurred).read(exposure).write(graph.createTexture("Tonemapped", ldr));
+        RenderResource graded = graph.addPass("Color grading", [chain, tonemapped](RenderGraph &g) {
+            chain->grade(g, tonemapped);
+        }).read(tonemapped).write(settings.fxaa ? graph.createTexture("Graded", ldr) : output);
+        if (!settings.fxaa) {
+            return graded;
+        }
+        return graph.addPass("FXAA", [chain, graded](RenderGraph &g) {
+            chain->antialias(g, graded);
+        }).read(graded).write(output);
+    }
+
+private:
+    PostSettings settings;
+    HdrPipeline *hdr = nullptr;  // Set by addPasses for the tonemap
+    TextureHandle lut;
+    GLuint lutSize = 0;
+    ProgramHandle downsampleProgram, upsampleProgram, tonemapProgram, gradingProgram, fxaaProgram;
+
+    static void bindTexture(GLuint unit, GLenum target, GLuint texture, GLuint program, const char *name) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, texture);
+        glUniform1i(glGetUniformLocation(program, name), (GLint) unit);
+    }
+
+    static void setTexelSize(GLuint program, const RenderTargetDesc &desc, GLfloat scale) {
+        glUniform2f(glGetUniformLocation(program, "texelSize"), scale / desc.width, scale / desc.height);
+    }
+
+    void downsample(RenderGraph &g, RenderResource source, bool karisAverage) {
+        glUseProgram(this->downsampleProgram);
+        bindTexture(0, GL_TEXTURE_2D, g.getTexture(source), this->downsampleProgram, "source");
+        setTexelSize(this->downsampleProgram, g.getDesc(source), 1.0f);
+        glUniform1i(glGetUniformLocation(this->downsampleProgram, "karisAverage"), karisAverage);
+        PROFILE_STATE_CHANGE();
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        PROFILE_DRAW(1);
+    }
+
+    void upsample(RenderGraph &g, RenderResource source) {
+        glUseProgram(this->upsampleProgram);
+        bindTexture(0, GL_TEXTURE_2D, g.getTexture(source), this->upsampleProgram, "source");
+        setTexelSize(this->upsampleProgram, g.getDesc(source), this->settings.bloomRadius);
+        PROFILE_STATE_CHANGE();
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        PROFILE_DRAW(1);
+    }
+
+    void tonemap(RenderGraph &g, RenderResource scene, RenderResource bloom) {
+        const HdrSettings &s = this->hdr->getSettings();
+        glUseProgram(this->tonemapProgram);
+        bindTexture(0, GL_TEXTURE_2D, g.getTexture(scene), this->tonemapProgram, "scene");
+        bindTexture(1, GL_TEXTURE_2D, g.getTexture(bloom), this->tonemapProgram, "bloom");
+        bindTexture(2, GL_TEXTURE_2D, this->hdr->getAdaptedLuminance(), this->tonemapProgram, "adaptedLuminance");
+        glUniform1f(glGetUniformLocation(this->tonemapProgram, "bloomStrength"), this->settings.bloomStrength);
+        glUniform2f(glGetUniformLocation(this->tonemapProgram, "exposure"), s.key, s.compensation);
+        glUniform2f(glGetUniformLocation(this->tonemapProgram, "curve"), s.whitePoint, 1.0f / s.gamma);
+        PROFILE_STATE_CHANGE();
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        PROFILE_DRAW(1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void grade(RenderGraph &g, RenderResource source) {
+        glUseProgram(this->gradingProgram);
+        bindTexture(0, GL_TEXTURE_2D, g.getTexture(source), this->gradingProgram, "source");
+        bindTexture(2, GL_TEXTURE_3D, this->lut, this->gradingProgram, "lut");
+        glUniform1f(glGetUniformLocation(this->gradingProgram, "lutSize"), (GLfloat) this->lutSize);
+        PROFILE_STATE_CHANGE();
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        PROFILE_DRAW(1);
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+
+    void antialias(RenderGraph &g, RenderResource source) {
+        glUseProgram(this->fxaaProgram);
+        bindTexture(0, GL_TEXTURE_2D, g.getTexture(source), this->fxaaProgram, "source");
+        setTexelSize(this->fxaaProgram, g.getDesc(source), 1.0f);
+        PROFILE_STATE_CHANGE();
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        PROFILE_DRAW(1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
+
+// Compiles the chain without a context: it must give each bloom level and both LDR targets a
+// texture of their own, or one fewer without FXAA, and cull none of its passes. Behind the game's
+// upscale the graded target must then reuse the spent upscaled scene, so the pool is smaller
+// than its targets. Run with GameForFuns --post-check; --render-graph-check covers the pool itself.
+inline bool checkPostProcess() {
+    bool passed = true;
+    auto report = [&passed](bool ok, const std::string &what) {
+        std::cout << (ok ? "OK       " : "FAILED   ") << what << std::endl;
+        passed = passed && ok;
+    };
+    auto sizes = [](const RenderGraph &graph) {
+        return std::to_string(graph.getPassCount()) + " passes in " + std::to_string(graph.getPhysicalCount()) + " textures, "
+               + std::to_string(graph.getPhysicalBytes() / 1024) + " KB for " + std::to_string(graph.getTransientBytes() / 1024)
+               + " KB of targets, peak " + std::to_string(graph.getPeakBytes() / 1024) + " KB";
+    };
+
+    for (bool fxaa : { true, false }) {
+        PostSettings settings;
+        settings.fxaa = fxaa;
+        RenderGraph graph;
+        RenderResource scene = graph.importTexture("HDR scene color", 0, { 1920, 1080, GL_RGBA16F });
+        RenderResource exposure = graph.importTexture("Adapted luminance", 0, { 1, 1, GL_R32F });
+        PostProcessChain::describe(graph, scene, exposure, graph.importOutput("Screen"), settings, nullptr);
+        graph.compile();
+        GLuint expected = BLOOM_LEVELS + (fxaa ? 2 : 1);
+        report(graph.getPhysicalCount() == expected && graph.getOrder().size() == graph.getPassCount(),
+               std::string(fxaa ? "chain: " : "chain without FXAA: ") + sizes(graph));
+    }
+
+    // As main.cpp builds it: the scene is upscaled into a transient target, measured, then post-processed
+    {
+        RenderGraph graph;
+        RenderResource scene = graph.importTexture("HDR scene color", 0, { 1920, 1080, GL_RGBA16F });
+        RenderResource upscaled = DynamicResolution::describeUpscale(graph, scene, nullptr);
+        RenderResource exposure = graph.addPass("Exposure", nullptr).read(upscaled)
+                                       .write(graph.importTexture("Adapted luminance", 0, { 1, 1, GL_R32F }), ACCESS_FRAMEBUFFER);
+        PostProcessChain::describe(graph, upscaled, exposure, graph.importOutput("Screen"), PostSettings(), nullptr);
+        graph.compile();
+        report(graph.getPhysicalCount() == BLOOM_LEVELS + 2 && graph.getPhysicalBytes() < graph.getTransientBytes()
+               && graph.getOrder().size() == graph.getPassCount(),
+               "game chain: " + sizes(graph));
+    }
+    return passed;
+}
@@ -0,0 +1,442 @@
+//
+//  Profiler.h
+//  GameForFuns
+//
+//  Frame profiler: RAII CPU scopes, double-buffered GL_TIME_ELAPSED queries,
+//  a ring buffer of per-frame stats, Chrome trace export and an overlay graph.
+//
+//  Build with PROFILER_ENABLED=0 to compile every PROFILE_* macro to nothing.
+//
+#pragma once
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Shader.h"
+
+const GLuint PROFILER_MAX_EVENTS = 4096;     // CPU scopes per frame
+const GLuint PROFILER_MAX_GPU_SCOPES = 32;   // GPU scopes per frame
+const GLuint PROFILER_FRAMES_IN_FLIGHT = 2;  // GPU query sets, read back one frame late
+const GLuint PROFILER_HISTORY = 240;         // Frames kept in the stats ring buffer
+
+struct ProfileEvent {
+    const char *name;   // A string literal or a name from Profiler::intern, never copied
+    GLuint threadId;
+    GLuint depth;
+    double startUs;
+    double endUs;
+};
+
+struct FrameStats {
+    GLuint frameIndex = 0;
+    GLfloat cpuMs = 0.0f;   // Wall time between beginFrame and endFrame
+    GLfloat gpuMs = 0.0f;   // Sum of the GPU scopes, from PROFILER_FRAMES_IN_FLIGHT frames ago
+    GLuint drawCalls = 0;
+    GLuint triangles = 0;
+    GLuint stateChanges = 0;
+};
+
+class Profiler {
+public:
+    static Profiler &get() {
+        static Profiler instance;
+        return instance;
+    }
+
+    double nowUs() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - this->epoch).count();
+    }
+
+    void beginFrame() {
+        this->eventCount.store(0, std::memory_order_relaxed);
+        this->current = FrameStats();
+        this->current.frameIndex = this->frameIndex;
+        this->frameStartUs = this->nowUs();
+
+        if (this->gpuReady) {
+            this->gpuScopeCount[this->frameIndex % PROFILER_FRAMES_IN_FLIGHT] = 0;
+        }
+    }
+
+    void endFrame() {
+        this->current.cpuMs = (GLfloat) ((this->nowUs() - this->frameStartUs) / 1000.0);
+        this->current.gpuMs = this->collectGpuResults();
+
+        this->history[this->frameIndex % PROFILER_HISTORY] = this->current;
+
+        if (this->capturing) {
+            GLuint count = std::min(this->eventCount.load(std::memory_order_acquire), PROFILER_MAX_EVENTS);
+            this->captured.insert(this->captured.end(), this->events, this->events + count);
+            if (--this->captureFramesLeft == 0) {
+                this->capturing = false;
+                this->exportChromeTrace(this->capturePath);
+            }
+        }
+
+        this->frameIndex++;
+    }
+
+    // CPU events are written lock-free so scopes may be opened from worker threads
+    GLuint beginEvent(const char *name, GLuint depth) {
+        GLuint slot = this->eventCount.fetch_add(1, std::memory_order_relaxed);
+        if (slot >= PROFILER_MAX_EVENTS) {
+            return PROFILER_MAX_EVENTS;
+        }
+        ProfileEvent &event = this->events[slot];
+        event.name = name;
+        event.threadId = threadIndex();
+        event.depth = depth;
+        event.startUs = this->nowUs();
+        event.endUs = event.startUs;
+        return slot;
+    }
+
+    void endEvent(GLuint slot) {
+        if (slot < PROFILER_MAX_EVENTS) {
+            this->events[slot].endUs = this->nowUs();
+        }
+    }
+
+    // A copy of name that lives as long as the profiler, for scopes named at run time, so a
+    // captured trace never points into a string freed before it is exported. A name seen
+    // before returns the same pointer without allocating.
+    const char *intern(const std::string &name) {
+        std::lock_guard<std::mutex> lock(this->internMutex);
+        return this->interned.insert(name).first->c_str();
+    }
+
+    // GL_TIME_ELAPSED queries cannot nest, so GPU scopes must be siblings
+    void initGpuQueries() {
+        for (GLuint i = 0; i < PROFILER_FRAMES_IN_FLIGHT; i++) {
+            glGenQueries(PROFILER_MAX_GPU_SCOPES, this->gpuQueries[i]);
+            this->gpuScopeCount[i] = 0;
+        }
+        this->gpuReady = true;
+    }
+
+    void destroyGpuQueries() {
+        if (!this->gpuReady) {
+            return;
+        }
+        for (GLuint i = 0; i < PROFILER_FRAMES_IN_FLIGHT; i++) {
+            glDeleteQueries(PROFILER_MAX_GPU_SCOPES, this->gpuQueries[i]);
+        }
+        this->gpuReady = false;
+    }
+
+    GLuint beginGpuScope() {
+        GLuint set = this->frameIndex % PROFILER_FRAMES_IN_FLIGHT;
+        if (!this->gpuReady || this->gpuScopeCount[set] >= PROFILER_MAX_GPU_SCOPES) {
+            return PROFILER_MAX_GPU_SCOPES;
+        }
+        GLuint slot = this->gpuScopeCount[set]++;
+        glBeginQuery(GL_TIME_ELAPSED, this->gpuQueries[set][slot]);
+        return slot;
+    }
+
+    void endGpuScope(GLuint slot) {
+        if (slot < PROFILER_MAX_GPU_SCOPES) {
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+    }
+
+    void countDraw(GLuint triangles) {
+        this->current.drawCalls++;
+        this->current.triangles += triangles;
+    }
+
+    void countStateChange() {
+        this->current.stateChanges++;
+    }
+
+    // Records the next frameCount frames and writes them to path when done
+    void captureTrace(const std::string &path, GLuint frameCount) {
+        this->captured.clear();
+        this->captured.reserve(frameCount * 64);
+        this->capturePath = path;
+        this->captureFramesLeft = frameCount;
+        this->capturing = frameCount > 0;
+    }
+
+    bool exportChromeTrace(const std::string &path) const {
+        std::ofstream out(path);
+        if (!out) {
+            std::cout << "ERROR::PROFILER::COULD_NOT_WRITE_TRACE " << path << std::endl;
+            return false;
+        }
+
+        out << "{\"traceEvents\":[";
+        for (size_t i = 0; i < this->captured.size(); i++) {
+            const ProfileEvent &event = this->captured[i];
+            out << (i ? ",\n" : "\n")
+                << "{\"name\":";
+            writeJsonString(out, event.name);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.threadId
+                << ",\"ts\":" << event.startUs << ",\"dur\":" << (event.endUs - event.startUs) << "}";
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+        std::cout << "Profiler: wrote " << this->captured.size() << " events to " << path << std::endl;
+        return true;
+    }
+
+    const FrameStats &getFrame(GLuint framesAgo) const {
+        GLuint index = this->frameIndex + PROFILER_HISTORY - 1 - (framesAgo % PROFILER_HISTORY);
+        return this->history[index % PROFILER_HISTORY];
+    }
+
+    const FrameStats &getLastFrame() const {
+        return this->getFrame(0);
+    }
+
+    bool isCapturing() const {
+        return this->capturing;
+    }
+
+    GLuint getFrameIndex() const {
+        return this->frameIndex;
+    }
+
+    GLuint getEventCount() const {
+        return std::min(this->eventCount.load(std::memory_order_acquire), PROFILER_MAX_EVENTS);
+    }
+
+    const ProfileEvent *getEvents() const {
+        return this->events;
+    }
+
+    // Depth of the innermost open CPU scope on the calling thread
+    static GLuint &scopeDepth() {
+        thread_local GLuint depth = 0;
+        return depth;
+    }
+
+private:
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    GLuint frameIndex = 0;
+    double frameStartUs = 0.0;
+    FrameStats current;
+    FrameStats history[PROFILER_HISTORY];
+
+    ProfileEvent events[PROFILER_MAX_EVENTS];
+    std::atomic<GLuint> eventCount{0};
+
+    bool gpuReady = false;
+    GLuint gpuQueries[PROFILER_FRAMES_IN_FLIGHT][PROFILER_MAX_GPU_SCOPES];
+    GLuint gpuScopeCount[PROFILER_FRAMES_IN_FLIGHT];
+    GLfloat lastGpuMs = 0.0f;
+
+    bool capturing = false;
+    GLuint captureFramesLeft = 0;
+    std::string capturePath;
+    std::vector<ProfileEvent> captured;
+
+    std::mutex internMutex;
+    std::set<std::string> interned;
+
+    Profiler() {}
+
+    // Reads the query set issued PROFILER_FRAMES_IN_FLIGHT - 1 frames ago, and only once the
+    // driver reports it available, so this never stalls. Otherwise the last result is repeated.
+    GLfloat collectGpuResults() {
+        if (!this->gpuReady) {
+            return 0.0f;
+        }
+
+        GLuint set = (this->frameIndex + 1) % PROFILER_FRAMES_IN_FLIGHT;
+        GLuint count = this->gpuScopeCount[set];
+        if (count == 0 || this->frameIndex + 1 < PROFILER_FRAMES_IN_FLIGHT) {
+            return this->lastGpuMs;
+        }
+
+        GLint available = 0;
+        glGetQueryObjectiv(this->gpuQueries[set][count - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return this->lastGpuMs;
+        }
+
+        GLuint64 totalNs = 0;
+        for (GLuint i = 0; i < count; i++) {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(this->gpuQueries[set][i], GL_QUERY_RESULT, &elapsed);
+            totalNs += elapsed;
+        }
+        this->lastGpuMs = (GLfloat) (totalNs / 1.0e6);
+        return this->lastGpuMs;
+    }
+
+    // Interned names such as render pass names may hold quotes, backslashes or control characters
+    static void writeJsonString(std::ostream &out, const char *text) {
+        const char *hex = "0123456789abcdef";
+        out << '"';
+        for (const char *c = text; *c; c++) {
+            unsigned char byte = (unsigned char) *c;
+            if (byte == '"' || byte == '\\') {
+                out << '\\' << *c;
+            } else if (byte < 0x20) {
+                out << "\\u00" << hex[byte >> 4] << hex[byte & 15];
+            } else {
+                out << *c;
+            }
+        }
+        out << '"';
+    }
+
+    static GLuint threadIndex() {
+        static std::atomic<GLuint> nextId{0};
+        thread_local GLuint id = nextId.fetch_add(1);
+        return id;
+    }
+};
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char *name) {
+        GLuint &depth = Profiler::scopeDepth();
+        this->slot = Profiler::get().beginEvent(name, depth++);
+    }
+
+    ~ProfileScope() {
+        Profiler::get().endEvent(this->slot);
+        Profiler::scopeDepth()--;
+    }
+
+private:
+    GLuint slot;
+};
+
+// The name only labels the scope where it is opened: GPU times are summed into the frame's total
+class GpuProfileScope {
+public:
+    explicit GpuProfileScope(const char *) {
+        this->slot = Profiler::get().beginGpuScope();
+    }
+
+    ~GpuProfileScope() {
+        Profiler::get().endGpuScope(this->slot);
+    }
+
+private:
+    GLuint slot;
+};
+
+// Bar graph of the last PROFILER_HISTORY frames: CPU time in the lower half of each bar, GPU time stacked on top
+class ProfilerOverlay {
+public:
+    void init() {
+        this->shader = new Shader("res/shaders/profiler.vs", "res/shaders/profiler.frag");
+
+        glGenVertexArrays(1, &this->VAO);
+        glGenBuffers(1, &this->VBO);
+        glBindVertexArray(this->VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(this->vertices), NULL, GL_STREAM_DRAW);
+
+        // Position
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *) 0);
+
+        // Color
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *) (2 * sizeof(GLfloat)));
+        glBindVertexArray(0);
+    }
+
+    void destroy() {
+        glDeleteVertexArrays(1, &this->VAO);
+        glDeleteBuffers(1, &this->VBO);
+        delete this->shader;
+        this->shader = nullptr;
+    }
+
+    // Graph occupies the bottom-left corner; budgetMs maps to the top of the graph
+    void draw(const Profiler &profiler, GLfloat budgetMs = 33.3f) {
+        GLuint count = 0;
+        const GLfloat width = 0.8f, height = 0.4f;
+        const GLfloat barWidth = width / PROFILER_HISTORY;
+
+        for (GLuint i = 0; i < PROFILER_HISTORY; i++) {
+            const FrameStats &stats = profiler.getFrame(PROFILER_HISTORY - 1 - i);
+            GLfloat x = -0.98f + i * barWidth;
+            GLfloat cpu = std::min(stats.cpuMs / budgetMs, 1.0f) * height;
+            GLfloat gpu = std::min(stats.gpuMs / budgetMs, 1.0f) * height;
+
+            count = this->addBar(count, x, -0.98f, barWidth, cpu, 0.2f, 0.8f, 0.2f);
+            count = this->addBar(count, x, -0.98f + cpu, barWidth, gpu, 0.9f, 0.5f, 0.1f);
+        }
+
+        // 16.6 ms reference line
+        GLfloat line = -0.98f + std::min(16.6f / budgetMs, 1.0f) * height;
+        count = this->addBar(count, -0.98f, line, width, 0.004f, 1.0f, 1.0f, 1.0f);
+
+        glDisable(GL_DEPTH_TEST);
+        this->shader->Use();
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(this->vertices), NULL, GL_STREAM_DRAW); // Orphan last frame's data
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * 5 * sizeof(GLfloat), this->vertices);
+        glBindVertexArray(this->VAO);
+        glDrawArrays(GL_TRIANGLES, 0, count);
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+private:
+    static const GLuint MAX_VERTICES = (PROFILER_HISTORY * 2 + 1) * 6;
+
+    Shader *shader = nullptr;
+    GLuint VAO = 0, VBO = 0;
+    GLfloat vertices[MAX_VERTICES * 5];
+
+    GLuint addBar(GLuint count, GLfloat x, GLfloat y, GLfloat w, GLfloat h, GLfloat r, GLfloat g, GLfloat b) {
+        if (h <= 0.0f) {
+            return count;
+        }
+        const GLfloat corners[6][2] = {
+            {x, y}, {x + w, y}, {x + w, y + h},
+            {x + w, y + h}, {x, y + h}, {x, y}
+        };
+        for (GLuint i = 0; i < 6; i++) {
+            GLfloat *v = &this->vertices[(count + i) * 5];
+            v[0] = corners[i][0];
+            v[1] = corners[i][1];
+            v[2] = r;
+            v[3] = g;
+            v[4] = b;
+        }
+        return count + 6;
+    }
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if PROFILER_ENABLED
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+#define PROFILE_BEGIN_FRAME() Profiler::get().beginFrame()
+#define PROFILE_END_FRAME() Profiler::get().endFrame()
+#define PROFILE_DRAW(triangles) Profiler::get().countDraw(triangles)
+#define PROFILE_STATE_CHANGE() Profiler::get().countStateChange()
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(name)
+#define PROFILE_BEGIN_FRAME()
+#define PROFILE_END_FRAME()
+#define PROFILE_DRAW(triangles)
+#define PROFILE_STATE_CHANGE()
+#endif
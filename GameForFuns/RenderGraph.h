@@ -0,0 +1,863 @@
+//
+//  RenderGraph.h
+//  GameForFuns
+//
+//  A frame as a graph of passes. Each pass declares the resources it reads
+//  and writes and the depth and blend state it draws with, and the graph does
+//  the binding, state changes and scheduling that used to be hand-ordered GL
+//  calls. Writing a resource makes a new version of it, so a pass that reads
+//  an old version runs before the pass that overwrites it, whatever order the
+//  two were added in. Compiling
+//
+//    - orders the passes topologically, keeping the order they were added in
+//      wherever the dependencies leave a choice,
+//    - culls every pass whose results reach neither the output nor a pass
+//      marked as having side effects,
+//    - gives each transient texture memory only from its first pass to its
+//      last: textures of the same size and format whose lifetimes do not
+//      overlap share one from the pool, so a chain of LDR passes ping-pongs
+//      between two however long it gets, and an LDR texture may take a spent
+//      HDR one of its size,
+//    - and puts a glMemoryBarrier before any pass touching what an earlier one
+//      wrote with image stores or storage buffers, with just the bits its
+//      accesses need. Draws into attachments are ordered by GL itself.
+//
+//  A texture's extent is the corner of it that passes draw into and read,
+//  the whole texture unless set otherwise. It may change every frame without
+//  recompiling, which is how dynamic resolution scales the scene.
+//
+//  None of that needs a GL context, so --render-graph-check compiles graphs
+//  headless and checks their order, culling, barriers and memory peaks.
+//  realize then creates the pooled textures and a framebuffer per pass.
+//
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "GpuResources.h"
+#include "Profiler.h"
+
+const GLuint RENDER_GRAPH_NONE = (GLuint) -1;  // No pass, no version, or a texture no pass uses
+const GLuint RENDER_GRAPH_MAX_COLOR = 4;        // Color attachments of one pass
+const GLuint RENDER_GRAPH_CHECK_EXTRA_PASSES = 16;
+
+// How a pass uses a resource. Images and storage buffers may be read or written, the last three are writes
+enum RenderAccess {
+    ACCESS_SAMPLED,      // Texture fetches
+    ACCESS_IMAGE,        // Image loads, or stores when written
+    ACCESS_STORAGE,      // A shader storage buffer
+    ACCESS_INDIRECT,     // Draw or dispatch arguments
+    ACCESS_VERTEX,       // Vertex attributes
+    ACCESS_READBACK,     // glGetTexImage or glGetBufferSubData
+    ACCESS_COLOR,        // A color attachment of the framebuffer the graph binds
+    ACCESS_DEPTH,        // Its depth attachment
+    ACCESS_FRAMEBUFFER   // Through framebuffers the pass binds itself
+};
+
+enum RenderBlend {
+    RENDER_BLEND_OFF,
+    RENDER_BLEND_ALPHA,
+    RENDER_BLEND_ADDITIVE  // ONE, ONE
+};
+
+// Set before each pass runs. The default suits fullscreen passes
+struct RenderState {
+    bool depthTest = false;
+    bool depthWrite = false;
+    GLenum depthFunc = GL_LESS;
+    RenderBlend blend = RENDER_BLEND_OFF;
+};
+
+// What the scene has always been drawn with: depth tested and written, alpha blended
+const RenderState RENDER_STATE_SCENE = { true, true, GL_LESS, RENDER_BLEND_ALPHA };
+
+struct RenderTargetDesc {
+    GLint width = 0, height = 0;
+    GLenum format = GL_RGBA8;
+
+    bool operator==(const RenderTargetDesc &other) const {
+        return this->width == other.width && this->height == other.height && this->format == other.format;
+    }
+
+    bool isDepth() const {
+        return this->format == GL_DEPTH_COMPONENT16 || this->format == GL_DEPTH_COMPONENT24
+            || this->format == GL_DEPTH_COMPONENT32F || this->format == GL_DEPTH24_STENCIL8;
+    }
+
+    size_t getBytes() const {
+        size_t pixelBytes = this->format == GL_RGBA16F ? 8 : this->format == GL_RGBA32F ? 16 : 4;
+        return (size_t) this->width * this->height * pixelBytes;
+    }
+
+    // Whether a texture made for this can stand in for other: the same size, so readers' texture
+    // coordinates still cover it, and a color format holding other's channels at least as precisely
+    bool canHost(const RenderTargetDesc &other) const {
+        if (this->width != other.width || this->height != other.height) {
+            return false;
+        }
+        if (this->format == other.format) {
+            return true;
+        }
+        bool narrower = other.format == GL_RGBA8 || other.format == GL_R11F_G11F_B10F;
+        return (this->format == GL_RGBA16F && narrower) || (this->format == GL_RGBA32F && (narrower || other.format == GL_RGBA16F));
+    }
+};
+
+// One version of a resource of the graph, as created, imported or written
+struct RenderResource {
+    GLuint index = RENDER_GRAPH_NONE;
+    GLuint version = 0;
+};
+
+class RenderGraph {
+public:
+    typedef std::function<void(RenderGraph &)> Execute;
+
+    // Declares what a pass uses; only valid until the next pass is added
+    class PassBuilder {
+    public:
+        PassBuilder(RenderGraph &graph, GLuint pass): graph(graph), pass(pass) {}
+
+        PassBuilder &read(RenderResource resource, RenderAccess access = ACCESS_SAMPLED) {
+            this->graph.addAccess(this->pass, resource, access, false);
+            return *this;
+        }
+
+        // Writes the latest version of resource and returns the version the pass leaves
+        RenderResource write(RenderResource resource, RenderAccess access = ACCESS_COLOR) {
+            return this->graph.addAccess(this->pass, resource, access, true);
+        }
+
+        PassBuilder &setState(const RenderState &state) {
+            this->graph.passes[this->pass].state = state;
+            return *this;
+        }
+
+        // Clearing an attachment first means the pass does not depend on what it held
+        PassBuilder &clearColor(const glm::vec4 &color) {
+            this->graph.passes[this->pass].clearsColor = true;
+            this->graph.passes[this->pass].clearColor = color;
+            return *this;
+        }
+
+        PassBuilder &clearDepth(GLfloat depth = 1.0f) {
+            this->graph.passes[this->pass].clearsDepth = true;
+            this->graph.passes[this->pass].clearDepth = depth;
+            return *this;
+        }
+
+        // Never culled, for passes whose results leave the graph some other way
+        PassBuilder &sideEffect() {
+            this->graph.passes[this->pass].sideEffect = true;
+            return *this;
+        }
+
+    private:
+        RenderGraph &graph;
+        GLuint pass;
+    };
+
+    // A transient texture: it only has memory from the first pass that uses it to the last
+    RenderResource createTexture(const std::string &name, const RenderTargetDesc &desc) {
+        Resource resource;
+        resource.name = name;
+        resource.desc = desc;
+        resource.extentWidth = desc.width;
+        resource.extentHeight = desc.height;
+        this->resources.push_back(resource);
+        RenderResource handle;
+        handle.index = (GLuint) this->resources.size() - 1;
+        return handle;
+    }
+
+    // A texture owned elsewhere, such as the HDR scene; never aliased. Set it again with setTexture when it changes
+    RenderResource importTexture(const std::string &name, GLuint texture, const RenderTargetDesc &desc) {
+        RenderResource handle = this->createTexture(name, desc);
+        this->resources[handle.index].imported = true;
+        this->resources[handle.index].object = texture;
+        return handle;
+    }
+
+    // A buffer owned elsewhere, for passes that hand one on through storage or indirect reads
+    RenderResource importBuffer(const std::string &name, GLuint buffer) {
+        return this->importTexture(name, buffer, { 0, 0, GL_NONE });
+    }
+
+    // Whichever framebuffer and viewport are bound when execute starts. Passes writing it are never culled
+    RenderResource importOutput(const std::string &name) {
+        RenderResource handle = this->importTexture(name, 0, { 0, 0, GL_NONE });
+        this->resources[handle.index].output = true;
+        return handle;
+    }
+
+    // The pass binds its program and inputs and draws; a null execute declares the pass only, for checks
+    PassBuilder addPass(const std::string &name, const Execute &execute) {
+        Pass pass;
+        pass.name = name;
+        pass.profileName = Profiler::get().intern(name);
+        pass.execute = execute;
+        this->passes.push_back(std::move(pass));
+        return PassBuilder(*this, (GLuint) this->passes.size() - 1);
+    }
+
+    // Drops the passes and resources; the pooled textures stay for the next compile to hand on
+    void clear() {
+        this->passes.clear();
+        this->resources.clear();
+        this->order.clear();
+    }
+
+    // Orders and culls the passes, gives every transient texture a pool slot and works out the barriers
+    void compile() {
+        this->findDependencies();
+        this->cull();
+        this->sort();
+        this->allocate();
+        this->placeBarriers();
+    }
+
+    // Creates the textures the compiled pool lacks and each pass's framebuffer; needs the GL context
+    void realize() {
+        for (Physical &slot : this->physical) {
+            if (slot.texture) {
+                continue;
+            }
+            const RenderTargetDesc &desc = slot.desc;
+            bool depth = desc.isDepth();
+            slot.texture = TextureHandle::create(GPU_MEMORY_RENDER_TARGETS, "Render graph target");
+            glBindTexture(GL_TEXTURE_2D, slot.texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, depth ? GL_DEPTH_COMPONENT : GL_RGBA,
+                         GL_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            slot.texture.setSize(desc.getBytes());
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        if (!this->fullscreenVAO) {
+            this->fullscreenVAO = VertexArrayHandle::create(GPU_MEMORY_GEOMETRY, "Render graph fullscreen");
+        }
+        this->attachFramebuffers();
+    }
+
+    // Runs the compiled passes in order, each with its barriers issued, its attachments bound, its state
+    // set, its clears done and a fullscreen triangle's attributeless vertex array bound. Restores the
+    // framebuffer, viewport and depth and blend state that were set when it started
+    void execute() {
+        GLint output = 0;
+        GLint viewport[4];
+        GLint depthFunc = GL_LESS;
+        GLboolean depthWrite = GL_TRUE;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &output);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+        glGetBooleanv(GL_DEPTH_WRITEMASK, &depthWrite);
+        GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+        GLboolean blend = glIsEnabled(GL_BLEND);
+        if (this->framebuffersDirty) {
+            this->attachFramebuffers();
+        }
+
+        for (GLuint index : this->order) {
+            Pass &pass = this->passes[index];
+            PROFILE_SCOPE(pass.profileName);
+            PROFILE_GPU_SCOPE(pass.profileName);
+            if (pass.barriers) {
+                glMemoryBarrier(pass.barriers);
+            }
+            if (pass.output) {
+                glBindFramebuffer(GL_FRAMEBUFFER, output);
+                glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+            } else if (pass.framebuffer) {
+                const Resource &attachment = this->resources[pass.attachment];
+                glBindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+                glViewport(0, 0, attachment.extentWidth, attachment.extentHeight);
+            }
+            this->applyState(pass);
+            glBindVertexArray(this->fullscreenVAO);
+            if (pass.execute) {
+                pass.execute(*this);
+            }
+        }
+
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, output);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        glDepthFunc(depthFunc);
+        glDepthMask(depthWrite);
+        if (depthTest) {
+            glEnable(GL_DEPTH_TEST);
+        } else {
+            glDisable(GL_DEPTH_TEST);
+        }
+        if (blend) {
+            glEnable(GL_BLEND);
+        } else {
+            glDisable(GL_BLEND);
+        }
+    }
+
+    // Limits the passes drawing into and reading resource to its lower left width x height texels
+    void setExtent(RenderResource resource, GLint width, GLint height) {
+        Resource &r = this->resources[resource.index];
+        r.extentWidth = std::min(std::max(width, 1), r.desc.width);
+        r.extentHeight = std::min(std::max(height, 1), r.desc.height);
+    }
+
+    glm::ivec2 getExtent(RenderResource resource) const {
+        return glm::ivec2(this->resources[resource.index].extentWidth, this->resources[resource.index].extentHeight);
+    }
+
+    void setTexture(RenderResource resource, GLuint texture) {
+        this->resources[resource.index].object = texture;
+        this->framebuffersDirty = true;
+    }
+
+    // The texture a resource has this frame, or 0 if it was culled
+    GLuint getTexture(RenderResource resource) const {
+        const Resource &r = this->resources[resource.index];
+        if (r.imported) {
+            return r.object;
+        }
+        return r.physical == RENDER_GRAPH_NONE ? 0 : this->physical[r.physical].texture.get();
+    }
+
+    GLuint getBuffer(RenderResource resource) const {
+        return this->resources[resource.index].object;
+    }
+
+    const RenderTargetDesc &getDesc(RenderResource resource) const {
+        return this->resources[resource.index].desc;
+    }
+
+    // The pool slot a transient texture was given, or RENDER_GRAPH_NONE
+    GLuint getPhysical(RenderResource resource) const {
+        return this->resources[resource.index].physical;
+    }
+
+    GLuint getPhysicalCount() const {
+        return (GLuint) this->physical.size();
+    }
+
+    GLuint getPassCount() const {
+        return (GLuint) this->passes.size();
+    }
+
+    // The passes that run, in the order they run
+    std::vector<std::string> getOrder() const {
+        std::vector<std::string> names;
+        for (GLuint index : this->order) {
+            names.push_back(this->passes[index].name);
+        }
+        return names;
+    }
+
+    // The barrier bits issued before the first pass called name
+    GLbitfield getBarriers(const std::string &name) const {
+        for (const Pass &pass : this->passes) {
+            if (pass.name == name) {
+                return pass.barriers;
+            }
+        }
+        return 0;
+    }
+
+    // What the transient textures would take without aliasing
+    size_t getTransientBytes() const {
+        size_t bytes = 0;
+        for (const Resource &r : this->resources) {
+            bytes += r.physical == RENDER_GRAPH_NONE ? 0 : r.desc.getBytes();
+        }
+        return bytes;
+    }
+
+    size_t getPhysicalBytes() const {
+        size_t bytes = 0;
+        for (const Physical &slot : this->physical) {
+            bytes += slot.desc.getBytes();
+        }
+        return bytes;
+    }
+
+    // The most transient texture memory alive during any one pass: what perfect aliasing would take
+    size_t getPeakBytes() const {
+        return this->peakBytes;
+    }
+
+private:
+    struct Resource {
+        std::string name;
+        RenderTargetDesc desc;
+        bool imported = false;
+        bool output = false;
+        GLuint object = 0;                                          // Imported only
+        GLint extentWidth = 0, extentHeight = 0;
+        GLuint version = 0;                                         // The latest
+        std::vector<GLuint> producers = { RENDER_GRAPH_NONE };      // The pass writing each version
+        std::vector<std::vector<GLuint>> readers = { {} };          // The passes reading each version
+        GLuint first = 0, last = 0;                                 // Positions in the order
+        GLuint physical = RENDER_GRAPH_NONE;
+    };
+
+    struct Access {
+        GLuint resource;
+        GLuint version;
+        RenderAccess access;
+        bool write;
+    };
+
+    struct Pass {
+        std::string name;
+        const char *profileName;         // The name interned by the profiler, which outlives the graph
+        std::vector<Access> accesses;
+        RenderState state;
+        bool clearsColor = false, clearsDepth = false;
+        glm::vec4 clearColor = glm::vec4(0.0f);
+        GLfloat clearDepth = 1.0f;
+        bool sideEffect = false;
+        Execute execute;
+
+        std::vector<GLuint> inputs;      // Passes whose results this one uses
+        std::vector<GLuint> after;       // Passes that only have to run first, as this one overwrites what they read
+        bool culled = false;
+        bool output = false;             // Draws into the output
+        GLbitfield barriers = 0;
+        GLuint attachment = RENDER_GRAPH_NONE; // One of its attachments, whose extent is the viewport
+        FramebufferHandle framebuffer;
+    };
+
+    struct Physical {
+        RenderTargetDesc desc;
+        TextureHandle texture;
+    };
+
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    std::vector<GLuint> order;
+    std::vector<Physical> physical;
+    size_t peakBytes = 0;
+    bool framebuffersDirty = false;
+    VertexArrayHandle fullscreenVAO;
+
+    RenderResource addAccess(GLuint pass, RenderResource resource, RenderAccess access, bool write) {
+        Resource &r = this->resources[resource.index];
+        if (write) {
+            if (resource.version != r.version) {
+                std::cout << "ERROR::RENDER_GRAPH::WRITE_TO_OLD_VERSION " << r.name << " in " << this->passes[pass].name
+                          << std::endl;
+            }
+            r.version++;
+            r.producers.push_back(pass);
+            r.readers.emplace_back();
+            resource.version = r.version;
+        } else {
+            r.readers[resource.version].push_back(pass);
+        }
+        this->passes[pass].accesses.push_back({ resource.index, resource.version, access, write });
+        return resource;
+    }
+
+    // A read depends on the pass that wrote its version. A write depends on the last one unless it
+    // clears the attachment first, and comes after every pass still reading the version it replaces
+    void findDependencies() {
+        for (GLuint i = 0; i < this->passes.size(); i++) {
+            Pass &pass = this->passes[i];
+            pass.inputs.clear();
+            pass.after.clear();
+            pass.output = false;
+            pass.attachment = RENDER_GRAPH_NONE;
+            auto add = [i](std::vector<GLuint> &list, GLuint other) {
+                if (other != RENDER_GRAPH_NONE && other != i && std::find(list.begin(), list.end(), other) == list.end()) {
+                    list.push_back(other);
+                }
+            };
+            for (const Access &a : pass.accesses) {
+                const Resource &r = this->resources[a.resource];
+                if (!a.write) {
+                    add(pass.inputs, r.producers[a.version]);
+                    continue;
+                }
+                bool cleared = (a.access == ACCESS_COLOR && pass.clearsColor) || (a.access == ACCESS_DEPTH && pass.clearsDepth);
+                add(cleared ? pass.after : pass.inputs, r.producers[a.version - 1]);
+                for (GLuint reader : r.readers[a.version - 1]) {
+                    add(pass.after, reader);
+                }
+                if (a.access == ACCESS_COLOR || a.access == ACCESS_DEPTH) {
+                    pass.output = pass.output || r.output;
+                    pass.attachment = a.resource;
+                }
+            }
+        }
+    }
+
+    // Keeps the passes writing the output or marked with side effects, and everything they use
+    void cull() {
+        std::vector<GLuint> needed;
+        for (GLuint i = 0; i < this->passes.size(); i++) {
+            this->passes[i].culled = true;
+            if (this->passes[i].sideEffect || this->passes[i].output) {
+                needed.push_back(i);
+            }
+        }
+        while (!needed.empty()) {
+            Pass &pass = this->passes[needed.back()];
+            needed.pop_back();
+            if (pass.culled) {
+                pass.culled = false;
+                needed.insert(needed.end(), pass.inputs.begin(), pass.inputs.end());
+            }
+        }
+    }
+
+    // Kahn's algorithm, taking the earliest added of the passes that are ready
+    void sort() {
+        GLuint count = (GLuint) this->passes.size();
+        std::vector<GLuint> waiting(count, 0);
+        std::vector<std::vector<GLuint>> dependents(count);
+        GLuint live = 0;
+        for (GLuint i = 0; i < count; i++) {
+            if (this->passes[i].culled) {
+                continue;
+            }
+            live++;
+            for (const std::vector<GLuint> *list : { &this->passes[i].inputs, &this->passes[i].after }) {
+                for (GLuint other : *list) {
+                    if (!this->passes[other].culled) {
+                        waiting[i]++;
+                        dependents[other].push_back(i);
+                    }
+                }
+            }
+        }
+
+        this->order.clear();
+        std::vector<bool> placed(count, false);
+        while (this->order.size() < live) {
+            GLuint next = RENDER_GRAPH_NONE;
+            for (GLuint i = 0; i < count && next == RENDER_GRAPH_NONE; i++) {
+                if (!this->passes[i].culled && !placed[i] && waiting[i] == 0) {
+                    next = i;
+                }
+            }
+            if (next == RENDER_GRAPH_NONE) {
+                // A pass read a version that one of its own inputs overwrote; runs the rest as added
+                std::cout << "ERROR::RENDER_GRAPH::CYCLE" << std::endl;
+                for (GLuint i = 0; i < count; i++) {
+                    if (!this->passes[i].culled && !placed[i]) {
+                        this->order.push_back(i);
+                    }
+                }
+                break;
+            }
+            placed[next] = true;
+            this->order.push_back(next);
+            for (GLuint dependent : dependents[next]) {
+                waiting[dependent]--;
+            }
+        }
+    }
+
+    // Walking the order, a transient texture takes the first pool slot of its description whose last
+    // user ran before the texture's first, or failing that one of a wider format of its size, so an
+    // LDR target reuses a spent HDR one. Then hands the old pool's textures to slots that fit them
+    void allocate() {
+        GLuint steps = (GLuint) this->order.size();
+        for (Resource &r : this->resources) {
+            r.first = steps;
+            r.last = 0;
+            r.physical = RENDER_GRAPH_NONE;
+        }
+        for (GLuint step = 0; step < steps; step++) {
+            for (const Access &a : this->passes[this->order[step]].accesses) {
+                Resource &r = this->resources[a.resource];
+                r.first = std::min(r.first, step);
+                r.last = std::max(r.last, step);
+            }
+        }
+
+        std::vector<Physical> previous;
+        previous.swap(this->physical);
+        std::vector<GLuint> busyUntil;
+        this->peakBytes = 0;
+        for (GLuint step = 0; step < steps; step++) {
+            size_t liveBytes = 0;
+            for (Resource &r : this->resources) {
+                if (r.imported || r.first > step || r.last < step) {
+                    continue;
+                }
+                liveBytes += r.desc.getBytes();
+                if (r.first != step) {
+                    continue;
+                }
+                for (bool exact : { true, false }) {
+                    for (GLuint slot = 0; slot < this->physical.size() && r.physical == RENDER_GRAPH_NONE; slot++) {
+                        const RenderTargetDesc &desc = this->physical[slot].desc;
+                        if ((exact ? desc == r.desc : desc.canHost(r.desc)) && busyUntil[slot] < step) {
+                            r.physical = slot;
+                        }
+                    }
+                }
+                if (r.physical == RENDER_GRAPH_NONE) {
+                    r.physical = (GLuint) this->physical.size();
+                    this->physical.emplace_back();
+                    this->physical.back().desc = r.desc;
+                    busyUntil.push_back(0);
+                }
+                busyUntil[r.physical] = r.last;
+            }
+            this->peakBytes = std::max(this->peakBytes, liveBytes);
+        }
+
+        for (Physical &slot : this->physical) {
+            for (Physical &old : previous) {
+                if (old.texture && old.desc == slot.desc) {
+                    slot.texture = std::move(old.texture);
+                    break;
+                }
+            }
+        }
+    }
+
+    static GLbitfield barrierBit(RenderAccess access) {
+        switch (access) {
+            case ACCESS_SAMPLED: return GL_TEXTURE_FETCH_BARRIER_BIT;
+            case ACCESS_IMAGE: return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+            case ACCESS_STORAGE: return GL_SHADER_STORAGE_BARRIER_BIT;
+            case ACCESS_INDIRECT: return GL_COMMAND_BARRIER_BIT;
+            case ACCESS_VERTEX: return GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT;
+            case ACCESS_READBACK: return GL_TEXTURE_UPDATE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT;
+            default: return GL_FRAMEBUFFER_BARRIER_BIT;
+        }
+    }
+
+    // Image stores and storage buffer writes are incoherent: the next pass to touch what they wrote
+    // needs a barrier with the bit for how it touches it, unless an earlier barrier already had that bit
+    void placeBarriers() {
+        std::vector<bool> incoherent(this->resources.size(), false);
+        std::vector<GLbitfield> covered(this->resources.size(), 0);
+        for (Pass &pass : this->passes) {
+            pass.barriers = 0;
+        }
+        for (GLuint index : this->order) {
+            Pass &pass = this->passes[index];
+            for (const Access &a : pass.accesses) {
+                if (incoherent[a.resource] && !(covered[a.resource] & barrierBit(a.access))) {
+                    pass.barriers |= barrierBit(a.access);
+                }
+            }
+            for (size_t r = 0; r < this->resources.size(); r++) {
+                covered[r] |= pass.barriers; // A barrier covers every write before it
+            }
+            for (const Access &a : pass.accesses) {
+                if (a.write) {
+                    incoherent[a.resource] = a.access == ACCESS_IMAGE || a.access == ACCESS_STORAGE;
+                    covered[a.resource] = 0;
+                }
+            }
+        }
+    }
+
+    // Points each pass's framebuffer at the textures its attachments have now
+    void attachFramebuffers() {
+        for (GLuint index : this->order) {
+            Pass &pass = this->passes[index];
+            GLenum drawBuffers[RENDER_GRAPH_MAX_COLOR];
+            GLuint colors = 0;
+            bool attached = false;
+            for (const Access &a : pass.accesses) {
+                RenderResource resource = { a.resource, a.version };
+                const RenderTargetDesc &desc = this->resources[a.resource].desc;
+                if (!a.write || pass.output || (a.access != ACCESS_COLOR && a.access != ACCESS_DEPTH)) {
+                    continue;
+                }
+                if (!pass.framebuffer) {
+                    pass.framebuffer = FramebufferHandle::create(GPU_MEMORY_RENDER_TARGETS, pass.name);
+                }
+                if (!attached) {
+                    glBindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+                    attached = true;
+                }
+                if (a.access == ACCESS_DEPTH) {
+                    GLenum attachment = desc.format == GL_DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, this->getTexture(resource), 0);
+                } else if (colors < RENDER_GRAPH_MAX_COLOR) {
+                    drawBuffers[colors] = GL_COLOR_ATTACHMENT0 + colors;
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[colors], GL_TEXTURE_2D, this->getTexture(resource), 0);
+                    colors++;
+                }
+            }
+            if (!attached) {
+                continue;
+            }
+            if (colors) {
+                glDrawBuffers(colors, drawBuffers);
+            } else {
+                glDrawBuffer(GL_NONE);
+            }
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                std::cout << "ERROR::RENDER_GRAPH::FRAMEBUFFER_INCOMPLETE " << pass.name << std::endl;
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        this->framebuffersDirty = false;
+    }
+
+    void applyState(const Pass &pass) {
+        const RenderState &state = pass.state;
+        if (state.depthTest) {
+            glEnable(GL_DEPTH_TEST);
+        } else {
+            glDisable(GL_DEPTH_TEST);
+        }
+        glDepthFunc(state.depthFunc);
+        if (state.blend == RENDER_BLEND_OFF) {
+            glDisable(GL_BLEND);
+        } else {
+            glEnable(GL_BLEND);
+            glBlendFunc(state.blend == RENDER_BLEND_ADDITIVE ? GL_ONE : GL_SRC_ALPHA,
+                        state.blend == RENDER_BLEND_ADDITIVE ? GL_ONE : GL_ONE_MINUS_SRC_ALPHA);
+        }
+
+        GLbitfield clearBits = 0;
+        if (pass.clearsColor) {
+            glClearColor(pass.clearColor.x, pass.clearColor.y, pass.clearColor.z, pass.clearColor.w);
+            clearBits |= GL_COLOR_BUFFER_BIT;
+        }
+        if (pass.clearsDepth) {
+            glDepthMask(GL_TRUE); // Clears are masked too
+            glClearDepth(pass.clearDepth);
+            clearBits |= GL_DEPTH_BUFFER_BIT;
+        }
+        if (clearBits) {
+            glClear(clearBits);
+        }
+        glDepthMask(state.depthWrite ? GL_TRUE : GL_FALSE);
+        PROFILE_STATE_CHANGE();
+    }
+};
+
+// Compiles graphs without a context: a pass reading what a later-added pass overwrites must run first,
+// passes nothing uses must be culled with their textures, a run of LDR passes must ping-pong between
+// two textures with the pool no bigger than the peak, an LDR target may only take a spent HDR
+// texture of its size, and barriers must follow incoherent writes.
+// Run with GameForFuns --render-graph-check.
+inline bool checkRenderGraph() {
+    bool passed = true;
+    auto report = [&passed](bool ok, const std::string &what) {
+        std::cout << (ok ? "OK       " : "FAILED   ") << what << std::endl;
+        passed = passed && ok;
+    };
+    auto join = [](const std::vector<std::string> &names) {
+        std::string text;
+        for (const std::string &name : names) {
+            text += (text.empty() ? "" : ", ") + name;
+        }
+        return text;
+    };
+    RenderTargetDesc ldr = { 1920, 1080, GL_RGBA8 };
+
+    // Reflect reads the scene before the decals, so it runs before Decals though added after it
+    {
+        RenderGraph graph;
+        RenderResource scene = graph.createTexture("Scene", ldr);
+        RenderResource reflection = graph.createTexture("Reflection", ldr);
+        RenderResource debug = graph.createTexture("Debug", ldr);
+        RenderResource screen = graph.importOutput("Screen");
+        RenderResource drawn = graph.addPass("Draw", nullptr).clearColor(glm::vec4(0.0f)).write(scene);
+        scene = graph.addPass("Decals", nullptr).write(drawn);
+        reflection = graph.addPass("Reflect", nullptr).read(drawn).write(reflection);
+        graph.addPass("Debug view", nullptr).read(drawn).write(debug);
+        graph.addPass("Present", nullptr).read(scene).read(reflection).write(screen);
+        graph.addPass("Screenshot", nullptr).read(scene, ACCESS_READBACK).sideEffect();
+        graph.compile();
+        std::vector<std::string> expected = { "Draw", "Reflect", "Decals", "Present", "Screenshot" };
+        report(graph.getOrder() == expected, "order: " + join(graph.getOrder()));
+        report(graph.getPhysical(debug) == RENDER_GRAPH_NONE && graph.getPhysicalCount() == 2,
+               "culling: Debug view and its target dropped, " + std::to_string(graph.getPhysicalCount()) + " textures");
+    }
+
+    // Every extra pass reads the last target and writes a new one
+    size_t firstBytes = 0;
+    for (GLuint extra = 2; extra <= RENDER_GRAPH_CHECK_EXTRA_PASSES; extra *= 2) {
+        RenderGraph graph;
+        RenderResource last = graph.importTexture("Input", 0, ldr);
+        for (GLuint i = 0; i < extra; i++) {
+            last = graph.addPass("Pass", nullptr).read(last).write(graph.createTexture("Pass", ldr));
+        }
+        graph.addPass("Present", nullptr).read(last).write(graph.importOutput("Screen"));
+        graph.compile();
+        firstBytes = firstBytes ? firstBytes : graph.getPhysicalBytes();
+        report(graph.getPhysicalCount() == 2 && graph.getPhysicalBytes() == firstBytes
+               && graph.getPeakBytes() == graph.getPhysicalBytes(),
+               std::to_string(extra) + " LDR passes: " + std::to_string(graph.getPhysicalCount()) + " textures, "
+               + std::to_string(graph.getPhysicalBytes() / 1024) + " KB for " + std::to_string(graph.getTransientBytes() / 1024)
+               + " KB of targets, peak " + std::to_string(graph.getPeakBytes() / 1024) + " KB");
+    }
+
+    // a is read again by the last pass, so b and c may share but neither may take a's texture
+    {
+        RenderGraph graph;
+        RenderResource a = graph.createTexture("A", ldr), b = graph.createTexture("B", ldr), c = graph.createTexture("C", ldr);
+        RenderResource small = graph.createTexture("Small", { ldr.width / 2, ldr.height / 2, GL_RGBA8 });
+        a = graph.addPass("Write A", nullptr).write(a);
+        b = graph.addPass("A to B", nullptr).read(a).write(b);
+        small = graph.addPass("B to small", nullptr).read(b).write(small);
+        c = graph.addPass("Small to C", nullptr).read(small).write(c);
+        graph.addPass("A and C", nullptr).read(a).read(c).write(graph.importOutput("Screen"));
+        graph.compile();
+        bool separate = graph.getPhysical(a) != graph.getPhysical(b) && graph.getPhysical(a) != graph.getPhysical(c)
+                     && graph.getPhysical(b) == graph.getPhysical(c) && graph.getPhysical(small) != graph.getPhysical(b);
+        report(separate && graph.getPhysicalCount() == 3 && graph.getPeakBytes() == graph.getPhysicalBytes(),
+               "lifetimes: a long-lived target keeps its texture, sizes never share, peak "
+               + std::to_string(graph.getPeakBytes() / 1024) + " KB");
+    }
+
+    // Once the HDR target is spent, the second LDR target reuses it; an HDR target never takes an LDR one
+    {
+        RenderGraph graph;
+        RenderTargetDesc hdr = { ldr.width, ldr.height, GL_RGBA16F };
+        RenderResource lit = graph.createTexture("Lit", hdr), tonemapped = graph.createTexture("Tonemapped", ldr);
+        RenderResource graded = graph.createTexture("Graded", ldr), blurred = graph.createTexture("Blurred", hdr);
+        lit = graph.addPass("Light", nullptr).write(lit);
+        tonemapped = graph.addPass("Tonemap", nullptr).read(lit).write(tonemapped);
+        graded = graph.addPass("Grade", nullptr).read(tonemapped).write(graded);
+        blurred = graph.addPass("Blur", nullptr).read(graded).write(blurred);
+        graph.addPass("Present", nullptr).read(blurred).write(graph.importOutput("Screen"));
+        graph.compile();
+        bool widened = graph.getPhysical(graded) == graph.getPhysical(lit) && graph.getPhysical(blurred) != graph.getPhysical(tonemapped)
+                    && graph.getPhysicalCount() == 3;
+        report(widened, "formats: Graded reuses Lit's RGBA16F texture, Blurred does not take Tonemapped's RGBA8, "
+               + std::to_string(graph.getPhysicalBytes() / 1024) + " KB for " + std::to_string(graph.getTransientBytes() / 1024)
+               + " KB of targets");
+    }
+
+    // Compute writes need barriers before the draws that consume them, and only once per bit
+    {
+        RenderGraph graph;
+        RenderResource particles = graph.importBuffer("Particles", 0);
+        RenderResource histogram = graph.createTexture("Histogram", { 256, 1, GL_R32F });
+        RenderResource screen = graph.importOutput("Screen");
+        particles = graph.addPass("Simulate", nullptr).write(particles, ACCESS_STORAGE);
+        histogram = graph.addPass("Histogram", nullptr).write(histogram, ACCESS_IMAGE);
+        RenderResource exposure = graph.addPass("Expose", nullptr).read(histogram).write(graph.createTexture("Exposure", { 1, 1, GL_R32F }));
+        screen = graph.addPass("Draw particles", nullptr).read(particles, ACCESS_INDIRECT).read(particles, ACCESS_VERTEX)
+                                                         .read(exposure).read(histogram).write(screen);
+        graph.compile();
+        bool barriers = graph.getBarriers("Simulate") == 0 && graph.getBarriers("Histogram") == 0
+                     && graph.getBarriers("Expose") == GL_TEXTURE_FETCH_BARRIER_BIT
+                     && graph.getBarriers("Draw particles") == (GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+        report(barriers, "barriers: texture fetch before Expose, command and vertex before Draw particles");
+    }
+    return passed;
+}
@@ -0,0 +1,893 @@
+//
+//  Scenes.h
+//  GameForFuns
+//
+//  The demo scenes the project has grown: the cube grid world, the same world
+//  as greedily meshed voxel chunks, the lit containers from
+//  rendererWithAllLightings and the nanosuit from modelLoader, optionally
+//  through virtual texturing, a fountain of GPU particles, plus any glTF model.
+//  The game draws the voxel world, streamed endlessly around the camera; the
+//  benchmark draws them all, the voxel world as the fixed grid, and a glTF
+//  model when given one. The cubes, containers and lamps are entities
+//  (Entities.h) that each scene creates once and draws from its own
+//  EntityWorld.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "Camera.h"
+#include "Model.h"
+#include "Texture.h"
+#include "Profiler.h"
+#include "JobSystem.h"
+#include "Frustum.h"
+#include "CommandBuffer.h"
+#include "FrameArena.h"
+#include "Entities.h"
+#include "StreamBuffer.h"
+#include "VirtualTexture.h"
+#include "GltfLoader.h"
+#include "VoxelWorld.h"
+#include "VoxelRenderer.h"
+#include "VoxelStreamer.h"
+#include "ParticleSystem.h"
+
+// Cube with positions, normals and texture coords; cube.vs only reads location 0 and 2
+static const GLfloat SCENE_CUBE_VERTICES[] = {
+    // Positions            // Normals              // Texture Coords
+    -0.5f, -0.5f, -0.5f,    0.0f,  0.0f, -1.0f,     0.0f,  0.0f,
+    0.5f, -0.5f, -0.5f,     0.0f,  0.0f, -1.0f,     1.0f,  0.0f,
+    0.5f,  0.5f, -0.5f,     0.0f,  0.0f, -1.0f,     1.0f,  1.0f,
+    0.5f,  0.5f, -0.5f,     0.0f,  0.0f, -1.0f,     1.0f,  1.0f,
+    -0.5f,  0.5f, -0.5f,    0.0f,  0.0f, -1.0f,     0.0f,  1.0f,
+    -0.5f, -0.5f, -0.5f,    0.0f,  0.0f, -1.0f,     0.0f,  0.0f,
+
+    -0.5f, -0.5f,  0.5f,    0.0f,  0.0f,  1.0f,     0.0f,  0.0f,
+    0.5f, -0.5f,  0.5f,     0.0f,  0.0f,  1.0f,     1.0f,  0.0f,
+    0.5f,  0.5f,  0.5f,     0.0f,  0.0f,  1.0f,     1.0f,  1.0f,
+    0.5f,  0.5f,  0.5f,     0.0f,  0.0f,  1.0f,     1.0f,  1.0f,
+    -0.5f,  0.5f,  0.5f,    0.0f,  0.0f,  1.0f,     0.0f,  1.0f,
+    -0.5f, -0.5f,  0.5f,    0.0f,  0.0f,  1.0f,     0.0f,  0.0f,
+
+    -0.5f,  0.5f,  0.5f,    -1.0f,  0.0f,  0.0f,    1.0f,  0.0f,
+    -0.5f,  0.5f, -0.5f,    -1.0f,  0.0f,  0.0f,    1.0f,  1.0f,
+    -0.5f, -0.5f, -0.5f,    -1.0f,  0.0f,  0.0f,    0.0f,  1.0f,
+    -0.5f, -0.5f, -0.5f,    -1.0f,  0.0f,  0.0f,    0.0f,  1.0f,
+    -0.5f, -0.5f,  0.5f,    -1.0f,  0.0f,  0.0f,    0.0f,  0.0f,
+    -0.5f,  0.5f,  0.5f,    -1.0f,  0.0f,  0.0f,    1.0f,  0.0f,
+
+    0.5f,  0.5f,  0.5f,     1.0f,  0.0f,  0.0f,     1.0f,  0.0f,
+    0.5f,  0.5f, -0.5f,     1.0f,  0.0f,  0.0f,     1.0f,  1.0f,
+    0.5f, -0.5f, -0.5f,     1.0f,  0.0f,  0.0f,     0.0f,  1.0f,
+    0.5f, -0.5f, -0.5f,     1.0f,  0.0f,  0.0f,     0.0f,  1.0f,
+    0.5f, -0.5f,  0.5f,     1.0f,  0.0f,  0.0f,     0.0f,  0.0f,
+    0.5f,  0.5f,  0.5f,     1.0f,  0.0f,  0.0f,     1.0f,  0.0f,
+
+    -0.5f, -0.5f, -0.5f,    0.0f, -1.0f,  0.0f,     0.0f,  1.0f,
+    0.5f, -0.5f, -0.5f,     0.0f, -1.0f,  0.0f,     1.0f,  1.0f,
+    0.5f, -0.5f,  0.5f,     0.0f, -1.0f,  0.0f,     1.0f,  0.0f,
+    0.5f, -0.5f,  0.5f,     0.0f, -1.0f,  0.0f,     1.0f,  0.0f,
+    -0.5f, -0.5f,  0.5f,    0.0f, -1.0f,  0.0f,     0.0f,  0.0f,
+    -0.5f, -0.5f, -0.5f,    0.0f, -1.0f,  0.0f,     0.0f,  1.0f,
+
+    -0.5f,  0.5f, -0.5f,    0.0f,  1.0f,  0.0f,     0.0f,  1.0f,
+    0.5f,  0.5f, -0.5f,     0.0f,  1.0f,  0.0f,     1.0f,  1.0f,
+    0.5f,  0.5f,  0.5f,     0.0f,  1.0f,  0.0f,     1.0f,  0.0f,
+    0.5f,  0.5f,  0.5f,     0.0f,  1.0f,  0.0f,     1.0f,  0.0f,
+    -0.5f,  0.5f,  0.5f,    0.0f,  1.0f,  0.0f,     0.0f,  0.0f,
+    -0.5f,  0.5f, -0.5f,    0.0f,  1.0f,  0.0f,     0.0f,  1.0f
+};
+
+// Creates a VAO for SCENE_CUBE_VERTICES with positions at 0, normals at 1 and texture coords at 2
+static void createSceneCube(VertexArrayHandle &VAO, BufferHandle &VBO) {
+    VAO = VertexArrayHandle::create(GPU_MEMORY_GEOMETRY, "Scene cube");
+    VBO = BufferHandle::create(GPU_MEMORY_GEOMETRY, "Scene cube vertices");
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(SCENE_CUBE_VERTICES), SCENE_CUBE_VERTICES, GL_STATIC_DRAW);
+    VBO.setSize(sizeof(SCENE_CUBE_VERTICES));
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid *) 0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid *) (3 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid *) (6 * sizeof(GLfloat)));
+    glBindVertexArray(0);
+}
+
+class Scene {
+public:
+    virtual ~Scene() {}
+
+    virtual const char *getName() const = 0;
+
+    // CPU work for the frame (transforms, culling, draw lists), may fan out to the job system
+    virtual void prepare(Camera &camera, const glm::mat4 &projection) {}
+
+    // Submits the prepared frame; GL calls only happen here, on the context thread
+    virtual void draw(Camera &camera, const glm::mat4 &projection) = 0;
+};
+
+// The GameForFuns block world: a 16x4x16 grid of textured cubes, one entity each
+class CubeGridScene : public Scene {
+public:
+    static const GLuint GRID_X = 16, GRID_Y = 4, GRID_Z = 16;
+    static const GLuint CUBE_COUNT = GRID_X * GRID_Y * GRID_Z;
+    static const GLuint RECORD_RANGES = 8; // Command buffers recorded in parallel, one instanced draw each
+    static const GLuint MODEL_LOCATION = 3; // Instanced mat4 in locations 3 to 6
+
+    CubeGridScene():
+        shader("res/shaders/cube.vs", "res/shaders/cube.frag"),
+        instances(GL_ARRAY_BUFFER, CUBE_COUNT * sizeof(glm::mat4)) {
+        createSceneCube(this->VAO, this->VBO);
+        this->texture = TextureHandle::adopt(TextureLoading::LoadTexture((GLchar *) "res/images/container2.png"));
+
+        // The pointers are set per draw, at the draw's offset into the stream buffer
+        glBindVertexArray(this->VAO);
+        for (GLuint column = 0; column < 4; column++) {
+            glEnableVertexAttribArray(MODEL_LOCATION + column);
+            glVertexAttribDivisor(MODEL_LOCATION + column, 1);
+        }
+        glBindVertexArray(0);
+
+        this->viewLoc = glGetUniformLocation(this->shader.Program, "view");
+        this->projLoc = glGetUniformLocation(this->shader.Program, "projection");
+        this->textureLoc = glGetUniformLocation(this->shader.Program, "texture1");
+        this->queue.reserve(CUBE_COUNT + 1);
+
+        for (GLuint i = 0; i < CUBE_COUNT; i++) {
+            Entity cube = this->entities.create(COMPONENT_TRANSFORM | COMPONENT_MESH);
+            this->entities.get<Transform>(cube)->position = cubePosition(i);
+        }
+    }
+
+    const char *getName() const {
+        return "cube_grid";
+    }
+
+    static glm::vec3 cubePosition(GLuint index) {
+        GLuint i = index / (GRID_Y * GRID_Z);
+        GLuint j = (index / GRID_Z) % GRID_Y;
+        GLuint k = index % GRID_Z;
+        return glm::vec3(-1.0f, -1.0f, 1.0f) + glm::vec3(1.0f * i, -1.0f * j, 1.0f * k);
+    }
+
+    // Builds the model matrices of the cube entities and culls them against the view frustum on
+    // the job system, then copies the visible ones front to back into the stream buffer and
+    // records one instanced draw per range
+    void prepare(Camera &camera, const glm::mat4 &projection) {
+        PROFILE_SCOPE("CubeGridScene::prepare");
+        glm::mat4 view = camera.getViewMatrix();
+        glm::vec3 cameraPos = camera.getPosition();
+        Frustum frustum(projection * view);
+
+        // Per frame data lives in the frame arena, indexed by the order the system visits the cubes
+        const ComponentMask drawable = COMPONENT_TRANSFORM | COMPONENT_MESH;
+        GLuint cubeCount = this->entities.count(drawable);
+        LinearArena &arena = FrameArena::get().current();
+        this->transforms = ArenaArray<glm::mat4>(arena, cubeCount);
+        this->visible = ArenaArray<bool>(arena, cubeCount);
+        this->distances = ArenaArray<GLfloat>(arena, cubeCount);
+        this->drawList = ArenaArray<GLuint>(arena, cubeCount);
+        this->transforms.resize(cubeCount);
+        this->visible.resize(cubeCount);
+        this->distances.resize(cubeCount);
+
+        GLuint count = std::min(std::min(this->transforms.size(), this->visible.size()), this->distances.size());
+        this->entities.parallelForEach(drawable, [this, &frustum, cameraPos, count](const EntityRange &range) {
+            PROFILE_SCOPE("Transforms and culling");
+            const Transform *cubes = range.archetype->get<Transform>();
+            for (GLuint row = range.begin, i = range.offset; row < range.end && i < count; row++, i++) {
+                const Transform &cube = cubes[row];
+                this->transforms[i] = cube.getMatrix();
+
+                glm::vec3 extent(0.5f * cube.scale); // The grid's cubes are not rotated
+                AABB bounds = { cube.position - extent, cube.position + extent };
+                this->visible[i] = frustum.containsAABB(bounds);
+                this->distances[i] = glm::length(cube.position - cameraPos);
+            }
+        }, JobSystem::get(), 128);
+
+        // Draw list front to back so early depth testing rejects the hidden cubes,
+        // cheap next to the per-cube work above
+        for (GLuint i = 0; i < count; i++) {
+            if (this->visible[i]) {
+                this->drawList.push_back(i);
+            }
+        }
+        std::sort(this->drawList.begin(), this->drawList.end(), [this](GLuint a, GLuint b) {
+            return this->distances[a] < this->distances[b];
+        });
+
+        // Every range writes its transforms straight into the mapped stream buffer
+        this->instances.beginFrame();
+        GLuint drawCount = this->drawList.size();
+        GLuint baseOffset = 0;
+        glm::mat4 *mapped = (glm::mat4 *) this->instances.allocate(drawCount * sizeof(glm::mat4), sizeof(glm::mat4), &baseOffset);
+        Bindings bindings = { this->shader.Program, this->texture, this->VAO, this->instances.getBuffer(), baseOffset,
+                              this->viewLoc, this->projLoc, this->textureLoc };
+        recordSetup(this->commands[0], bindings, view, projection);
+
+        JobSystem::get().parallelForWait(RECORD_RANGES, 1, [this, &bindings, drawCount, mapped](GLuint begin, GLuint end) {
+            PROFILE_SCOPE("Record cubes");
+            for (GLuint range = begin; range < end; range++) {
+                recordRange(this->commands[range + 1], bindings, range, this->drawList.begin(), drawCount,
+                            this->transforms.begin(), this->distances.begin(), mapped);
+            }
+        });
+        this->prepared = true;
+    }
+
+    // The GL names and locations the recorded commands refer to
+    struct Bindings {
+        GLuint program;
+        GLuint texture;
+        GLuint vertexArray;
+        GLuint instanceBuffer;
+        GLuint instanceOffset; // Of the frame's transforms in instanceBuffer, in bytes
+        GLint viewLoc, projLoc, textureLoc;
+    };
+
+    // Per frame state goes first, in its own layer
+    static void recordSetup(CommandBuffer &buffer, const Bindings &bindings, const glm::mat4 &view, const glm::mat4 &projection) {
+        buffer.reset();
+        buffer.begin(makeSortKey(0, 0, 0));
+        buffer.useProgram(bindings.program);
+        buffer.bindTexture(0, GL_TEXTURE_2D, bindings.texture);
+        buffer.uniform1i(bindings.textureLoc, 0);
+        buffer.uniformMatrix4fv(bindings.viewLoc, glm::value_ptr(view));
+        buffer.uniformMatrix4fv(bindings.projLoc, glm::value_ptr(projection));
+    }
+
+    // Copies range's share of the draw list to mapped and records it as one instanced draw,
+    // keyed by its nearest cube; any thread, each range into a buffer of its own
+    static void recordRange(CommandBuffer &buffer, const Bindings &bindings, GLuint range, const GLuint *drawList, GLuint drawCount,
+                            const glm::mat4 *transforms, const GLfloat *distances, glm::mat4 *mapped) {
+        buffer.reset();
+        GLuint rangeSize = (drawCount + RECORD_RANGES - 1) / RECORD_RANGES;
+        GLuint first = range * rangeSize;
+        GLuint last = std::min(drawCount, first + rangeSize);
+        if (!mapped || first >= last) {
+            return;
+        }
+        for (GLuint i = first; i < last; i++) {
+            mapped[i] = transforms[drawList[i]];
+        }
+
+        GLfloat distance = distances[drawList[first]];
+        buffer.begin(makeSortKey(1, bindings.texture, (GLuint) std::min(distance * 1024.0f, 16777215.0f)));
+        buffer.useProgram(bindings.program);
+        buffer.bindTexture(0, GL_TEXTURE_2D, bindings.texture);
+        buffer.bindVertexArray(bindings.vertexArray);
+        buffer.bindInstanceTransforms(bindings.instanceBuffer, bindings.instanceOffset + first * sizeof(glm::mat4), MODEL_LOCATION);
+        buffer.drawArraysInstanced(GL_TRIANGLES, 0, 36, last - first);
+    }
+
+    void draw(Camera &camera, const glm::mat4 &projection) {
+        PROFILE_SCOPE("CubeGridScene");
+        if (!this->prepared) {
+            this->prepare(camera, projection);
+        }
+        this->prepared = false;
+
+        CommandBuffer *buffers[RECORD_RANGES + 1];
+        for (GLuint i = 0; i <= RECORD_RANGES; i++) {
+            buffers[i] = &this->commands[i];
+        }
+        this->instances.unmap();
+        this->backend.invalidate();
+        this->queue.submit(buffers, RECORD_RANGES + 1, this->backend);
+        glBindVertexArray(0);
+        this->instances.endFrame();
+    }
+
+private:
+    Shader shader;
+    VertexArrayHandle VAO;
+    BufferHandle VBO;
+    TextureHandle texture;
+    GLint viewLoc, projLoc, textureLoc;
+    StreamBuffer instances;
+
+    ArenaArray<glm::mat4> transforms;
+    ArenaArray<bool> visible;
+    ArenaArray<GLfloat> distances;
+    ArenaArray<GLuint> drawList;
+    bool prepared = false;
+    EntityWorld entities;
+
+    CommandBuffer commands[RECORD_RANGES + 1]; // Setup, then one per recorded range
+    CommandQueue queue;
+    GLCommandBackend backend;
+};
+
+// Records the cube grid seen from a fixed camera twice, once range by range on this thread and
+// once on four threads as CubeGridScene::prepare does, and replays both through
+// TraceCommandBackend. The sorted streams and the instance transforms must be identical and
+// draw every cube. No context is needed: the GL names are made up.
+// Run with GameForFuns --command-buffer-check.
+inline bool checkCommandBuffers() {
+    bool passed = true;
+    auto report = [&passed](bool ok, const std::string &what) {
+        std::cout << (ok ? "OK       " : "FAILED   ") << what << std::endl;
+        passed = passed && ok;
+    };
+
+    const GLuint count = CubeGridScene::CUBE_COUNT;
+    const GLuint buffers = CubeGridScene::RECORD_RANGES + 1;
+    glm::vec3 cameraPos(7.5f, 3.0f, 24.0f);
+    glm::mat4 view = glm::lookAt(cameraPos, glm::vec3(7.5f, -2.0f, 7.5f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+
+    std::vector<glm::mat4> transforms(count);
+    std::vector<GLfloat> distances(count);
+    std::vector<GLuint> drawList(count);
+    for (GLuint i = 0; i < count; i++) {
+        Transform cube;
+        cube.position = CubeGridScene::cubePosition(i);
+        transforms[i] = cube.getMatrix();
+        distances[i] = glm::length(cube.position - cameraPos);
+        drawList[i] = i;
+    }
+    std::sort(drawList.begin(), drawList.end(), [&distances](GLuint a, GLuint b) {
+        return distances[a] != distances[b] ? distances[a] < distances[b] : a < b;
+    });
+    CubeGridScene::Bindings bindings = { 3, 7, 5, 9, 256, 0, 1, 2 };
+    JobSystem jobs(3); // Workers whatever the machine, so the ranges really are recorded concurrently
+
+    // Counts the instances drawn on top of the trace
+    class InstanceTrace : public TraceCommandBackend {
+    public:
+        GLuint instances = 0;
+
+        void drawArraysInstanced(const DrawArraysInstancedCommand &command) {
+            this->instances += command.instances;
+            TraceCommandBackend::drawArraysInstanced(command);
+        }
+    };
+
+    std::string traces[2];
+    std::vector<glm::mat4> mapped[2];
+    GLuint instances[2];
+    for (GLuint run = 0; run < 2; run++) {
+        std::vector<CommandBuffer> commands(buffers);
+        mapped[run].assign(count, glm::mat4(0.0f));
+        glm::mat4 *instanceData = mapped[run].data();
+        CubeGridScene::recordSetup(commands[0], bindings, view, projection);
+        auto record = [&](GLuint begin, GLuint end) {
+            for (GLuint range = begin; range < end; range++) {
+                CubeGridScene::recordRange(commands[range + 1], bindings, range, drawList.data(), count,
+                                           transforms.data(), distances.data(), instanceData);
+            }
+        };
+        if (run == 0) {
+            record(0, CubeGridScene::RECORD_RANGES);
+        } else {
+            jobs.parallelForWait(CubeGridScene::RECORD_RANGES, 1, record);
+        }
+
+        CommandBuffer *pointers[buffers];
+        for (GLuint i = 0; i < buffers; i++) {
+            pointers[i] = &commands[i];
+        }
+        InstanceTrace trace;
+        CommandQueue queue;
+        queue.submit(pointers, buffers, trace);
+        traces[run] = trace.str();
+        instances[run] = trace.instances;
+    }
+
+    report(!traces[0].empty() && traces[0] == traces[1],
+           "sorted streams recorded on one thread and on " + std::to_string(jobs.getThreadCount()) + " match, "
+           + std::to_string(std::count(traces[0].begin(), traces[0].end(), '\n')) + " commands");
+    report(std::memcmp(mapped[0].data(), mapped[1].data(), count * sizeof(glm::mat4)) == 0, "instance transforms match");
+    report(instances[0] == count && instances[1] == count, std::to_string(instances[1]) + " of " + std::to_string(count) + " cubes drawn");
+    report(traces[0].compare(0, 11, "useProgram ") == 0, "per frame state replays first");
+    return passed;
+}
+
+// The GameForFuns block world as voxel chunks. By default the cube grid's blocks, greedily
+// meshed so only the outer faces of the grid are drawn, a few quads per side; given a region
+// directory, endless generated terrain streamed around the camera and saved there
+class VoxelScene : public Scene {
+public:
+    static const GLint STREAM_RADIUS = 8;     // Chunk columns kept resident around the camera
+    static const GLint STREAM_MIN_Y = -2;     // Chunk layers the terrain spans
+    static const GLint STREAM_MAX_Y = 1;
+    static const GLuint RECORD_RANGES = 8;    // Command buffers the visible chunks are recorded into in parallel
+
+    VoxelScene():
+        shader("res/shaders/voxel.vs", "res/shaders/voxel.frag"),
+        renderer(world) {
+        for (GLuint i = 0; i < CubeGridScene::CUBE_COUNT; i++) {
+            glm::vec3 position = CubeGridScene::cubePosition(i);
+            this->world.setBlock((GLint) position.x, (GLint) position.y, (GLint) position.z, BLOCK_CONTAINER);
+        }
+        this->renderer.finish();
+        this->init();
+    }
+
+    VoxelScene(const std::string &regionDirectory, uint32_t seed, size_t budgetBytes):
+        shader("res/shaders/voxel.vs", "res/shaders/voxel.frag"),
+        renderer(world),
+        regions(new RegionStore(regionDirectory)),
+        streamer(new VoxelStreamer(world, *regions, seed, STREAM_RADIUS, STREAM_MIN_Y, STREAM_MAX_Y, budgetBytes)) {
+        this->init();
+    }
+
+    const char *getName() const {
+        return "voxel_world";
+    }
+
+    // Blocks edited here are remeshed by the jobs the next prepare starts
+    VoxelWorld &getWorld() {
+        return this->world;
+    }
+
+    // Streams in every chunk around position and meshes the world now, behind a loading screen
+    void finish(const glm::vec3 &position) {
+        if (this->streamer) {
+            this->streamer->finish(position);
+        }
+        this->renderer.finish();
+    }
+
+    // Streams chunks around the camera, uploads the chunks meshed since the last frame, starts
+    // meshing the ones edited or streamed in since and records the visible chunks' draws
+    void prepare(Camera &camera, const glm::mat4 &projection) {
+        if (this->streamer) {
+            this->streamer->update(camera.getPosition());
+        }
+        this->renderer.update();
+
+        // Per frame state goes first, in its own layer
+        glm::mat4 view = camera.getViewMatrix();
+        CommandBuffer &setup = this->commands[0];
+        setup.reset();
+        setup.begin(makeSortKey(0, 0, 0));
+        setup.useProgram(this->shader.Program);
+        setup.bindTexture(0, GL_TEXTURE_2D, this->texture);
+        setup.uniform1i(this->textureLoc, 0);
+        setup.uniformMatrix4fv(this->viewLoc, glm::value_ptr(view));
+        setup.uniformMatrix4fv(this->projLoc, glm::value_ptr(projection));
+
+        VoxelRenderer::Bindings bindings = { this->shader.Program, this->texture, this->originLoc };
+        CommandBuffer *buffers[RECORD_RANGES];
+        for (GLuint i = 0; i < RECORD_RANGES; i++) {
+            buffers[i] = &this->commands[i + 1];
+        }
+        this->renderer.record(Frustum(projection * view), camera.getPosition(), bindings, buffers, RECORD_RANGES);
+        this->prepared = true;
+    }
+
+    void draw(Camera &camera, const glm::mat4 &projection) {
+        PROFILE_SCOPE("VoxelScene");
+        if (!this->prepared) {
+            this->prepare(camera, projection);
+        }
+        this->prepared = false;
+
+        CommandBuffer *buffers[RECORD_RANGES + 1];
+        for (GLuint i = 0; i <= RECORD_RANGES; i++) {
+            buffers[i] = &this->commands[i];
+        }
+        this->backend.invalidate();
+        this->queue.submit(buffers, RECORD_RANGES + 1, this->backend);
+        glBindVertexArray(0);
+    }
+
+private:
+    Shader shader;
+    VoxelWorld world;
+    VoxelRenderer renderer;
+    std::unique_ptr<RegionStore> regions;
+    std::unique_ptr<VoxelStreamer> streamer; // Destroyed before world and regions, saving the one into the other
+    TextureHandle texture;
+    GLint viewLoc, projLoc, originLoc, textureLoc;
+    bool prepared = false;
+
+    CommandBuffer commands[RECORD_RANGES + 1]; // Setup, then one per recorded range of chunks
+    CommandQueue queue;
+    GLCommandBackend backend;
+
+    void init() {
+        this->texture = TextureHandle::adopt(TextureLoading::LoadTexture((GLchar *) "res/images/container2.png"));
+        this->viewLoc = glGetUniformLocation(this->shader.Program, "view");
+        this->projLoc = glGetUniformLocation(this->shader.Program, "projection");
+        this->originLoc = glGetUniformLocation(this->shader.Program, "chunkOrigin");
+        this->textureLoc = glGetUniformLocation(this->shader.Program, "texture1");
+        this->queue.reserve(RECORD_RANGES + 1);
+    }
+};
+
+// rendererWithAllLightings: ten containers lit by a directional light, four point lights and a camera
+// spot light. Containers and lamps are entities; a lamp is a small cube with a Light.
+class LitContainersScene : public Scene {
+public:
+    static const GLuint NUMBER_OF_CONTAINERS = 10;
+    static const GLuint NUMBER_OF_POINT_LIGHTS = 4;  // lighting.frag's pointLights array
+    static const GLuint MATERIAL_CONTAINER = 0;     // MeshRef materials; every mesh is the scene cube
+    static const GLuint MATERIAL_LAMP = 1;
+
+    LitContainersScene():
+        lightingShader("res/shaders/lighting.vs", "res/shaders/lighting.frag"),
+        lampShader("res/shaders/lamp.vs", "res/shaders/lamp.frag") {
+        createSceneCube(this->VAO, this->VBO);
+        this->diffuseMap = TextureHandle::adopt(TextureLoading::LoadTexture((GLchar *) "res/images/container2.png"));
+        this->specularMap = TextureHandle::adopt(TextureLoading::LoadTexture((GLchar *) "res/images/container2_specular.png"));
+
+        this->lightingShader.Use();
+        GLuint program = this->lightingShader.Program;
+        glUniform1i(glGetUniformLocation(program, "material.diffuse"), 0);
+        glUniform1i(glGetUniformLocation(program, "material.specular"), 1);
+        glUniform1f(glGetUniformLocation(program, "material.shininess"), 32.0f);
+
+        // Directional light
+        glUniform3f(glGetUniformLocation(program, "dirLight.direction"), -0.2f, -1.0f, -0.3f);
+        glUniform3f(glGetUniformLocation(program, "dirLight.ambient"), 0.05f, 0.05f, 0.05f);
+        glUniform3f(glGetUniformLocation(program, "dirLight.diffuse"), 0.4f, 0.4f, 0.4f);
+        glUniform3f(glGetUniformLocation(program, "dirLight.specular"), 0.5f, 0.5f, 0.5f);
+
+        // Point lights are uploaded from their entities every frame, so they may move
+        for (GLuint i = 0; i < NUMBER_OF_POINT_LIGHTS; i++) {
+            std::string light = "pointLights[" + std::to_string(i) + "].";
+            PointLightLocations &locations = this->pointLightLocs[i];
+            locations.position = glGetUniformLocation(program, (light + "position").c_str());
+            locations.ambient = glGetUniformLocation(program, (light + "ambient").c_str());
+            locations.diffuse = glGetUniformLocation(program, (light + "diffuse").c_str());
+            locations.specular = glGetUniformLocation(program, (light + "specular").c_str());
+            locations.constant = glGetUniformLocation(program, (light + "constant").c_str());
+            locations.linear = glGetUniformLocation(program, (light + "linear").c_str());
+            locations.quadratic = glGetUniformLocation(program, (light + "quadratic").c_str());
+        }
+
+        // Spot light, only position and direction follow the camera
+        glUniform3f(glGetUniformLocation(program, "spotLight.ambient"), 0.0f, 0.0f, 0.0f);
+        glUniform3f(glGetUniformLocation(program, "spotLight.diffuse"), 1.0f, 1.0f, 1.0f);
+        glUniform3f(glGetUniformLocation(program, "spotLight.specular"), 1.0f, 1.0f, 1.0f);
+        glUniform1f(glGetUniformLocation(program, "spotLight.constant"), 1.0f);
+        glUniform1f(glGetUniformLocation(program, "spotLight.linear"), 0.09f);
+        glUniform1f(glGetUniformLocation(program, "spotLight.quadratic"), 0.032f);
+        glUniform1f(glGetUniformLocation(program, "spotLight.cutOff"), glm::cos(glm::radians(12.5f)));
+        glUniform1f(glGetUniformLocation(program, "spotLight.outerCutOff"), glm::cos(glm::radians(15.0f)));
+
+        this->viewPosLoc = glGetUniformLocation(program, "viewPos");
+        this->spotPositionLoc = glGetUniformLocation(program, "spotLight.position");
+        this->spotDirectionLoc = glGetUniformLocation(program, "spotLight.direction");
+
+        for (GLuint i = 0; i < NUMBER_OF_CONTAINERS; i++) {
+            Entity container = this->entities.create(COMPONENT_TRANSFORM | COMPONENT_MESH);
+            Transform &transform = *this->entities.get<Transform>(container);
+            transform.position = cubePositions()[i];
+            transform.angle = 20.0f * i;
+            transform.axis = glm::vec3(1.0f, 0.3f, 0.5f);
+            this->entities.get<MeshRef>(container)->material = MATERIAL_CONTAINER;
+        }
+        for (GLuint i = 0; i < NUMBER_OF_POINT_LIGHTS; i++) {
+            Entity lamp = this->entities.create(COMPONENT_TRANSFORM | COMPONENT_MESH | COMPONENT_LIGHT);
+            Transform &transform = *this->entities.get<Transform>(lamp);
+            transform.position = pointLightPositions()[i];
+            transform.scale = 0.2f;
+            this->entities.get<MeshRef>(lamp)->material = MATERIAL_LAMP;
+        }
+    }
+
+    const char *getName() const {
+        return "lit_containers";
+    }
+
+    static const glm::vec3 *cubePositions() {
+        static const glm::vec3 positions[NUMBER_OF_CONTAINERS] = {
+            glm::vec3(  0.0f,   0.0f,   0.0f),
+            glm::vec3(  2.0f,   5.0f,   -15.0f),
+            glm::vec3(  -1.5f,  -2.2f,  -2.5f),
+            glm::vec3(  -3.8f,  -2.0f,  -12.3f),
+            glm::vec3(  2.4f,   -0.4f,  -3.5f),
+            glm::vec3(  -1.7f,  3.0f,   -7.5f),
+            glm::vec3(  1.3f,   -2.0f,  -2.5f),
+            glm::vec3(  1.5f,   2.0f,   -2.5f),
+            glm::vec3(  1.5f,   0.2f,   -1.5f),
+            glm::vec3(  -1.3f,  1.0f,   -1.5f)
+        };
+        return positions;
+    }
+
+    static const glm::vec3 *pointLightPositions() {
+        static const glm::vec3 positions[NUMBER_OF_POINT_LIGHTS] = {
+            glm::vec3(  0.7f,  0.2f,  2.0f      ),
+            glm::vec3(  2.3f, -3.3f, -4.0f      ),
+            glm::vec3(  -4.0f,  2.0f, -12.0f    ),
+            glm::vec3(  0.0f,  0.0f, -3.0f      )
+        };
+        return positions;
+    }
+
+    // Every container, lit by the first NUMBER_OF_POINT_LIGHTS light entities, then every lamp
+    void draw(Camera &camera, const glm::mat4 &projection) {
+        PROFILE_SCOPE("LitContainersScene");
+        glm::vec3 cameraPos = camera.getPosition();
+        glm::vec3 cameraFront = camera.getFront();
+        glm::mat4 view = camera.getViewMatrix();
+
+        this->lightingShader.Use();
+        PROFILE_STATE_CHANGE();
+        glUniform3f(this->viewPosLoc, cameraPos.x, cameraPos.y, cameraPos.z);
+        glUniform3f(this->spotPositionLoc, cameraPos.x, cameraPos.y, cameraPos.z);
+        glUniform3f(this->spotDirectionLoc, cameraFront.x, cameraFront.y, cameraFront.z);
+        this->uploadLights();
+
+        GLuint program = this->lightingShader.Program;
+        GLint modelLoc = glGetUniformLocation(program, "model");
+        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, this->diffuseMap);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, this->specularMap);
+        PROFILE_STATE_CHANGE();
+        PROFILE_STATE_CHANGE();
+
+        // Draw the containers with the same VAO; only their world space coordinates differ
+        glBindVertexArray(this->VAO);
+        PROFILE_STATE_CHANGE();
+        this->drawMaterial(MATERIAL_CONTAINER, modelLoc);
+
+        // Lamps
+        this->lampShader.Use();
+        PROFILE_STATE_CHANGE();
+        program = this->lampShader.Program;
+        modelLoc = glGetUniformLocation(program, "model");
+        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        this->drawMaterial(MATERIAL_LAMP, modelLoc);
+        glBindVertexArray(0);
+
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    Shader lightingShader;
+    Shader lampShader;
+    VertexArrayHandle VAO;
+    BufferHandle VBO;
+    TextureHandle diffuseMap, specularMap;
+    GLint viewPosLoc, spotPositionLoc, spotDirectionLoc;
+    EntityWorld entities;
+
+    struct PointLightLocations {
+        GLint position, ambient, diffuse, specular, constant, linear, quadratic;
+    };
+    PointLightLocations pointLightLocs[NUMBER_OF_POINT_LIGHTS];
+
+    // Lights past NUMBER_OF_POINT_LIGHTS are ignored; missing ones are uploaded black
+    void uploadLights() {
+        GLuint uploaded = 0;
+        this->entities.forEach(COMPONENT_TRANSFORM | COMPONENT_LIGHT, [this, &uploaded](const EntityRange &range) {
+            const Transform *transforms = range.archetype->get<Transform>();
+            const Light *lights = range.archetype->get<Light>();
+            for (GLuint row = range.begin; row < range.end && uploaded < NUMBER_OF_POINT_LIGHTS; row++) {
+                const PointLightLocations &locations = this->pointLightLocs[uploaded++];
+                const glm::vec3 &position = transforms[row].position;
+                const Light &light = lights[row];
+                glUniform3f(locations.position, position.x, position.y, position.z);
+                glUniform3f(locations.ambient, light.ambient.x, light.ambient.y, light.ambient.z);
+                glUniform3f(locations.diffuse, light.diffuse.x, light.diffuse.y, light.diffuse.z);
+                glUniform3f(locations.specular, light.specular.x, light.specular.y, light.specular.z);
+                glUniform1f(locations.constant, light.constant);
+                glUniform1f(locations.linear, light.linear);
+                glUniform1f(locations.quadratic, light.quadratic);
+            }
+        });
+        for (; uploaded < NUMBER_OF_POINT_LIGHTS; uploaded++) {
+            const PointLightLocations &locations = this->pointLightLocs[uploaded];
+            glUniform3f(locations.ambient, 0.0f, 0.0f, 0.0f);
+            glUniform3f(locations.diffuse, 0.0f, 0.0f, 0.0f);
+            glUniform3f(locations.specular, 0.0f, 0.0f, 0.0f);
+            glUniform1f(locations.constant, 1.0f);
+        }
+    }
+
+    // One draw of the bound cube per entity with the material, the current program's model at modelLoc
+    void drawMaterial(GLuint material, GLint modelLoc) {
+        this->entities.forEach(COMPONENT_TRANSFORM | COMPONENT_MESH, [material, modelLoc](const EntityRange &range) {
+            const Transform *transforms = range.archetype->get<Transform>();
+            const MeshRef *meshes = range.archetype->get<MeshRef>();
+            for (GLuint row = range.begin; row < range.end; row++) {
+                if (meshes[row].material != material) {
+                    continue;
+                }
+                glm::mat4 model = transforms[row].getMatrix();
+                glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+                glDrawArrays(GL_TRIANGLES, 0, 36);
+                PROFILE_DRAW(12);
+            }
+        });
+    }
+};
+
+// modelLoader: the nanosuit loaded through Assimp. With virtual texturing the diffuse maps
+// are sampled through a VirtualTextureSystem instead of the model's own textures.
+class NanosuitScene : public Scene {
+public:
+    explicit NanosuitScene(bool virtualTexturing = false):
+        shader("res/shaders/modelLoading.vs", "res/shaders/modelLoading.frag"),
+        model((GLchar *) "res/models/nanosuit.obj") {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        this->viewportHeight = (GLfloat) viewport[3];
+        if (virtualTexturing) {
+            this->setupVirtualTexturing((GLuint) viewport[2], (GLuint) viewport[3]);
+        }
+    }
+
+    const char *getName() const {
+        return "nanosuit";
+    }
+
+    void draw(Camera &camera, const glm::mat4 &projection) {
+        PROFILE_SCOPE("NanosuitScene");
+        glm::mat4 view = camera.getViewMatrix();
+
+        glm::mat4 transform(1);
+        transform = glm::translate(transform, glm::vec3(0.0f, -1.75f, 0.0f));
+        transform = glm::scale(transform, glm::vec3(0.2f, 0.2f, 0.2f));
+
+        if (this->virtualTextures) {
+            {
+                PROFILE_SCOPE("Virtual texture feedback");
+                this->virtualTextures->beginFeedback();
+                this->drawVirtual(*this->feedbackShader, view, projection, transform);
+                this->virtualTextures->endFeedback();
+            }
+            this->virtualTextures->update();
+            this->drawVirtual(*this->virtualShader, view, projection, transform);
+            return;
+        }
+
+        this->shader.Use();
+        PROFILE_STATE_CHANGE();
+        glUniformMatrix4fv(glGetUniformLocation(this->shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniformMatrix4fv(glGetUniformLocation(this->shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(this->shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(transform));
+        this->model.draw(this->shader);
+
+        // Projected height of the bounding sphere, the suit is about 3 units tall after scaling
+        const glm::vec3 center(0.0f, -0.2f, 0.0f);
+        const GLfloat radius = 1.6f;
+        GLfloat distance = std::max(glm::length(camera.getPosition() - center), radius);
+        GLfloat screenSize = radius / distance * projection[1][1] * this->viewportHeight;
+        for (const Texture &texture : this->model.getTextures()) {
+            TextureResidency::get().touch(texture.id, screenSize);
+        }
+    }
+
+private:
+    Shader shader;
+    Model model;
+    GLfloat viewportHeight;
+    std::unique_ptr<VirtualTextureSystem> virtualTextures;
+    std::unique_ptr<Shader> virtualShader, feedbackShader;
+    std::vector<GLint> meshTextures; // Virtual texture of each mesh's diffuse map, -1 for none
+
+    void setupVirtualTexturing(GLuint width, GLuint height) {
+        this->virtualTextures.reset(new VirtualTextureSystem(width, height));
+        this->virtualShader.reset(new Shader("res/shaders/modelLoading.vs", "res/shaders/virtualTexture.frag"));
+        this->feedbackShader.reset(new Shader("res/shaders/modelLoading.vs", "res/shaders/virtualTextureFeedback.frag"));
+
+        std::map<std::string, GLint> added;
+        for (Mesh &mesh : this->model.getMeshes()) {
+            GLint texture = -1;
+            for (const Texture &candidate : mesh.textures) {
+                if (candidate.type != "texture_diffuse") {
+                    continue;
+                }
+                std::string path = this->model.getDirectory() + '/' + candidate.path.C_Str();
+                auto found = added.find(path);
+                texture = found != added.end() ? found->second : (added[path] = this->virtualTextures->addTexture(path));
+                break;
+            }
+            this->meshTextures.push_back(texture);
+        }
+    }
+
+    void drawVirtual(Shader &shader, const glm::mat4 &view, const glm::mat4 &projection, const glm::mat4 &transform) {
+        shader.Use();
+        PROFILE_STATE_CHANGE();
+        glUniformMatrix4fv(glGetUniformLocation(shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniformMatrix4fv(glGetUniformLocation(shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(transform));
+
+        std::vector<Mesh> &meshes = this->model.getMeshes();
+        for (GLuint i = 0; i < meshes.size(); i++) {
+            if (this->meshTextures[i] < 0) {
+                continue;
+            }
+            this->virtualTextures->apply(shader.Program, (GLuint) this->meshTextures[i]);
+            meshes[i].drawGeometry();
+        }
+    }
+};
+
+// A glTF model at the origin, drawn with the nanosuit's shaders
+class GltfScene : public Scene {
+public:
+    explicit GltfScene(const std::string &path):
+        shader("res/shaders/modelLoading.vs", "res/shaders/modelLoading.frag"),
+        model(path) {}
+
+    const char *getName() const {
+        return "gltf";
+    }
+
+    void draw(Camera &camera, const glm::mat4 &projection) {
+        PROFILE_SCOPE("GltfScene");
+        this->shader.Use();
+        PROFILE_STATE_CHANGE();
+        glUniformMatrix4fv(glGetUniformLocation(this->shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniformMatrix4fv(glGetUniformLocation(this->shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(camera.getViewMatrix()));
+        this->model.draw(this->shader, glm::mat4(1));
+    }
+
+private:
+    Shader shader;
+    GltfModel model;
+};
+
+// A million particle fountain over a wavy heightfield, simulated, culled and sorted on the GPU
+class ParticleScene : public Scene {
+public:
+    static const GLuint CAPACITY = 1 << 20;
+    static const GLuint FIELD_SIZE = 64;
+
+    ParticleScene(): particles(CAPACITY, settings()) {
+        ParticleHeightfield field;
+        field.origin = glm::vec2(-(GLfloat) FIELD_SIZE / 2.0f);
+        field.width = FIELD_SIZE;
+        field.depth = FIELD_SIZE;
+        for (GLuint z = 0; z < FIELD_SIZE; z++) {
+            for (GLuint x = 0; x < FIELD_SIZE; x++) {
+                field.heights.push_back(-2.0f + 0.5f * std::sin(0.4f * x) * std::cos(0.3f * z));
+            }
+        }
+        this->particles.setHeightfield(field);
+    }
+
+    const char *getName() const {
+        return "particles";
+    }
+
+    // Steps at the benchmark's fixed frame time, so every run sees the same particles
+    void draw(Camera &camera, const glm::mat4 &projection) {
+        PROFILE_SCOPE("ParticleScene");
+        this->particles.update(1.0f / 60.0f);
+        this->particles.draw(camera.getViewMatrix(), projection, camera.getPosition());
+    }
+
+private:
+    ParticleSystem particles;
+
+    static ParticleSettings settings() {
+        ParticleSettings settings;
+        settings.emitter = glm::vec3(0.0f, -1.5f, -6.0f);
+        settings.emitRate = CAPACITY / 5.0f; // About the longest lifetime, so the pool stays full
+        settings.size = 0.03f;
+        return settings;
+    }
+};
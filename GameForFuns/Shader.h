@@ -5,9 +5,13 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <utility>
+#include <vector>
 
 #include <GL/glew.h>
 
+#include "GpuResources.h"
+
 class Shader {
 public:
     GLuint Program;
@@ -90,17 +94,66 @@ public:
         glDeleteShader( vertex );
         glDeleteShader( fragment );
         
+        GpuResourceRegistry::get( ).track( GPU_PROGRAM, this->Program, GPU_MEMORY_OTHER, 0, vertexPath );
     }
     
+    // Owns the program, so it can't be copied
+    Shader( const Shader & ) = delete;
+    Shader &operator=( const Shader & ) = delete;
+    
     // Uses the current shader
     void Use() {
         glUseProgram( this->Program );
     }
     
     ~Shader() {
-        if(Program != 0)                           // delete only if successfully created
-            glDeleteShader(Program);      // delete program
+        GpuResourceRegistry::get( ).release( GPU_PROGRAM, this->Program ); // Deleted once the GPU is done with it
     }
 };
 
+// Links a program from any set of stages, each read from a file, e.g. a lone compute shader.
+// Transform feedback varyings, when given, are captured interleaved in the order listed.
+inline ProgramHandle linkProgram( const std::vector<std::pair<GLenum, const char *>> &stages,
+                                  const std::vector<const GLchar *> &feedbackVaryings = { } ) {
+    ProgramHandle program = ProgramHandle::create( GPU_MEMORY_OTHER, stages[0].second );
+    std::vector<GLuint> shaders;
+    for (const auto &stage : stages) {
+        std::ifstream file( stage.second );
+        std::stringstream source;
+        source << file.rdbuf( );
+        std::string code = source.str( );
+        if (code.empty( )) {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ " << stage.second << std::endl;
+        }
+        const GLchar *text = code.c_str( );
+        GLuint shader = glCreateShader( stage.first );
+        glShaderSource( shader, 1, &text, NULL );
+        glCompileShader( shader );
+        GLint success;
+        glGetShaderiv( shader, GL_COMPILE_STATUS, &success );
+        if (!success) {
+            GLchar infoLog[512];
+            glGetShaderInfoLog( shader, 512, NULL, infoLog );
+            std::cout << "ERROR::SHADER::COMPILATION_FAILED " << stage.second << "\n" << infoLog << std::endl;
+        }
+        glAttachShader( program, shader );
+        shaders.push_back( shader );
+    }
+    if (!feedbackVaryings.empty( )) {
+        glTransformFeedbackVaryings( program, (GLsizei) feedbackVaryings.size( ), feedbackVaryings.data( ), GL_INTERLEAVED_ATTRIBS );
+    }
+    glLinkProgram( program );
+    GLint success;
+    glGetProgramiv( program, GL_LINK_STATUS, &success );
+    if (!success) {
+        GLchar infoLog[512];
+        glGetProgramInfoLog( program, 512, NULL, infoLog );
+        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED " << stages[0].second << "\n" << infoLog << std::endl;
+    }
+    for (GLuint shader : shaders) {
+        glDeleteShader( shader );
+    }
+    return program;
+}
+
 #endif
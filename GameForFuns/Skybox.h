@@ -0,0 +1,274 @@
+//
+//  Skybox.h
+//  GameForFuns
+//
+//  Cubemap sky drawn behind everything. The six face images are decoded in
+//  parallel on the job system, each face building its own mip chain, and the
+//  result is baked beside them into one KTX2 file holding every face and
+//  level. Later runs map that file and upload it as stored, with no decode
+//  and no mip generation; the bake is redone when a face is newer than it.
+//
+//  The sky is a single fullscreen triangle at depth 1.0. Each corner carries
+//  the world direction through it, unprojected with the inverse of the
+//  rotation-only view projection, so the rasterizer interpolates view rays
+//  and no cube geometry is drawn.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "SOIL2/SOIL2.h"
+
+#include "Shader.h"
+#include "Camera.h"
+#include "Profiler.h"
+#include "JobSystem.h"
+#include "GpuResources.h"
+#include "MappedFile.h"
+#include "TextureResidency.h"
+#include "AsyncTextureLoader.h"
+
+const GLuint CUBEMAP_FACE_COUNT = 6;
+const GLuint KTX2_VK_FORMAT_R8G8B8A8_UNORM = 37;
+
+class Skybox {
+public:
+    // faces in GL order, +X -X +Y -Y +Z -Z; bakedPath is where the single-file cubemap is kept
+    Skybox(const std::vector<std::string> &faces, const std::string &bakedPath)
+        : shader("res/shaders/skybox.vs", "res/shaders/skybox.frag") {
+        // The triangle's corners come from gl_VertexID, but core profiles still want a VAO bound
+        this->vao = VertexArrayHandle::create(GPU_MEMORY_GEOMETRY, "Skybox");
+        this->cubemap = TextureHandle::create(GPU_MEMORY_TEXTURES, bakedPath);
+
+        PROFILE_SCOPE("Skybox load");
+        if (!isStale(faces, bakedPath) && this->loadBaked(bakedPath)) {
+            return;
+        }
+        this->bake(faces, bakedPath);
+    }
+
+    // The triangle lies exactly on the far plane, where the cleared depth is, so draw with GL_LEQUAL
+    void draw(Camera &camera, const glm::mat4 &projection) {
+        glm::mat4 rotation = glm::mat4(glm::mat3(camera.getViewMatrix())); // The sky is infinitely far, so only rotation matters
+        glm::mat4 inverseViewProjection = glm::inverse(projection * rotation);
+
+        this->shader.Use();
+        glUniformMatrix4fv(glGetUniformLocation(this->shader.Program, "inverseViewProjection"), 1, GL_FALSE, glm::value_ptr(inverseViewProjection));
+        glBindVertexArray(this->vao);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, this->cubemap);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        PROFILE_DRAW(1);
+        glBindVertexArray(0);
+    }
+
+    GLuint getTexture() const {
+        return this->cubemap;
+    }
+
+private:
+    Shader shader;
+    VertexArrayHandle vao;
+    TextureHandle cubemap;
+
+    // RGBA8 levels of one face, finest first
+    struct Face {
+        std::vector<std::vector<unsigned char>> levels;
+        int width = 0, height = 0;
+    };
+
+    // The bake is missing, or older than one of the images it was made from
+    static bool isStale(const std::vector<std::string> &faces, const std::string &bakedPath) {
+        struct stat baked;
+        if (stat(bakedPath.c_str(), &baked) != 0) {
+            return true;
+        }
+        for (const std::string &face : faces) {
+            struct stat source;
+            if (stat(face.c_str(), &source) == 0 && source.st_mtime > baked.st_mtime) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool loadBaked(const std::string &path) {
+        MappedFile file;
+        DecodedTexture decoded;
+        if (!file.open(path) || !parseKtx2((const unsigned char *) file.getData(), file.getSize(), decoded)) {
+            return false;
+        }
+        if (decoded.faces != CUBEMAP_FACE_COUNT) {
+            std::cout << "ERROR::SKYBOX::NOT_A_CUBEMAP " << path << std::endl;
+            return false;
+        }
+        bool bptc = decoded.internalFormat == GL_COMPRESSED_RGBA_BPTC_UNORM_ARB || decoded.internalFormat == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB;
+        if (decoded.compressed && !(bptc ? (GLEW_ARB_texture_compression_bptc || GLEW_VERSION_4_2) : GLEW_EXT_texture_compression_s3tc)) {
+            std::cout << "ERROR::SKYBOX::COMPRESSED_FORMAT_UNSUPPORTED " << path << std::endl;
+            return false;
+        }
+
+        glBindTexture(GL_TEXTURE_CUBE_MAP, this->cubemap);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        size_t bytes = 0;
+        for (GLuint level = 0; level < decoded.levels.size(); level++) {
+            GLsizei width = std::max(decoded.width >> level, 1u), height = std::max(decoded.height >> level, 1u);
+            size_t faceSize = decoded.levelSizes[level] / CUBEMAP_FACE_COUNT; // A level holds its faces back to back
+            for (GLuint face = 0; face < CUBEMAP_FACE_COUNT; face++) {
+                const unsigned char *pixels = decoded.levels[level] + face * faceSize;
+                if (decoded.compressed) {
+                    glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, decoded.internalFormat, width, height, 0, (GLsizei) faceSize, pixels);
+                } else {
+                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, decoded.internalFormat, width, height, 0, decoded.format, GL_UNSIGNED_BYTE, pixels);
+                }
+            }
+            bytes += decoded.levelSizes[level];
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        if (decoded.generateMips) {
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+            bytes = bytes * 4 / 3;
+        }
+        this->finishTexture(bytes);
+        return true;
+    }
+
+    void bake(const std::vector<std::string> &faces, const std::string &bakedPath) {
+        if (faces.size() != CUBEMAP_FACE_COUNT) {
+            std::cout << "ERROR::SKYBOX::NEEDS_SIX_FACES" << std::endl;
+            return;
+        }
+
+        // Each face is read, decoded and filtered down on its own worker
+        Face decoded[CUBEMAP_FACE_COUNT];
+        JobSystem::get().parallelForWait(CUBEMAP_FACE_COUNT, 1, [&](GLuint first, GLuint last) {
+            for (GLuint i = first; i < last; i++) {
+                PROFILE_SCOPE("Skybox face decode");
+                Face &face = decoded[i];
+                unsigned char *image = SOIL_load_image(faces[i].c_str(), &face.width, &face.height, 0, SOIL_LOAD_RGBA);
+                if (image) {
+                    buildMipChain(image, (GLuint) face.width, (GLuint) face.height, 4, face.levels);
+                }
+                SOIL_free_image_data(image);
+            }
+        });
+
+        for (GLuint i = 0; i < CUBEMAP_FACE_COUNT; i++) {
+            if (decoded[i].levels.empty() || decoded[i].width != decoded[0].width || decoded[i].height != decoded[0].height) {
+                std::cout << "ERROR::SKYBOX::FACE_NOT_LOADED " << faces[i] << std::endl;
+                return;
+            }
+        }
+
+        glBindTexture(GL_TEXTURE_CUBE_MAP, this->cubemap);
+        size_t bytes = 0;
+        for (GLuint level = 0; level < decoded[0].levels.size(); level++) {
+            GLsizei width = std::max(decoded[0].width >> level, 1), height = std::max(decoded[0].height >> level, 1);
+            for (GLuint face = 0; face < CUBEMAP_FACE_COUNT; face++) {
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, decoded[face].levels[level].data());
+                bytes += decoded[face].levels[level].size();
+            }
+        }
+        this->finishTexture(bytes);
+
+        if (!writeKtx2(bakedPath, decoded)) {
+            std::cout << "ERROR::SKYBOX::COULD_NOT_WRITE_BAKE " << bakedPath << std::endl;
+        }
+    }
+
+    void finishTexture(size_t bytes) {
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS); // Filter across face edges, which the coarse mips would otherwise show
+        this->cubemap.setSize(bytes);
+    }
+
+    // KTX2 cubemap of RGBA8 faces: header, level index, data format descriptor, then levels coarsest first
+    static bool writeKtx2(const std::string &path, const Face *faces) {
+        static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+        const uint32_t headerSize = 80, levelEntrySize = 24;
+        uint32_t levelCount = (uint32_t) faces[0].levels.size();
+
+        std::vector<unsigned char> file;
+        auto put32 = [&file](uint32_t value) {
+            file.insert(file.end(), (const unsigned char *) &value, (const unsigned char *) &value + sizeof(value));
+        };
+        auto put64 = [&file](uint64_t value) {
+            file.insert(file.end(), (const unsigned char *) &value, (const unsigned char *) &value + sizeof(value));
+        };
+        auto patch64 = [&file](size_t offset, uint64_t value) {
+            std::memcpy(file.data() + offset, &value, sizeof(value));
+        };
+
+        // Basic descriptor for R8G8B8A8_UNORM: one 88 byte block of four 8 bit samples
+        const uint32_t dfdOffset = headerSize + levelCount * levelEntrySize, dfdSize = 4 + 24 + 4 * 16;
+
+        file.insert(file.end(), identifier, identifier + sizeof(identifier));
+        put32(KTX2_VK_FORMAT_R8G8B8A8_UNORM);
+        put32(1);                                   // typeSize
+        put32((uint32_t) faces[0].width);
+        put32((uint32_t) faces[0].height);
+        put32(0);                                   // pixelDepth
+        put32(0);                                   // layerCount
+        put32(CUBEMAP_FACE_COUNT);
+        put32(levelCount);
+        put32(0);                                   // supercompressionScheme
+        put32(dfdOffset);
+        put32(dfdSize);
+        put32(0);                                   // kvdByteOffset
+        put32(0);                                   // kvdByteLength
+        put64(0);                                   // sgdByteOffset
+        put64(0);                                   // sgdByteLength
+
+        size_t levelIndex = file.size();
+        file.resize(file.size() + levelCount * levelEntrySize);
+
+        put32(dfdSize);
+        put32(0);                                   // vendorId and descriptorType, Khronos basic
+        put32(2 | (dfdSize - 4) << 16);             // versionNumber, descriptorBlockSize
+        put32(1 | 1 << 8 | 1 << 16);                // RGBSDA model, BT.709 primaries, linear transfer
+        put32(0);                                   // 1x1x1x1 texel blocks
+        put32(4);                                   // bytesPlane0
+        put32(0);
+        static const uint32_t channels[4] = { 0, 1, 2, 15 }; // R, G, B, alpha
+        for (uint32_t sample = 0; sample < 4; sample++) {
+            put32(sample * 8 | 7 << 16 | channels[sample] << 24);
+            put32(0);                               // samplePosition
+            put32(0);                               // sampleLower
+            put32(255);                             // sampleUpper
+        }
+
+        // Levels are stored from the smallest up, each holding all six faces
+        for (uint32_t level = levelCount; level-- > 0;) {
+            size_t offset = file.size();
+            for (GLuint face = 0; face < CUBEMAP_FACE_COUNT; face++) {
+                file.insert(file.end(), faces[face].levels[level].begin(), faces[face].levels[level].end());
+            }
+            size_t length = file.size() - offset;
+            patch64(levelIndex + level * levelEntrySize, offset);
+            patch64(levelIndex + level * levelEntrySize + 8, length);
+            patch64(levelIndex + level * levelEntrySize + 16, length);
+        }
+
+        std::ofstream out(path, std::ios::binary);
+        out.write((const char *) file.data(), (std::streamsize) file.size());
+        return (bool) out;
+    }
+};
@@ -0,0 +1,153 @@
+//
+//  StreamBuffer.h
+//  GameForFuns
+//
+//  Ring buffer for data written every frame (transforms, instance data,
+//  dynamic geometry). The buffer is split into one region per frame in
+//  flight. With ARB_buffer_storage it is mapped once, persistently and
+//  coherently, and each region is guarded by a fence, so the CPU writes
+//  straight into memory the GPU reads and waits only if the GPU falls a
+//  whole ring behind. Without it (GL 3.3, macOS) the buffer is orphaned and
+//  mapped unsynchronized every frame, so the driver hands out fresh storage
+//  instead of stalling.
+//
+//  Writes may come from any thread between beginFrame and unmap; only
+//  beginFrame, unmap and endFrame touch GL.
+//
+#pragma once
+
+#include <atomic>
+#include <iostream>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Profiler.h"
+#include "FrameArena.h"
+#include "GpuResources.h"
+
+const GLuint STREAM_BUFFER_REGIONS = FRAME_ARENA_COUNT; // Same latency as the frame arenas
+
+class StreamBuffer {
+public:
+    StreamBuffer(GLenum target, GLuint regionSize): target(target), regionSize(regionSize) {
+        this->persistent = GLEW_ARB_buffer_storage || GLEW_VERSION_4_4;
+
+        this->buffer = BufferHandle::create(GPU_MEMORY_STREAMING, "StreamBuffer");
+        glBindBuffer(target, this->buffer);
+        if (this->persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(target, this->getSize(), NULL, flags);
+            this->mapped = (unsigned char *) glMapBufferRange(target, 0, this->getSize(), flags);
+            if (!this->mapped) {
+                std::cout << "ERROR::STREAM_BUFFER::PERSISTENT_MAP_FAILED" << std::endl;
+            }
+        } else {
+            glBufferData(target, this->getSize(), NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(target, 0);
+        this->buffer.setSize(this->getSize());
+
+        for (GLuint i = 0; i < STREAM_BUFFER_REGIONS; i++) {
+            this->fences[i] = 0;
+        }
+    }
+
+    ~StreamBuffer() {
+        for (GLuint i = 0; i < STREAM_BUFFER_REGIONS; i++) {
+            if (this->fences[i]) {
+                glDeleteSync(this->fences[i]);
+            }
+        }
+        if (this->mapped) {
+            glBindBuffer(this->target, this->buffer);
+            glUnmapBuffer(this->target);
+            glBindBuffer(this->target, 0);
+        }
+    }
+
+    StreamBuffer(const StreamBuffer &) = delete;
+    StreamBuffer &operator=(const StreamBuffer &) = delete;
+
+    // Moves to the next region, waiting for the GPU to finish reading it if it has not yet
+    void beginFrame() {
+        PROFILE_SCOPE("StreamBuffer::beginFrame");
+        this->used.store(0, std::memory_order_relaxed);
+
+        if (this->persistent) {
+            this->region = (this->region + 1) % STREAM_BUFFER_REGIONS;
+            GLsync &fence = this->fences[this->region];
+            if (fence) {
+                GLenum result = glClientWaitSync(fence, 0, 0);
+                if (result == GL_TIMEOUT_EXPIRED) {
+                    PROFILE_SCOPE("StreamBuffer stall");
+                    while (result == GL_TIMEOUT_EXPIRED) {
+                        result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+                    }
+                }
+                glDeleteSync(fence);
+                fence = 0;
+            }
+            return;
+        }
+
+        // Orphan, then map the fresh storage without synchronising
+        this->region = 0;
+        glBindBuffer(this->target, this->buffer);
+        glBufferData(this->target, this->getSize(), NULL, GL_STREAM_DRAW);
+        this->mapped = (unsigned char *) glMapBufferRange(this->target, 0, this->regionSize,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(this->target, 0);
+    }
+
+    // Returns a pointer to write bytes to and their offset in the buffer, nullptr when the region is full
+    void *allocate(GLuint bytes, GLuint alignment, GLuint *offset) {
+        GLuint start = this->used.fetch_add(bytes + alignment - 1, std::memory_order_relaxed);
+        start = (start + alignment - 1) / alignment * alignment;
+        if (!this->mapped || start + bytes > this->regionSize) {
+            return nullptr;
+        }
+        *offset = this->region * this->regionSize + start;
+        return this->mapped + *offset;
+    }
+
+    // Makes this frame's writes visible to GL; call after the last allocate and before drawing
+    void unmap() {
+        if (this->persistent || !this->mapped) {
+            return; // Coherent mapping, nothing to flush
+        }
+        glBindBuffer(this->target, this->buffer);
+        glUnmapBuffer(this->target);
+        glBindBuffer(this->target, 0);
+        this->mapped = nullptr;
+    }
+
+    // Fences this frame's region; call after the last draw that reads it
+    void endFrame() {
+        if (this->persistent) {
+            this->fences[this->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+    }
+
+    GLuint getBuffer() const {
+        return this->buffer;
+    }
+
+    GLuint getSize() const {
+        return this->persistent ? this->regionSize * STREAM_BUFFER_REGIONS : this->regionSize;
+    }
+
+    bool isPersistent() const {
+        return this->persistent;
+    }
+
+private:
+    GLenum target;
+    BufferHandle buffer;
+    GLuint regionSize;
+    GLuint region = 0;
+    bool persistent = false;
+    unsigned char *mapped = nullptr;
+    std::atomic<GLuint> used{0};
+    GLsync fences[STREAM_BUFFER_REGIONS];
+};
@@ -0,0 +1,203 @@
+//
+//  TextureCache.h
+//  GameForFuns
+//
+//  Process-wide texture cache, so every model that names the same image file
+//  shares one GL texture. Entries are keyed by canonical path and load mode
+//  in a hash map and reference counted: acquire() adds a reference and
+//  release() drops one, freeing the texture with the last. Asynchronous
+//  entries are cached from the moment the placeholder exists, so a second
+//  request while the image is still decoding shares that decode. A blocking
+//  load in progress on one thread makes other threads asking for the same
+//  key wait for it rather than load it again.
+//
+//  A miss creates GL objects and a last release frees them, so both must
+//  happen on the context thread; hits may come from any thread.
+//
+#pragma once
+
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "SOIL2/SOIL2.h"
+
+#include "GpuResources.h"
+#include "TextureResidency.h"
+#include "AsyncTextureLoader.h"
+
+enum TextureLoadMode {
+    TEXTURE_LOAD_BLOCKING, // Decoded and uploaded before acquire returns, RGB under TextureResidency
+    TEXTURE_LOAD_ASYNC     // A placeholder at once, RGBA or KTX2 through AsyncTextureLoader
+};
+
+// Decodes and uploads an image file now, with its mips handed to TextureResidency
+inline GLuint loadTextureFile(const std::string &path) {
+    GLuint textureId;
+    glGenTextures(1, &textureId);
+
+    int width = 0, height = 0;
+
+    unsigned char *image = SOIL_load_image(path.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
+    glBindTexture(GL_TEXTURE_2D, textureId);
+    if (!image) {
+        // The same 1x1 white placeholder an asynchronous load shows until its decode
+        std::cout << "ERROR::TEXTURE::DECODE_FAILED " << path << std::endl;
+        const unsigned char white[4] = { 255, 255, 255, 255 };
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        GpuResourceRegistry::get().track(GPU_TEXTURE, textureId, GPU_MEMORY_TEXTURES, 4, path);
+        return textureId;
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Keeps a system memory copy so mips can be dropped and streamed back under the VRAM budget
+    TextureResidency::get().add(textureId, width, height, 3, image);
+
+    SOIL_free_image_data(image);
+
+    // Drivers pad RGB to four bytes per texel; mips add a third
+    GpuResourceRegistry::get().track(GPU_TEXTURE, textureId, GPU_MEMORY_TEXTURES, (size_t) width * height * 4 * 4 / 3, path);
+
+    return textureId;
+}
+
+class TextureCache {
+public:
+    static TextureCache &get() {
+        static TextureCache instance;
+        return instance;
+    }
+
+    // What the cache uses is created first, so it outlives the cache
+    TextureCache() {
+        GpuResourceRegistry::get();
+        AsyncTextureLoader::get();
+        TextureResidency::get();
+    }
+
+    TextureCache(const TextureCache &) = delete;
+    TextureCache &operator=(const TextureCache &) = delete;
+
+    // Returns the texture for a file, loading it on the first request; pair with release()
+    GLuint acquire(const std::string &path, TextureLoadMode mode) {
+        return this->acquireKey(canonicalPath(path), mode, nullptr, 0);
+    }
+
+    // As acquire for an encoded image in memory, e.g. inside a .glb; key names it uniquely,
+    // such as the model's canonical path and the image index. Always asynchronous.
+    GLuint acquireFromMemory(const std::string &key, const unsigned char *bytes, size_t size) {
+        return this->acquireKey(key, TEXTURE_LOAD_ASYNC, bytes, size);
+    }
+
+    void release(GLuint texture) {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        auto owner = this->owners.find(texture);
+        if (owner == this->owners.end()) {
+            return;
+        }
+        auto found = this->entries.find(owner->second);
+        if (--found->second.references > 0) {
+            return;
+        }
+        TextureHandle handle = std::move(found->second.texture);
+        this->entries.erase(found);
+        this->owners.erase(owner);
+        lock.unlock();
+
+        AsyncTextureLoader::get().cancel(handle);
+        TextureResidency::get().remove(handle);
+    } // The handle hands the texture to the registry for deletion after the GPU is done with it
+
+    // Canonical path and load mode, the identity of a file's texture
+    static std::string makeKey(const std::string &canonical, TextureLoadMode mode) {
+        return canonical + (mode == TEXTURE_LOAD_ASYNC ? "|async" : "|blocking");
+    }
+
+    // The file the path names with links, . and .. resolved, or the path as given if it does not exist
+    static std::string canonicalPath(const std::string &path) {
+        char resolved[PATH_MAX];
+        return realpath(path.c_str(), resolved) ? std::string(resolved) : path;
+    }
+
+    GLuint getEntryCount() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return (GLuint) this->entries.size();
+    }
+
+    // Requests served without loading, and requests that loaded
+    void getCounts(size_t &hits, size_t &misses) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        hits = this->hits;
+        misses = this->misses;
+    }
+
+private:
+    struct Entry {
+        TextureHandle texture;
+        GLuint references = 0;
+        bool loading = true;  // The first requester is still loading it
+    };
+
+    std::mutex mutex;
+    std::condition_variable loaded;
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_map<GLuint, std::string> owners; // Texture to key, for release
+    size_t hits = 0, misses = 0;
+
+    GLuint acquireKey(const std::string &path, TextureLoadMode mode, const unsigned char *bytes, size_t size) {
+        std::string key = makeKey(path, mode);
+        std::unique_lock<std::mutex> lock(this->mutex);
+        auto found = this->entries.find(key);
+        if (found != this->entries.end()) {
+            Entry *shared = &found->second; // Iterators do not survive a rehash while waiting
+            shared->references++;
+            this->hits++;
+            this->loaded.wait(lock, [shared]() { return !shared->loading; });
+            return shared->texture;
+        }
+
+        // Reserve the entry, then load without holding the lock
+        Entry &entry = this->entries[key];
+        entry.references = 1;
+        this->misses++;
+        lock.unlock();
+
+        GLuint texture;
+        if (bytes) {
+            texture = AsyncTextureLoader::get().loadFromMemory(bytes, size, path);
+        } else if (mode == TEXTURE_LOAD_ASYNC) {
+            texture = AsyncTextureLoader::get().load(path);
+        } else {
+            texture = loadTextureFile(path);
+        }
+
+        lock.lock();
+        entry.texture = TextureHandle::adopt(texture); // unordered_map references survive rehashing
+        entry.loading = false;
+        this->owners[texture] = key;
+        lock.unlock();
+        this->loaded.notify_all();
+        return texture;
+    }
+};
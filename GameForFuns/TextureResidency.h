@@ -0,0 +1,410 @@
+//
+//  TextureResidency.h
+//  GameForFuns
+//
+//  Keeps textures inside a VRAM budget. Each managed texture keeps its mip
+//  chain in system memory, and only the levels from residentLevel down are
+//  uploaded. Every frame, draws report the projected size a texture covers
+//  on screen, which gives the finest level worth having. update() then
+//  streams levels back, a level at a time and largest on screen first. To
+//  make room it drops the top levels of the least recently used textures.
+//
+//  The policy does not depend on GL (uploads are skipped when constructed
+//  without it), so simulateResidency() can replay an access trace on the CPU
+//  and report the hit rate and peak memory for a given budget.
+//
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Profiler.h"
+#include "GpuResources.h"
+
+const GLuint RESIDENCY_DEFAULT_BUDGET_MB = 256;
+const GLuint RESIDENCY_UPLOADS_PER_FRAME = 4; // Level uploads, bounds the streaming cost of one frame
+
+// Box filtered mip chain in system memory, level 0 first
+inline void buildMipChain(const unsigned char *pixels, GLuint width, GLuint height, GLuint channels,
+                          std::vector<std::vector<unsigned char>> &mips) {
+    GLuint levelCount = 1;
+    while ((width | height) >> levelCount) {
+        levelCount++;
+    }
+    mips.resize(levelCount);
+    mips[0].assign(pixels, pixels + (size_t) width * height * channels);
+
+    for (GLuint level = 1; level < levelCount; level++) {
+        const std::vector<unsigned char> &source = mips[level - 1];
+        GLuint sourceWidth = std::max(width >> (level - 1), 1u);
+        GLuint sourceHeight = std::max(height >> (level - 1), 1u);
+        GLuint levelWidth = std::max(width >> level, 1u);
+        GLuint levelHeight = std::max(height >> level, 1u);
+        std::vector<unsigned char> &target = mips[level];
+        target.resize((size_t) levelWidth * levelHeight * channels);
+
+        for (GLuint y = 0; y < levelHeight; y++) {
+            GLuint y0 = std::min(y * 2, sourceHeight - 1), y1 = std::min(y * 2 + 1, sourceHeight - 1);
+            for (GLuint x = 0; x < levelWidth; x++) {
+                GLuint x0 = std::min(x * 2, sourceWidth - 1), x1 = std::min(x * 2 + 1, sourceWidth - 1);
+                for (GLuint c = 0; c < channels; c++) {
+                    GLuint sum = source[((size_t) y0 * sourceWidth + x0) * channels + c]
+                               + source[((size_t) y0 * sourceWidth + x1) * channels + c]
+                               + source[((size_t) y1 * sourceWidth + x0) * channels + c]
+                               + source[((size_t) y1 * sourceWidth + x1) * channels + c];
+                    target[((size_t) y * levelWidth + x) * channels + c] = (unsigned char) ((sum + 2) / 4);
+                }
+            }
+        }
+    }
+}
+
+struct ResidentTexture {
+    GLuint id;
+    GLuint width, height;
+    GLuint bytesPerTexel;
+    GLuint levelCount;
+    GLuint residentLevel;       // Finest level in VRAM; the coarsest level is always resident
+    GLuint wantedLevel;         // Finest level asked for this frame
+    GLuint lastUsedFrame;
+    GLfloat screenSize;         // Largest projected size this frame, in pixels along the longest axis
+    std::vector<std::vector<unsigned char>> mips; // System memory copy, empty when simulating
+};
+
+class TextureResidency {
+public:
+    // Shared manager for the textures the game loads
+    static TextureResidency &get() {
+        static TextureResidency instance((size_t) RESIDENCY_DEFAULT_BUDGET_MB * 1024 * 1024, true);
+        return instance;
+    }
+
+    TextureResidency(size_t budgetBytes, bool uploadToGL): budget(budgetBytes), uploadToGL(uploadToGL) {
+    }
+
+    static GLuint levelCountFor(GLuint width, GLuint height) {
+        GLuint levels = 1;
+        while ((width | height) >> levels) {
+            levels++;
+        }
+        return levels;
+    }
+
+    static size_t levelBytes(const ResidentTexture &texture, GLuint level) {
+        size_t width = std::max(texture.width >> level, 1u);
+        size_t height = std::max(texture.height >> level, 1u);
+        return width * height * texture.bytesPerTexel;
+    }
+
+    // Bytes of the chain from level down to the smallest mip
+    static size_t chainBytes(const ResidentTexture &texture, GLuint level) {
+        size_t bytes = 0;
+        for (GLuint i = level; i < texture.levelCount; i++) {
+            bytes += levelBytes(texture, i);
+        }
+        return bytes;
+    }
+
+    // Takes over a texture. With pixels (level 0, tightly packed) the full chain is assumed to
+    // be uploaded already and the next update() trims it to the budget. Without, as when
+    // simulating, only the smallest mip starts resident.
+    void add(GLuint id, GLuint width, GLuint height, GLuint bytesPerTexel, const unsigned char *pixels) {
+        ResidentTexture texture;
+        texture.id = id;
+        texture.width = std::max(width, 1u);
+        texture.height = std::max(height, 1u);
+        texture.bytesPerTexel = bytesPerTexel;
+        texture.levelCount = levelCountFor(texture.width, texture.height);
+        texture.residentLevel = pixels ? 0 : texture.levelCount - 1;
+        texture.wantedLevel = texture.levelCount - 1;
+        texture.lastUsedFrame = this->frame;
+        texture.screenSize = 0.0f;
+        if (pixels) {
+            buildMips(texture, pixels);
+        }
+
+        this->remove(id);
+        this->index[id] = (GLuint) this->textures.size();
+        this->textures.push_back(std::move(texture));
+        this->residentBytes += chainBytes(this->textures.back(), this->textures.back().residentLevel);
+        this->order.reserve(this->textures.size());
+    }
+
+    void remove(GLuint id) {
+        auto found = this->index.find(id);
+        if (found == this->index.end()) {
+            return;
+        }
+        GLuint slot = found->second;
+        this->residentBytes -= chainBytes(this->textures[slot], this->textures[slot].residentLevel);
+        this->index.erase(found);
+
+        // Swap with the last so slots stay dense
+        if (slot != this->textures.size() - 1) {
+            this->textures[slot] = std::move(this->textures.back());
+            this->index[this->textures[slot].id] = slot;
+        }
+        this->textures.pop_back();
+    }
+
+    // Records a use this frame. screenSize is the number of pixels the texture spans on screen
+    // along its longest axis. Returns true if the level that size needs is already resident.
+    bool touch(GLuint id, GLfloat screenSize) {
+        auto found = this->index.find(id);
+        if (found == this->index.end()) {
+            return true;
+        }
+        ResidentTexture &texture = this->textures[found->second];
+        GLuint level = texture.levelCount - 1;
+        if (screenSize > 0.0f) {
+            GLfloat texels = (GLfloat) std::max(texture.width, texture.height);
+            GLfloat ratio = std::log2(std::max(texels / screenSize, 1.0f));
+            level = std::min((GLuint) ratio, texture.levelCount - 1);
+        }
+
+        texture.wantedLevel = std::min(texture.wantedLevel, level);
+        texture.screenSize = std::max(texture.screenSize, screenSize);
+        texture.lastUsedFrame = this->frame;
+
+        bool hit = texture.residentLevel <= level;
+        if (hit) {
+            this->hits++;
+        } else {
+            this->misses++;
+        }
+        return hit;
+    }
+
+    // Streams in what this frame asked for, within the budget and upload limit, and trims
+    // back under budget. Call once per frame after the draws that touch textures.
+    void update() {
+        PROFILE_SCOPE("TextureResidency::update");
+
+        // Largest on screen first
+        this->order.clear();
+        for (GLuint i = 0; i < this->textures.size(); i++) {
+            if (this->textures[i].wantedLevel < this->textures[i].residentLevel) {
+                this->order.push_back(i);
+            }
+        }
+        std::sort(this->order.begin(), this->order.end(), [this](GLuint a, GLuint b) {
+            return this->textures[a].screenSize > this->textures[b].screenSize;
+        });
+
+        GLuint uploads = 0;
+        for (GLuint slot : this->order) {
+            if (uploads == RESIDENCY_UPLOADS_PER_FRAME) {
+                break;
+            }
+            ResidentTexture &texture = this->textures[slot];
+            GLuint level = texture.residentLevel - 1;
+            size_t needed = levelBytes(texture, level);
+            if (!this->makeRoom(needed, slot)) {
+                continue;
+            }
+            this->setResidentLevel(texture, level);
+            uploads++;
+        }
+
+        this->makeRoom(0, (GLuint) this->textures.size());
+        this->peakBytes = std::max(this->peakBytes, this->residentBytes);
+
+        for (ResidentTexture &texture : this->textures) {
+            texture.wantedLevel = texture.levelCount - 1;
+            texture.screenSize = 0.0f;
+        }
+        this->frame++;
+    }
+
+    void setBudget(size_t bytes) {
+        this->budget = bytes;
+    }
+
+    size_t getBudget() const {
+        return this->budget;
+    }
+
+    size_t getResidentBytes() const {
+        return this->residentBytes;
+    }
+
+    // Highest resident total at the end of a frame
+    size_t getPeakBytes() const {
+        return this->peakBytes;
+    }
+
+    uint64_t getHits() const {
+        return this->hits;
+    }
+
+    uint64_t getMisses() const {
+        return this->misses;
+    }
+
+    GLuint getResidentLevel(GLuint id) const {
+        auto found = this->index.find(id);
+        return found == this->index.end() ? 0 : this->textures[found->second].residentLevel;
+    }
+
+private:
+    size_t budget;
+    bool uploadToGL;
+    size_t residentBytes = 0;
+    size_t peakBytes = 0;
+    GLuint frame = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    std::vector<ResidentTexture> textures;
+    std::unordered_map<GLuint, GLuint> index;
+    std::vector<GLuint> order; // Scratch, reserved so update() does not allocate
+
+    // Drops top levels until needed more bytes fit the budget. Textures holding more detail
+    // than this frame asked for go first, then the least recently used, then the smallest on
+    // screen. keep is never trimmed. Returns false if the bytes cannot be made to fit.
+    bool makeRoom(size_t needed, GLuint keep) {
+        while (this->residentBytes + needed > this->budget) {
+            GLuint victim = (GLuint) this->textures.size();
+            for (GLuint i = 0; i < this->textures.size(); i++) {
+                const ResidentTexture &texture = this->textures[i];
+                if (i == keep || texture.residentLevel + 1 >= texture.levelCount) {
+                    continue;
+                }
+                if (victim == this->textures.size() || evictBefore(texture, this->textures[victim])) {
+                    victim = i;
+                }
+            }
+            if (victim == this->textures.size()) {
+                return false;
+            }
+            // Never trim what this frame needs just to load something else
+            ResidentTexture &texture = this->textures[victim];
+            if (needed > 0 && texture.lastUsedFrame == this->frame && texture.residentLevel >= texture.wantedLevel) {
+                return false;
+            }
+            this->setResidentLevel(texture, texture.residentLevel + 1);
+        }
+        return true;
+    }
+
+    static bool evictBefore(const ResidentTexture &a, const ResidentTexture &b) {
+        bool aSurplus = a.residentLevel < a.wantedLevel;
+        bool bSurplus = b.residentLevel < b.wantedLevel;
+        if (aSurplus != bSurplus) {
+            return aSurplus;
+        }
+        if (a.lastUsedFrame != b.lastUsedFrame) {
+            return a.lastUsedFrame < b.lastUsedFrame;
+        }
+        return a.screenSize < b.screenSize;
+    }
+
+    void setResidentLevel(ResidentTexture &texture, GLuint level) {
+        this->residentBytes -= chainBytes(texture, texture.residentLevel);
+        this->residentBytes += chainBytes(texture, level);
+        GLuint previous = texture.residentLevel;
+        texture.residentLevel = level;
+        if (this->uploadToGL && !texture.mips.empty()) {
+            upload(texture, previous);
+        }
+    }
+
+    // Respecifies the texture with levels residentLevel.. as GL levels 0.., and frees the
+    // GL levels the previous chain used beyond that. UVs are normalized so sampling is unchanged.
+    static void upload(const ResidentTexture &texture, GLuint previousLevel) {
+        GLuint count = texture.levelCount - texture.residentLevel;
+        GLuint previousCount = texture.levelCount - previousLevel;
+
+        glBindTexture(GL_TEXTURE_2D, texture.id);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        GLenum format = texture.bytesPerTexel == 4 ? GL_RGBA : GL_RGB;
+        for (GLuint i = 0; i < count; i++) {
+            GLuint level = texture.residentLevel + i;
+            GLsizei width = std::max(texture.width >> level, 1u);
+            GLsizei height = std::max(texture.height >> level, 1u);
+            glTexImage2D(GL_TEXTURE_2D, i, format, width, height, 0, format, GL_UNSIGNED_BYTE, texture.mips[level].data());
+        }
+        for (GLuint i = count; i < previousCount; i++) {
+            glTexImage2D(GL_TEXTURE_2D, i, format, 0, 0, 0, format, GL_UNSIGNED_BYTE, NULL);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, count - 1);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        GpuResourceRegistry::get().setSize(GPU_TEXTURE, texture.id, chainBytes(texture, texture.residentLevel) * 4 / texture.bytesPerTexel);
+    }
+
+    static void buildMips(ResidentTexture &texture, const unsigned char *pixels) {
+        buildMipChain(pixels, texture.width, texture.height, texture.bytesPerTexel, texture.mips);
+    }
+};
+
+// Replays an access trace through a CPU-only manager and prints the hit rate and peak memory.
+// Trace lines: "texture <id> <width> <height>", "frame" to end a frame, "use <id> <screenSize>".
+// Without a trace, a synthetic walk past a row of 96 textures is used.
+inline bool simulateResidency(const std::string &tracePath, size_t budgetBytes) {
+    TextureResidency residency(budgetBytes, false);
+    GLuint frames = 0;
+
+    if (!tracePath.empty()) {
+        std::ifstream file(tracePath);
+        if (!file) {
+            std::cout << "ERROR::RESIDENCY::COULD_NOT_READ_TRACE " << tracePath << std::endl;
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream in(line);
+            std::string command;
+            in >> command;
+            if (command == "texture") {
+                GLuint id, width, height;
+                in >> id >> width >> height;
+                residency.add(id, width, height, 4, nullptr);
+            } else if (command == "use") {
+                GLuint id;
+                GLfloat screenSize;
+                in >> id >> screenSize;
+                residency.touch(id, screenSize);
+            } else if (command == "frame") {
+                residency.update();
+                frames++;
+            }
+        }
+    } else {
+        // Textures along a corridor, 2 units apart, with sizes from 512 to 4096
+        const GLuint count = 96;
+        for (GLuint i = 0; i < count; i++) {
+            GLuint size = 512u << (i * 7919 % 4);
+            residency.add(i, size, size, 4, nullptr);
+        }
+        for (GLuint frame = 0; frame < 1200; frame++) {
+            GLfloat camera = frame * 0.16f;
+            for (GLuint i = 0; i < count; i++) {
+                GLfloat distance = i * 2.0f - camera;
+                if (distance > 0.5f && distance < 40.0f) {
+                    residency.touch(i, 800.0f / distance);
+                }
+            }
+            residency.update();
+            frames++;
+        }
+    }
+
+    uint64_t accesses = residency.getHits() + residency.getMisses();
+    GLfloat hitRate = accesses ? (GLfloat) residency.getHits() / accesses : 1.0f;
+    std::cout << "Residency: " << frames << " frames, " << accesses << " accesses, hit rate " << hitRate * 100.0f << "%"
+              << ", peak " << residency.getPeakBytes() / (1024.0f * 1024.0f) << " MB"
+              << " of " << budgetBytes / (1024.0f * 1024.0f) << " MB budget" << std::endl;
+
+    return residency.getPeakBytes() <= budgetBytes;
+}
@@ -0,0 +1,1135 @@
+//
+//  VirtualTexture.h
+//  GameForFuns
+//
+//  Virtual texturing. Textures are cut into fixed size pages and only the
+//  pages the screen samples live in VRAM, in one physical cache texture of
+//  fixed size, however large the textures behind it are.
+//
+//  A low resolution feedback pass writes the page every pixel wants and is
+//  read back a couple of frames later, so nothing stalls. PageRequestResolver
+//  turns it into a short, deduplicated list of missing pages, TileLoader reads
+//  them on its own thread from tiled .vtex files, and TileCache gives them
+//  slots, evicting the least recently used. Each texture has a page table
+//  texture, one texel per page per level, pointing at the page's slot or,
+//  while the page is missing, at its nearest resident ancestor. The coarsest
+//  page of every texture is locked in, so sampling always finds something.
+//
+//  TileCache, PageRequestResolver and TileLoader do not touch GL;
+//  checkVirtualTexturing() exercises them on the CPU.
+//
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "SOIL2/SOIL2.h"
+
+#include "Profiler.h"
+#include "FrameArena.h"
+#include "GpuResources.h"
+#include "TextureResidency.h"
+
+const GLuint VT_PAGE_SIZE = 128;                                // Texels along a page
+const GLuint VT_PAGE_BORDER = 1;                                // Texels around a page so bilinear filtering stays inside its tile
+const GLuint VT_TILE_SIZE = VT_PAGE_SIZE + 2 * VT_PAGE_BORDER;
+const GLuint VT_TILE_BYTES = VT_TILE_SIZE * VT_TILE_SIZE * 4;   // RGBA8
+const GLuint VT_CACHE_TILES = 16;                               // Tiles along each side of the physical cache
+const GLuint VT_MAX_TEXTURES = 32;
+const GLuint VT_FEEDBACK_DIVISOR = 8;                           // Feedback is rendered at 1/8 of the screen size
+const GLuint VT_FEEDBACK_READBACKS = FRAME_ARENA_COUNT;         // Readbacks in flight, the latency of the feedback
+const GLuint VT_REQUESTS_PER_FRAME = 16;
+const GLuint VT_UPLOADS_PER_FRAME = 8;
+const GLuint VT_LOADS_IN_FLIGHT = 32;
+const uint32_t VT_NO_PAGE = 0xFFFFFFFF;                         // Feedback clear value, never a valid page
+const uint32_t VT_FILE_VERSION = 1;
+
+// Page ids pack the texture (6 bits), level (4), x (11) and y (11); virtualTextureFeedback.frag writes the same layout
+inline uint32_t makePageId(GLuint texture, GLuint level, GLuint x, GLuint y) {
+    return (texture << 26) | (level << 22) | (x << 11) | y;
+}
+
+inline GLuint pageTexture(uint32_t page) {
+    return page >> 26;
+}
+
+inline GLuint pageLevel(uint32_t page) {
+    return (page >> 22) & 15;
+}
+
+inline GLuint pageX(uint32_t page) {
+    return (page >> 11) & 2047;
+}
+
+inline GLuint pageY(uint32_t page) {
+    return page & 2047;
+}
+
+inline uint32_t parentPage(uint32_t page) {
+    return makePageId(pageTexture(page), pageLevel(page) + 1, pageX(page) / 2, pageY(page) / 2);
+}
+
+struct VirtualTextureHeader {
+    char magic[4];          // "VTEX"
+    uint32_t version;
+    uint32_t width, height; // Level 0 texels
+    uint32_t pageSize, border;
+    uint32_t levelCount;    // Down to the first level that fits in one page
+};
+
+// A .vtex file is the header followed by every tile as VT_TILE_SIZE rows of RGBA8 texels,
+// level 0 first and each level row by row. Tiles are fixed size, so any tile is one seek away.
+class VirtualTextureFile {
+public:
+    bool open(const std::string &path) {
+        this->file.open(path, std::ios::binary);
+        if (!this->file || !this->file.read((char *) &this->header, sizeof(this->header))
+            || std::memcmp(this->header.magic, "VTEX", 4) != 0 || this->header.version != VT_FILE_VERSION
+            || this->header.pageSize != VT_PAGE_SIZE || this->header.border != VT_PAGE_BORDER) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::INVALID_FILE " << path << std::endl;
+            return false;
+        }
+
+        GLuint first = 0;
+        for (GLuint level = 0; level < this->header.levelCount; level++) {
+            this->firstTile.push_back(first);
+            first += this->getPagesX(level) * this->getPagesY(level);
+        }
+        return true;
+    }
+
+    // Reads one tile of VT_TILE_BYTES; not safe to call from two threads at once
+    bool readTile(GLuint level, GLuint x, GLuint y, unsigned char *out) {
+        if (level >= this->header.levelCount || x >= this->getPagesX(level) || y >= this->getPagesY(level)) {
+            return false;
+        }
+        size_t tile = this->firstTile[level] + y * this->getPagesX(level) + x;
+        this->file.clear();
+        this->file.seekg(sizeof(VirtualTextureHeader) + tile * VT_TILE_BYTES);
+        return (bool) this->file.read((char *) out, VT_TILE_BYTES);
+    }
+
+    const VirtualTextureHeader &getHeader() const {
+        return this->header;
+    }
+
+    GLuint getPagesX(GLuint level) const {
+        return pagesAlong(this->header.width, level);
+    }
+
+    GLuint getPagesY(GLuint level) const {
+        return pagesAlong(this->header.height, level);
+    }
+
+    static GLuint pagesAlong(GLuint size, GLuint level) {
+        return (std::max(size >> level, 1u) + VT_PAGE_SIZE - 1) / VT_PAGE_SIZE;
+    }
+
+    static GLuint levelCountFor(GLuint width, GLuint height) {
+        GLuint levels = 1;
+        while ((std::max(width, height) >> (levels - 1)) > VT_PAGE_SIZE) {
+            levels++;
+        }
+        return levels;
+    }
+
+    // Copies page (x, y) of an RGBA8 level with its border, wrapping like GL_REPEAT
+    static void extractTile(const unsigned char *level, GLuint width, GLuint height, GLuint x, GLuint y, unsigned char *out) {
+        // Source texel of tile texel t is page origin + t - border, wrapped
+        for (GLuint ty = 0; ty < VT_TILE_SIZE; ty++) {
+            GLuint sy = (y * VT_PAGE_SIZE + ty + height - VT_PAGE_BORDER % height) % height;
+            for (GLuint tx = 0; tx < VT_TILE_SIZE; tx++) {
+                GLuint sx = (x * VT_PAGE_SIZE + tx + width - VT_PAGE_BORDER % width) % width;
+                std::memcpy(out + ((size_t) ty * VT_TILE_SIZE + tx) * 4, level + ((size_t) sy * width + sx) * 4, 4);
+            }
+        }
+    }
+
+    // Writes a .vtex from RGBA8 level 0 pixels. Sizes must be powers of two so the pages of
+    // every level line up with the mips of the page table.
+    static bool build(const unsigned char *pixels, GLuint width, GLuint height, const std::string &path) {
+        if ((width & (width - 1)) || (height & (height - 1)) || !width || !height) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::NOT_POWER_OF_TWO " << path << " " << width << "x" << height << std::endl;
+            return false;
+        }
+
+        std::vector<std::vector<unsigned char>> mips;
+        buildMipChain(pixels, width, height, 4, mips);
+
+        VirtualTextureHeader header;
+        std::memcpy(header.magic, "VTEX", 4);
+        header.version = VT_FILE_VERSION;
+        header.width = width;
+        header.height = height;
+        header.pageSize = VT_PAGE_SIZE;
+        header.border = VT_PAGE_BORDER;
+        header.levelCount = levelCountFor(width, height);
+
+        std::ofstream out(path, std::ios::binary);
+        out.write((const char *) &header, sizeof(header));
+        std::vector<unsigned char> tile(VT_TILE_BYTES);
+        for (GLuint level = 0; level < header.levelCount; level++) {
+            GLuint levelWidth = std::max(width >> level, 1u);
+            GLuint levelHeight = std::max(height >> level, 1u);
+            for (GLuint y = 0; y < pagesAlong(height, level); y++) {
+                for (GLuint x = 0; x < pagesAlong(width, level); x++) {
+                    extractTile(mips[level].data(), levelWidth, levelHeight, x, y, tile.data());
+                    out.write((const char *) tile.data(), VT_TILE_BYTES);
+                }
+            }
+        }
+        if (!out) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::COULD_NOT_WRITE " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    static bool buildFromImage(const std::string &imagePath, const std::string &path) {
+        int width, height;
+        unsigned char *image = SOIL_load_image(imagePath.c_str(), &width, &height, 0, SOIL_LOAD_RGBA);
+        if (!image) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::COULD_NOT_LOAD " << imagePath << std::endl;
+            return false;
+        }
+        bool built = build(image, width, height, path);
+        SOIL_free_image_data(image);
+        return built;
+    }
+
+private:
+    std::ifstream file;
+    VirtualTextureHeader header;
+    std::vector<GLuint> firstTile; // Index of the first tile of each level
+};
+
+// A fixed number of slots holding pages, with least recently used eviction. A slot is
+// claimed when its page is requested and becomes ready once the texels are uploaded.
+class TileCache {
+public:
+    static const GLuint NO_SLOT = 0xFFFFFFFF;
+
+    explicit TileCache(GLuint slotCount) {
+        this->slots.resize(slotCount);
+        GLuint tableSize = 1;
+        while (tableSize < slotCount * 2) {
+            tableSize <<= 1;
+        }
+        this->table.resize(tableSize);
+    }
+
+    GLuint find(uint32_t page) const {
+        GLuint mask = (GLuint) this->table.size() - 1;
+        for (GLuint i = bucket(page, mask); this->table[i].page != VT_NO_PAGE; i = (i + 1) & mask) {
+            if (this->table[i].page == page) {
+                return this->table[i].slot;
+            }
+        }
+        return NO_SLOT;
+    }
+
+    void touch(GLuint slot, GLuint frame) {
+        this->slots[slot].lastUsed = frame;
+    }
+
+    // Claims a slot for page, replacing the least recently used page that is not locked, not
+    // loading and not used this frame. *evicted is set to the page it replaced, or VT_NO_PAGE.
+    // Returns NO_SLOT when every slot is in use.
+    GLuint allocate(uint32_t page, GLuint frame, uint32_t *evicted) {
+        *evicted = VT_NO_PAGE;
+        GLuint victim = NO_SLOT;
+        for (GLuint i = 0; i < this->slots.size(); i++) {
+            const Slot &slot = this->slots[i];
+            if (slot.page == VT_NO_PAGE) {
+                victim = i;
+                break;
+            }
+            if (slot.locked || !slot.ready || slot.lastUsed == frame) {
+                continue;
+            }
+            if (victim == NO_SLOT || slot.lastUsed < this->slots[victim].lastUsed) {
+                victim = i;
+            }
+        }
+        if (victim == NO_SLOT) {
+            return NO_SLOT;
+        }
+
+        Slot &slot = this->slots[victim];
+        if (slot.page != VT_NO_PAGE) {
+            *evicted = slot.page;
+            this->erase(slot.page);
+        } else {
+            this->used++;
+        }
+        slot.page = page;
+        slot.lastUsed = frame;
+        slot.ready = false;
+        slot.locked = false;
+        this->insert(page, victim);
+        return victim;
+    }
+
+    void setReady(GLuint slot) {
+        this->slots[slot].ready = true;
+    }
+
+    bool isReady(GLuint slot) const {
+        return slot != NO_SLOT && this->slots[slot].ready;
+    }
+
+    // Never evicted, for the pages every fallback ends at
+    void lock(GLuint slot) {
+        this->slots[slot].locked = true;
+    }
+
+    // Frees the slot of page, e.g. when its load failed
+    void remove(uint32_t page) {
+        GLuint slot = this->find(page);
+        if (slot == NO_SLOT) {
+            return;
+        }
+        this->erase(page);
+        this->slots[slot] = Slot();
+        this->used--;
+    }
+
+    uint32_t getPage(GLuint slot) const {
+        return this->slots[slot].page;
+    }
+
+    GLuint getSlotCount() const {
+        return (GLuint) this->slots.size();
+    }
+
+    GLuint getUsedCount() const {
+        return this->used;
+    }
+
+private:
+    struct Slot {
+        uint32_t page = VT_NO_PAGE;
+        GLuint lastUsed = 0;
+        bool ready = false;
+        bool locked = false;
+    };
+
+    // Open addressing page to slot map, sized once so lookups never allocate
+    struct TableEntry {
+        uint32_t page = VT_NO_PAGE;
+        GLuint slot = NO_SLOT;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<TableEntry> table;
+    GLuint used = 0;
+
+    static GLuint bucket(uint32_t page, GLuint mask) {
+        return (page * 2654435761u) & mask;
+    }
+
+    void insert(uint32_t page, GLuint slot) {
+        GLuint mask = (GLuint) this->table.size() - 1;
+        GLuint i = bucket(page, mask);
+        while (this->table[i].page != VT_NO_PAGE) {
+            i = (i + 1) & mask;
+        }
+        this->table[i].page = page;
+        this->table[i].slot = slot;
+    }
+
+    // Shifts later entries of the probe run back so no tombstones are needed
+    void erase(uint32_t page) {
+        GLuint mask = (GLuint) this->table.size() - 1;
+        GLuint i = bucket(page, mask);
+        while (this->table[i].page != page) {
+            if (this->table[i].page == VT_NO_PAGE) {
+                return;
+            }
+            i = (i + 1) & mask;
+        }
+        for (GLuint j = (i + 1) & mask; this->table[j].page != VT_NO_PAGE; j = (j + 1) & mask) {
+            GLuint home = bucket(this->table[j].page, mask);
+            bool homeBetween = i < j ? (home > i && home <= j) : (home > i || home <= j);
+            if (!homeBetween) {
+                this->table[i] = this->table[j];
+                i = j;
+            }
+        }
+        this->table[i] = TableEntry();
+    }
+};
+
+struct PageRequest {
+    uint32_t page;
+    GLuint count; // Feedback texels that asked for it or for a page below it
+};
+
+// Turns feedback texels into the pages to load: deduplicated, with the missing ancestors of
+// every page so coarse fallbacks arrive first, ordered coarse to fine and then by how many
+// texels want them, and capped at maxRequests.
+class PageRequestResolver {
+public:
+    PageRequestResolver(GLuint maxTexels, GLuint maxRequests): maxRequests(maxRequests) {
+        this->pages.reserve(maxTexels);
+        this->missing.reserve(maxTexels * 2);
+    }
+
+    // Touches the resident pages in cache and fills requests with those that are missing
+    void resolve(const uint32_t *texels, GLuint count, TileCache &cache, GLuint frame, std::vector<PageRequest> &requests) {
+        this->pages.clear();
+        for (GLuint i = 0; i < count && this->pages.size() < this->pages.capacity(); i++) {
+            if (texels[i] != VT_NO_PAGE && pageTexture(texels[i]) < VT_MAX_TEXTURES) {
+                this->pages.push_back(texels[i]);
+            }
+        }
+        std::sort(this->pages.begin(), this->pages.end());
+
+        this->missing.clear();
+        this->lastPages = 0;
+        this->lastHits = 0;
+        for (size_t i = 0; i < this->pages.size();) {
+            uint32_t page = this->pages[i];
+            GLuint texels = 0;
+            for (; i < this->pages.size() && this->pages[i] == page; i++) {
+                texels++;
+            }
+            this->lastPages++;
+
+            // Up the chain until a resident page; pages still loading are kept, not requested again
+            for (uint32_t wanted = page;; wanted = parentPage(wanted)) {
+                GLuint slot = cache.find(wanted);
+                if (slot != TileCache::NO_SLOT) {
+                    cache.touch(slot, frame);
+                    if (cache.isReady(slot)) {
+                        this->lastHits += wanted == page;
+                        break;
+                    }
+                } else if (this->missing.size() < this->missing.capacity()) {
+                    this->missing.push_back(PageRequest{wanted, texels});
+                }
+                if (pageLevel(wanted) == 15) {
+                    break;
+                }
+            }
+        }
+
+        // Merge the ancestors several pages asked for
+        std::sort(this->missing.begin(), this->missing.end(), [](const PageRequest &a, const PageRequest &b) {
+            return a.page < b.page;
+        });
+        requests.clear();
+        for (const PageRequest &request : this->missing) {
+            if (!requests.empty() && requests.back().page == request.page) {
+                requests.back().count += request.count;
+            } else {
+                requests.push_back(request);
+            }
+        }
+
+        auto first = [](const PageRequest &a, const PageRequest &b) {
+            if (pageLevel(a.page) != pageLevel(b.page)) {
+                return pageLevel(a.page) > pageLevel(b.page);
+            }
+            if (a.count != b.count) {
+                return a.count > b.count;
+            }
+            return a.page < b.page;
+        };
+        GLuint kept = std::min((GLuint) requests.size(), this->maxRequests);
+        std::partial_sort(requests.begin(), requests.begin() + kept, requests.end(), first);
+        requests.resize(kept);
+    }
+
+    // Distinct pages in the last feedback, and how many of them were resident
+    GLuint getLastPages() const {
+        return this->lastPages;
+    }
+
+    GLuint getLastHits() const {
+        return this->lastHits;
+    }
+
+private:
+    GLuint maxRequests;
+    GLuint lastPages = 0;
+    GLuint lastHits = 0;
+    std::vector<uint32_t> pages;        // Scratch, reserved so resolve() does not allocate
+    std::vector<PageRequest> missing;
+};
+
+struct LoadedTile {
+    uint32_t page;
+    GLuint slot;
+    bool loaded;                 // False if the tile could not be read
+    const unsigned char *pixels; // VT_TILE_BYTES, valid until release()
+    GLuint job;
+};
+
+// Reads tiles from .vtex files on a thread of its own, so disk latency never reaches the
+// frame. At most capacity reads are in flight; their buffers are allocated up front.
+class TileLoader {
+public:
+    explicit TileLoader(GLuint capacity): capacity(capacity) {
+        this->jobs.resize(capacity);
+        this->queued.resize(capacity);
+        this->done.resize(capacity);
+        this->freeJobs.reserve(capacity);
+        for (GLuint i = 0; i < capacity; i++) {
+            this->jobs[i].pixels.resize(VT_TILE_BYTES);
+            this->freeJobs.push_back(capacity - 1 - i);
+        }
+        this->thread = std::thread(&TileLoader::run, this);
+    }
+
+    ~TileLoader() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->wake.notify_one();
+        this->thread.join();
+    }
+
+    TileLoader(const TileLoader &) = delete;
+    TileLoader &operator=(const TileLoader &) = delete;
+
+    // Registers the tiles of texture; call before requesting any of its pages
+    bool addFile(GLuint texture, const std::string &path) {
+        std::unique_ptr<VirtualTextureFile> file(new VirtualTextureFile());
+        if (texture >= VT_MAX_TEXTURES || !file->open(path)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(this->fileMutex);
+        if (this->files.size() <= texture) {
+            this->files.resize(texture + 1);
+        }
+        this->files[texture] = std::move(file);
+        return true;
+    }
+
+    // Header of a registered texture, nullptr if there is none
+    const VirtualTextureHeader *getHeader(GLuint texture) {
+        std::lock_guard<std::mutex> lock(this->fileMutex);
+        return texture < this->files.size() && this->files[texture] ? &this->files[texture]->getHeader() : nullptr;
+    }
+
+    // Reads a tile on the calling thread, for pages needed before the first frame
+    bool loadNow(uint32_t page, unsigned char *out) {
+        return this->read(page, out);
+    }
+
+    // Queues a read; false when capacity reads are already in flight
+    bool request(uint32_t page, GLuint slot) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (this->freeJobs.empty()) {
+                return false;
+            }
+            GLuint job = this->freeJobs.back();
+            this->freeJobs.pop_back();
+            this->jobs[job].page = page;
+            this->jobs[job].slot = slot;
+            this->queued[(this->queuedHead + this->queuedCount) % this->capacity] = job;
+            this->queuedCount++;
+        }
+        this->wake.notify_one();
+        return true;
+    }
+
+    // Takes up to max finished reads; hand each back with release() once its pixels are used
+    GLuint collect(LoadedTile *out, GLuint max) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        GLuint count = 0;
+        while (count < max && this->doneCount > 0) {
+            GLuint job = this->done[this->doneHead];
+            this->doneHead = (this->doneHead + 1) % this->capacity;
+            this->doneCount--;
+            out[count++] = LoadedTile{this->jobs[job].page, this->jobs[job].slot, this->jobs[job].loaded,
+                                      this->jobs[job].pixels.data(), job};
+        }
+        return count;
+    }
+
+    void release(const LoadedTile &tile) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->freeJobs.push_back(tile.job);
+    }
+
+    GLuint getInFlight() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->capacity - (GLuint) this->freeJobs.size();
+    }
+
+private:
+    struct Job {
+        uint32_t page = VT_NO_PAGE;
+        GLuint slot = 0;
+        bool loaded = false;
+        std::vector<unsigned char> pixels;
+    };
+
+    GLuint capacity;
+    std::vector<Job> jobs;
+    std::vector<GLuint> queued, done; // Rings of job indices
+    GLuint queuedHead = 0, queuedCount = 0;
+    GLuint doneHead = 0, doneCount = 0;
+    std::vector<GLuint> freeJobs;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    std::mutex fileMutex; // Files are read by one thread at a time
+    std::vector<std::unique_ptr<VirtualTextureFile>> files;
+    std::thread thread;
+
+    bool read(uint32_t page, unsigned char *out) {
+        std::lock_guard<std::mutex> lock(this->fileMutex);
+        GLuint texture = pageTexture(page);
+        if (texture >= this->files.size() || !this->files[texture]) {
+            return false;
+        }
+        return this->files[texture]->readTile(pageLevel(page), pageX(page), pageY(page), out);
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        for (;;) {
+            this->wake.wait(lock, [this] { return this->stopping || this->queuedCount > 0; });
+            if (this->stopping) {
+                return;
+            }
+            GLuint job = this->queued[this->queuedHead];
+            this->queuedHead = (this->queuedHead + 1) % this->capacity;
+            this->queuedCount--;
+
+            lock.unlock();
+            bool loaded = this->read(this->jobs[job].page, this->jobs[job].pixels.data());
+            lock.lock();
+
+            this->jobs[job].loaded = loaded;
+            this->done[(this->doneHead + this->doneCount) % this->capacity] = job;
+            this->doneCount++;
+        }
+    }
+};
+
+// The GL side: the physical cache, one page table per texture, and the feedback pass with
+// its asynchronous readback. Draw with virtualTexture.frag after apply(); draw the same
+// geometry with virtualTextureFeedback.frag between beginFeedback() and endFeedback().
+class VirtualTextureSystem {
+public:
+    VirtualTextureSystem(GLuint screenWidth, GLuint screenHeight):
+        cache(VT_CACHE_TILES * VT_CACHE_TILES),
+        resolver(std::max(screenWidth / VT_FEEDBACK_DIVISOR, 1u) * std::max(screenHeight / VT_FEEDBACK_DIVISOR, 1u), VT_REQUESTS_PER_FRAME),
+        loader(VT_LOADS_IN_FLIGHT) {
+        this->feedbackWidth = std::max(screenWidth / VT_FEEDBACK_DIVISOR, 1u);
+        this->feedbackHeight = std::max(screenHeight / VT_FEEDBACK_DIVISOR, 1u);
+        this->requests.reserve(VT_REQUESTS_PER_FRAME);
+        this->tile.resize(VT_TILE_BYTES);
+
+        // Physical cache, filtered within a tile thanks to the borders
+        GLuint cacheSize = VT_CACHE_TILES * VT_TILE_SIZE;
+        this->physical = TextureHandle::create(GPU_MEMORY_TEXTURES, "Virtual texture cache");
+        glBindTexture(GL_TEXTURE_2D, this->physical);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cacheSize, cacheSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        this->physical.setSize((size_t) cacheSize * cacheSize * 4);
+
+        // Feedback target, page ids in RGBA8
+        this->feedbackColor = TextureHandle::create(GPU_MEMORY_RENDER_TARGETS, "Virtual texture feedback");
+        glBindTexture(GL_TEXTURE_2D, this->feedbackColor);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, this->feedbackWidth, this->feedbackHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        this->feedbackColor.setSize((size_t) this->feedbackWidth * this->feedbackHeight * 4);
+
+        this->feedbackDepth = TextureHandle::create(GPU_MEMORY_RENDER_TARGETS, "Virtual texture feedback depth");
+        glBindTexture(GL_TEXTURE_2D, this->feedbackDepth);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, this->feedbackWidth, this->feedbackHeight, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        this->feedbackDepth.setSize((size_t) this->feedbackWidth * this->feedbackHeight * 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &this->framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->feedbackColor, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->feedbackDepth, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FEEDBACK_FRAMEBUFFER_INCOMPLETE" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        GLuint readbackBytes = this->feedbackWidth * this->feedbackHeight * 4;
+        for (GLuint i = 0; i < VT_FEEDBACK_READBACKS; i++) {
+            this->readbacks[i] = BufferHandle::create(GPU_MEMORY_STREAMING, "Virtual texture readback");
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, this->readbacks[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, readbackBytes, NULL, GL_STREAM_READ);
+            this->readbacks[i].setSize(readbackBytes);
+            this->fences[i] = 0;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    ~VirtualTextureSystem() {
+        for (GLuint i = 0; i < VT_FEEDBACK_READBACKS; i++) {
+            if (this->fences[i]) {
+                glDeleteSync(this->fences[i]);
+            }
+        }
+        glDeleteFramebuffers(1, &this->framebuffer);
+    }
+
+    VirtualTextureSystem(const VirtualTextureSystem &) = delete;
+    VirtualTextureSystem &operator=(const VirtualTextureSystem &) = delete;
+
+    // Registers an image, converting it to a .vtex beside it the first time. Returns the
+    // index to pass to apply(), or -1.
+    GLint addTexture(const std::string &imagePath) {
+        GLuint index = (GLuint) this->textures.size();
+        std::string path = imagePath.substr(0, imagePath.find_last_of('.')) + ".vtex";
+        if (index == VT_MAX_TEXTURES) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::TOO_MANY_TEXTURES " << imagePath << std::endl;
+            return -1;
+        }
+        if (!std::ifstream(path) && !VirtualTextureFile::buildFromImage(imagePath, path)) {
+            return -1;
+        }
+        if (!this->loader.addFile(index, path)) {
+            return -1;
+        }
+
+        const VirtualTextureHeader &header = *this->loader.getHeader(index);
+        this->textures.push_back(PageTable());
+        PageTable &table = this->textures.back();
+        table.width = header.width;
+        table.height = header.height;
+        table.levelCount = header.levelCount;
+        size_t entries = 0;
+        for (GLuint level = 0; level < table.levelCount; level++) {
+            table.levelOffset.push_back(entries);
+            entries += VirtualTextureFile::pagesAlong(table.width, level) * VirtualTextureFile::pagesAlong(table.height, level) * 4;
+        }
+        table.entries.resize(entries);
+
+        table.texture = TextureHandle::create(GPU_MEMORY_TEXTURES, "Virtual texture page table " + imagePath);
+        glBindTexture(GL_TEXTURE_2D, table.texture);
+        for (GLuint level = 0; level < table.levelCount; level++) {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, VirtualTextureFile::pagesAlong(table.width, level),
+                         VirtualTextureFile::pagesAlong(table.height, level), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, table.levelCount - 1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        table.texture.setSize(entries * 4 / 3);
+
+        // The coarsest page is the last fallback, load it now and keep it
+        uint32_t root = makePageId(index, table.levelCount - 1, 0, 0);
+        uint32_t evicted;
+        GLuint slot = this->cache.allocate(root, this->frame, &evicted);
+        if (slot == TileCache::NO_SLOT || !this->loader.loadNow(root, this->tile.data())) {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::COULD_NOT_LOAD_ROOT " << path << std::endl;
+            this->cache.remove(root);
+            return -1;
+        }
+        this->uploadTile(slot, this->tile.data());
+        this->cache.setReady(slot);
+        this->cache.lock(slot);
+        this->refreshPageTable(index);
+        return (GLint) index;
+    }
+
+    // Binds the feedback target; draw the virtually textured geometry with the feedback shader next
+    void beginFeedback() {
+        glGetIntegerv(GL_VIEWPORT, this->viewport);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &this->target); // The screen, or an HDR target
+        this->blend = glIsEnabled(GL_BLEND);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glViewport(0, 0, this->feedbackWidth, this->feedbackHeight);
+        glDisable(GL_BLEND); // Page ids must be written as they are
+        glClearColor(1.0f, 1.0f, 1.0f, 1.0f); // VT_NO_PAGE
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // Starts the readback of this frame's feedback and restores the target drawn to before
+    void endFeedback() {
+        GLuint index = this->feedbackIndex;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, this->readbacks[index]);
+        glReadPixels(0, 0, this->feedbackWidth, this->feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (this->fences[index]) {
+            glDeleteSync(this->fences[index]); // Never read back, dropped
+        }
+        this->fences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        this->feedbackIndex = (index + 1) % VT_FEEDBACK_READBACKS;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, this->target);
+        glViewport(this->viewport[0], this->viewport[1], this->viewport[2], this->viewport[3]);
+        if (this->blend) {
+            glEnable(GL_BLEND);
+        }
+    }
+
+    // Resolves the oldest feedback if the GPU has written it, queues the loads it asks for,
+    // uploads finished tiles and refreshes the page tables they change. Call once per frame
+    // after endFeedback().
+    void update() {
+        PROFILE_SCOPE("VirtualTexture::update");
+        GLuint oldest = this->feedbackIndex;
+        GLsync &fence = this->fences[oldest];
+        if (fence) {
+            GLenum status = glClientWaitSync(fence, 0, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+                glDeleteSync(fence);
+                fence = 0;
+                this->resolveReadback(oldest);
+            }
+        }
+
+        LoadedTile loaded[VT_UPLOADS_PER_FRAME];
+        GLuint count = this->loader.collect(loaded, VT_UPLOADS_PER_FRAME);
+        for (GLuint i = 0; i < count; i++) {
+            if (loaded[i].loaded) {
+                this->uploadTile(loaded[i].slot, loaded[i].pixels);
+                this->cache.setReady(loaded[i].slot);
+                this->uploadedPages++;
+            } else {
+                std::cout << "ERROR::VIRTUAL_TEXTURE::COULD_NOT_READ_TILE " << loaded[i].page << std::endl;
+                this->cache.remove(loaded[i].page);
+            }
+            this->dirty[pageTexture(loaded[i].page)] = true;
+            this->loader.release(loaded[i]);
+        }
+
+        for (GLuint i = 0; i < this->textures.size(); i++) {
+            if (this->dirty[i]) {
+                this->refreshPageTable(i);
+            }
+        }
+        this->frame++;
+    }
+
+    // Binds the cache to unit 0 and the page table of texture to unit 1 and sets the uniforms
+    // both virtual texture shaders read. program must be in use.
+    void apply(GLuint program, GLuint texture) {
+        const PageTable &table = this->textures[texture];
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, this->physical);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, table.texture);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(glGetUniformLocation(program, "physicalCache"), 0);
+        glUniform1i(glGetUniformLocation(program, "pageTable"), 1);
+        glUniform2f(glGetUniformLocation(program, "virtualSize"), (GLfloat) table.width, (GLfloat) table.height);
+        glUniform1f(glGetUniformLocation(program, "maxLevel"), (GLfloat) (table.levelCount - 1));
+        glUniform1f(glGetUniformLocation(program, "cacheTiles"), (GLfloat) VT_CACHE_TILES);
+        glUniform1i(glGetUniformLocation(program, "textureIndex"), (GLint) texture);
+        glUniform1f(glGetUniformLocation(program, "feedbackLodBias"), -std::log2((GLfloat) VT_FEEDBACK_DIVISOR));
+    }
+
+    GLuint getResidentPages() const {
+        return this->cache.getUsedCount();
+    }
+
+    uint64_t getUploadedPages() const {
+        return this->uploadedPages;
+    }
+
+private:
+    struct PageTable {
+        GLuint width, height, levelCount;
+        TextureHandle texture;
+        std::vector<size_t> levelOffset;   // Into entries, per level
+        std::vector<unsigned char> entries; // RGBA8 per page: slot x, slot y, level of the data, unused
+    };
+
+    TileCache cache;
+    PageRequestResolver resolver;
+    TileLoader loader;
+    std::vector<PageTable> textures;
+    bool dirty[VT_MAX_TEXTURES] = {};
+    std::vector<PageRequest> requests;
+    std::vector<unsigned char> tile;
+    GLuint frame = 0;
+    uint64_t uploadedPages = 0;
+
+    TextureHandle physical;
+    TextureHandle feedbackColor, feedbackDepth;
+    GLuint framebuffer = 0;
+    GLuint feedbackWidth, feedbackHeight;
+    BufferHandle readbacks[VT_FEEDBACK_READBACKS];
+    GLsync fences[VT_FEEDBACK_READBACKS];
+    GLuint feedbackIndex = 0;
+    GLint viewport[4];
+    GLint target = 0;
+    GLboolean blend = GL_FALSE;
+
+    void resolveReadback(GLuint index) {
+        GLuint count = this->feedbackWidth * this->feedbackHeight;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, this->readbacks[index]);
+        const uint32_t *texels = (const uint32_t *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, count * 4, GL_MAP_READ_BIT);
+        if (texels) {
+            this->resolver.resolve(texels, count, this->cache, this->frame, this->requests);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!texels) {
+            return;
+        }
+
+        for (const PageRequest &request : this->requests) {
+            uint32_t evicted;
+            GLuint slot = this->cache.allocate(request.page, this->frame, &evicted);
+            if (slot == TileCache::NO_SLOT) {
+                break; // Everything in the cache is on screen
+            }
+            if (evicted != VT_NO_PAGE) {
+                this->dirty[pageTexture(evicted)] = true;
+            }
+            if (!this->loader.request(request.page, slot)) {
+                this->cache.remove(request.page);
+                break;
+            }
+        }
+    }
+
+    void uploadTile(GLuint slot, const unsigned char *pixels) {
+        glBindTexture(GL_TEXTURE_2D, this->physical);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % VT_CACHE_TILES) * VT_TILE_SIZE, (slot / VT_CACHE_TILES) * VT_TILE_SIZE,
+                        VT_TILE_SIZE, VT_TILE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Points every page at its slot or at the entry of its parent, coarsest level first
+    void refreshPageTable(GLuint texture) {
+        PageTable &table = this->textures[texture];
+        glBindTexture(GL_TEXTURE_2D, table.texture);
+        for (GLint level = table.levelCount - 1; level >= 0; level--) {
+            GLuint pagesX = VirtualTextureFile::pagesAlong(table.width, level);
+            GLuint pagesY = VirtualTextureFile::pagesAlong(table.height, level);
+            unsigned char *entries = table.entries.data() + table.levelOffset[level];
+            for (GLuint y = 0; y < pagesY; y++) {
+                for (GLuint x = 0; x < pagesX; x++) {
+                    unsigned char *entry = entries + (y * pagesX + x) * 4;
+                    GLuint slot = this->cache.find(makePageId(texture, level, x, y));
+                    if (this->cache.isReady(slot)) {
+                        entry[0] = (unsigned char) (slot % VT_CACHE_TILES);
+                        entry[1] = (unsigned char) (slot / VT_CACHE_TILES);
+                        entry[2] = (unsigned char) level;
+                        entry[3] = 255;
+                    } else if ((GLuint) level + 1 < table.levelCount) {
+                        GLuint parentPagesX = VirtualTextureFile::pagesAlong(table.width, level + 1);
+                        const unsigned char *parent = table.entries.data() + table.levelOffset[level + 1] + ((y / 2) * parentPagesX + x / 2) * 4;
+                        std::memcpy(entry, parent, 4);
+                    }
+                }
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, pagesX, pagesY, GL_RGBA, GL_UNSIGNED_BYTE, entries);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        this->dirty[texture] = false;
+    }
+};
+
+// CPU checks of the tile cache, the page request resolver and the tile file round trip
+inline bool checkVirtualTexturing() {
+    bool passed = true;
+    auto expect = [&passed](bool condition, const char *what) {
+        std::cout << what << (condition ? " OK" : " FAILED") << std::endl;
+        passed = passed && condition;
+    };
+
+    // Least recently used eviction that spares locked pages and this frame's pages
+    {
+        TileCache cache(4);
+        uint32_t evicted;
+        uint32_t a = makePageId(0, 2, 0, 0), b = makePageId(0, 1, 0, 0), c = makePageId(0, 1, 1, 0), d = makePageId(0, 1, 0, 1);
+        GLuint slots[4] = { cache.allocate(a, 0, &evicted), cache.allocate(b, 0, &evicted),
+                            cache.allocate(c, 0, &evicted), cache.allocate(d, 0, &evicted) };
+        for (GLuint slot : slots) {
+            cache.setReady(slot);
+        }
+        cache.lock(slots[0]);
+        cache.touch(slots[1], 1);
+        uint32_t e = makePageId(0, 0, 0, 0), f = makePageId(0, 0, 1, 0), g = makePageId(0, 0, 2, 0);
+        GLuint slot = cache.allocate(e, 1, &evicted);
+        expect(slot == slots[2] && evicted == c && cache.find(c) == TileCache::NO_SLOT && cache.find(e) == slot,
+               "Cache evicts the least recently used page");
+        cache.setReady(slot);
+        slot = cache.allocate(f, 1, &evicted);
+        expect(slot == slots[3] && evicted == d, "Cache evicts the next least recently used page");
+        expect(cache.allocate(g, 1, &evicted) == TileCache::NO_SLOT, "Cache refuses when every page is locked, loading or in use");
+        expect(cache.find(a) == slots[0] && cache.find(b) == slots[1], "Cache keeps locked and touched pages");
+    }
+
+    // The page map against std::map under churn
+    {
+        TileCache cache(64);
+        std::map<uint32_t, GLuint> reference;
+        uint32_t random = 12345;
+        bool same = true;
+        for (GLuint frame = 1; frame < 20000; frame++) {
+            random = random * 1664525u + 1013904223u;
+            uint32_t page = makePageId(random >> 28, 0, (random >> 8) & 31, (random >> 16) & 31);
+            if ((random & 3) == 0) {
+                cache.remove(page);
+                reference.erase(page);
+            } else if (cache.find(page) == TileCache::NO_SLOT) {
+                uint32_t evicted;
+                GLuint slot = cache.allocate(page, frame, &evicted);
+                if (slot != TileCache::NO_SLOT) {
+                    cache.setReady(slot);
+                    reference.erase(evicted);
+                    reference[page] = slot;
+                }
+            }
+            uint32_t probe = makePageId(random >> 28, 0, (random >> 3) & 31, (random >> 21) & 31);
+            auto found = reference.find(probe);
+            same = same && cache.find(probe) == (found == reference.end() ? TileCache::NO_SLOT : found->second);
+        }
+        for (const auto &entry : reference) {
+            same = same && cache.find(entry.first) == entry.second;
+        }
+        expect(same && cache.getUsedCount() == reference.size(), "Cache page map matches a reference map");
+    }
+
+    // Duplicates merged, ancestors requested, coarse first, then by texel count, then capped
+    {
+        TileCache cache(16);
+        uint32_t evicted;
+        GLuint root = cache.allocate(makePageId(0, 2, 0, 0), 0, &evicted);
+        cache.setReady(root);
+        cache.lock(root);
+
+        std::vector<uint32_t> feedback;
+        feedback.insert(feedback.end(), 100, makePageId(0, 0, 1, 1));
+        feedback.insert(feedback.end(), 50, makePageId(0, 0, 3, 3));
+        feedback.insert(feedback.end(), 30, VT_NO_PAGE);
+        feedback.insert(feedback.end(), 10, makePageId(0, 1, 0, 0));
+        std::mt19937 random(7);
+        std::shuffle(feedback.begin(), feedback.end(), random);
+
+        PageRequestResolver resolver((GLuint) feedback.size(), 3);
+        std::vector<PageRequest> requests;
+        resolver.resolve(feedback.data(), (GLuint) feedback.size(), cache, 1, requests);
+        expect(requests.size() == 3
+               && requests[0].page == makePageId(0, 1, 0, 0) && requests[0].count == 110
+               && requests[1].page == makePageId(0, 1, 1, 1) && requests[1].count == 50
+               && requests[2].page == makePageId(0, 0, 1, 1) && requests[2].count == 100,
+               "Resolver merges, adds ancestors and prioritizes");
+        expect(resolver.getLastPages() == 3 && resolver.getLastHits() == 0, "Resolver counts distinct pages");
+    }
+
+    // Tiles written by the builder come back through the loader thread with their borders
+    {
+        const GLuint width = 512, height = 256;
+        const std::string path = "virtual_texture_check.vtex";
+        std::vector<unsigned char> pixels((size_t) width * height * 4);
+        for (GLuint y = 0; y < height; y++) {
+            for (GLuint x = 0; x < width; x++) {
+                unsigned char *texel = &pixels[((size_t) y * width + x) * 4];
+                texel[0] = (unsigned char) x;
+                texel[1] = (unsigned char) y;
+                texel[2] = (unsigned char) (x * 7 + y * 13);
+                texel[3] = 255;
+            }
+        }
+        bool built = VirtualTextureFile::build(pixels.data(), width, height, path);
+
+        std::vector<std::vector<unsigned char>> mips;
+        buildMipChain(pixels.data(), width, height, 4, mips);
+        GLuint levels = VirtualTextureFile::levelCountFor(width, height);
+
+        TileLoader loader(4);
+        bool registered = built && loader.addFile(0, path);
+        GLuint total = 0, matched = 0;
+        std::vector<unsigned char> expected(VT_TILE_BYTES);
+        for (GLuint level = 0; registered && level < levels; level++) {
+            GLuint levelWidth = width >> level, levelHeight = height >> level;
+            for (GLuint y = 0; y < VirtualTextureFile::pagesAlong(height, level); y++) {
+                for (GLuint x = 0; x < VirtualTextureFile::pagesAlong(width, level); x++) {
+                    uint32_t page = makePageId(0, level, x, y);
+                    while (!loader.request(page, total)) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                    total++;
+                    LoadedTile loaded;
+                    while (loader.collect(&loaded, 1) == 0) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                    VirtualTextureFile::extractTile(mips[level].data(), levelWidth, levelHeight, x, y, expected.data());
+                    matched += loaded.loaded && loaded.page == page && std::memcmp(loaded.pixels, expected.data(), VT_TILE_BYTES) == 0;
+                    loader.release(loaded);
+                }
+            }
+        }
+        std::remove(path.c_str());
+        expect(registered && levels == 3 && total == 11 && matched == total, "Tiles round trip through the file and loader");
+        expect(VirtualTextureFile::levelCountFor(128, 128) == 1 && VirtualTextureFile::pagesAlong(64, 0) == 1,
+               "Textures smaller than a page fit one page");
+    }
+
+    // A walk over more pages than the cache holds settles once the camera stops
+    {
+        const GLuint textureCount = 4, levels = 5; // 2048 x 2048 each, 1364 pages in all
+        TileCache cache(96);
+        PageRequestResolver resolver(256, VT_REQUESTS_PER_FRAME);
+        std::vector<PageRequest> requests;
+        std::vector<uint32_t> feedback;
+        feedback.reserve(256);
+        uint32_t evicted;
+        for (GLuint texture = 0; texture < textureCount; texture++) {
+            GLuint root = cache.allocate(makePageId(texture, levels - 1, 0, 0), 0, &evicted);
+            cache.setReady(root);
+            cache.lock(root);
+        }
+
+        GLuint peakUsed = 0;
+        for (GLuint frame = 1; frame <= 400; frame++) {
+            GLuint step = std::min(frame, 340u);
+            GLuint texture = step / 100 % textureCount, start = step / 8 % 12;
+            feedback.clear();
+            for (GLuint y = 0; y < 4; y++) {
+                for (GLuint x = 0; x < 4; x++) {
+                    feedback.push_back(makePageId(texture, 1, start / 2 + x, y));
+                    feedback.push_back(makePageId(texture, 0, start + x, y));
+                    feedback.push_back(makePageId(texture, 0, start + x, y + 4));
+                }
+            }
+            resolver.resolve(feedback.data(), (GLuint) feedback.size(), cache, frame, requests);
+            for (const PageRequest &request : requests) {
+                GLuint slot = cache.allocate(request.page, frame, &evicted);
+                if (slot != TileCache::NO_SLOT) {
+                    cache.setReady(slot); // Loads finish at once here
+                }
+            }
+            peakUsed = std::max(peakUsed, cache.getUsedCount());
+        }
+        expect(peakUsed <= cache.getSlotCount() && resolver.getLastHits() == resolver.getLastPages(),
+               "Working set becomes resident within the cache");
+    }
+
+    return passed;
+}
@@ -0,0 +1,465 @@
+//
+//  VoxelBenchmark.h
+//  GameForFuns
+//
+//  Voxel benchmarks, both headless. --benchmark-voxel greedily meshes a hilly
+//  chunk world with 1 to N threads and reports chunks meshed per second and the
+//  faces saved against drawing every face of every block, as the cube grid does.
+//  --benchmark-streaming times terrain generation with 1 to N threads and the wide
+//  noise against the one-sample reference, compresses the chunks and round trips
+//  them through region files, then walks the chunk streamer out and back under a
+//  small memory budget.
+//
+//  Usage: GameForFuns --benchmark-voxel [--out voxel.json]
+//         GameForFuns --benchmark-streaming [--out streaming.json]
+//
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Benchmark.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "Scenes.h"
+#include "VoxelWorld.h"
+#include "VoxelMesher.h"
+#include "VoxelNoise.h"
+#include "VoxelRegion.h"
+#include "VoxelStreamer.h"
+
+const GLint BENCHMARK_VOXEL_CHUNKS_XZ = 8;  // Chunks along x and z of the terrain, two high
+const GLuint BENCHMARK_VOXEL_REPEATS = 5;
+const GLint BENCHMARK_STREAM_COLUMNS = 16;       // Chunk columns along x and z of the generated patch
+const GLint BENCHMARK_STREAM_MIN_Y = -2;         // Chunk layers of each column
+const GLint BENCHMARK_STREAM_MAX_Y = 1;
+const GLuint BENCHMARK_NOISE_SAMPLES = 1 << 20;
+const GLfloat BENCHMARK_NOISE_EPSILON = 1e-5f;   // Contracted multiply-adds may round the reference differently
+const GLint BENCHMARK_STREAM_RADIUS = 6;
+const GLint BENCHMARK_STREAM_WALK = 48;          // Chunks the streamer walks out before coming back
+const size_t BENCHMARK_STREAM_BUDGET = 8 * 1024 * 1024; // The 676 chunks in the radius hold about 5.2 MB, the rest is for chunks outside it
+const char *const BENCHMARK_STREAM_DIRECTORY = "streaming_benchmark";
+
+struct VoxelMeshingResult {
+    GLuint threads;
+    GLfloat meshMs;    // Gathering and meshing every chunk, median over BENCHMARK_VOXEL_REPEATS runs
+    GLfloat chunksPerSecond;
+};
+
+struct VoxelGenerationResult {
+    GLuint threads;
+    GLfloat generateMs; // Every chunk of the patch, median over BENCHMARK_VOXEL_REPEATS runs
+    GLfloat chunksPerSecond;
+};
+
+// Face counts of a world: every face of every solid block, as the cube grid draws them,
+// the faces against air, and the quads greedy meshing makes of those
+struct VoxelFaceCounts {
+    size_t solidBlocks = 0;
+    size_t naiveFaces = 0;
+    size_t visibleFaces = 0;
+    size_t greedyQuads = 0;
+    size_t greedyArea = 0; // Block faces the quads cover, which must equal visibleFaces
+};
+
+// Rolling hills two chunks deep, grass over container blocks, with a scattering of single block holes
+inline void buildVoxelTerrain(VoxelWorld &world) {
+    std::vector<BlockId> blocks(CHUNK_VOLUME);
+    for (GLint cy = 0; cy < 2; cy++) {
+        for (GLint cz = 0; cz < BENCHMARK_VOXEL_CHUNKS_XZ; cz++) {
+            for (GLint cx = 0; cx < BENCHMARK_VOXEL_CHUNKS_XZ; cx++) {
+                for (GLint y = 0; y < CHUNK_SIZE; y++) {
+                    for (GLint z = 0; z < CHUNK_SIZE; z++) {
+                        for (GLint x = 0; x < CHUNK_SIZE; x++) {
+                            GLint wx = cx * CHUNK_SIZE + x, wy = cy * CHUNK_SIZE + y, wz = cz * CHUNK_SIZE + z;
+                            GLint height = 24 + (GLint) (12.0f * std::sin(wx * 0.07f) * std::cos(wz * 0.05f) + 6.0f * std::sin((wx + wz) * 0.13f));
+                            bool hole = (wx * 7 + wy * 13 + wz * 3) % 97 == 0 && wy < height - 2;
+                            blocks[ChunkStorage::index(x, y, z)] = wy >= height || hole ? BLOCK_AIR : wy == height - 1 ? BLOCK_GRASS : BLOCK_CONTAINER;
+                        }
+                    }
+                }
+                std::unique_ptr<ChunkStorage> chunk(new ChunkStorage());
+                chunk->encode(blocks.data());
+                world.insertChunk({ cx, cy, cz }, std::move(chunk));
+            }
+        }
+    }
+}
+
+inline VoxelFaceCounts countVoxelFaces(const VoxelWorld &world) {
+    VoxelFaceCounts counts;
+    std::vector<BlockId> padded(CHUNK_PADDED_VOLUME);
+    std::vector<VoxelVertex> vertices;
+    for (const auto &entry : world.getChunks()) {
+        world.gatherPadded(entry.first, padded.data());
+        for (GLint y = 0; y < CHUNK_SIZE; y++) {
+            for (GLint z = 0; z < CHUNK_SIZE; z++) {
+                for (GLint x = 0; x < CHUNK_SIZE; x++) {
+                    counts.solidBlocks += padded[paddedIndex(x, y, z)] != BLOCK_AIR;
+                }
+            }
+        }
+        counts.visibleFaces += countVisibleFaces(padded.data());
+        vertices.clear();
+        meshChunkGreedy(padded.data(), vertices);
+        counts.greedyQuads += vertices.size() / 4;
+        for (size_t quad = 0; quad < vertices.size(); quad += 4) {
+            // Opposite corners differ along the quad's two in-plane axes; the normal axis counts as 1
+            size_t area = 1;
+            for (GLuint axis = 0; axis < 3; axis++) {
+                GLint a = (vertices[quad] >> (axis * 6)) & 63, b = (vertices[quad + 2] >> (axis * 6)) & 63;
+                area *= std::max(std::abs(a - b), 1);
+            }
+            counts.greedyArea += area;
+        }
+    }
+    counts.naiveFaces = counts.solidBlocks * 6;
+    return counts;
+}
+
+// FNV-1a over the blocks of every chunk
+inline uint64_t hashChunks(const std::vector<ChunkStorage> &chunks) {
+    std::vector<uint64_t> hashes(chunks.size());
+    BlockId blocks[CHUNK_VOLUME];
+    for (size_t i = 0; i < chunks.size(); i++) {
+        chunks[i].decode(blocks);
+        hashes[i] = Benchmark::hashBytes(blocks, CHUNK_VOLUME);
+    }
+    return Benchmark::hashBytes(hashes.data(), hashes.size() * sizeof(uint64_t));
+}
+
+// Deletes the region files of coords left by an earlier run, so writes start from empty files
+inline void removeRegions(const std::vector<ChunkCoord> &coords) {
+    RegionStore regions(BENCHMARK_STREAM_DIRECTORY);
+    std::set<std::string> files;
+    for (const ChunkCoord &coord : coords) {
+        files.insert(regions.regionPath(coord));
+    }
+    for (const std::string &file : files) {
+        std::remove(file.c_str());
+    }
+}
+
+// Meshes every chunk of a BENCHMARK_VOXEL_CHUNKS_XZ^2 x 2 chunk terrain with 1 to N threads,
+// then counts the faces of the terrain and of the cube grid. Fails if the greedy quads do not
+// cover exactly the visible faces or a thread count meshes differently.
+inline int benchmarkVoxelMeshing(const BenchmarkOptions &options) {
+    VoxelWorld terrain;
+    buildVoxelTerrain(terrain);
+    std::vector<ChunkCoord> coords;
+    size_t storageBytes = 0;
+    for (const auto &entry : terrain.getChunks()) {
+        coords.push_back(entry.first);
+        storageBytes += entry.second->getMemoryBytes();
+    }
+    std::sort(coords.begin(), coords.end(), [](const ChunkCoord &a, const ChunkCoord &b) {
+        return a.x != b.x ? a.x < b.x : a.y != b.y ? a.y < b.y : a.z < b.z;
+    });
+    GLuint chunkCount = (GLuint) coords.size();
+
+    VoxelWorld grid;
+    for (GLuint i = 0; i < CubeGridScene::CUBE_COUNT; i++) {
+        glm::vec3 position = CubeGridScene::cubePosition(i);
+        grid.setBlock((GLint) position.x, (GLint) position.y, (GLint) position.z, BLOCK_CONTAINER);
+    }
+    VoxelFaceCounts terrainFaces = countVoxelFaces(terrain), gridFaces = countVoxelFaces(grid);
+
+    std::vector<VoxelMeshingResult> results;
+    std::vector<uint64_t> hashes(chunkCount);
+    uint64_t reference = 0;
+    bool identical = true;
+    for (GLuint threads : Benchmark::threadCounts()) {
+        JobSystem jobs(threads - 1);
+        std::vector<GLfloat> times;
+        for (GLuint repeat = 0; repeat < BENCHMARK_VOXEL_REPEATS; repeat++) {
+            double start = Profiler::get().nowUs();
+            jobs.parallelForWait(chunkCount, 1, [&](GLuint begin, GLuint end) {
+                std::vector<BlockId> padded(CHUNK_PADDED_VOLUME);
+                std::vector<VoxelVertex> vertices;
+                for (GLuint i = begin; i < end; i++) {
+                    vertices.clear();
+                    terrain.gatherPadded(coords[i], padded.data());
+                    meshChunkGreedy(padded.data(), vertices);
+                    hashes[i] = Benchmark::hashBytes(vertices.data(), vertices.size() * sizeof(VoxelVertex));
+                }
+            });
+            times.push_back((GLfloat) ((Profiler::get().nowUs() - start) / 1000.0));
+        }
+        uint64_t hash = Benchmark::hashBytes(hashes.data(), hashes.size() * sizeof(uint64_t));
+        reference = results.empty() ? hash : reference;
+        identical = identical && hash == reference;
+
+        GLfloat meshMs = Benchmark::percentile(times, 50.0f);
+        VoxelMeshingResult result = { threads, meshMs, chunkCount / (meshMs / 1000.0f) };
+        std::cout << threads << " threads: " << chunkCount << " chunks in " << result.meshMs << " ms, "
+                  << result.chunksPerSecond << " chunks/s" << std::endl;
+        results.push_back(result);
+    }
+
+    bool covered = terrainFaces.greedyArea == terrainFaces.visibleFaces && gridFaces.greedyArea == gridFaces.visibleFaces;
+    std::cout << "terrain: " << terrainFaces.naiveFaces << " block faces, " << terrainFaces.visibleFaces << " visible, "
+              << terrainFaces.greedyQuads << " greedy quads (" << (GLfloat) terrainFaces.naiveFaces / terrainFaces.greedyQuads
+              << "x fewer), " << storageBytes / 1024 << " KB of chunks" << std::endl;
+    std::cout << "cube grid: " << gridFaces.naiveFaces << " block faces, " << gridFaces.visibleFaces << " visible, "
+              << gridFaces.greedyQuads << " greedy quads (" << (GLfloat) gridFaces.naiveFaces / gridFaces.greedyQuads
+              << "x fewer)" << std::endl;
+    if (!covered) {
+        std::cout << "ERROR::BENCHMARK::VOXEL_COVERAGE greedy quads do not cover the visible faces" << std::endl;
+    }
+    if (!identical) {
+        std::cout << "ERROR::BENCHMARK::VOXEL_MISMATCH meshes differ between thread counts" << std::endl;
+    }
+
+    std::ofstream out(options.output);
+    if (!out) {
+        std::cout << "ERROR::BENCHMARK::COULD_NOT_WRITE " << options.output << std::endl;
+        return EXIT_FAILURE;
+    }
+    auto writeFaces = [&out](const char *name, const VoxelFaceCounts &faces) {
+        out << "  \"" << name << "\": {\"solid_blocks\": " << faces.solidBlocks << ", \"naive_faces\": " << faces.naiveFaces
+            << ", \"visible_faces\": " << faces.visibleFaces << ", \"greedy_quads\": " << faces.greedyQuads
+            << ", \"reduction\": " << (GLfloat) faces.naiveFaces / std::max<size_t>(faces.greedyQuads, 1) << "},\n";
+    };
+    out << "{\n  \"chunks\": " << chunkCount << ",\n  \"chunk_size\": " << CHUNK_SIZE
+        << ",\n  \"storage_bytes\": " << storageBytes << ",\n  \"raw_bytes\": " << (size_t) chunkCount * CHUNK_VOLUME << ",\n";
+    writeFaces("terrain", terrainFaces);
+    writeFaces("cube_grid", gridFaces);
+    out << "  \"meshing\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const VoxelMeshingResult &r = results[i];
+        out << "    {\"threads\": " << r.threads << ", \"mesh_ms\": " << r.meshMs << ", \"chunks_per_second\": " << r.chunksPerSecond
+            << ", \"speedup\": " << results[0].meshMs / r.meshMs << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return covered && identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Generates a BENCHMARK_STREAM_COLUMNS^2 patch of chunk columns with 1 to N threads and times the
+// wide noise against the one-sample reference; compresses the patch, writes it to region files
+// and reads it back; then walks a streamer BENCHMARK_STREAM_WALK chunks out and back under
+// BENCHMARK_STREAM_BUDGET, with one block edited at the start. Fails if the two noises disagree,
+// thread counts generate differently, a chunk or the edit comes back from disk changed, or the
+// walk evicts nothing or holds more than the budget and one column of chunks.
+inline int benchmarkVoxelStreaming(const BenchmarkOptions &options) {
+    // Noise, the same samples four at a time and one at a time
+    std::vector<GLfloat> xs(BENCHMARK_NOISE_SAMPLES), zs(BENCHMARK_NOISE_SAMPLES);
+    std::vector<GLfloat> wide(BENCHMARK_NOISE_SAMPLES), scalar(BENCHMARK_NOISE_SAMPLES);
+    for (GLuint i = 0; i < BENCHMARK_NOISE_SAMPLES; i++) {
+        xs[i] = ((GLfloat) (i % 1024) - 512.0f) * TERRAIN_FREQUENCY;
+        zs[i] = ((GLfloat) (i / 1024) - 512.0f) * TERRAIN_FREQUENCY;
+    }
+    std::vector<GLfloat> wideTimes, scalarTimes;
+    for (GLuint repeat = 0; repeat < BENCHMARK_VOXEL_REPEATS; repeat++) {
+        double start = Profiler::get().nowUs();
+        for (GLuint i = 0; i < BENCHMARK_NOISE_SAMPLES; i += 4) {
+            noiseStore(&wide[i], fractalNoise4(noiseLoad(&xs[i]), noiseLoad(&zs[i]), TERRAIN_OCTAVES, VOXEL_WORLD_SEED));
+        }
+        double middle = Profiler::get().nowUs();
+        for (GLuint i = 0; i < BENCHMARK_NOISE_SAMPLES; i++) {
+            scalar[i] = fractalNoise(xs[i], zs[i], TERRAIN_OCTAVES, VOXEL_WORLD_SEED);
+        }
+        wideTimes.push_back((GLfloat) ((middle - start) / 1000.0));
+        scalarTimes.push_back((GLfloat) ((Profiler::get().nowUs() - middle) / 1000.0));
+    }
+    GLfloat noiseError = 0.0f;
+    for (GLuint i = 0; i < BENCHMARK_NOISE_SAMPLES; i++) {
+        noiseError = std::max(noiseError, std::fabs(wide[i] - scalar[i]));
+    }
+    GLfloat wideMs = Benchmark::percentile(wideTimes, 50.0f), scalarMs = Benchmark::percentile(scalarTimes, 50.0f);
+    std::cout << "noise (" << VOXEL_NOISE_BACKEND << "): " << BENCHMARK_NOISE_SAMPLES << " samples in " << wideMs << " ms, "
+              << scalarMs << " ms one at a time (" << scalarMs / wideMs << "x), max difference " << noiseError << std::endl;
+
+    // Generation
+    std::vector<ChunkCoord> coords;
+    for (GLint z = 0; z < BENCHMARK_STREAM_COLUMNS; z++) {
+        for (GLint x = 0; x < BENCHMARK_STREAM_COLUMNS; x++) {
+            for (GLint y = BENCHMARK_STREAM_MIN_Y; y <= BENCHMARK_STREAM_MAX_Y; y++) {
+                coords.push_back({ x - BENCHMARK_STREAM_COLUMNS / 2, y, z - BENCHMARK_STREAM_COLUMNS / 2 });
+            }
+        }
+    }
+    GLuint chunkCount = (GLuint) coords.size();
+    std::vector<ChunkStorage> chunks(chunkCount);
+    std::vector<VoxelGenerationResult> results;
+    uint64_t reference = 0;
+    bool identical = true;
+    for (GLuint threads : Benchmark::threadCounts()) {
+        JobSystem jobs(threads - 1);
+        std::vector<GLfloat> times;
+        for (GLuint repeat = 0; repeat < BENCHMARK_VOXEL_REPEATS; repeat++) {
+            double start = Profiler::get().nowUs();
+            jobs.parallelForWait(chunkCount, 4, [&](GLuint begin, GLuint end) {
+                for (GLuint i = begin; i < end; i++) {
+                    generateChunk(coords[i], VOXEL_WORLD_SEED, chunks[i]);
+                }
+            });
+            times.push_back((GLfloat) ((Profiler::get().nowUs() - start) / 1000.0));
+        }
+        uint64_t hash = hashChunks(chunks);
+        reference = results.empty() ? hash : reference;
+        identical = identical && hash == reference;
+
+        GLfloat generateMs = Benchmark::percentile(times, 50.0f);
+        VoxelGenerationResult result = { threads, generateMs, chunkCount / (generateMs / 1000.0f) };
+        std::cout << threads << " threads: " << chunkCount << " chunks generated in " << result.generateMs << " ms, "
+                  << result.chunksPerSecond << " chunks/s" << std::endl;
+        results.push_back(result);
+    }
+
+    // Compression
+    size_t storageBytes = 0, compressedBytes = 0, rawBytes = (size_t) chunkCount * CHUNK_VOLUME;
+    std::vector<std::vector<unsigned char>> compressed(chunkCount);
+    std::vector<ChunkStorage> restored(chunkCount);
+    double start = Profiler::get().nowUs();
+    for (GLuint i = 0; i < chunkCount; i++) {
+        compressChunk(chunks[i], compressed[i]);
+    }
+    double middle = Profiler::get().nowUs();
+    bool decompressed = true;
+    for (GLuint i = 0; i < chunkCount; i++) {
+        decompressed = decompressChunk(compressed[i].data(), compressed[i].size(), restored[i]) && decompressed;
+    }
+    GLfloat compressMs = (GLfloat) ((middle - start) / 1000.0), decompressMs = (GLfloat) ((Profiler::get().nowUs() - middle) / 1000.0);
+    for (GLuint i = 0; i < chunkCount; i++) {
+        storageBytes += chunks[i].getMemoryBytes();
+        compressedBytes += compressed[i].size();
+    }
+    decompressed = decompressed && hashChunks(restored) == reference;
+    std::cout << "compression: " << rawBytes / 1024 << " KB of blocks, " << storageBytes / 1024 << " KB palette encoded, "
+              << compressedBytes / 1024 << " KB compressed (" << (GLfloat) rawBytes / compressedBytes << "x) in " << compressMs
+              << " ms, decompressed in " << decompressMs << " ms" << std::endl;
+
+    // Region files, written fresh and read back
+    removeRegions(coords);
+    GLfloat writeMs, readMs;
+    size_t fileBytes = 0;
+    bool roundTrip = true;
+    {
+        RegionStore regions(BENCHMARK_STREAM_DIRECTORY);
+        start = Profiler::get().nowUs();
+        for (GLuint i = 0; i < chunkCount; i++) {
+            roundTrip = regions.save(coords[i], chunks[i]) && roundTrip;
+        }
+        middle = Profiler::get().nowUs();
+        for (GLuint i = 0; i < chunkCount; i++) {
+            roundTrip = regions.load(coords[i], restored[i]) && roundTrip;
+        }
+        writeMs = (GLfloat) ((middle - start) / 1000.0);
+        readMs = (GLfloat) ((Profiler::get().nowUs() - middle) / 1000.0);
+        std::set<std::string> files;
+        for (const ChunkCoord &coord : coords) {
+            files.insert(regions.regionPath(coord));
+        }
+        for (const std::string &file : files) {
+            struct stat info;
+            fileBytes += stat(file.c_str(), &info) == 0 ? (size_t) info.st_size : 0;
+        }
+    }
+    roundTrip = roundTrip && hashChunks(restored) == reference;
+    std::cout << "regions: " << chunkCount << " chunks written in " << writeMs << " ms, read in " << readMs << " ms, "
+              << fileBytes / 1024 << " KB on disk" << std::endl;
+
+    // A walk out along x and back, every chunk in the radius streamed in at each step
+    std::vector<ChunkCoord> walked;
+    for (GLint x = -BENCHMARK_STREAM_RADIUS; x <= BENCHMARK_STREAM_WALK + BENCHMARK_STREAM_RADIUS; x++) {
+        for (GLint z = -BENCHMARK_STREAM_RADIUS; z <= BENCHMARK_STREAM_RADIUS; z++) {
+            for (GLint y = BENCHMARK_STREAM_MIN_Y; y <= BENCHMARK_STREAM_MAX_Y; y++) {
+                walked.push_back({ x, y, z });
+            }
+        }
+    }
+    removeRegions(walked);
+    VoxelStreamingStats walk;
+    GLfloat walkMs;
+    bool editKept, walkIdentical = true;
+    {
+        RegionStore regions(BENCHMARK_STREAM_DIRECTORY);
+        VoxelWorld world;
+        VoxelStreamer streamer(world, regions, VOXEL_WORLD_SEED, BENCHMARK_STREAM_RADIUS, BENCHMARK_STREAM_MIN_Y,
+                               BENCHMARK_STREAM_MAX_Y, BENCHMARK_STREAM_BUDGET);
+        start = Profiler::get().nowUs();
+        streamer.finish(glm::vec3(0.0f));
+        const GLint editY = BENCHMARK_STREAM_MAX_Y * CHUNK_SIZE + CHUNK_SIZE - 1; // Above any terrain
+        world.setBlock(3, editY, 3, BLOCK_GRASS);
+        for (GLint step = 1; step <= 2 * BENCHMARK_STREAM_WALK; step++) {
+            GLint chunk = step <= BENCHMARK_STREAM_WALK ? step : 2 * BENCHMARK_STREAM_WALK - step;
+            streamer.finish(glm::vec3((GLfloat) (chunk * CHUNK_SIZE), 0.0f, 0.0f));
+        }
+        walkMs = (GLfloat) ((Profiler::get().nowUs() - start) / 1000.0);
+        walk = streamer.getStats();
+        editKept = world.getBlock(3, editY, 3) == BLOCK_GRASS;
+        world.setBlock(3, editY, 3, BLOCK_AIR);
+
+        ChunkStorage expected;
+        BlockId a[CHUNK_VOLUME], b[CHUNK_VOLUME];
+        for (const auto &entry : world.getChunks()) {
+            generateChunk(entry.first, VOXEL_WORLD_SEED, expected);
+            entry.second->decode(a);
+            expected.decode(b);
+            walkIdentical = walkIdentical && std::memcmp(a, b, CHUNK_VOLUME) == 0;
+        }
+    }
+    std::cout << "walk: " << 2 * BENCHMARK_STREAM_WALK << " chunks out and back in " << walkMs << " ms, " << walk.generated
+              << " generated, " << walk.loaded << " loaded, " << walk.evicted << " evicted, peak " << walk.peakBytes / 1024
+              << " KB of chunks against a " << BENCHMARK_STREAM_BUDGET / 1024 << " KB budget" << std::endl;
+
+    // evict() runs after each frame's inserts, so the world may end a frame over the budget by at
+    // most a column of chunks at one byte per block with a full palette
+    const size_t columnBytes = (BENCHMARK_STREAM_MAX_Y - BENCHMARK_STREAM_MIN_Y + 1)
+                             * (sizeof(ChunkStorage) + CHUNK_VOLUME + 256 * sizeof(BlockId));
+
+    bool passed = true;
+    if (noiseError > BENCHMARK_NOISE_EPSILON) {
+        std::cout << "ERROR::BENCHMARK::NOISE_MISMATCH wide and one-sample noise differ by " << noiseError << std::endl;
+        passed = false;
+    }
+    if (!identical) {
+        std::cout << "ERROR::BENCHMARK::GENERATION_MISMATCH chunks differ between thread counts" << std::endl;
+        passed = false;
+    }
+    if (!decompressed || !roundTrip || !editKept || !walkIdentical) {
+        std::cout << "ERROR::BENCHMARK::STREAMING_MISMATCH chunks changed through compression or region files" << std::endl;
+        passed = false;
+    }
+    if (walk.evicted == 0 || walk.peakBytes > BENCHMARK_STREAM_BUDGET + columnBytes) {
+        std::cout << "ERROR::BENCHMARK::STREAMING_OVER_BUDGET " << walk.evicted << " chunks evicted, peak "
+                  << walk.peakBytes / 1024 << " KB against a " << BENCHMARK_STREAM_BUDGET / 1024 << " KB budget" << std::endl;
+        passed = false;
+    }
+
+    std::ofstream out(options.output);
+    if (!out) {
+        std::cout << "ERROR::BENCHMARK::COULD_NOT_WRITE " << options.output << std::endl;
+        return EXIT_FAILURE;
+    }
+    out << "{\n  \"noise\": {\"backend\": \"" << VOXEL_NOISE_BACKEND << "\", \"samples\": " << BENCHMARK_NOISE_SAMPLES
+        << ", \"wide_ms\": " << wideMs << ", \"scalar_ms\": " << scalarMs << ", \"speedup\": " << scalarMs / wideMs
+        << ", \"max_difference\": " << noiseError << "},\n";
+    out << "  \"generation\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const VoxelGenerationResult &r = results[i];
+        out << "    {\"threads\": " << r.threads << ", \"generate_ms\": " << r.generateMs << ", \"chunks_per_second\": " << r.chunksPerSecond
+            << ", \"speedup\": " << results[0].generateMs / r.generateMs << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ],\n  \"compression\": {\"chunks\": " << chunkCount << ", \"raw_bytes\": " << rawBytes << ", \"storage_bytes\": " << storageBytes
+        << ", \"compressed_bytes\": " << compressedBytes << ", \"ratio\": " << (GLfloat) rawBytes / compressedBytes
+        << ", \"compress_ms\": " << compressMs << ", \"decompress_ms\": " << decompressMs
+        << ", \"identical\": " << (decompressed ? "true" : "false") << "},\n";
+    out << "  \"regions\": {\"write_ms\": " << writeMs << ", \"read_ms\": " << readMs << ", \"file_bytes\": " << fileBytes
+        << ", \"identical\": " << (roundTrip ? "true" : "false") << "},\n";
+    out << "  \"walk\": {\"radius\": " << BENCHMARK_STREAM_RADIUS << ", \"chunks_walked\": " << 2 * BENCHMARK_STREAM_WALK
+        << ", \"budget_bytes\": " << BENCHMARK_STREAM_BUDGET << ", \"walk_ms\": " << walkMs << ", \"generated\": " << walk.generated
+        << ", \"loaded\": " << walk.loaded << ", \"evicted\": " << walk.evicted << ", \"discarded\": " << walk.discarded
+        << ", \"peak_bytes\": " << walk.peakBytes << ", \"edit_kept\": " << (editKept ? "true" : "false")
+        << ", \"identical\": " << (walkIdentical ? "true" : "false") << "}\n}\n";
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
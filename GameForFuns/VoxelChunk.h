@@ -0,0 +1,203 @@
+//
+//  VoxelChunk.h
+//  GameForFuns
+//
+//  Block storage for the voxel world. A chunk is a CHUNK_SIZE cube of block
+//  ids kept palette encoded: the distinct ids in the chunk are listed once and
+//  each block stores its index into that list, packed into 64-bit words with
+//  as few bits as the palette needs. Widths are 0, 1, 2, 4 or 8 bits, powers
+//  of two so no index straddles a word; a chunk of one block type, such as
+//  all air, holds a single palette entry and no words at all.
+//
+//  Blocks are ordered x fastest, then z, then y.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+typedef uint8_t BlockId;
+
+const BlockId BLOCK_AIR = 0;
+const BlockId BLOCK_CONTAINER = 1;
+const BlockId BLOCK_GRASS = 2;
+
+const GLint CHUNK_SHIFT = 5;
+const GLint CHUNK_SIZE = 1 << CHUNK_SHIFT; // 32, so a chunk-local corner fits in 6 bits
+const GLint CHUNK_VOLUME = CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
+
+struct ChunkCoord {
+    GLint x, y, z;
+
+    bool operator==(const ChunkCoord &other) const {
+        return this->x == other.x && this->y == other.y && this->z == other.z;
+    }
+
+    bool operator!=(const ChunkCoord &other) const {
+        return !(*this == other);
+    }
+};
+
+struct ChunkCoordHash {
+    size_t operator()(const ChunkCoord &coord) const {
+        return (size_t) ((uint32_t) coord.x * 73856093u ^ (uint32_t) coord.y * 19349663u ^ (uint32_t) coord.z * 83492791u);
+    }
+};
+
+// The chunk holding a block; shifts floor, so negative coordinates land in the chunk below
+inline ChunkCoord chunkOf(GLint x, GLint y, GLint z) {
+    return { x >> CHUNK_SHIFT, y >> CHUNK_SHIFT, z >> CHUNK_SHIFT };
+}
+
+// A block coordinate's offset inside its chunk
+inline GLint chunkLocal(GLint coordinate) {
+    return coordinate & (CHUNK_SIZE - 1);
+}
+
+class ChunkStorage {
+public:
+    explicit ChunkStorage(BlockId fill = BLOCK_AIR) : palette(1, fill) {}
+
+    static GLuint index(GLint x, GLint y, GLint z) {
+        return ((GLuint) y * CHUNK_SIZE + (GLuint) z) * CHUNK_SIZE + (GLuint) x;
+    }
+
+    BlockId get(GLint x, GLint y, GLint z) const {
+        return this->getIndex(index(x, y, z));
+    }
+
+    BlockId getIndex(GLuint i) const {
+        if (this->bits == 0) {
+            return this->palette[0];
+        }
+        GLuint perWord = 64 / this->bits;
+        uint64_t word = this->words[i / perWord];
+        return this->palette[(word >> ((i % perWord) * this->bits)) & ((1u << this->bits) - 1)];
+    }
+
+    void set(GLint x, GLint y, GLint z, BlockId block) {
+        this->setIndex(index(x, y, z), block);
+    }
+
+    void setIndex(GLuint i, BlockId block) {
+        GLuint entry = this->paletteEntry(block);
+        if (this->bits == 0) {
+            return; // Only reached when block is the chunk's single type
+        }
+        GLuint perWord = 64 / this->bits, shift = (i % perWord) * this->bits;
+        uint64_t mask = (((uint64_t) 1 << this->bits) - 1) << shift;
+        uint64_t &word = this->words[i / perWord];
+        word = (word & ~mask) | ((uint64_t) entry << shift);
+    }
+
+    void fill(BlockId block) {
+        this->palette.assign(1, block);
+        this->words.clear();
+        this->bits = 0;
+    }
+
+    // Writes all CHUNK_VOLUME blocks, in storage order
+    void decode(BlockId *blocks) const {
+        if (this->bits == 0) {
+            std::memset(blocks, this->palette[0], CHUNK_VOLUME);
+            return;
+        }
+        GLuint perWord = 64 / this->bits, mask = (1u << this->bits) - 1;
+        GLuint i = 0;
+        for (uint64_t word : this->words) {
+            for (GLuint slot = 0; slot < perWord && i < (GLuint) CHUNK_VOLUME; slot++, i++) {
+                blocks[i] = this->palette[(word >> (slot * this->bits)) & mask];
+            }
+        }
+    }
+
+    // Replaces the contents with CHUNK_VOLUME blocks, with a palette of only the ids they use
+    void encode(const BlockId *blocks) {
+        GLint entries[256];
+        std::fill(entries, entries + 256, -1);
+        this->palette.clear();
+        for (GLint i = 0; i < CHUNK_VOLUME; i++) {
+            if (entries[blocks[i]] < 0) {
+                entries[blocks[i]] = (GLint) this->palette.size();
+                this->palette.push_back(blocks[i]);
+            }
+        }
+        this->bits = bitsFor((GLuint) this->palette.size());
+        this->words.assign(wordsFor(this->bits), 0);
+        if (this->bits == 0) {
+            return;
+        }
+        GLuint perWord = 64 / this->bits;
+        for (GLint i = 0; i < CHUNK_VOLUME; i++) {
+            this->words[i / perWord] |= (uint64_t) entries[blocks[i]] << ((i % perWord) * this->bits);
+        }
+    }
+
+    // Drops palette entries no block uses any more, narrowing the indices if it can
+    void compact() {
+        std::vector<BlockId> blocks(CHUNK_VOLUME);
+        this->decode(blocks.data());
+        this->encode(blocks.data());
+    }
+
+    bool isUniform() const {
+        return this->bits == 0;
+    }
+
+    const std::vector<BlockId> &getPalette() const {
+        return this->palette;
+    }
+
+    GLuint getBits() const {
+        return this->bits;
+    }
+
+    size_t getMemoryBytes() const {
+        return sizeof(*this) + this->palette.capacity() * sizeof(BlockId) + this->words.capacity() * sizeof(uint64_t);
+    }
+
+private:
+    std::vector<BlockId> palette;
+    std::vector<uint64_t> words;
+    GLuint bits = 0;
+
+    static GLuint bitsFor(GLuint paletteSize) {
+        GLuint bits = 0;
+        while ((1u << bits) < paletteSize) {
+            bits = bits == 0 ? 1 : bits * 2;
+        }
+        return bits;
+    }
+
+    static size_t wordsFor(GLuint bits) {
+        return bits == 0 ? 0 : (size_t) CHUNK_VOLUME / (64 / bits);
+    }
+
+    // Index of block in the palette, adding it and widening every stored index when it is new
+    GLuint paletteEntry(BlockId block) {
+        for (GLuint entry = 0; entry < this->palette.size(); entry++) {
+            if (this->palette[entry] == block) {
+                return entry;
+            }
+        }
+        this->palette.push_back(block);
+        GLuint wanted = bitsFor((GLuint) this->palette.size());
+        if (wanted != this->bits) {
+            std::vector<uint64_t> widened(wordsFor(wanted), 0);
+            GLuint oldPerWord = this->bits ? 64 / this->bits : 0, newPerWord = 64 / wanted;
+            uint64_t oldMask = this->bits ? ((uint64_t) 1 << this->bits) - 1 : 0;
+            for (GLuint i = 0; i < (GLuint) CHUNK_VOLUME && this->bits; i++) {
+                uint64_t entry = (this->words[i / oldPerWord] >> ((i % oldPerWord) * this->bits)) & oldMask;
+                widened[i / newPerWord] |= entry << ((i % newPerWord) * wanted);
+            }
+            this->words.swap(widened); // From 0 bits every block was entry 0, which the zeroed words already say
+            this->bits = wanted;
+        }
+        return (GLuint) this->palette.size() - 1;
+    }
+};
@@ -0,0 +1,279 @@
+//
+//  VoxelCollision.h
+//  GameForFuns
+//
+//  Collision against the blocks of a VoxelWorld. Boxes are swept one axis at
+//  a time, vertical first: along each axis only the layers of blocks between
+//  the box's leading face and where it would end up are read, nearest first,
+//  and the box stops flush against the first layer with a solid block under
+//  its cross-section. A motion is cut to VOXEL_MAX_MOTION first, so a sweep
+//  reads a bounded number of blocks however fast the body goes, and a body
+//  cannot skip over a block within one step.
+//
+//  Rays step from block to block along their path (Amanatides and Woo's
+//  grid traversal), at most three blocks per unit of distance, and report the
+//  first solid block with the face they entered it through, for picking and
+//  placing blocks.
+//
+//  Both read blocks through a cursor that keeps the last chunk looked up, as
+//  neighbouring reads nearly always fall in the same chunk. Missing chunks
+//  read as air. checkVoxelCollision() runs both against small hand built
+//  worlds with no window, as GameForFuns --collision-check.
+//
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "VoxelChunk.h"
+#include "VoxelWorld.h"
+
+const GLfloat VOXEL_MAX_MOTION = 8.0f;        // Longest sweep, in blocks; at 120 steps a second, 960 blocks/s
+const GLfloat VOXEL_COLLISION_EPSILON = 1e-4f; // Faces this close count as touching, not overlapping
+const GLfloat PLAYER_HALF_WIDTH = 0.3f;
+const GLfloat PLAYER_HEIGHT = 1.8f;
+const GLfloat PLAYER_EYE_HEIGHT = 1.62f;      // Camera above the feet
+const GLfloat PLAYER_REACH = 8.0f;            // Farthest block the player can pick
+
+// The player's body when the camera is at eye
+inline AABB playerBody(const glm::vec3 &eye) {
+    glm::vec3 feet = eye - glm::vec3(0.0f, PLAYER_EYE_HEIGHT, 0.0f);
+    return { feet - glm::vec3(PLAYER_HALF_WIDTH, 0.0f, PLAYER_HALF_WIDTH), feet + glm::vec3(PLAYER_HALF_WIDTH, PLAYER_HEIGHT, PLAYER_HALF_WIDTH) };
+}
+
+// Block reads that look a chunk up only when they leave the last one
+class VoxelCursor {
+public:
+    explicit VoxelCursor(const VoxelWorld &world) : world(world) {}
+
+    BlockId get(GLint x, GLint y, GLint z) {
+        ChunkCoord coord = chunkOf(x, y, z);
+        if (!this->valid || coord != this->coord) {
+            this->coord = coord;
+            this->chunk = this->world.getChunk(coord);
+            this->valid = true;
+        }
+        this->reads++;
+        return this->chunk ? this->chunk->get(chunkLocal(x), chunkLocal(y), chunkLocal(z)) : BLOCK_AIR;
+    }
+
+    bool isSolid(GLint x, GLint y, GLint z) {
+        return this->get(x, y, z) != BLOCK_AIR;
+    }
+
+    GLuint getReads() const {
+        return this->reads;
+    }
+
+private:
+    const VoxelWorld &world;
+    ChunkCoord coord = { 0, 0, 0 };
+    const ChunkStorage *chunk = nullptr;
+    bool valid = false;
+    GLuint reads = 0;
+};
+
+struct VoxelSweep {
+    glm::vec3 motion;            // The part of the asked motion the box can make
+    bool blocked[3] = { false, false, false }; // Axes a block cut short
+    GLuint blocksRead = 0;
+};
+
+// How far box can move by motion before it touches a solid block
+inline VoxelSweep sweepBox(const VoxelWorld &world, const AABB &box, glm::vec3 motion) {
+    GLfloat length = glm::length(motion);
+    if (length > VOXEL_MAX_MOTION) {
+        motion *= VOXEL_MAX_MOTION / length;
+    }
+
+    VoxelSweep sweep;
+    VoxelCursor cursor(world);
+    AABB moved = box;
+    const GLint order[3] = { 1, 0, 2 };
+    for (GLint axis : order) {
+        GLfloat m = motion[axis];
+        if (m == 0.0f) {
+            continue;
+        }
+        GLint u = (axis + 1) % 3, v = (axis + 2) % 3;
+        GLint uFirst = (GLint) std::floor(moved.min[u] + VOXEL_COLLISION_EPSILON), uLast = (GLint) std::floor(moved.max[u] - VOXEL_COLLISION_EPSILON);
+        GLint vFirst = (GLint) std::floor(moved.min[v] + VOXEL_COLLISION_EPSILON), vLast = (GLint) std::floor(moved.max[v] - VOXEL_COLLISION_EPSILON);
+
+        // Layers past the leading face, up to the one the face would reach
+        GLint first, last, step;
+        if (m > 0.0f) {
+            first = (GLint) std::floor(moved.max[axis] - VOXEL_COLLISION_EPSILON) + 1;
+            last = (GLint) std::floor(moved.max[axis] + m - VOXEL_COLLISION_EPSILON);
+            step = 1;
+        } else {
+            first = (GLint) std::floor(moved.min[axis] + VOXEL_COLLISION_EPSILON) - 1;
+            last = (GLint) std::floor(moved.min[axis] + m + VOXEL_COLLISION_EPSILON);
+            step = -1;
+        }
+
+        for (GLint layer = first; (last - layer) * step >= 0; layer += step) {
+            bool solid = false;
+            GLint c[3];
+            c[axis] = layer;
+            for (c[u] = uFirst; c[u] <= uLast && !solid; c[u]++) {
+                for (c[v] = vFirst; c[v] <= vLast && !solid; c[v]++) {
+                    solid = cursor.isSolid(c[0], c[1], c[2]);
+                }
+            }
+            if (solid) {
+                m = m > 0.0f ? (GLfloat) layer - moved.max[axis] : (GLfloat) (layer + 1) - moved.min[axis];
+                sweep.blocked[axis] = true;
+                break;
+            }
+        }
+        moved.min[axis] += m;
+        moved.max[axis] += m;
+        motion[axis] = m;
+    }
+    sweep.motion = motion;
+    sweep.blocksRead = cursor.getReads();
+    return sweep;
+}
+
+struct VoxelRayHit {
+    glm::ivec3 block;   // The solid block hit
+    glm::ivec3 normal;  // Outward normal of the face the ray entered through, zero if it started inside
+    GLfloat distance;   // Along the normalized direction
+    BlockId id;
+};
+
+// First solid block along the ray within maxDistance; direction need not be normalized
+inline bool raycastBlocks(const VoxelWorld &world, const glm::vec3 &origin, const glm::vec3 &direction, GLfloat maxDistance,
+                          VoxelRayHit &hit) {
+    GLfloat length = glm::length(direction);
+    if (length == 0.0f) {
+        return false;
+    }
+    glm::vec3 d = direction / length;
+    VoxelCursor cursor(world);
+    GLint cell[3] = { (GLint) std::floor(origin.x), (GLint) std::floor(origin.y), (GLint) std::floor(origin.z) };
+    GLint step[3];
+    GLfloat next[3], delta[3]; // Distance to the next boundary on each axis, and between boundaries
+    for (GLint axis = 0; axis < 3; axis++) {
+        if (d[axis] > 0.0f) {
+            step[axis] = 1;
+            delta[axis] = 1.0f / d[axis];
+            next[axis] = ((GLfloat) (cell[axis] + 1) - origin[axis]) * delta[axis];
+        } else if (d[axis] < 0.0f) {
+            step[axis] = -1;
+            delta[axis] = -1.0f / d[axis];
+            next[axis] = (origin[axis] - (GLfloat) cell[axis]) * delta[axis];
+        } else {
+            step[axis] = 0;
+            delta[axis] = next[axis] = INFINITY;
+        }
+    }
+
+    GLint entered = -1;
+    GLfloat t = 0.0f;
+    while (t <= maxDistance) {
+        BlockId id = cursor.get(cell[0], cell[1], cell[2]);
+        if (id != BLOCK_AIR) {
+            hit.block = glm::ivec3(cell[0], cell[1], cell[2]);
+            hit.normal = glm::ivec3(0);
+            if (entered >= 0) {
+                hit.normal[entered] = -step[entered];
+            }
+            hit.distance = t;
+            hit.id = id;
+            return true;
+        }
+        entered = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+        t = next[entered];
+        next[entered] += delta[entered];
+        cell[entered] += step[entered];
+    }
+    return false;
+}
+
+// Runs the sweeps and rays against small worlds and prints each case. Run with GameForFuns --collision-check.
+inline bool checkVoxelCollision() {
+    bool passed = true;
+    auto expect = [&passed](bool ok, const char *name) {
+        std::cout << (ok ? "OK       " : "MISMATCH ") << name << std::endl;
+        passed = passed && ok;
+    };
+    auto near = [](GLfloat a, GLfloat b) {
+        return std::fabs(a - b) < 1e-3f;
+    };
+
+    // A 16x16 floor whose top is at y = 0, a wall one block thick at x = 5, and a pillar across a chunk border
+    VoxelWorld world;
+    for (GLint z = -8; z < 8; z++) {
+        for (GLint x = -8; x < 8; x++) {
+            world.setBlock(x, -1, z, BLOCK_GRASS);
+        }
+    }
+    for (GLint y = 0; y < 4; y++) {
+        for (GLint z = -8; z < 8; z++) {
+            world.setBlock(5, y, z, BLOCK_CONTAINER);
+        }
+    }
+    for (GLint y = 0; y < 4; y++) {
+        world.setBlock(-1, y, 0, BLOCK_CONTAINER);
+    }
+
+    AABB body = playerBody(glm::vec3(0.5f, 3.0f, 0.5f));
+    VoxelSweep fall = sweepBox(world, body, glm::vec3(0.0f, -5.0f, 0.0f));
+    expect(fall.blocked[1] && near(body.min.y + fall.motion.y, 0.0f), "falling body lands on the floor");
+
+    AABB standing = playerBody(glm::vec3(0.5f, PLAYER_EYE_HEIGHT, 0.5f));
+    VoxelSweep rest = sweepBox(world, standing, glm::vec3(0.0f, -0.01f, 0.0f));
+    expect(rest.blocked[1] && rest.motion.y == 0.0f, "standing body stays on the floor");
+
+    VoxelSweep walk = sweepBox(world, standing, glm::vec3(6.0f, 0.0f, 0.0f));
+    expect(walk.blocked[0] && near(standing.max.x + walk.motion.x, 5.0f), "walking body stops at the wall");
+
+    VoxelSweep slide = sweepBox(world, standing, glm::vec3(6.0f, 0.0f, 2.0f));
+    expect(slide.blocked[0] && !slide.blocked[2] && near(slide.motion.z, 2.0f), "body slides along the wall");
+
+    VoxelSweep fast = sweepBox(world, standing, glm::vec3(10000.0f, 0.0f, 0.0f));
+    expect(fast.blocked[0] && near(standing.max.x + fast.motion.x, 5.0f), "fast body does not pass through the wall");
+
+    AABB sky = playerBody(glm::vec3(0.5f, 100.0f, 0.5f));
+    VoxelSweep plunge = sweepBox(world, sky, glm::vec3(0.0f, -1e6f, 0.0f));
+    GLuint bound = ((GLuint) VOXEL_MAX_MOTION + 2) * 2 * 3 * 3; // Layers times the cross-section, on every axis
+    expect(!plunge.blocked[1] && near(plunge.motion.y, -VOXEL_MAX_MOTION) && plunge.blocksRead <= bound,
+           "huge velocity is cut to VOXEL_MAX_MOTION and reads a bounded number of blocks");
+
+    VoxelSweep pillar = sweepBox(world, standing, glm::vec3(-2.0f, 0.0f, -2.0f));
+    expect(pillar.blocked[0] && near(standing.min.x + pillar.motion.x, 0.0f) && near(pillar.motion.z, -2.0f),
+           "body stops at a pillar in the next chunk and slides past it");
+
+    VoxelRayHit hit;
+    bool down = raycastBlocks(world, glm::vec3(0.5f, 10.0f, 0.5f), glm::vec3(0.0f, -1.0f, 0.0f), 20.0f, hit);
+    expect(down && hit.block == glm::ivec3(0, -1, 0) && hit.normal == glm::ivec3(0, 1, 0) && near(hit.distance, 10.0f),
+           "ray down hits the floor's top face");
+
+    bool across = raycastBlocks(world, glm::vec3(0.5f, 1.5f, 0.5f), glm::vec3(1.0f, 0.0f, 0.0f), 20.0f, hit);
+    expect(across && hit.block == glm::ivec3(5, 1, 0) && hit.normal == glm::ivec3(-1, 0, 0) && near(hit.distance, 4.5f),
+           "ray along x hits the wall's near face");
+
+    bool diagonal = raycastBlocks(world, glm::vec3(0.5f, 1.5f, 0.5f), glm::vec3(-1.0f, 0.0f, -0.3f), 20.0f, hit);
+    expect(diagonal && hit.block == glm::ivec3(-1, 1, 0) && hit.normal == glm::ivec3(1, 0, 0),
+           "diagonal ray finds the pillar across the chunk border");
+
+    bool shortRay = raycastBlocks(world, glm::vec3(0.5f, 1.5f, 0.5f), glm::vec3(1.0f, 0.0f, 0.0f), 4.0f, hit);
+    expect(!shortRay, "ray stops at its maximum distance");
+
+    bool up = raycastBlocks(world, glm::vec3(0.5f, 1.5f, 0.5f), glm::vec3(0.0f, 1.0f, 0.0f), 1000.0f, hit);
+    expect(!up, "ray into empty sky misses");
+
+    bool inside = raycastBlocks(world, glm::vec3(5.5f, 1.5f, 0.5f), glm::vec3(1.0f, 0.0f, 0.0f), 5.0f, hit);
+    expect(inside && hit.block == glm::ivec3(5, 1, 0) && hit.normal == glm::ivec3(0) && hit.distance == 0.0f,
+           "ray starting in a block hits it at once");
+
+    return passed;
+}
@@ -0,0 +1,130 @@
+//
+//  VoxelMesher.h
+//  GameForFuns
+//
+//  Greedy meshing of a chunk. For each of the six face directions the chunk
+//  is swept one slice at a time: a mask marks the blocks whose face in that
+//  direction is visible, meaning the block is solid and its neighbour is air,
+//  and runs of the same block type are grown first along a row and then over
+//  the rows below into the largest rectangles they make. Each rectangle is one
+//  quad, so a flat wall of any size costs two triangles.
+//
+//  Vertices are packed into 32 bits: the chunk-local corner in 6 bits per axis
+//  (0 to 32), the face direction in 3 and the block id in 8. Quads are four
+//  vertices drawn through a shared index buffer.
+//
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "VoxelChunk.h"
+#include "VoxelWorld.h"
+
+typedef uint32_t VoxelVertex;
+
+// Face directions, in the order of the cubemap faces
+enum VoxelFace {
+    VOXEL_FACE_POSITIVE_X,
+    VOXEL_FACE_NEGATIVE_X,
+    VOXEL_FACE_POSITIVE_Y,
+    VOXEL_FACE_NEGATIVE_Y,
+    VOXEL_FACE_POSITIVE_Z,
+    VOXEL_FACE_NEGATIVE_Z,
+    VOXEL_FACE_COUNT
+};
+
+inline VoxelVertex packVoxelVertex(GLuint x, GLuint y, GLuint z, GLuint face, BlockId block) {
+    return x | y << 6 | z << 12 | face << 18 | (GLuint) block << 21;
+}
+
+// Greedy quads of a chunk given as a CHUNK_PADDED_VOLUME array from VoxelWorld::gatherPadded,
+// appended four vertices each, counter-clockwise seen from outside
+inline void meshChunkGreedy(const BlockId *padded, std::vector<VoxelVertex> &vertices) {
+    const GLint strides[3] = { 1, CHUNK_PADDED_SIZE * CHUNK_PADDED_SIZE, CHUNK_PADDED_SIZE }; // x, y, z
+    BlockId mask[CHUNK_SIZE * CHUNK_SIZE];
+
+    for (GLuint face = 0; face < VOXEL_FACE_COUNT; face++) {
+        GLint d = face / 2, u = (d + 1) % 3, v = (d + 2) % 3; // u cross v points along +d
+        bool positive = face % 2 == 0;
+        GLint toNeighbour = positive ? strides[d] : -strides[d];
+
+        for (GLint slice = 0; slice < CHUNK_SIZE; slice++) {
+            GLint c[3];
+            c[d] = slice;
+            for (GLint j = 0; j < CHUNK_SIZE; j++) {
+                c[v] = j;
+                c[u] = 0;
+                GLuint at = paddedIndex(c[0], c[1], c[2]);
+                for (GLint i = 0; i < CHUNK_SIZE; i++, at += strides[u]) {
+                    BlockId block = padded[at];
+                    mask[j * CHUNK_SIZE + i] = block != BLOCK_AIR && padded[at + toNeighbour] == BLOCK_AIR ? block : BLOCK_AIR;
+                }
+            }
+
+            c[d] = slice + (positive ? 1 : 0); // The plane the faces lie on
+            for (GLint j = 0; j < CHUNK_SIZE; j++) {
+                for (GLint i = 0; i < CHUNK_SIZE;) {
+                    BlockId block = mask[j * CHUNK_SIZE + i];
+                    if (block == BLOCK_AIR) {
+                        i++;
+                        continue;
+                    }
+                    GLint width = 1;
+                    while (i + width < CHUNK_SIZE && mask[j * CHUNK_SIZE + i + width] == block) {
+                        width++;
+                    }
+                    GLint height = 1;
+                    for (; j + height < CHUNK_SIZE; height++) {
+                        const BlockId *row = mask + (j + height) * CHUNK_SIZE + i;
+                        GLint k = 0;
+                        while (k < width && row[k] == block) {
+                            k++;
+                        }
+                        if (k < width) {
+                            break;
+                        }
+                    }
+                    for (GLint h = 0; h < height; h++) {
+                        std::memset(mask + (j + h) * CHUNK_SIZE + i, BLOCK_AIR, width);
+                    }
+
+                    // Corners (i, j), (i + w, j), (i + w, j + h), (i, j + h), reversed for negative faces
+                    GLint us[4] = { i, i + width, i + width, i };
+                    GLint vs[4] = { j, j, j + height, j + height };
+                    for (GLint k = 0; k < 4; k++) {
+                        GLint corner = positive ? k : 3 - k;
+                        c[u] = us[corner];
+                        c[v] = vs[corner];
+                        vertices.push_back(packVoxelVertex(c[0], c[1], c[2], face, block));
+                    }
+                    i += width;
+                }
+            }
+        }
+    }
+}
+
+// Faces a per-block mesher without merging would emit: every solid face against air
+inline GLuint countVisibleFaces(const BlockId *padded) {
+    const GLint strides[3] = { 1, CHUNK_PADDED_SIZE * CHUNK_PADDED_SIZE, CHUNK_PADDED_SIZE };
+    GLuint faces = 0;
+    for (GLint y = 0; y < CHUNK_SIZE; y++) {
+        for (GLint z = 0; z < CHUNK_SIZE; z++) {
+            GLuint at = paddedIndex(0, y, z);
+            for (GLint x = 0; x < CHUNK_SIZE; x++, at++) {
+                if (padded[at] == BLOCK_AIR) {
+                    continue;
+                }
+                for (GLint axis = 0; axis < 3; axis++) {
+                    faces += (padded[at + strides[axis]] == BLOCK_AIR) + (padded[at - strides[axis]] == BLOCK_AIR);
+                }
+            }
+        }
+    }
+    return faces;
+}
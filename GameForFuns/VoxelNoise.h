@@ -0,0 +1,228 @@
+//
+//  VoxelNoise.h
+//  GameForFuns
+//
+//  2D gradient noise for terrain, four samples at a time. The lanes map onto
+//  SSE2 on x86 and NEON on ARM, with a plain array fallback elsewhere. Lattice
+//  corners are hashed with adds, shifts and xors only (Jenkins' one-at-a-time
+//  steps), which every backend has as 32-bit lane operations, and the hash
+//  picks one of four diagonal gradients by flipping sign bits, so a sample
+//  takes no table lookups or branches.
+//
+//  gradientNoise and fractalNoise are the one-sample versions, built from the
+//  same operations in the same order, as a reference for the wide ones.
+//
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VOXEL_NOISE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VOXEL_NOISE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if VOXEL_NOISE_SSE2
+
+const char *const VOXEL_NOISE_BACKEND = "sse2";
+
+typedef __m128 NoiseFloat4;
+typedef __m128i NoiseInt4;
+
+inline NoiseFloat4 noiseSet(GLfloat value) { return _mm_set1_ps(value); }
+inline NoiseFloat4 noiseLoad(const GLfloat *values) { return _mm_loadu_ps(values); }
+inline void noiseStore(GLfloat *values, NoiseFloat4 v) { _mm_storeu_ps(values, v); }
+inline NoiseFloat4 noiseAdd(NoiseFloat4 a, NoiseFloat4 b) { return _mm_add_ps(a, b); }
+inline NoiseFloat4 noiseSub(NoiseFloat4 a, NoiseFloat4 b) { return _mm_sub_ps(a, b); }
+inline NoiseFloat4 noiseMul(NoiseFloat4 a, NoiseFloat4 b) { return _mm_mul_ps(a, b); }
+inline NoiseInt4 noiseSetInt(uint32_t value) { return _mm_set1_epi32((int) value); }
+inline NoiseInt4 noiseAddInt(NoiseInt4 a, NoiseInt4 b) { return _mm_add_epi32(a, b); }
+inline NoiseInt4 noiseXorInt(NoiseInt4 a, NoiseInt4 b) { return _mm_xor_si128(a, b); }
+inline NoiseInt4 noiseAndInt(NoiseInt4 a, NoiseInt4 b) { return _mm_and_si128(a, b); }
+inline NoiseInt4 noiseShiftLeft(NoiseInt4 a, int bits) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(bits)); }
+inline NoiseInt4 noiseShiftRight(NoiseInt4 a, int bits) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(bits)); }
+inline NoiseFloat4 noiseToFloat(NoiseInt4 a) { return _mm_cvtepi32_ps(a); }
+inline NoiseFloat4 noiseXorSign(NoiseFloat4 a, NoiseInt4 sign) { return _mm_xor_ps(a, _mm_castsi128_ps(sign)); }
+
+// Truncation rounds negative values up; the comparison mask is -1 in exactly those lanes
+inline NoiseInt4 noiseFloor(NoiseFloat4 a) {
+    NoiseInt4 truncated = _mm_cvttps_epi32(a);
+    return _mm_add_epi32(truncated, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(truncated), a)));
+}
+
+#elif VOXEL_NOISE_NEON
+
+const char *const VOXEL_NOISE_BACKEND = "neon";
+
+typedef float32x4_t NoiseFloat4;
+typedef uint32x4_t NoiseInt4;
+
+inline NoiseFloat4 noiseSet(GLfloat value) { return vdupq_n_f32(value); }
+inline NoiseFloat4 noiseLoad(const GLfloat *values) { return vld1q_f32(values); }
+inline void noiseStore(GLfloat *values, NoiseFloat4 v) { vst1q_f32(values, v); }
+inline NoiseFloat4 noiseAdd(NoiseFloat4 a, NoiseFloat4 b) { return vaddq_f32(a, b); }
+inline NoiseFloat4 noiseSub(NoiseFloat4 a, NoiseFloat4 b) { return vsubq_f32(a, b); }
+inline NoiseFloat4 noiseMul(NoiseFloat4 a, NoiseFloat4 b) { return vmulq_f32(a, b); }
+inline NoiseInt4 noiseSetInt(uint32_t value) { return vdupq_n_u32(value); }
+inline NoiseInt4 noiseAddInt(NoiseInt4 a, NoiseInt4 b) { return vaddq_u32(a, b); }
+inline NoiseInt4 noiseXorInt(NoiseInt4 a, NoiseInt4 b) { return veorq_u32(a, b); }
+inline NoiseInt4 noiseAndInt(NoiseInt4 a, NoiseInt4 b) { return vandq_u32(a, b); }
+inline NoiseInt4 noiseShiftLeft(NoiseInt4 a, int bits) { return vshlq_u32(a, vdupq_n_s32(bits)); }
+inline NoiseInt4 noiseShiftRight(NoiseInt4 a, int bits) { return vshlq_u32(a, vdupq_n_s32(-bits)); }
+inline NoiseFloat4 noiseToFloat(NoiseInt4 a) { return vcvtq_f32_s32(vreinterpretq_s32_u32(a)); }
+inline NoiseFloat4 noiseXorSign(NoiseFloat4 a, NoiseInt4 sign) { return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a), sign)); }
+
+inline NoiseInt4 noiseFloor(NoiseFloat4 a) {
+    int32x4_t truncated = vcvtq_s32_f32(a);
+    uint32x4_t roundedUp = vcgtq_f32(vcvtq_f32_s32(truncated), a);
+    return vaddq_u32(vreinterpretq_u32_s32(truncated), roundedUp); // All ones is -1
+}
+
+#else
+
+const char *const VOXEL_NOISE_BACKEND = "scalar";
+
+struct NoiseFloat4 { GLfloat v[4]; };
+struct NoiseInt4 { uint32_t v[4]; };
+
+#define VOXEL_NOISE_LANES(result, expression) for (int i = 0; i < 4; i++) { result.v[i] = expression; }
+
+inline NoiseFloat4 noiseSet(GLfloat value) { NoiseFloat4 r; VOXEL_NOISE_LANES(r, value); return r; }
+inline NoiseFloat4 noiseLoad(const GLfloat *values) { NoiseFloat4 r; VOXEL_NOISE_LANES(r, values[i]); return r; }
+inline void noiseStore(GLfloat *values, NoiseFloat4 a) { for (int i = 0; i < 4; i++) { values[i] = a.v[i]; } }
+inline NoiseFloat4 noiseAdd(NoiseFloat4 a, NoiseFloat4 b) { NoiseFloat4 r; VOXEL_NOISE_LANES(r, a.v[i] + b.v[i]); return r; }
+inline NoiseFloat4 noiseSub(NoiseFloat4 a, NoiseFloat4 b) { NoiseFloat4 r; VOXEL_NOISE_LANES(r, a.v[i] - b.v[i]); return r; }
+inline NoiseFloat4 noiseMul(NoiseFloat4 a, NoiseFloat4 b) { NoiseFloat4 r; VOXEL_NOISE_LANES(r, a.v[i] * b.v[i]); return r; }
+inline NoiseInt4 noiseSetInt(uint32_t value) { NoiseInt4 r; VOXEL_NOISE_LANES(r, value); return r; }
+inline NoiseInt4 noiseAddInt(NoiseInt4 a, NoiseInt4 b) { NoiseInt4 r; VOXEL_NOISE_LANES(r, a.v[i] + b.v[i]); return r; }
+inline NoiseInt4 noiseXorInt(NoiseInt4 a, NoiseInt4 b) { NoiseInt4 r; VOXEL_NOISE_LANES(r, a.v[i] ^ b.v[i]); return r; }
+inline NoiseInt4 noiseAndInt(NoiseInt4 a, NoiseInt4 b) { NoiseInt4 r; VOXEL_NOISE_LANES(r, a.v[i] & b.v[i]); return r; }
+inline NoiseInt4 noiseShiftLeft(NoiseInt4 a, int bits) { NoiseInt4 r; VOXEL_NOISE_LANES(r, a.v[i] << bits); return r; }
+inline NoiseInt4 noiseShiftRight(NoiseInt4 a, int bits) { NoiseInt4 r; VOXEL_NOISE_LANES(r, a.v[i] >> bits); return r; }
+inline NoiseFloat4 noiseToFloat(NoiseInt4 a) { NoiseFloat4 r; VOXEL_NOISE_LANES(r, (GLfloat) (int32_t) a.v[i]); return r; }
+inline NoiseInt4 noiseFloor(NoiseFloat4 a) { NoiseInt4 r; VOXEL_NOISE_LANES(r, (uint32_t) (int32_t) std::floor(a.v[i])); return r; }
+
+inline NoiseFloat4 noiseXorSign(NoiseFloat4 a, NoiseInt4 sign) {
+    NoiseFloat4 r;
+    for (int i = 0; i < 4; i++) {
+        uint32_t bits;
+        std::memcpy(&bits, &a.v[i], sizeof(bits));
+        bits ^= sign.v[i];
+        std::memcpy(&r.v[i], &bits, sizeof(bits));
+    }
+    return r;
+}
+
+#undef VOXEL_NOISE_LANES
+
+#endif
+
+// One-at-a-time mixing of a lattice corner into the seed
+inline NoiseInt4 noiseHash(NoiseInt4 seed, NoiseInt4 x, NoiseInt4 z) {
+    NoiseInt4 h = noiseAddInt(seed, x);
+    h = noiseAddInt(h, noiseShiftLeft(h, 10));
+    h = noiseXorInt(h, noiseShiftRight(h, 6));
+    h = noiseAddInt(h, z);
+    h = noiseAddInt(h, noiseShiftLeft(h, 10));
+    h = noiseXorInt(h, noiseShiftRight(h, 6));
+    h = noiseAddInt(h, noiseShiftLeft(h, 3));
+    h = noiseXorInt(h, noiseShiftRight(h, 11));
+    return noiseAddInt(h, noiseShiftLeft(h, 15));
+}
+
+// Dot product with the gradient (+-1, +-1) the hash's low two bits pick
+inline NoiseFloat4 noiseGradient(NoiseInt4 hash, NoiseFloat4 dx, NoiseFloat4 dz) {
+    NoiseInt4 signX = noiseShiftLeft(noiseAndInt(hash, noiseSetInt(1)), 31);
+    NoiseInt4 signZ = noiseShiftLeft(noiseAndInt(hash, noiseSetInt(2)), 30);
+    return noiseAdd(noiseXorSign(dx, signX), noiseXorSign(dz, signZ));
+}
+
+// 6t^5 - 15t^4 + 10t^3, flat at both ends so cells join smoothly
+inline NoiseFloat4 noiseFade(NoiseFloat4 t) {
+    NoiseFloat4 inner = noiseAdd(noiseMul(t, noiseSub(noiseMul(t, noiseSet(6.0f)), noiseSet(15.0f))), noiseSet(10.0f));
+    return noiseMul(noiseMul(noiseMul(t, t), t), inner);
+}
+
+inline NoiseFloat4 noiseLerp(NoiseFloat4 a, NoiseFloat4 b, NoiseFloat4 t) {
+    return noiseAdd(a, noiseMul(t, noiseSub(b, a)));
+}
+
+inline NoiseFloat4 gradientNoise4(NoiseFloat4 x, NoiseFloat4 z, uint32_t seed) {
+    NoiseInt4 x0 = noiseFloor(x), z0 = noiseFloor(z);
+    NoiseInt4 one = noiseSetInt(1), seeds = noiseSetInt(seed);
+    NoiseInt4 x1 = noiseAddInt(x0, one), z1 = noiseAddInt(z0, one);
+    NoiseFloat4 fx = noiseSub(x, noiseToFloat(x0)), fz = noiseSub(z, noiseToFloat(z0));
+    NoiseFloat4 fx1 = noiseSub(fx, noiseSet(1.0f)), fz1 = noiseSub(fz, noiseSet(1.0f));
+
+    NoiseFloat4 n00 = noiseGradient(noiseHash(seeds, x0, z0), fx, fz);
+    NoiseFloat4 n10 = noiseGradient(noiseHash(seeds, x1, z0), fx1, fz);
+    NoiseFloat4 n01 = noiseGradient(noiseHash(seeds, x0, z1), fx, fz1);
+    NoiseFloat4 n11 = noiseGradient(noiseHash(seeds, x1, z1), fx1, fz1);
+
+    NoiseFloat4 u = noiseFade(fx), w = noiseFade(fz);
+    return noiseLerp(noiseLerp(n00, n10, u), noiseLerp(n01, n11, u), w);
+}
+
+// Octaves of gradient noise, each at twice the frequency and half the amplitude of the last
+inline NoiseFloat4 fractalNoise4(NoiseFloat4 x, NoiseFloat4 z, GLuint octaves, uint32_t seed) {
+    NoiseFloat4 sum = noiseSet(0.0f);
+    GLfloat amplitude = 0.5f, frequency = 1.0f;
+    for (GLuint octave = 0; octave < octaves; octave++) {
+        NoiseFloat4 scale = noiseSet(frequency);
+        sum = noiseAdd(sum, noiseMul(gradientNoise4(noiseMul(x, scale), noiseMul(z, scale), seed + octave), noiseSet(amplitude)));
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+    return sum;
+}
+
+// Reference versions, one sample at a time
+
+inline uint32_t noiseHash(uint32_t seed, uint32_t x, uint32_t z) {
+    uint32_t h = seed + x;
+    h += h << 10;
+    h ^= h >> 6;
+    h += z;
+    h += h << 10;
+    h ^= h >> 6;
+    h += h << 3;
+    h ^= h >> 11;
+    return h + (h << 15);
+}
+
+inline GLfloat noiseGradient(uint32_t hash, GLfloat dx, GLfloat dz) {
+    return ((hash & 1) ? -dx : dx) + ((hash & 2) ? -dz : dz);
+}
+
+inline GLfloat noiseFade(GLfloat t) {
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+inline GLfloat gradientNoise(GLfloat x, GLfloat z, uint32_t seed) {
+    GLint x0 = (GLint) std::floor(x), z0 = (GLint) std::floor(z);
+    GLfloat fx = x - (GLfloat) x0, fz = z - (GLfloat) z0;
+    GLfloat n00 = noiseGradient(noiseHash(seed, (uint32_t) x0, (uint32_t) z0), fx, fz);
+    GLfloat n10 = noiseGradient(noiseHash(seed, (uint32_t) x0 + 1, (uint32_t) z0), fx - 1.0f, fz);
+    GLfloat n01 = noiseGradient(noiseHash(seed, (uint32_t) x0, (uint32_t) z0 + 1), fx, fz - 1.0f);
+    GLfloat n11 = noiseGradient(noiseHash(seed, (uint32_t) x0 + 1, (uint32_t) z0 + 1), fx - 1.0f, fz - 1.0f);
+    GLfloat u = noiseFade(fx), w = noiseFade(fz);
+    GLfloat bottom = n00 + u * (n10 - n00), top = n01 + u * (n11 - n01);
+    return bottom + w * (top - bottom);
+}
+
+inline GLfloat fractalNoise(GLfloat x, GLfloat z, GLuint octaves, uint32_t seed) {
+    GLfloat sum = 0.0f, amplitude = 0.5f, frequency = 1.0f;
+    for (GLuint octave = 0; octave < octaves; octave++) {
+        sum += gradientNoise(x * frequency, z * frequency, seed + octave) * amplitude;
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+    return sum;
+}
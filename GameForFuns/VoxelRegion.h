@@ -0,0 +1,212 @@
+//
+//  VoxelRegion.h
+//  GameForFuns
+//
+//  Chunks on disk. A chunk is compressed as runs of equal blocks in storage
+//  order, each a varint length and a block id; terrain is mostly long runs of
+//  air or stone, so a chunk is typically a few hundred bytes against 32 KB of
+//  blocks. Chunks are grouped into region files of REGION_SIZE^3 chunks named
+//  after the region's coordinates. A region file opens with a table giving
+//  each chunk's offset, length and reserved capacity, followed by the
+//  compressed chunks. A chunk that grows past its capacity moves to the end
+//  of the file; the space it leaves is not reused.
+//
+//  A RegionStore may be used from several job threads at once; file access is
+//  serialized by a mutex, while compression runs outside it.
+//
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "VoxelChunk.h"
+
+const GLint REGION_SHIFT = 3;
+const GLint REGION_SIZE = 1 << REGION_SHIFT;    // Chunks along each axis of a region
+const GLuint REGION_CHUNKS = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+const GLuint REGION_VERSION = 1;
+const GLuint REGION_ENTRY_SIZE = 12;            // Offset, length and capacity, 32 bits each
+const GLuint REGION_HEADER_SIZE = 8 + REGION_CHUNKS * REGION_ENTRY_SIZE;
+const GLuint REGION_SLACK = 256;                // Capacity is rounded up to this so small edits rewrite in place
+
+// Appends chunk as runs of (varint length, block id)
+inline void compressChunk(const ChunkStorage &chunk, std::vector<unsigned char> &out) {
+    BlockId blocks[CHUNK_VOLUME];
+    chunk.decode(blocks);
+    for (GLuint i = 0; i < (GLuint) CHUNK_VOLUME;) {
+        GLuint run = 1;
+        while (i + run < (GLuint) CHUNK_VOLUME && blocks[i + run] == blocks[i]) {
+            run++;
+        }
+        for (GLuint length = run; ; length >>= 7) {
+            if (length < 0x80) {
+                out.push_back((unsigned char) length);
+                break;
+            }
+            out.push_back((unsigned char) (length & 0x7F) | 0x80);
+        }
+        out.push_back(blocks[i]);
+        i += run;
+    }
+}
+
+// Fails on data that does not describe exactly one chunk
+inline bool decompressChunk(const unsigned char *data, size_t size, ChunkStorage &chunk) {
+    BlockId blocks[CHUNK_VOLUME];
+    size_t at = 0;
+    GLuint filled = 0;
+    while (at < size) {
+        GLuint run = 0;
+        for (GLuint shift = 0; ; shift += 7) {
+            if (at >= size || shift > 21) {
+                return false;
+            }
+            unsigned char byte = data[at++];
+            run |= (GLuint) (byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+        if (at >= size || run == 0 || run > (GLuint) CHUNK_VOLUME - filled) {
+            return false;
+        }
+        std::memset(blocks + filled, data[at++], run);
+        filled += run;
+    }
+    if (filled != (GLuint) CHUNK_VOLUME) {
+        return false;
+    }
+    chunk.encode(blocks);
+    return true;
+}
+
+class RegionStore {
+public:
+    // Region files go in directory, which is created if missing
+    explicit RegionStore(const std::string &directory) : directory(directory) {
+        mkdir(directory.c_str(), 0755);
+    }
+
+    RegionStore(const RegionStore &) = delete;
+    RegionStore &operator=(const RegionStore &) = delete;
+
+    bool save(const ChunkCoord &coord, const ChunkStorage &chunk) {
+        std::vector<unsigned char> data;
+        compressChunk(chunk, data);
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::string path = this->regionPath(coord);
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        if (!file) {
+            // A new region: magic, version and an empty table
+            std::ofstream create(path, std::ios::binary);
+            std::vector<unsigned char> header(REGION_HEADER_SIZE, 0);
+            std::memcpy(header.data(), "GFFR", 4);
+            std::memcpy(header.data() + 4, &REGION_VERSION, 4);
+            create.write((const char *) header.data(), header.size());
+            create.close();
+            file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        }
+        if (!file || !checkHeader(file)) {
+            std::cout << "ERROR::REGION::COULD_NOT_OPEN " << path << std::endl;
+            return false;
+        }
+
+        uint32_t entry[3];
+        size_t entryOffset = 8 + (size_t) slot(coord) * REGION_ENTRY_SIZE;
+        file.seekg(entryOffset);
+        file.read((char *) entry, sizeof(entry));
+        if (entry[0] == 0 || data.size() > entry[2]) {
+            file.seekp(0, std::ios::end);
+            entry[0] = (uint32_t) file.tellp();
+            entry[2] = (uint32_t) ((data.size() + REGION_SLACK - 1) / REGION_SLACK * REGION_SLACK);
+        }
+        entry[1] = (uint32_t) data.size();
+        file.seekp(entry[0]);
+        file.write((const char *) data.data(), data.size());
+        if (entry[2] > data.size()) {
+            std::vector<char> padding(entry[2] - data.size(), 0);
+            file.write(padding.data(), padding.size());
+        }
+        file.seekp(entryOffset);
+        file.write((const char *) entry, sizeof(entry));
+        this->bytesWritten += data.size();
+        return (bool) file;
+    }
+
+    // Reads a saved chunk into chunk; false if the chunk was never saved
+    bool load(const ChunkCoord &coord, ChunkStorage &chunk) {
+        std::vector<unsigned char> data;
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            path = this->regionPath(coord);
+            std::ifstream file(path, std::ios::binary);
+            if (!file || !checkHeader(file)) {
+                return false;
+            }
+            uint32_t entry[3];
+            file.seekg(8 + (size_t) slot(coord) * REGION_ENTRY_SIZE);
+            if (!file.read((char *) entry, sizeof(entry)) || entry[0] == 0) {
+                return false;
+            }
+            data.resize(entry[1]);
+            file.seekg(entry[0]);
+            if (!file.read((char *) data.data(), data.size())) {
+                std::cout << "ERROR::REGION::TRUNCATED " << path << std::endl;
+                return false;
+            }
+            this->bytesRead += data.size();
+        }
+        if (!decompressChunk(data.data(), data.size(), chunk)) {
+            std::cout << "ERROR::REGION::CORRUPT_CHUNK " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Compressed bytes moved so far
+    void getCounts(size_t &written, size_t &read) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        written = this->bytesWritten;
+        read = this->bytesRead;
+    }
+
+    // The file holding coord's region
+    std::string regionPath(const ChunkCoord &coord) const {
+        return this->directory + "/r." + std::to_string(coord.x >> REGION_SHIFT) + "." + std::to_string(coord.y >> REGION_SHIFT)
+             + "." + std::to_string(coord.z >> REGION_SHIFT) + ".region";
+    }
+
+private:
+    std::string directory;
+    std::mutex mutex;
+    size_t bytesWritten = 0, bytesRead = 0;
+
+    static GLuint slot(const ChunkCoord &coord) {
+        GLuint x = coord.x & (REGION_SIZE - 1), y = coord.y & (REGION_SIZE - 1), z = coord.z & (REGION_SIZE - 1);
+        return (y * REGION_SIZE + z) * REGION_SIZE + x;
+    }
+
+    static bool checkHeader(std::istream &file) {
+        char header[8];
+        uint32_t version;
+        file.seekg(0);
+        if (!file.read(header, sizeof(header)) || std::memcmp(header, "GFFR", 4) != 0) {
+            return false;
+        }
+        std::memcpy(&version, header + 4, sizeof(version));
+        return version == REGION_VERSION;
+    }
+};
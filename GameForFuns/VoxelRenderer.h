@@ -0,0 +1,265 @@
+//
+//  VoxelRenderer.h
+//  GameForFuns
+//
+//  Chunk meshes of a VoxelWorld on the GPU. Each frame update() uploads the
+//  meshes the last batch of jobs built, then takes the chunks edited since
+//  from the world, copies their blocks with a one block border and meshes
+//  them greedily on the job system while the frame goes on. Only edited
+//  chunks are ever remeshed. A chunk that meshes to nothing, or has left the
+//  world, loses its buffers.
+//
+//  Every mesh shares one index buffer of quads, grown to the largest mesh.
+//  Visible chunks are culled into the frame arena and recorded front to back
+//  into command buffers, which the scene replays with the rest of its frame.
+//
+//  A batch's tasks are a fixed pool whose block and vertex buffers persist,
+//  and erased meshes keep their GL objects in spare map nodes for the next
+//  chunk, so remeshing does not allocate. A task's vertices only grow past the
+//  largest mesh it has built, exempt from the frame's allocation count.
+//
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "Profiler.h"
+#include "AllocationTracker.h"
+#include "JobSystem.h"
+#include "GpuResources.h"
+#include "Frustum.h"
+#include "FrameArena.h"
+#include "CommandBuffer.h"
+#include "NodePool.h"
+#include "VoxelWorld.h"
+#include "VoxelMesher.h"
+
+const GLuint VOXEL_MESH_BATCH = 64;          // Chunks meshed per batch of jobs
+const GLuint VOXEL_MESH_RESERVE_QUADS = 2048; // Vertex capacity of each task to start with, in quads
+const GLuint VOXEL_MESH_SPARES = 256;         // Erased meshes whose GL objects are kept for the chunks streamed in next
+
+class VoxelRenderer {
+public:
+    explicit VoxelRenderer(VoxelWorld &world) : world(world), jobs(JobSystem::get()), tasks(VOXEL_MESH_BATCH), meshNodes(VOXEL_MESH_SPARES) {
+        this->indices = BufferHandle::create(GPU_MEMORY_GEOMETRY, "Voxel quad indices");
+        this->dirty.reserve(VOXEL_MESH_BATCH);
+        for (MeshTask &task : this->tasks) {
+            task.padded.resize(CHUNK_PADDED_VOLUME);
+            task.vertices.reserve(VOXEL_MESH_RESERVE_QUADS * 4);
+        }
+    }
+
+    ~VoxelRenderer() {
+        this->jobs.wait(this->counter);
+    }
+
+    VoxelRenderer(const VoxelRenderer &) = delete;
+    VoxelRenderer &operator=(const VoxelRenderer &) = delete;
+
+    // Uploads the finished batch and starts the next; context thread, once per frame
+    void update() {
+        PROFILE_SCOPE("VoxelRenderer::update");
+        if (this->counter.load(std::memory_order_acquire) > 0) {
+            return;
+        }
+        for (GLuint i = 0; i < this->taskCount; i++) {
+            this->upload(this->tasks[i]);
+        }
+        this->taskCount = 0;
+
+        this->dirty.clear();
+        this->world.takeDirty(VOXEL_MESH_BATCH, this->dirty);
+        for (const ChunkCoord &coord : this->dirty) {
+            if (!this->world.getChunk(coord)) {
+                this->eraseMesh(coord);
+                continue;
+            }
+            MeshTask *pending = &this->tasks[this->taskCount++];
+            pending->coord = coord;
+            this->world.gatherPadded(coord, pending->padded.data());
+            this->jobs.run(this->counter, [pending]() {
+                PROFILE_SCOPE("Chunk mesh");
+                AllocationTracker::Exempt growth; // Only a mesh larger than any this task has built allocates
+                pending->vertices.clear();
+                meshChunkGreedy(pending->padded.data(), pending->vertices);
+            });
+        }
+    }
+
+    // Meshes every dirty chunk now, for loading screens and the benchmark
+    void finish() {
+        do {
+            this->jobs.wait(this->counter);
+            this->update();
+        } while (this->taskCount > 0 || this->world.getDirtyCount() > 0);
+    }
+
+    // The GL names and locations the recorded draws refer to
+    struct Bindings {
+        GLuint program;
+        GLuint texture;
+        GLint originLoc; // The shader's vec3 chunk origin
+    };
+
+    // Culls the meshes against the frustum into the frame arena, front to back from eye so early
+    // depth testing rejects what nearer chunks hide, and records them as one group per buffer,
+    // on the job system when it has workers
+    void record(const Frustum &frustum, const glm::vec3 &eye, const Bindings &bindings, CommandBuffer *const *buffers, GLuint bufferCount) {
+        PROFILE_SCOPE("VoxelRenderer::record");
+        ArenaArray<ChunkDraw> draws(FrameArena::get().current(), (GLuint) this->meshes.size());
+        for (const auto &entry : this->meshes) {
+            const ChunkCoord &coord = entry.first;
+            glm::vec3 origin((GLfloat) coord.x * CHUNK_SIZE, (GLfloat) coord.y * CHUNK_SIZE, (GLfloat) coord.z * CHUNK_SIZE);
+            AABB bounds = { origin, origin + glm::vec3((GLfloat) CHUNK_SIZE) };
+            if (!frustum.containsAABB(bounds)) {
+                continue;
+            }
+            ChunkDraw draw = { entry.second.vao, entry.second.quads, origin,
+                               glm::length(origin + glm::vec3(0.5f * CHUNK_SIZE) - eye) };
+            draws.push_back(draw);
+        }
+        std::sort(draws.begin(), draws.end(), [](const ChunkDraw &a, const ChunkDraw &b) {
+            return a.distance < b.distance;
+        });
+
+        const ChunkDraw *list = draws.begin();
+        GLuint drawCount = draws.size();
+        GLuint rangeSize = (drawCount + bufferCount - 1) / bufferCount;
+        auto recordRanges = [&bindings, buffers, list, drawCount, rangeSize](GLuint begin, GLuint end) {
+            PROFILE_SCOPE("Record chunks");
+            for (GLuint range = begin; range < end; range++) {
+                CommandBuffer &buffer = *buffers[range];
+                buffer.reset();
+                GLuint first = range * rangeSize;
+                GLuint last = std::min(drawCount, first + rangeSize);
+                if (first >= last) {
+                    continue;
+                }
+                buffer.begin(makeSortKey(1, bindings.texture, (GLuint) std::min(list[first].distance * 1024.0f, 16777215.0f)));
+                buffer.useProgram(bindings.program);
+                buffer.bindTexture(0, GL_TEXTURE_2D, bindings.texture);
+                for (GLuint i = first; i < last; i++) {
+                    buffer.bindVertexArray(list[i].vao);
+                    buffer.uniform3f(bindings.originLoc, list[i].origin.x, list[i].origin.y, list[i].origin.z);
+                    buffer.drawElements(GL_TRIANGLES, list[i].quads * 6, GL_UNSIGNED_INT, 0);
+                }
+            }
+        };
+        if (this->jobs.getThreadCount() == 1) {
+            recordRanges(0, bufferCount); // Waiting here would run the queued meshing jobs on this thread
+        } else {
+            this->jobs.parallelForWait(bufferCount, 1, recordRanges);
+        }
+    }
+
+    size_t getMeshCount() const {
+        return this->meshes.size();
+    }
+
+    GLuint getQuadCount() const {
+        GLuint quads = 0;
+        for (const auto &entry : this->meshes) {
+            quads += entry.second.quads;
+        }
+        return quads;
+    }
+
+private:
+    struct ChunkMesh {
+        VertexArrayHandle vao;
+        BufferHandle vertices;
+        GLuint quads = 0;
+    };
+
+    struct ChunkDraw {
+        GLuint vao;
+        GLuint quads;
+        glm::vec3 origin;
+        GLfloat distance; // From the eye to the chunk's center
+    };
+
+    struct MeshTask {
+        ChunkCoord coord;
+        std::vector<BlockId> padded;          // CHUNK_PADDED_VOLUME blocks
+        std::vector<VoxelVertex> vertices;
+    };
+
+    typedef std::unordered_map<ChunkCoord, ChunkMesh, ChunkCoordHash> MeshMap;
+
+    VoxelWorld &world;
+    JobSystem &jobs;
+    JobCounter counter{0};
+    std::vector<MeshTask> tasks;              // VOXEL_MESH_BATCH of them, the first taskCount in flight
+    GLuint taskCount = 0;
+    std::vector<ChunkCoord> dirty;            // Scratch of update
+    MeshMap meshes;
+    NodePool<MeshMap> meshNodes;              // Spare nodes keep their vertex array and buffer
+    BufferHandle indices;
+    GLuint indexQuads = 0;
+
+    void eraseMesh(const ChunkCoord &coord) {
+        auto found = this->meshes.find(coord);
+        if (found == this->meshes.end()) {
+            return;
+        }
+        if (this->meshNodes.isFull()) {
+            AllocationTracker::get().allowFrame(); // Its GL objects are released, which queues them in the registry
+        }
+        this->meshNodes.erase(this->meshes, found);
+    }
+
+    void upload(const MeshTask &task) {
+        GLuint quads = (GLuint) task.vertices.size() / 4;
+        if (quads == 0 || !this->world.getChunk(task.coord)) {
+            this->eraseMesh(task.coord);
+            return;
+        }
+        this->reserveIndices(quads);
+
+        ChunkMesh &mesh = this->meshNodes.entry(this->meshes, task.coord);
+        if (mesh.vao == 0) {
+            mesh.vao = VertexArrayHandle::create(GPU_MEMORY_GEOMETRY, "Voxel chunk");
+            mesh.vertices = BufferHandle::create(GPU_MEMORY_GEOMETRY, "Voxel chunk vertices");
+            glBindVertexArray(mesh.vao);
+            glBindBuffer(GL_ARRAY_BUFFER, mesh.vertices);
+            glEnableVertexAttribArray(0);
+            glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(VoxelVertex), (GLvoid *) 0);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indices);
+            glBindVertexArray(0);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertices);
+        glBufferData(GL_ARRAY_BUFFER, task.vertices.size() * sizeof(VoxelVertex), task.vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        mesh.vertices.setSize(task.vertices.size() * sizeof(VoxelVertex));
+        mesh.quads = quads;
+    }
+
+    // Grows the shared quad index buffer to cover quads, keeping the binding of every mesh's VAO
+    void reserveIndices(GLuint quads) {
+        if (quads <= this->indexQuads) {
+            return;
+        }
+        GLuint capacity = std::max(quads, this->indexQuads * 2);
+        size_t bytes = (size_t) capacity * 6 * sizeof(GLuint);
+        // Respecifying the store keeps the buffer name, so the VAOs need no rebinding. Written mapped, without a copy on the heap
+        glBindVertexArray(0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indices);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, bytes, nullptr, GL_STATIC_DRAW);
+        GLuint *out = (GLuint *) glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        for (GLuint quad = 0; quad < capacity; quad++, out += 6) {
+            GLuint base = quad * 4;
+            out[0] = base; out[1] = base + 1; out[2] = base + 2;
+            out[3] = base; out[4] = base + 2; out[5] = base + 3;
+        }
+        glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        this->indices.setSize(bytes);
+        this->indexQuads = capacity;
+    }
+};
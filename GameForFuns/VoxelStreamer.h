@@ -0,0 +1,386 @@
+//
+//  VoxelStreamer.h
+//  GameForFuns
+//
+//  An endless block world streamed around the camera. Every frame update()
+//  looks at the columns of chunks within radius of the camera's chunk and
+//  starts a job for each missing one, nearest first: the job reads the chunk
+//  back from the region files if it was ever saved, and otherwise generates
+//  it from the seed. Finished chunks join the world a few per frame, so the
+//  renderer's remeshing stays spread out.
+//
+//  Chunks that fall outside the radius stay resident while they fit the
+//  memory budget, so turning back costs nothing; past the budget the
+//  farthest are taken out of the world and saved by a job. A chunk is not
+//  loaded again until its save has finished.
+//
+//  Tasks, chunk storage and the nodes of the sets tracking them are pooled,
+//  and the storage of saved or discarded chunks goes back to its pool, so a
+//  world at its budget streams without allocating. Only growing allocates:
+//  more chunks, or more tasks in flight, than ever before, which the frame
+//  declares with AllocationTracker::allowFrame. The jobs read and write
+//  region files through fstreams, exempt from the frame's count.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "Profiler.h"
+#include "AllocationTracker.h"
+#include "JobSystem.h"
+#include "NodePool.h"
+#include "VoxelChunk.h"
+#include "VoxelWorld.h"
+#include "VoxelNoise.h"
+#include "VoxelRegion.h"
+
+const GLuint TERRAIN_OCTAVES = 5;
+const GLfloat TERRAIN_FREQUENCY = 1.0f / 160.0f; // Of the first octave, per block
+const GLfloat TERRAIN_BASE = -12.0f;             // Surface height where the noise is zero
+const GLfloat TERRAIN_AMPLITUDE = 64.0f;         // Fractal noise stays within about +-0.5 of this
+const GLuint VOXEL_STREAM_JOBS = 32;             // Loads in flight at most
+const GLuint VOXEL_STREAM_INSERTS = 8;           // Finished chunks added to the world per frame
+const size_t VOXEL_STREAM_BUDGET = 64 * 1024 * 1024; // Default chunk memory before chunks outside the radius are evicted
+const uint32_t VOXEL_WORLD_SEED = 20161009;
+
+// Surface heights of the CHUNK_SIZE^2 columns of a chunk, x fastest, four columns per noise call
+inline void generateHeights(GLint chunkX, GLint chunkZ, uint32_t seed, GLint *heights) {
+    const GLfloat offsets[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    NoiseFloat4 step = noiseLoad(offsets);
+    for (GLint z = 0; z < CHUNK_SIZE; z++) {
+        NoiseFloat4 wz = noiseSet((GLfloat) (chunkZ * CHUNK_SIZE + z) * TERRAIN_FREQUENCY);
+        for (GLint x = 0; x < CHUNK_SIZE; x += 4) {
+            NoiseFloat4 wx = noiseMul(noiseAdd(noiseSet((GLfloat) (chunkX * CHUNK_SIZE + x)), step), noiseSet(TERRAIN_FREQUENCY));
+            GLfloat samples[4];
+            noiseStore(samples, fractalNoise4(wx, wz, TERRAIN_OCTAVES, seed));
+            for (GLint i = 0; i < 4; i++) {
+                heights[z * CHUNK_SIZE + x + i] = (GLint) std::floor(TERRAIN_BASE + samples[i] * TERRAIN_AMPLITUDE);
+            }
+        }
+    }
+}
+
+// Fills chunk with the terrain at coord: container blocks below the surface, grass on it, air above
+inline void generateChunk(const ChunkCoord &coord, uint32_t seed, ChunkStorage &chunk) {
+    GLint heights[CHUNK_SIZE * CHUNK_SIZE];
+    generateHeights(coord.x, coord.z, seed, heights);
+    GLint lowest = *std::min_element(heights, heights + CHUNK_SIZE * CHUNK_SIZE);
+    GLint highest = *std::max_element(heights, heights + CHUNK_SIZE * CHUNK_SIZE);
+    GLint bottom = coord.y * CHUNK_SIZE, top = bottom + CHUNK_SIZE - 1;
+    if (bottom > highest) {
+        chunk.fill(BLOCK_AIR);
+        return;
+    }
+    if (top < lowest) {
+        chunk.fill(BLOCK_CONTAINER);
+        return;
+    }
+
+    BlockId blocks[CHUNK_VOLUME];
+    for (GLint y = 0; y < CHUNK_SIZE; y++) {
+        BlockId *layer = blocks + ChunkStorage::index(0, y, 0);
+        for (GLint column = 0; column < CHUNK_SIZE * CHUNK_SIZE; column++) {
+            GLint height = heights[column] - bottom;
+            layer[column] = y > height ? BLOCK_AIR : y == height ? BLOCK_GRASS : BLOCK_CONTAINER;
+        }
+    }
+    chunk.encode(blocks);
+}
+
+struct VoxelStreamingStats {
+    GLuint generated = 0;
+    GLuint loaded = 0;    // Read back from region files
+    GLuint evicted = 0;
+    GLuint discarded = 0; // Finished after the camera had moved away
+    size_t residentBytes = 0;
+    size_t peakBytes = 0;
+};
+
+class VoxelStreamer {
+public:
+    // Keeps chunk columns within radius chunks of the camera resident, from chunk layer minY to maxY
+    VoxelStreamer(VoxelWorld &world, RegionStore &regions, uint32_t seed, GLint radius, GLint minY, GLint maxY, size_t budgetBytes):
+        world(world), regions(regions), jobs(JobSystem::get()), seed(seed), radius(radius), minY(minY), maxY(maxY), budget(budgetBytes),
+        coordNodes(spareCount(radius, minY, maxY)) {
+        size_t area = (size_t) (2 * radius + 1) * (2 * radius + 1) * (maxY - minY + 1);
+        size_t spares = spareCount(radius, minY, maxY);
+        this->missing.reserve(area);
+        this->outside.reserve(area);
+        this->tasks.reserve(spares);
+        this->freeTasks.reserve(spares);
+        this->spareChunks.reserve(spares);
+        this->loading.reserve(spares);
+        this->saving.reserve(spares);
+        for (size_t i = 0; i < spares; i++) {
+            this->freeTasks.emplace_back(new StreamTask());
+            this->spareChunks.emplace_back(new ChunkStorage());
+            this->loading.insert({ (GLint) i, 0, 0 });
+        }
+        while (!this->loading.empty()) {
+            this->coordNodes.erase(this->loading, this->loading.begin()); // Leaves the nodes spare
+        }
+    }
+
+    ~VoxelStreamer() {
+        this->flush();
+    }
+
+    VoxelStreamer(const VoxelStreamer &) = delete;
+    VoxelStreamer &operator=(const VoxelStreamer &) = delete;
+
+    void update(const glm::vec3 &position) {
+        PROFILE_SCOPE("VoxelStreamer::update");
+        ChunkCoord center = chunkOf((GLint) std::floor(position.x), (GLint) std::floor(position.y), (GLint) std::floor(position.z));
+        if (center.x != this->center.x || center.z != this->center.z) {
+            this->complete = false;
+        }
+        this->center = center;
+
+        if (this->jobs.getThreadCount() == 1) {
+            for (GLuint i = 0; i < VOXEL_STREAM_INSERTS && this->jobs.runPending(); i++) {
+                // No workers, stream a few chunks per frame here
+            }
+        }
+        this->collect(VOXEL_STREAM_INSERTS);
+        this->evict();
+        if (!this->complete) {
+            this->schedule();
+        }
+    }
+
+    // Streams in every chunk within the radius of position now, for loading screens and the benchmark
+    void finish(const glm::vec3 &position) {
+        do {
+            this->jobs.wait(this->counter);
+            this->update(position);
+        } while (!this->isComplete());
+    }
+
+    // Waits for every job and saves the resident chunks, leaving them in the world
+    void flush() {
+        this->jobs.wait(this->counter);
+        this->collect(0);
+        for (const auto &entry : this->world.getChunks()) {
+            this->regions.save(entry.first, *entry.second);
+        }
+    }
+
+    // True once every chunk within the radius is resident
+    bool isComplete() const {
+        return this->complete && this->loading.empty();
+    }
+
+    const VoxelStreamingStats &getStats() const {
+        return this->stats;
+    }
+
+    void setBudget(size_t budgetBytes) {
+        this->budget = budgetBytes;
+    }
+
+private:
+    struct StreamTask {
+        ChunkCoord coord;
+        std::unique_ptr<ChunkStorage> chunk;
+        bool save = false;   // Otherwise a load, or a generation if the chunk was never saved
+        bool loaded = false;
+        std::atomic<bool> done{false};
+    };
+
+    VoxelWorld &world;
+    RegionStore &regions;
+    JobSystem &jobs;
+    uint32_t seed;
+    GLint radius, minY, maxY;
+    size_t budget;
+    ChunkCoord center = { 0, 0, 0 };
+    bool complete = false;
+
+    JobCounter counter{0};
+    std::vector<std::unique_ptr<StreamTask>> tasks; // In flight
+    std::vector<std::unique_ptr<StreamTask>> freeTasks;
+    std::vector<std::unique_ptr<ChunkStorage>> spareChunks;
+    ChunkCoordSet loading, saving;
+    NodePool<ChunkCoordSet> coordNodes;
+    std::vector<std::pair<GLint, ChunkCoord>> outside, missing; // Scratch of evict and schedule
+    VoxelStreamingStats stats;
+
+    GLint distance(const ChunkCoord &coord) const {
+        return std::max(std::abs(coord.x - this->center.x), std::abs(coord.z - this->center.z));
+    }
+
+    // Adds up to inserts finished chunks to the world, 0 for none, and retires finished saves
+    void collect(GLuint inserts) {
+        for (size_t i = 0; i < this->tasks.size();) {
+            StreamTask &task = *this->tasks[i];
+            if (!task.done.load(std::memory_order_acquire)) {
+                i++;
+                continue;
+            }
+            if (task.save) {
+                this->coordNodes.erase(this->saving, task.coord);
+            } else {
+                if (this->distance(task.coord) > this->radius) {
+                    // Regenerated or reloaded if the camera comes back
+                    this->stats.discarded++;
+                } else if (inserts > 0) {
+                    inserts--;
+                    task.loaded ? this->stats.loaded++ : this->stats.generated++;
+                    this->world.insertChunk(task.coord, std::move(task.chunk));
+                } else {
+                    i++;
+                    continue;
+                }
+                this->coordNodes.erase(this->loading, task.coord);
+            }
+            std::unique_ptr<StreamTask> finished = std::move(this->tasks[i]);
+            this->tasks[i] = std::move(this->tasks.back());
+            this->tasks.pop_back();
+            this->recycle(std::move(finished));
+        }
+    }
+
+    // Tasks, chunks and set nodes kept for reuse, of each: a diagonal step across a chunk boundary
+    // brings in two rows of columns and drops two, and the loads in flight hold theirs meanwhile
+    static size_t spareCount(GLint radius, GLint minY, GLint maxY) {
+        return (size_t) 2 * (2 * radius + 1) * (maxY - minY + 1) + VOXEL_STREAM_JOBS;
+    }
+
+    // A pooled task, or a new one when more are in flight than ever before
+    std::unique_ptr<StreamTask> acquireTask() {
+        if (this->freeTasks.empty()) {
+            AllocationTracker::get().allowFrame();
+            return std::unique_ptr<StreamTask>(new StreamTask());
+        }
+        std::unique_ptr<StreamTask> task = std::move(this->freeTasks.back());
+        this->freeTasks.pop_back();
+        return task;
+    }
+
+    // Pooled storage for a chunk to load, or new storage when the world grows past its largest yet
+    std::unique_ptr<ChunkStorage> acquireChunk() {
+        if (this->spareChunks.empty()) {
+            AllocationTracker::get().allowFrame();
+            return std::unique_ptr<ChunkStorage>(new ChunkStorage());
+        }
+        std::unique_ptr<ChunkStorage> chunk = std::move(this->spareChunks.back());
+        this->spareChunks.pop_back();
+        return chunk;
+    }
+
+    // Returns a finished task, and the chunk it saved or discarded, to their pools while they have room
+    void recycle(std::unique_ptr<StreamTask> task) {
+        if (task->chunk && this->spareChunks.size() < this->spareChunks.capacity()) {
+            this->spareChunks.push_back(std::move(task->chunk));
+        }
+        task->chunk.reset();
+        task->save = false;
+        task->loaded = false;
+        task->done.store(false, std::memory_order_relaxed);
+        if (this->freeTasks.size() < this->freeTasks.capacity()) {
+            this->freeTasks.push_back(std::move(task));
+        }
+    }
+
+    // Saves and drops the farthest chunks outside the radius until the world fits the budget
+    void evict() {
+        if (this->outside.capacity() < this->world.getChunkCount()) {
+            AllocationTracker::get().allowFrame(); // Only when the world grows past its largest yet
+            this->outside.reserve(this->world.getChunkCount() * 2);
+        }
+        size_t bytes = 0;
+        this->outside.clear();
+        for (const auto &entry : this->world.getChunks()) {
+            bytes += entry.second->getMemoryBytes();
+            GLint d = this->distance(entry.first);
+            if (d > this->radius) {
+                this->outside.push_back(std::make_pair(d, entry.first));
+            }
+        }
+        std::sort(this->outside.begin(), this->outside.end(), [](const std::pair<GLint, ChunkCoord> &a, const std::pair<GLint, ChunkCoord> &b) {
+            return a.first > b.first;
+        });
+        for (size_t i = 0; i < this->outside.size() && bytes > this->budget; i++) {
+            std::unique_ptr<StreamTask> task = this->acquireTask();
+            task->coord = this->outside[i].second;
+            task->chunk = this->world.removeChunk(task->coord);
+            task->save = true;
+            bytes -= task->chunk->getMemoryBytes();
+            this->coordNodes.insert(this->saving, task->coord);
+            this->start(std::move(task));
+            this->stats.evicted++;
+        }
+        this->stats.residentBytes = bytes;
+        this->stats.peakBytes = std::max(this->stats.peakBytes, bytes);
+    }
+
+    // Starts loads for the nearest missing chunks, up to VOXEL_STREAM_JOBS in flight
+    void schedule() {
+        if (this->loading.size() >= VOXEL_STREAM_JOBS) {
+            return;
+        }
+        this->missing.clear();
+        bool blocked = false;
+        for (GLint z = -this->radius; z <= this->radius; z++) {
+            for (GLint x = -this->radius; x <= this->radius; x++) {
+                for (GLint y = this->minY; y <= this->maxY; y++) {
+                    ChunkCoord coord = { this->center.x + x, y, this->center.z + z };
+                    if (this->world.getChunk(coord) || this->loading.count(coord)) {
+                        continue;
+                    }
+                    if (this->saving.count(coord)) {
+                        blocked = true;
+                        continue;
+                    }
+                    this->missing.push_back(std::make_pair(x * x + z * z, coord));
+                }
+            }
+        }
+        this->complete = this->missing.empty() && !blocked;
+
+        size_t count = std::min(this->missing.size(), (size_t) VOXEL_STREAM_JOBS - this->loading.size());
+        std::partial_sort(this->missing.begin(), this->missing.begin() + count, this->missing.end(),
+                          [](const std::pair<GLint, ChunkCoord> &a, const std::pair<GLint, ChunkCoord> &b) {
+            return a.first < b.first;
+        });
+        for (size_t i = 0; i < count; i++) {
+            std::unique_ptr<StreamTask> task = this->acquireTask();
+            task->coord = this->missing[i].second;
+            task->chunk = this->acquireChunk();
+            this->coordNodes.insert(this->loading, task->coord);
+            this->start(std::move(task));
+        }
+    }
+
+    void start(std::unique_ptr<StreamTask> task) {
+        StreamTask *pending = task.get();
+        VoxelStreamer *streamer = this;
+        if (this->tasks.size() == this->tasks.capacity()) {
+            AllocationTracker::get().allowFrame(); // More in flight than ever before
+        }
+        this->tasks.push_back(std::move(task));
+        this->jobs.run(this->counter, [streamer, pending]() {
+            AllocationTracker::Exempt exempt; // Region files go through fstreams
+            if (pending->save) {
+                PROFILE_SCOPE("Chunk save");
+                streamer->regions.save(pending->coord, *pending->chunk);
+            } else {
+                PROFILE_SCOPE("Chunk load");
+                pending->loaded = streamer->regions.load(pending->coord, *pending->chunk);
+                if (!pending->loaded) {
+                    generateChunk(pending->coord, streamer->seed, *pending->chunk);
+                }
+            }
+            pending->done.store(true, std::memory_order_release);
+        });
+    }
+};
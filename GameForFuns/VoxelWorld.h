@@ -0,0 +1,193 @@
+//
+//  VoxelWorld.h
+//  GameForFuns
+//
+//  The block world as a hash map of palette encoded chunks. Blocks outside any
+//  chunk read as air. Every change marks the chunks whose meshes it affects as
+//  dirty: the edited chunk, and a neighbour when the block lies on the face
+//  they share, since that neighbour's border faces may appear or vanish. The
+//  renderer drains the dirty set to remesh only those chunks. Both the chunk
+//  map and the dirty set insert into the nodes of erased entries, so chunks
+//  streaming in and out at a steady count do not allocate.
+//
+//  Not thread safe; it is edited and read on the main thread, and meshing jobs
+//  work on copies made by gatherPadded.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "AllocationTracker.h"
+#include "NodePool.h"
+#include "VoxelChunk.h"
+
+// Side of the block array a chunk is meshed from: the chunk and a one block border of its neighbours
+const GLint CHUNK_PADDED_SIZE = CHUNK_SIZE + 2;
+const GLint CHUNK_PADDED_VOLUME = CHUNK_PADDED_SIZE * CHUNK_PADDED_SIZE * CHUNK_PADDED_SIZE;
+const GLuint VOXEL_SPARE_NODES = 1024; // Erased nodes the chunk map and the dirty set each keep for reuse
+
+// Offset of (x, y, z) in a padded array, each coordinate from -1 to CHUNK_SIZE
+inline GLuint paddedIndex(GLint x, GLint y, GLint z) {
+    return ((GLuint) (y + 1) * CHUNK_PADDED_SIZE + (GLuint) (z + 1)) * CHUNK_PADDED_SIZE + (GLuint) (x + 1);
+}
+
+typedef std::unordered_map<ChunkCoord, std::unique_ptr<ChunkStorage>, ChunkCoordHash> ChunkMap;
+typedef std::unordered_set<ChunkCoord, ChunkCoordHash> ChunkCoordSet;
+
+class VoxelWorld {
+public:
+    VoxelWorld() : chunkNodes(VOXEL_SPARE_NODES), dirtyNodes(VOXEL_SPARE_NODES) {}
+
+    BlockId getBlock(GLint x, GLint y, GLint z) const {
+        const ChunkStorage *chunk = this->getChunk(chunkOf(x, y, z));
+        return chunk ? chunk->get(chunkLocal(x), chunkLocal(y), chunkLocal(z)) : BLOCK_AIR;
+    }
+
+    // Sets a block, creating its chunk if needed, and marks the meshes it touches dirty
+    void setBlock(GLint x, GLint y, GLint z, BlockId block) {
+        ChunkCoord coord = chunkOf(x, y, z);
+        ChunkStorage *chunk = this->getChunk(coord);
+        if (!chunk) {
+            if (block == BLOCK_AIR) {
+                return;
+            }
+            chunk = &this->createChunk(coord);
+        }
+        GLint lx = chunkLocal(x), ly = chunkLocal(y), lz = chunkLocal(z);
+        if (chunk->get(lx, ly, lz) == block) {
+            return;
+        }
+        const std::vector<BlockId> &palette = chunk->getPalette();
+        if (std::find(palette.begin(), palette.end(), block) == palette.end()) {
+            AllocationTracker::get().allowFrame(); // The chunk's palette grows, and may widen its indices
+        }
+        chunk->set(lx, ly, lz, block);
+
+        this->markDirty(coord);
+        if (lx == 0) this->markDirty({ coord.x - 1, coord.y, coord.z });
+        if (lx == CHUNK_SIZE - 1) this->markDirty({ coord.x + 1, coord.y, coord.z });
+        if (ly == 0) this->markDirty({ coord.x, coord.y - 1, coord.z });
+        if (ly == CHUNK_SIZE - 1) this->markDirty({ coord.x, coord.y + 1, coord.z });
+        if (lz == 0) this->markDirty({ coord.x, coord.y, coord.z - 1 });
+        if (lz == CHUNK_SIZE - 1) this->markDirty({ coord.x, coord.y, coord.z + 1 });
+    }
+
+    ChunkStorage *getChunk(const ChunkCoord &coord) {
+        auto found = this->chunks.find(coord);
+        return found != this->chunks.end() ? found->second.get() : nullptr;
+    }
+
+    const ChunkStorage *getChunk(const ChunkCoord &coord) const {
+        auto found = this->chunks.find(coord);
+        return found != this->chunks.end() ? found->second.get() : nullptr;
+    }
+
+    // An all-air chunk at coord, or the one already there
+    ChunkStorage &createChunk(const ChunkCoord &coord) {
+        std::unique_ptr<ChunkStorage> &chunk = this->chunkNodes.entry(this->chunks, coord);
+        if (!chunk) {
+            AllocationTracker::get().allowFrame(); // The world grows by a chunk
+            chunk.reset(new ChunkStorage());
+        }
+        return *chunk;
+    }
+
+    // Adds or replaces a whole chunk; it and its six neighbours need meshing
+    void insertChunk(const ChunkCoord &coord, std::unique_ptr<ChunkStorage> chunk) {
+        this->chunkNodes.entry(this->chunks, coord) = std::move(chunk);
+        this->markWithNeighbours(coord);
+    }
+
+    // Drops a chunk; the renderer frees its mesh when it finds the coord dirty and the chunk gone
+    std::unique_ptr<ChunkStorage> removeChunk(const ChunkCoord &coord) {
+        std::unique_ptr<ChunkStorage> chunk;
+        auto found = this->chunks.find(coord);
+        if (found != this->chunks.end()) {
+            chunk = std::move(found->second);
+            this->chunkNodes.erase(this->chunks, found);
+            this->markWithNeighbours(coord);
+        }
+        return chunk;
+    }
+
+    // Moves up to limit dirty chunks into out
+    void takeDirty(GLuint limit, std::vector<ChunkCoord> &out) {
+        while (limit-- > 0 && !this->dirty.empty()) {
+            out.push_back(*this->dirty.begin());
+            this->dirtyNodes.erase(this->dirty, this->dirty.begin());
+        }
+    }
+
+    size_t getDirtyCount() const {
+        return this->dirty.size();
+    }
+
+    // Copies a chunk and the neighbouring blocks across its six faces into a
+    // CHUNK_PADDED_VOLUME array; edges and corners of the border are left as air
+    void gatherPadded(const ChunkCoord &coord, BlockId *padded) const {
+        std::memset(padded, BLOCK_AIR, CHUNK_PADDED_VOLUME);
+        const ChunkStorage *chunk = this->getChunk(coord);
+        if (chunk) {
+            BlockId blocks[CHUNK_VOLUME];
+            chunk->decode(blocks);
+            for (GLint y = 0; y < CHUNK_SIZE; y++) {
+                for (GLint z = 0; z < CHUNK_SIZE; z++) {
+                    std::memcpy(padded + paddedIndex(0, y, z), blocks + ChunkStorage::index(0, y, z), CHUNK_SIZE);
+                }
+            }
+        }
+
+        const GLint last = CHUNK_SIZE - 1;
+        const ChunkStorage *neighbours[6] = {
+            this->getChunk({ coord.x - 1, coord.y, coord.z }), this->getChunk({ coord.x + 1, coord.y, coord.z }),
+            this->getChunk({ coord.x, coord.y - 1, coord.z }), this->getChunk({ coord.x, coord.y + 1, coord.z }),
+            this->getChunk({ coord.x, coord.y, coord.z - 1 }), this->getChunk({ coord.x, coord.y, coord.z + 1 })
+        };
+        for (GLint a = 0; a < CHUNK_SIZE; a++) {
+            for (GLint b = 0; b < CHUNK_SIZE; b++) {
+                if (neighbours[0]) padded[paddedIndex(-1, a, b)] = neighbours[0]->get(last, a, b);
+                if (neighbours[1]) padded[paddedIndex(CHUNK_SIZE, a, b)] = neighbours[1]->get(0, a, b);
+                if (neighbours[2]) padded[paddedIndex(a, -1, b)] = neighbours[2]->get(a, last, b);
+                if (neighbours[3]) padded[paddedIndex(a, CHUNK_SIZE, b)] = neighbours[3]->get(a, 0, b);
+                if (neighbours[4]) padded[paddedIndex(a, b, -1)] = neighbours[4]->get(a, b, last);
+                if (neighbours[5]) padded[paddedIndex(a, b, CHUNK_SIZE)] = neighbours[5]->get(a, b, 0);
+            }
+        }
+    }
+
+    size_t getChunkCount() const {
+        return this->chunks.size();
+    }
+
+    const ChunkMap &getChunks() const {
+        return this->chunks;
+    }
+
+private:
+    ChunkMap chunks;
+    ChunkCoordSet dirty;
+    NodePool<ChunkMap> chunkNodes;
+    NodePool<ChunkCoordSet> dirtyNodes;
+
+    void markDirty(const ChunkCoord &coord) {
+        this->dirtyNodes.insert(this->dirty, coord);
+    }
+
+    void markWithNeighbours(const ChunkCoord &coord) {
+        this->markDirty(coord);
+        this->markDirty({ coord.x - 1, coord.y, coord.z });
+        this->markDirty({ coord.x + 1, coord.y, coord.z });
+        this->markDirty({ coord.x, coord.y - 1, coord.z });
+        this->markDirty({ coord.x, coord.y + 1, coord.z });
+        this->markDirty({ coord.x, coord.y, coord.z - 1 });
+        this->markDirty({ coord.x, coord.y, coord.z + 1 });
+    }
+};
@@ -15,26 +15,58 @@
 #include <glm/gtc/type_ptr.hpp>
 
 // Other includes
+// The tracker comes first: other headers include it too, and only the first inclusion compiles the counting operator new
+#define ALLOCATION_TRACKER_IMPLEMENTATION
+#include "AllocationTracker.h"
+
 #include "Shader.h"
 #include "Camera.h"
 #include "Model.h"
 
 #include "Texture.h"
-
+#include "Profiler.h"
+#include "Scenes.h"
+#include "Benchmark.h"
+#include "JobSystemBenchmark.h"
+#include "ImportBenchmark.h"
+#include "VoxelBenchmark.h"
+#include "BroadphaseBenchmark.h"
+#include "EntitiesBenchmark.h"
+#include "FixedTimestep.h"
+#include "FrameArena.h"
+#include "TextureResidency.h"
+#include "VirtualTexture.h"
+#include "AsyncTextureLoader.h"
+#include "Skybox.h"
+#include "ParticleSystem.h"
+#include "HdrPipeline.h"
+#include "PostProcess.h"
+#include "DynamicResolution.h"
+#include "RenderGraph.h"
 
 // Window dimensions
 const GLuint WIDTH = 1200, HEIGHT = 800;
+const GLuint FOUNTAIN_PARTICLES = 1 << 18;
+const GLuint FOUNTAIN_FIELD_SIZE = 64;   // Blocks along each side of the heightfield the fountain bounces off
 int SCREEN_WIDTH, SCREEN_HEIGHT;
 
 void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mode);
 void MouseCallback(GLFWwindow *window, double xPos, double yPos);
-void DoMovement();
+void MouseButtonCallback(GLFWwindow *window, int button, int action, int mods);
+void DoMovement(GLfloat stepTime, const VoxelWorld &world);
+void EditBlocks(VoxelWorld &world);
 
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
 GLfloat lastX = WIDTH / 2.0f;
 GLfloat lastY = WIDTH / 2.0f;
 bool keys[1024];
 bool firstMouse = true;
+bool breakBlock = false; // Clicked since the last frame, applied to the block under the crosshair
+bool placeBlock = false;
+bool showProfiler = false;
+bool recordingPath = false;
+GLfloat recordingStart = 0.0f;
+CameraPath recordedPath;
 
 GLfloat deltaTime = 0.0f;
 GLfloat lastFrame = 0.0f;
@@ -42,7 +74,97 @@ GLfloat lastFrame = 0.0f;
 glm::vec3 lightPos(1.2f, 1.0f, -2.0f);
 
 // The MAIN function, from here we start the application and run the game loop
-int main() {
+int main(int argc, char **argv) {
+    BenchmarkOptions benchmarkOptions;
+    bool benchmark = Benchmark::parseOptions(argc, argv, benchmarkOptions);
+    bool vsync = true;
+    bool residencySim = false;
+    bool particleCheck = false;
+    bool hdrCheck = false;
+    size_t chunkBudget = VOXEL_STREAM_BUDGET;
+    std::string residencyTrace;
+    std::string gradingLut;
+    ResolutionSettings resolutionSettings;
+    
+    if (benchmarkOptions.jobScaling) {
+        return benchmarkJobScaling(benchmarkOptions);
+    }
+    if (benchmarkOptions.objComparison) {
+        return benchmarkObjComparison(benchmarkOptions);
+    }
+    if (benchmarkOptions.importScaling) {
+        return benchmarkImportScaling(benchmarkOptions);
+    }
+    if (benchmarkOptions.voxelMeshing) {
+        return benchmarkVoxelMeshing(benchmarkOptions);
+    }
+    if (benchmarkOptions.voxelStreaming) {
+        return benchmarkVoxelStreaming(benchmarkOptions);
+    }
+    if (benchmarkOptions.broadphase) {
+        return benchmarkBroadphase(benchmarkOptions);
+    }
+    if (benchmarkOptions.entities) {
+        return benchmarkEntities(benchmarkOptions);
+    }
+    
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--determinism-check") {
+            return checkDeterminism() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (arg == "--collision-check") {
+            return checkVoxelCollision() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (arg == "--virtual-texture-check") {
+            return checkVirtualTexturing() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (arg == "--post-check") {
+            return checkPostProcess() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (arg == "--command-buffer-check") {
+            return checkCommandBuffers() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (arg == "--render-graph-check") {
+            return checkRenderGraph() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (arg == "--resolution-check") {
+            return checkDynamicResolution() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (arg == "--particle-check") {
+            particleCheck = true; // Needs a context, so runs once GL is up
+        }
+        if (arg == "--hdr-check") {
+            hdrCheck = true;
+        }
+        if (arg == "--novsync") {
+            vsync = false;
+        }
+        if (arg == "--texture-budget-mb" && i + 1 < argc) {
+            TextureResidency::get().setBudget((size_t) std::strtoul(argv[++i], nullptr, 10) * 1024 * 1024);
+        }
+        if (arg == "--frame-budget-ms" && i + 1 < argc) {
+            resolutionSettings.budgetMs = std::strtof(argv[++i], nullptr); // 0 keeps the full resolution
+        }
+        if (arg == "--grading-lut" && i + 1 < argc) {
+            gradingLut = argv[++i];
+        }
+        if (arg == "--chunk-budget-mb" && i + 1 < argc) {
+            chunkBudget = (size_t) std::strtoul(argv[++i], nullptr, 10) * 1024 * 1024;
+        }
+        if (arg == "--residency-sim") {
+            residencySim = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                residencyTrace = argv[++i];
+            }
+        }
+    }
+    
+    // Replays a texture access trace against the budget, no window needed
+    if (residencySim) {
+        return simulateResidency(residencyTrace, TextureResidency::get().getBudget()) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    
     // Init GLFW
     glfwInit();
     
@@ -54,6 +176,11 @@ int main() {
     
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
     
+    // The benchmark and the particle and HDR checks render to a hidden window
+    if (benchmark || particleCheck || hdrCheck) {
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    }
+    
     // Create a GLFWwindow object that we can use for GLFW's functions
     GLFWwindow *window = glfwCreateWindow(WIDTH, HEIGHT, "Game for funs", nullptr, nullptr);
     
@@ -65,11 +192,13 @@ int main() {
     }
     
     glfwMakeContextCurrent( window );
+    glfwSwapInterval( vsync ? 1 : 0 ); // Simulation runs at a fixed rate either way
     
     glfwGetFramebufferSize(window, &SCREEN_WIDTH, &SCREEN_HEIGHT);
     
     glfwSetKeyCallback(window, KeyCallback);
     glfwSetCursorPosCallback(window, MouseCallback);
+    glfwSetMouseButtonCallback(window, MouseButtonCallback);
     
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     
@@ -90,220 +219,180 @@ int main() {
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     
-    // Setup and compile our shaders
-    Shader shader( "res/shaders/cube.vs", "res/shaders/cube.frag" );
-    Shader skyboxShader( "res/shaders/skybox.vs", "res/shaders/skybox.frag" );
-    
-    GLfloat cubeVertices[] = {
-        // Positions          // Texture Coords
-        -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-        0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
-        0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-        
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-        0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-        0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-        -0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        
-        -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        -0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        
-        0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
-        0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-        0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-        0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        -0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f
-    };
-    
-    GLfloat skyboxVertices[] = {
-        // Positions
-        -1.0f,  1.0f, -1.0f,
-        -1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-        1.0f,  1.0f, -1.0f,
-        -1.0f,  1.0f, -1.0f,
-        
-        -1.0f, -1.0f,  1.0f,
-        -1.0f, -1.0f, -1.0f,
-        -1.0f,  1.0f, -1.0f,
-        -1.0f,  1.0f, -1.0f,
-        -1.0f,  1.0f,  1.0f,
-        -1.0f, -1.0f,  1.0f,
-        
-        1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-        
-        -1.0f, -1.0f,  1.0f,
-        -1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f, -1.0f,  1.0f,
-        -1.0f, -1.0f,  1.0f,
-        
-        -1.0f,  1.0f, -1.0f,
-        1.0f,  1.0f, -1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        -1.0f,  1.0f,  1.0f,
-        -1.0f,  1.0f, -1.0f,
-        
-        -1.0f, -1.0f, -1.0f,
-        -1.0f, -1.0f,  1.0f,
-        1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-        -1.0f, -1.0f,  1.0f,
-        1.0f, -1.0f,  1.0f
-    };
-    
-    // Setup cube VAO
-    GLuint cubeVAO, cubeVBO;
-    glGenVertexArrays( 1, &cubeVAO );
-    glGenBuffers( 1, &cubeVBO );
-    glBindVertexArray( cubeVAO );
-    glBindBuffer( GL_ARRAY_BUFFER, cubeVBO );
-    
-    glBufferData( GL_ARRAY_BUFFER, sizeof( cubeVertices ), &cubeVertices, GL_STATIC_DRAW );
-    glEnableVertexAttribArray(0);
-    
-    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof( GLfloat ), ( GLvoid * ) 0 );
-    glEnableVertexAttribArray( 1 );
-    
-    glVertexAttribPointer( 1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof( GLfloat ), ( GLvoid * )( 3 * sizeof( GLfloat ) ) );
-    glBindVertexArray(0);
-    
-    // Setup skybox VAO
-    GLuint skyboxVAO, skyboxVBO;
-    glGenVertexArrays( 1, &skyboxVAO );
-    glGenBuffers( 1, &skyboxVBO );
-    glBindVertexArray( skyboxVAO );
-    glBindBuffer( GL_ARRAY_BUFFER, skyboxVBO );
+#if PROFILER_ENABLED
+    Profiler::get().initGpuQueries();
+#endif
     
-    glBufferData( GL_ARRAY_BUFFER, sizeof( skyboxVertices ), &skyboxVertices, GL_STATIC_DRAW );
-    glEnableVertexAttribArray( 0 );
-    
-    glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof( GLfloat ), ( GLvoid * ) 0 );
-    glBindVertexArray(0);
-    
-    // Load textures
-    GLuint cubeTexture = TextureLoading::LoadTexture( "res/images/container2.png" );
+    if (particleCheck || hdrCheck) {
+        bool passed = particleCheck ? checkParticles() : checkHdr();
+        GpuResourceRegistry::get().shutdown();
+        glfwTerminate();
+        return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
     
-    // Cubemap (Skybox)
-    vector<const GLchar*> faces;
-    faces.push_back( "res/images/skybox/right.tga" );
-    faces.push_back( "res/images/skybox/left.tga" );
-    faces.push_back( "res/images/skybox/top.tga" );
-    faces.push_back( "res/images/skybox/bottom.tga" );
-    faces.push_back( "res/images/skybox/back.tga" );
-    faces.push_back( "res/images/skybox/front.tga" );
-    GLuint cubemapTexture = TextureLoading::LoadCubemap( faces );
-
+    if (benchmark) {
+        int result = Benchmark::run(window, SCREEN_WIDTH, SCREEN_HEIGHT, benchmarkOptions);
+        GpuResourceRegistry::get().shutdown();
+        glfwTerminate();
+        return result;
+    }
     
-    // FOV of camera
-    glm::mat4 projection(1);
-    projection = glm::perspective(camera.getZoom(), (GLfloat) SCREEN_WIDTH / (GLfloat) SCREEN_HEIGHT, 0.1f, 1000.0f);
+#if PROFILER_ENABLED
+    ProfilerOverlay profilerOverlay;
+    profilerOverlay.init();
+#endif
     
-    // Game loop
-    while (!glfwWindowShouldClose( window )) {
-        GLfloat currentFrame = glfwGetTime(); // for dt
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
-        
-//        std::cout << "fps: " << 1/deltaTime << std::endl;
+    {
+        // The block world, as greedily meshed voxel chunks streamed around the camera and saved in world/
+        VoxelScene voxelWorld("world", VOXEL_WORLD_SEED, chunkBudget);
         
-        // Check if any events have been activiated (key pressed, mouse moved etc.) and call corresponding response functions
-        glfwPollEvents( );
-        
-        DoMovement(); // Camera movement
-        
-        // Render
-        // Clear the colorbuffer
-        glClearColor( 0.1f, 0.1f, 0.1f, 1.0f );
-        glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+        // Streams in the chunks around the camera and stands it on the ground below
+        voxelWorld.finish(camera.getPosition());
+        glm::vec3 spawn = camera.getPosition();
+        VoxelRayHit ground;
+        glm::vec3 sky(spawn.x, (GLfloat) ((VoxelScene::STREAM_MAX_Y + 1) * CHUNK_SIZE), spawn.z);
+        if (raycastBlocks(voxelWorld.getWorld(), sky, glm::vec3(0.0f, -1.0f, 0.0f),
+                          (GLfloat) ((VoxelScene::STREAM_MAX_Y - VoxelScene::STREAM_MIN_Y + 1) * CHUNK_SIZE), ground)) {
+            camera.setPosition(glm::vec3(spawn.x, (GLfloat) (ground.block.y + 1) + PLAYER_EYE_HEIGHT, spawn.z));
+        }
         
-        glm::mat4 model(1);
-        glm::mat4 view = camera.getViewMatrix();
+        // A fountain a few blocks in front of the spawn, bouncing off the ground around it
+        ParticleSettings fountainSettings;
+        fountainSettings.emitter = camera.getPosition() + glm::vec3(0.0f, -PLAYER_EYE_HEIGHT, -6.0f);
+        fountainSettings.emitRate = FOUNTAIN_PARTICLES / fountainSettings.lifetimeMax;
+        ParticleSystem fountain(FOUNTAIN_PARTICLES, fountainSettings);
+        fountain.setHeightfield(voxelHeightfield(voxelWorld.getWorld(), (GLint) std::floor(fountainSettings.emitter.x),
+                                                 (GLint) std::floor(fountainSettings.emitter.z), FOUNTAIN_FIELD_SIZE,
+                                                 (VoxelScene::STREAM_MAX_Y + 1) * CHUNK_SIZE - 1, VoxelScene::STREAM_MIN_Y * CHUNK_SIZE));
         
-        // Draw our first triangle
-        shader.Use();
+        // Cubemap (Skybox), baked into one file with mips on the first run
+        Skybox skybox( { "res/images/skybox/right.tga", "res/images/skybox/left.tga", "res/images/skybox/top.tga",
+                         "res/images/skybox/bottom.tga", "res/images/skybox/back.tga", "res/images/skybox/front.tga" },
+                       "res/images/skybox/skybox.ktx2" );
         
-        // Bind Textures using texture units
-        glActiveTexture( GL_TEXTURE0 );
-        glBindTexture( GL_TEXTURE_2D, cubeTexture );
-        glUniform1i( glGetUniformLocation( shader.Program, "texture1" ), 0 );
+        // The scene is lit and drawn in HDR at a scale that keeps the GPU inside the frame budget, upscaled,
+        // then bloomed, exposed, tonemapped, graded and antialiased onto the screen
+        HdrPipeline hdr(SCREEN_WIDTH, SCREEN_HEIGHT);
+        DynamicResolution resolution(resolutionSettings);
+        PostProcessChain post;
+        GLuint lutSize;
+        std::vector<GLfloat> lut;
+        if (!gradingLut.empty() && loadCubeLut(gradingLut, lutSize, lut)) {
+            post.setGradingLut(lutSize, lut);
+        }
         
-        // Get the uniform locations
-        GLint modelLoc = glGetUniformLocation( shader.Program, "model" );
-        GLint viewLoc = glGetUniformLocation( shader.Program, "view" );
-        GLint projLoc = glGetUniformLocation( shader.Program, "projection" );
+        // FOV of camera
+        glm::mat4 projection(1);
+        projection = glm::perspective(camera.getZoom(), (GLfloat) SCREEN_WIDTH / (GLfloat) SCREEN_HEIGHT, 0.1f, 1000.0f);
         
-        // Pass the matrices to the shader
-        glUniformMatrix4fv( viewLoc, 1, GL_FALSE, glm::value_ptr( view ) );
-        glUniformMatrix4fv( projLoc, 1, GL_FALSE, glm::value_ptr( projection ) );
+        // Simulation steps at SIMULATION_RATE, rendering interpolates between the last two steps
+        FixedTimestep timestep;
+        Camera renderCamera = camera;
         
-        glBindVertexArray( cubeVAO );
-        for ( GLuint i = 0; i < 16; i++) {
-            for ( GLuint j = 0; j < 4; j++) {
-                for ( GLuint k = 0; k < 16; k++) {
-                    model = glm::mat4(1);
-                    model = glm::translate(model, glm::vec3(-1.0f, -1.0f, 1.0f));
-                    model = glm::translate(model, glm::vec3(1.0f * i, -1.0f * j, 1.0f * k));
-                    glUniformMatrix4fv( modelLoc, 1, GL_FALSE, glm::value_ptr( model ) );
-                    glDrawArrays( GL_TRIANGLES, 0, 36 );
+        // The frame's passes; the graph orders them, binds their targets and sets their depth and blend state
+        RenderGraph frame;
+        RenderResource color, depth;
+        hdr.importScene(frame, color, depth);
+        {
+            RenderGraph::PassBuilder voxels = frame.addPass("Voxels", [&voxelWorld, &renderCamera, &projection](RenderGraph &) {
+                voxelWorld.draw(renderCamera, projection);
+            });
+            voxels.setState(RENDER_STATE_SCENE).clearColor(glm::vec4(0.1f, 0.1f, 0.1f, 1.0f)).clearDepth();
+            color = voxels.write(color);
+            depth = voxels.write(depth, ACCESS_DEPTH);
+            
+            // Only where nothing else was drawn, so after the opaque passes
+            RenderState sky = RENDER_STATE_SCENE;
+            sky.depthWrite = false;
+            sky.depthFunc = GL_LEQUAL;
+            RenderGraph::PassBuilder skyboxPass = frame.addPass("Skybox", [&skybox, &renderCamera, &projection](RenderGraph &) {
+                skybox.draw(renderCamera, projection);
+            });
+            color = skyboxPass.setState(sky).write(color);
+            depth = skyboxPass.write(depth, ACCESS_DEPTH);
+            
+            // Blended over everything, so after the sky
+            RenderState blended = RENDER_STATE_SCENE;
+            blended.depthWrite = false;
+            RenderGraph::PassBuilder particles = frame.addPass("Particles", [&fountain, &renderCamera, &projection](RenderGraph &) {
+                fountain.update(std::min(deltaTime, 1.0f / 20.0f));
+                fountain.draw(renderCamera.getViewMatrix(), projection, renderCamera.getPosition());
+            });
+            color = particles.setState(blended).write(color);
+            depth = particles.write(depth, ACCESS_DEPTH);
+            
+            RenderResource scene = resolution.addUpscalePass(frame, color, depth);
+            RenderResource exposure = hdr.addExposurePass(frame, scene, deltaTime);
+            RenderResource screen = post.addPasses(frame, hdr, scene, exposure, frame.importOutput("Screen"));
+#if PROFILER_ENABLED
+            RenderState overlay;
+            overlay.blend = RENDER_BLEND_ALPHA;
+            frame.addPass("Profiler overlay", [&profilerOverlay](RenderGraph &) {
+                if (showProfiler) {
+                    profilerOverlay.draw(Profiler::get());
                 }
-            }
+            }).setState(overlay).write(screen);
+#endif
         }
-        glBindVertexArray(0);
-        
-        
-        // Draw skybox as last
-        glDepthFunc( GL_LEQUAL );  // Change depth function so depth test passes when values are equal to depth buffer's content
-        skyboxShader.Use( );
-        view = glm::mat4( glm::mat3( camera.getViewMatrix( ) ) );    // Remove any translation component of the view matrix
-        
-        glUniformMatrix4fv( glGetUniformLocation( skyboxShader.Program, "view" ), 1, GL_FALSE, glm::value_ptr( view ) );
-        glUniformMatrix4fv( glGetUniformLocation( skyboxShader.Program, "projection" ), 1, GL_FALSE, glm::value_ptr( projection ) );
+        frame.compile();
+        frame.realize();
         
-        // draw skybox cube
-        glBindVertexArray( skyboxVAO );
-        glBindTexture( GL_TEXTURE_CUBE_MAP, cubemapTexture );
-        glDrawArrays( GL_TRIANGLES, 0, 36 );
-        glBindVertexArray( 0 );
-        glDepthFunc( GL_LESS ); // Set depth function back to default
-        
-        // Swap the screen buffers
-        glfwSwapBuffers( window );
-    }
+        // Game loop
+        while (!glfwWindowShouldClose( window )) {
+            GLfloat currentFrame = glfwGetTime(); // for dt
+            deltaTime = currentFrame - lastFrame;
+            lastFrame = currentFrame;
+            
+            PROFILE_BEGIN_FRAME();
+            FrameArena::get().beginFrame();
+            AllocationTracker::get().beginFrame();
+            
+            GLfloat alpha;
+            {
+                PROFILE_SCOPE("Simulation");
+                // Check if any events have been activiated (key pressed, mouse moved etc.) and call corresponding response functions
+                glfwPollEvents( );
+                
+                const VoxelWorld &world = voxelWorld.getWorld();
+                alpha = timestep.advance(deltaTime, [&world](GLfloat stepTime) { DoMovement(stepTime, world); }); // Camera movement
+                EditBlocks(voxelWorld.getWorld());
+            }
+            renderCamera = camera.interpolated(alpha);
+            
+            // Render
+            voxelWorld.prepare(renderCamera, projection);
+            resolution.beginFrame(frame);
+            frame.execute();
+            resolution.endFrame();
+            
+            TextureResidency::get().update();
+            AsyncTextureLoader::get().update();
+            
+            // Swap the screen buffers
+            glfwSwapBuffers( window );
+            GpuResourceRegistry::get().endFrame(); // Deletes what the GPU has finished with
+            
+            PROFILE_END_FRAME();
+            
+            if (recordingPath) {
+                recordedPath.record(currentFrame - recordingStart, camera);
+                AllocationTracker::get().allowFrame();
+            }
+#if PROFILER_ENABLED
+            if (Profiler::get().isCapturing()) {
+                AllocationTracker::get().allowFrame();
+            }
+#endif
+            AllocationTracker::get().endFrame();
+        }
+    } // Scene resources are released here, while the context is alive
     
     // Properly de-allocate all resources once they've outlived their purpose
+#if PROFILER_ENABLED
+    profilerOverlay.destroy();
+    Profiler::get().destroyGpuQueries();
+#endif
+    GpuResourceRegistry::get().shutdown(); // Reports anything not released
     
     // Terminate GLFW, clearing any resources allocated by GLFW.
     glfwTerminate( );
@@ -312,24 +401,49 @@ int main() {
 }
 
 
-void DoMovement() {
-    camera.update(deltaTime);
-    camera.intersect();
+// One fixed simulation step: input, physics, then collision
+void DoMovement(GLfloat stepTime, const VoxelWorld &world) {
+    camera.storePreviousState();
     if (keys[GLFW_KEY_W] || keys[GLFW_KEY_UP]) {
-        camera.processKeyboard(FORWARD, deltaTime);
+        camera.processKeyboard(FORWARD, stepTime);
     }
     if (keys[GLFW_KEY_S] || keys[GLFW_KEY_DOWN]) {
-        camera.processKeyboard(BACKWARD, deltaTime);
+        camera.processKeyboard(BACKWARD, stepTime);
     }
     if (keys[GLFW_KEY_A] || keys[GLFW_KEY_LEFT]) {
-        camera.processKeyboard(LEFT, deltaTime);
+        camera.processKeyboard(LEFT, stepTime);
     }
     if (keys[GLFW_KEY_D] || keys[GLFW_KEY_RIGHT]) {
-        camera.processKeyboard(RIGHT, deltaTime);
+        camera.processKeyboard(RIGHT, stepTime);
     }
     if (keys[GLFW_KEY_SPACE]) {
-        camera.processKeyboard(UP, deltaTime);
+        camera.processKeyboard(UP, stepTime);
     }
+    camera.update(stepTime);
+    camera.intersect(world);
+}
+
+// Left click breaks the block under the crosshair, right click places one against the face it shows
+void EditBlocks(VoxelWorld &world) {
+    if (!breakBlock && !placeBlock) {
+        return;
+    }
+    VoxelRayHit hit;
+    if (raycastBlocks(world, camera.getPosition(), camera.getFront(), PLAYER_REACH, hit)) {
+        if (breakBlock) {
+            world.setBlock(hit.block.x, hit.block.y, hit.block.z, BLOCK_AIR);
+        } else if (hit.normal != glm::ivec3(0)) {
+            glm::ivec3 target = hit.block + hit.normal;
+            AABB body = playerBody(camera.getPosition());
+            bool inside = target.x + 1 > body.min.x && target.x < body.max.x && target.y + 1 > body.min.y && target.y < body.max.y
+                       && target.z + 1 > body.min.z && target.z < body.max.z;
+            if (!inside) {
+                world.setBlock(target.x, target.y, target.z, BLOCK_CONTAINER);
+            }
+        }
+    }
+    breakBlock = false;
+    placeBlock = false;
 }
 
 void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mode) {
@@ -337,6 +451,27 @@ void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mode
         glfwSetWindowShouldClose(window, GL_TRUE);
     }
     
+#if PROFILER_ENABLED
+    // F1 toggles the frame-time overlay, F2 writes the next 120 frames as a Chrome trace
+    if (key == GLFW_KEY_F1 && action == GLFW_PRESS) {
+        showProfiler = !showProfiler;
+    }
+    if (key == GLFW_KEY_F2 && action == GLFW_PRESS) {
+        Profiler::get().captureTrace("profile.json", 120);
+    }
+#endif
+    
+    // F3 starts recording a camera path for the benchmark, pressing it again saves camera.path
+    if (key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+        if (recordingPath) {
+            recordedPath.save("camera.path");
+            std::cout << "Saved camera path to camera.path" << std::endl;
+        }
+        recordedPath.clear();
+        recordingStart = glfwGetTime();
+        recordingPath = !recordingPath;
+    }
+    
     if (key >= 0 && key < 1024) {
         if (action == GLFW_PRESS) {
             keys[key] = true;
@@ -346,6 +481,13 @@ void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mode
     }
 }
 
+void MouseButtonCallback(GLFWwindow *window, int button, int action, int mods) {
+    if (action == GLFW_PRESS) {
+        breakBlock = breakBlock || button == GLFW_MOUSE_BUTTON_LEFT;
+        placeBlock = placeBlock || button == GLFW_MOUSE_BUTTON_RIGHT;
+    }
+}
+
 void MouseCallback(GLFWwindow *window, double xPos, double yPos) {
     if (firstMouse) {
         lastX = xPos;
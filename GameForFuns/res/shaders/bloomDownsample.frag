@@ -0,0 +1,42 @@
+#version 330 core
+// Halves the source with 13 bilinear taps spread over 6x6 texels: five overlapping 2x2 boxes,
+// the centre one weighted 0.5 and the four corner ones 0.125 each (Jimenez, "Next Generation
+// Post Processing in Call of Duty: Advanced Warfare"). For the first level each box is weighted
+// by 1 / (1 + luma), the Karis average, so a single very bright pixel cannot flicker the bloom.
+in vec2 TexCoords;
+
+out vec4 color;
+
+uniform sampler2D source;
+uniform vec2 texelSize;   // Of the source
+uniform bool karisAverage;
+
+vec3 tap(float x, float y) {
+    // The scene can hold NaN or infinity, which blurring would spread
+    vec3 c = texture(source, TexCoords + vec2(x, y) * texelSize).rgb;
+    return clamp(c, vec3(0.0), vec3(65000.0));
+}
+
+float weight(vec3 box) {
+    return karisAverage ? 1.0 / (1.0 + dot(box, vec3(0.2126, 0.7152, 0.0722))) : 1.0;
+}
+
+void main() {
+    vec3 a = tap(-2.0, 2.0), b = tap(0.0, 2.0), c = tap(2.0, 2.0);
+    vec3 d = tap(-1.0, 1.0), e = tap(1.0, 1.0);
+    vec3 f = tap(-2.0, 0.0), g = tap(0.0, 0.0), h = tap(2.0, 0.0);
+    vec3 i = tap(-1.0, -1.0), j = tap(1.0, -1.0);
+    vec3 k = tap(-2.0, -2.0), l = tap(0.0, -2.0), m = tap(2.0, -2.0);
+
+    vec3 boxes[5] = vec3[5]((d + e + i + j) * 0.25, (a + b + f + g) * 0.25, (b + c + g + h) * 0.25,
+                            (f + g + k + l) * 0.25, (g + h + l + m) * 0.25);
+    float shares[5] = float[5](0.5, 0.125, 0.125, 0.125, 0.125);
+    vec3 sum = vec3(0.0);
+    float total = 0.0;
+    for (int n = 0; n < 5; n++) {
+        float w = shares[n] * weight(boxes[n]);
+        sum += boxes[n] * w;
+        total += w;
+    }
+    color = vec4(sum / total, 1.0);
+}
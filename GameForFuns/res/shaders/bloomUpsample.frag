@@ -0,0 +1,17 @@
+#version 330 core
+// Doubles the smaller level with a 3x3 tent; blended additively onto the level's own downsample.
+in vec2 TexCoords;
+
+out vec4 color;
+
+uniform sampler2D source;
+uniform vec2 texelSize;  // Of the source, scaled by the bloom radius
+
+void main() {
+    vec3 sum = texture(source, TexCoords).rgb * 4.0;
+    sum += (texture(source, TexCoords + vec2(-texelSize.x, 0.0)).rgb + texture(source, TexCoords + vec2(texelSize.x, 0.0)).rgb
+          + texture(source, TexCoords + vec2(0.0, -texelSize.y)).rgb + texture(source, TexCoords + vec2(0.0, texelSize.y)).rgb) * 2.0;
+    sum += texture(source, TexCoords - texelSize).rgb + texture(source, TexCoords + texelSize).rgb
+         + texture(source, TexCoords + vec2(-texelSize.x, texelSize.y)).rgb + texture(source, TexCoords + vec2(texelSize.x, -texelSize.y)).rgb;
+    color = vec4(sum / 16.0, 1.0);
+}
@@ -0,0 +1,41 @@
+#version 330 core
+// Averages the log2 luminance of the pixels between the low and high percent points of the
+// histogram, bin 0 left out, and eases the adapted value towards it. Matches
+// histogramLogLuminance and adaptLogLuminance in HdrPipeline.h.
+in vec2 TexCoords;
+
+out vec4 adapted;
+
+uniform sampler2D histogram;
+uniform sampler2D previous;
+uniform vec2 percent;     // Low, high
+uniform vec3 adaptation;  // Seconds since the last frame (negative to jump), rate towards brighter, rate towards darker
+
+const int BINS = 256;
+const float MIN_LOG = -8.0;
+const float BINS_PER_STOP = 16.0;
+
+void main() {
+    float total = 0.0;
+    for (int bin = 1; bin < BINS; bin++) {
+        total += texelFetch(histogram, ivec2(bin, 0), 0).r;
+    }
+    float low = total * percent.x;
+    float high = total * percent.y;
+    float below = 0.0;
+    float weight = 0.0;
+    float sum = 0.0;
+    for (int bin = 1; bin < BINS; bin++) {
+        float count = texelFetch(histogram, ivec2(bin, 0), 0).r;
+        float inside = max(min(below + count, high) - max(below, low), 0.0);
+        sum += inside * (MIN_LOG + (float(bin) + 0.5) / BINS_PER_STOP);
+        weight += inside;
+        below += count;
+    }
+
+    float last = texelFetch(previous, ivec2(0, 0), 0).r;
+    float target = weight > 0.0 ? sum / weight : last;
+    float rate = target > last ? adaptation.y : adaptation.z;
+    float next = adaptation.x < 0.0 ? target : last + (target - last) * (1.0 - exp(-adaptation.x * rate));
+    adapted = vec4(next, 0.0, 0.0, 1.0);
+}
@@ -0,0 +1,45 @@
+#version 330 core
+// FXAA 3.11, console version (Lottes). Four bilinear taps at the pixel's corners find the local
+// contrast; pixels below the threshold pass through, the rest are blurred along the edge with
+// two or four taps, falling back to two when the wider pair strays outside the corner range.
+// Luma comes from alpha, written by the grading pass.
+in vec2 TexCoords;
+
+out vec4 color;
+
+uniform sampler2D source;
+uniform vec2 texelSize;
+
+const float EDGE_SHARPNESS = 8.0;
+const float EDGE_THRESHOLD = 0.125;
+const float EDGE_THRESHOLD_MIN = 0.05;
+
+void main() {
+    float lumaNw = texture(source, TexCoords + vec2(-0.5, -0.5) * texelSize).a;
+    float lumaSw = texture(source, TexCoords + vec2(-0.5, 0.5) * texelSize).a;
+    float lumaNe = texture(source, TexCoords + vec2(0.5, -0.5) * texelSize).a + 1.0 / 384.0;
+    float lumaSe = texture(source, TexCoords + vec2(0.5, 0.5) * texelSize).a;
+    vec4 rgbyM = texture(source, TexCoords);
+    float lumaM = rgbyM.a;
+
+    float lumaMax = max(max(lumaNw, lumaSw), max(lumaNe, lumaSe));
+    float lumaMin = min(min(lumaNw, lumaSw), min(lumaNe, lumaSe));
+    if (max(lumaMax, lumaM) - min(lumaMin, lumaM) < max(EDGE_THRESHOLD_MIN, lumaMax * EDGE_THRESHOLD)) {
+        color = vec4(rgbyM.rgb, 1.0);
+        return;
+    }
+
+    float dirSwMinusNe = lumaSw - lumaNe;
+    float dirSeMinusNw = lumaSe - lumaNw;
+    vec2 dir1 = normalize(vec2(dirSwMinusNe + dirSeMinusNw, dirSwMinusNe - dirSeMinusNw));
+    float dirAbsMinTimesC = min(abs(dir1.x), abs(dir1.y)) * EDGE_SHARPNESS;
+    vec2 dir2 = clamp(dir1 / dirAbsMinTimesC, -2.0, 2.0);
+
+    vec4 rgby1 = (texture(source, TexCoords - dir1 * 0.5 * texelSize) + texture(source, TexCoords + dir1 * 0.5 * texelSize)) * 0.5;
+    vec4 rgby2 = (texture(source, TexCoords - dir2 * 2.0 * texelSize) + texture(source, TexCoords + dir2 * 2.0 * texelSize)) * 0.5;
+    rgby2 = (rgby2 + rgby1) * 0.5;
+    if (rgby2.a < lumaMin || rgby2.a > lumaMax) {
+        rgby2 = rgby1;
+    }
+    color = vec4(rgby2.rgb, 1.0);
+}
@@ -0,0 +1,16 @@
+#version 330 core
+// Looks the tonemapped color up in the grading LUT, sampling texel centres so the ends of the
+// range hit the first and last entries, and stores its luma in alpha for FXAA.
+in vec2 TexCoords;
+
+out vec4 color;
+
+uniform sampler2D source;
+uniform sampler3D lut;
+uniform float lutSize;
+
+void main() {
+    vec3 c = clamp(texture(source, TexCoords).rgb, 0.0, 1.0);
+    vec3 graded = texture(lut, c * ((lutSize - 1.0) / lutSize) + 0.5 / lutSize).rgb;
+    color = vec4(graded, dot(graded, vec3(0.299, 0.587, 0.114)));
+}
@@ -0,0 +1,6 @@
+#version 330 core
+out vec4 count;
+
+void main() {
+    count = vec4(1.0);
+}
@@ -0,0 +1,25 @@
+#version 330 core
+// One point per sampled pixel, placed on the texel of its luminance bin; the fragments are
+// blended additively, so the 256x1 target ends up holding the counts.
+uniform sampler2D scene;
+uniform int stride;
+
+const float LUMINANCE_MIN = 1.0 / 256.0;
+const float LUMINANCE_MAX = 255.99;
+const uint BIN_BASE = uint((127 - 8) * 16);
+
+// Matches luminanceBin in HdrPipeline.h: the exponent and top four mantissa bits
+uint luminanceBin(vec3 color) {
+    float luminance = dot(color, vec3(0.2126, 0.7152, 0.0722));
+    luminance = luminance > LUMINANCE_MIN ? luminance : LUMINANCE_MIN;
+    luminance = luminance < LUMINANCE_MAX ? luminance : LUMINANCE_MAX;
+    return (floatBitsToUint(luminance) >> 19u) - BIN_BASE;
+}
+
+void main() {
+    ivec2 size = textureSize(scene, 0);
+    int columns = (size.x + stride - 1) / stride;
+    ivec2 pixel = ivec2(gl_VertexID % columns, gl_VertexID / columns) * stride;
+    uint bin = luminanceBin(texelFetch(scene, pixel, 0).rgb);
+    gl_Position = vec4((float(bin) + 0.5) / 128.0 - 1.0, 0.0, 0.0, 1.0);
+}
@@ -0,0 +1,16 @@
+#version 330 core
+in float Fade;
+
+out vec4 color;
+
+uniform vec3 particleColor;
+
+void main() {
+    // Round, soft edged points
+    vec2 offset = gl_PointCoord * 2.0 - 1.0;
+    float falloff = 1.0 - dot(offset, offset);
+    if (falloff <= 0.0) {
+        discard;
+    }
+    color = vec4(particleColor, falloff * Fade);
+}
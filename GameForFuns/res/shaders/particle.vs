@@ -0,0 +1,24 @@
+#version 330 core
+layout (location = 0) in vec4 positionAge;
+layout (location = 1) in vec4 velocityLife;
+
+out float Fade;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform float particleSize;   // World units
+uniform float viewportHeight;
+
+void main() {
+    if (!(positionAge.w < velocityLife.w)) {
+        // Dead: outside the clip volume, so the point is dropped before rasterization
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        gl_PointSize = 1.0;
+        Fade = 0.0;
+        return;
+    }
+    vec4 viewPosition = view * vec4(positionAge.xyz, 1.0);
+    gl_Position = projection * viewPosition;
+    gl_PointSize = max(particleSize * projection[1][1] * 0.5 * viewportHeight / max(-viewPosition.z, 0.01), 1.0);
+    Fade = 1.0 - positionAge.w / velocityLife.w;
+}
@@ -0,0 +1,30 @@
+#version 430 core
+// particle.vs reading the particles through the sorted keys; only visible ones are drawn
+
+struct Particle {
+    vec4 positionAge;
+    vec4 velocityLife;
+};
+
+layout (std430, binding = 0) readonly buffer Particles {
+    Particle particles[];
+};
+
+layout (std430, binding = 1) readonly buffer Keys {
+    uvec2 keys[];
+};
+
+out float Fade;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform float particleSize;
+uniform float viewportHeight;
+
+void main() {
+    Particle particle = particles[keys[gl_VertexID].y];
+    vec4 viewPosition = view * vec4(particle.positionAge.xyz, 1.0);
+    gl_Position = projection * viewPosition;
+    gl_PointSize = max(particleSize * projection[1][1] * 0.5 * viewportHeight / max(-viewPosition.z, 0.01), 1.0);
+    Fade = 1.0 - particle.positionAge.w / particle.velocityLife.w;
+}
@@ -0,0 +1,70 @@
+#version 330 core
+// One particle per vertex, captured by transform feedback into the other buffer.
+// Keep in step with particleUpdate.comp and simulateParticle in ParticleSystem.h.
+layout (location = 0) in vec4 positionAge;  // Position, seconds since emission
+layout (location = 1) in vec4 velocityLife; // Velocity, lifetime; a particle is alive while age < lifetime
+
+out vec4 outPositionAge;
+out vec4 outVelocityLife;
+
+uniform float deltaTime;
+uniform vec4 emitter;         // Position, speed
+uniform vec3 emitShape;       // Cosine of the cone's half angle, shortest and longest lifetime
+uniform uvec4 emission;       // First slot, slot count, capacity, seed
+uniform vec4 forces;          // Gravity, drag, restitution, friction
+uniform sampler2D heightfield;
+uniform vec3 heightfieldOrigin; // x and z of cell (0, 0), cell size
+uniform ivec2 heightfieldSize;  // 0 without a heightfield
+
+uint hash(uint v) {
+    uint state = v * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random(uint id, uint stream) {
+    return float(hash(id ^ hash(emission.w + stream)) >> 8u) / 16777216.0;
+}
+
+float groundHeight(vec2 xz) {
+    ivec2 cell = ivec2(floor((xz - heightfieldOrigin.xy) / heightfieldOrigin.z));
+    if (any(lessThan(cell, ivec2(0))) || any(greaterThanEqual(cell, heightfieldSize))) {
+        return -1e30;
+    }
+    return texelFetch(heightfield, cell, 0).r;
+}
+
+void main() {
+    uint id = uint(gl_VertexID);
+    vec3 position = positionAge.xyz;
+    float age = positionAge.w;
+    vec3 velocity = velocityLife.xyz;
+    float lifetime = velocityLife.w;
+
+    uint offset = id >= emission.x ? id - emission.x : id + emission.z - emission.x;
+    if (offset < emission.y) {
+        // Emitted this step: straight up a cone around +y
+        float angle = 6.2831853 * random(id, 0u);
+        float y = mix(emitShape.x, 1.0, random(id, 1u));
+        float radius = sqrt(max(1.0 - y * y, 0.0));
+        position = emitter.xyz;
+        velocity = vec3(radius * cos(angle), y, radius * sin(angle)) * emitter.w;
+        age = 0.0;
+        lifetime = mix(emitShape.y, emitShape.z, random(id, 2u));
+    } else if (age < lifetime) {
+        age += deltaTime;
+        velocity.y -= forces.x * deltaTime;
+        velocity /= 1.0 + forces.y * deltaTime;
+        position += velocity * deltaTime;
+        float ground = groundHeight(position.xz);
+        if (position.y < ground) {
+            position.y = ground;
+            if (velocity.y < 0.0) {
+                velocity.y = -velocity.y * forces.z;
+                velocity.xz *= forces.w;
+            }
+        }
+    }
+    outPositionAge = vec4(position, age);
+    outVelocityLife = vec4(velocity, lifetime);
+}
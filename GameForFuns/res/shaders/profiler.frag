@@ -0,0 +1,8 @@
+#version 330 core
+in vec3 BarColor;
+
+out vec4 color;
+
+void main() {
+    color = vec4(BarColor, 0.85);
+}
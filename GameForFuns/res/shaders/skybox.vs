@@ -1,13 +1,14 @@
 #version 330 core
-layout (location = 0) in vec3 position;
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+uniform mat4 inverseViewProjection;
 
 
 void main() {
-    vec4 pos = projection * view * vec4(position, 1.0);
-    gl_Position = pos.xyww;
-    TexCoords = position;
+    // One triangle covering the screen: (-1,-1), (3,-1), (-1,3), on the far plane
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    vec4 clip = vec4(corner, 1.0, 1.0);
+    gl_Position = clip;
+    // Every corner shares w, so interpolating the unprojected point gives the view ray's direction
+    TexCoords = (inverseViewProjection * clip).xyz;
 }
@@ -0,0 +1,31 @@
+#version 330 core
+// Mixes the bloom into the HDR scene, exposes it so its adapted average lands on the key, then
+// maps it through Hable's filmic curve, scaled so the white point reaches 1, and gamma encodes it.
+in vec2 TexCoords;
+
+out vec4 color;
+
+uniform sampler2D scene;
+uniform sampler2D bloom;
+uniform sampler2D adaptedLuminance;
+uniform float bloomStrength;
+uniform vec2 exposure;  // Key, compensation in stops
+uniform vec2 curve;     // White point, 1 / gamma
+
+vec3 filmic(vec3 x) {
+    const float A = 0.15; // Shoulder strength
+    const float B = 0.50; // Linear strength
+    const float C = 0.10; // Linear angle
+    const float D = 0.20; // Toe strength
+    const float E = 0.02; // Toe numerator
+    const float F = 0.30; // Toe denominator
+    return ((x * (A * x + C * B) + D * E) / (x * (A * x + B) + D * F)) - E / F;
+}
+
+void main() {
+    float logLuminance = texelFetch(adaptedLuminance, ivec2(0, 0), 0).r;
+    vec3 hdr = mix(texture(scene, TexCoords).rgb, texture(bloom, TexCoords).rgb, bloomStrength);
+    hdr *= exposure.x * exp2(exposure.y - logLuminance);
+    vec3 mapped = filmic(max(hdr, vec3(0.0))) / filmic(vec3(curve.x));
+    color = vec4(pow(mapped, vec3(curve.y)), 1.0);
+}
@@ -0,0 +1,35 @@
+#version 330 core
+// Stretches the rendered corner of the scene target over the whole of it with a bilinear tap, then
+// sharpens with the source texels above, below and to either side. Colors are compressed by
+// 1 / (1 + luma) first, so highlights cannot ring, and the sharpened color is clamped to the range
+// of the five taps, so it never overshoots an edge.
+in vec2 TexCoords;
+
+out vec4 color;
+
+uniform sampler2D scene;
+uniform vec2 uvScale;    // The rendered extent over the target's size
+uniform vec2 uvMax;      // Half a texel inside the rendered extent, so no tap blends in what lies outside it
+uniform vec2 texelSize;  // Of the scene target
+uniform float sharpness;
+
+const vec3 LUMA = vec3(0.2126, 0.7152, 0.0722);
+
+vec3 tap(vec2 uv) {
+    vec3 c = texture(scene, min(uv, uvMax)).rgb;
+    return c / (1.0 + dot(c, LUMA));
+}
+
+void main() {
+    vec2 uv = TexCoords * uvScale;
+    vec3 center = tap(uv);
+    vec3 north = tap(uv + vec2(0.0, texelSize.y));
+    vec3 south = tap(uv - vec2(0.0, texelSize.y));
+    vec3 east = tap(uv + vec2(texelSize.x, 0.0));
+    vec3 west = tap(uv - vec2(texelSize.x, 0.0));
+
+    vec3 low = min(center, min(min(north, south), min(east, west)));
+    vec3 high = max(center, max(max(north, south), max(east, west)));
+    vec3 sharpened = clamp(center + sharpness * (center - (north + south + east + west) * 0.25), low, high);
+    color = vec4(sharpened / max(1.0 - dot(sharpened, LUMA), 1.0 / 65504.0), 1.0);
+}
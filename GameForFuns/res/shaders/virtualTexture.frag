@@ -0,0 +1,31 @@
+#version 330 core
+
+in vec2 TexCoords;
+
+out vec4 color;
+
+const float PAGE_SIZE = 128.0;
+const float PAGE_BORDER = 1.0;
+const float TILE_SIZE = PAGE_SIZE + 2.0 * PAGE_BORDER;
+
+uniform sampler2D physicalCache;
+uniform sampler2D pageTable;
+uniform vec2 virtualSize;   // Level 0 texels
+uniform float maxLevel;
+uniform float cacheTiles;   // Tiles along each side of the physical cache
+
+void main() {
+    vec2 uv = fract( TexCoords );
+    vec2 texels = TexCoords * virtualSize;
+    vec2 dx = dFdx( texels );
+    vec2 dy = dFdy( texels );
+    float level = clamp( floor( 0.5 * log2( max( dot( dx, dx ), dot( dy, dy ) ) ) ), 0.0, maxLevel );
+    
+    // The entry points at the page's tile, or its nearest resident ancestor's while it streams in
+    vec2 pages = max( virtualSize / ( PAGE_SIZE * exp2( level ) ), vec2( 1.0 ) );
+    vec4 entry = floor( texelFetch( pageTable, ivec2( min( uv * pages, pages - 1.0 ) ), int( level ) ) * 255.0 + 0.5 );
+    vec2 inPage = mod( uv * virtualSize / exp2( entry.b ), PAGE_SIZE );
+    
+    vec2 texel = entry.rg * TILE_SIZE + PAGE_BORDER + inPage;
+    color = texture( physicalCache, texel / ( cacheTiles * TILE_SIZE ) );
+}
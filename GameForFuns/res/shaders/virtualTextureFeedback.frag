@@ -0,0 +1,26 @@
+#version 330 core
+
+in vec2 TexCoords;
+
+out vec4 color;
+
+const float PAGE_SIZE = 128.0;
+
+uniform vec2 virtualSize;       // Level 0 texels
+uniform float maxLevel;
+uniform int textureIndex;
+uniform float feedbackLodBias;  // Rendered smaller than the screen, so derivatives are larger
+
+// Writes the page this pixel samples, packed as in makePageId in VirtualTexture.h
+void main() {
+    vec2 uv = fract( TexCoords );
+    vec2 texels = TexCoords * virtualSize;
+    vec2 dx = dFdx( texels );
+    vec2 dy = dFdy( texels );
+    float level = clamp( floor( 0.5 * log2( max( dot( dx, dx ), dot( dy, dy ) ) ) + feedbackLodBias ), 0.0, maxLevel );
+    
+    vec2 pages = max( virtualSize / ( PAGE_SIZE * exp2( level ) ), vec2( 1.0 ) );
+    uvec2 page = uvec2( min( uv * pages, pages - 1.0 ) );
+    uint id = ( uint( textureIndex ) << 26 ) | ( uint( level ) << 22 ) | ( page.x << 11 ) | page.y;
+    color = vec4( uvec4( id, id >> 8, id >> 16, id >> 24 ) & 255u ) / 255.0;
+}
@@ -0,0 +1,11 @@
+#version 330 core
+in vec2 TexCoord;
+in float Shade;
+
+out vec4 color;
+
+uniform sampler2D texture1;
+
+void main() {
+    color = vec4(texture(texture1, TexCoord).rgb * Shade, 1.0);
+}
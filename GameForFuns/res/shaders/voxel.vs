@@ -0,0 +1,25 @@
+#version 330 core
+layout (location = 0) in uint packed; // x, y, z in 6 bits each, face in 3, block in 8
+
+out vec2 TexCoord;
+out float Shade;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 chunkOrigin;
+
+// +X -X +Y -Y +Z -Z: sides a little darker than the top, the bottom darkest
+const float FACE_SHADE[6] = float[6](0.8, 0.8, 1.0, 0.5, 0.9, 0.9);
+
+void main() {
+    vec3 local = vec3(packed & 63u, (packed >> 6) & 63u, (packed >> 12) & 63u);
+    uint face = (packed >> 18) & 7u;
+    vec3 position = chunkOrigin + local;
+    gl_Position = projection * view * vec4(position, 1.0f);
+
+    // The texture repeats once per block across a merged quad
+    uint axis = face / 2u;
+    TexCoord = axis == 0u ? position.zy : axis == 1u ? position.xz : position.xy;
+    TexCoord.y = -TexCoord.y;
+    Shade = FACE_SHADE[face];
+}
@@ -45,7 +45,7 @@ public:
         this->setupMesh();
     }
     
-    void draw(Shader shader) {
+    void draw(const Shader &shader) {
         GLuint diffuseNr = 1;
         GLuint specularNr = 1;
         
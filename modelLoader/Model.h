@@ -30,7 +30,7 @@ public:
         this->loadModel(path);
     }
     
-    void draw(Shader shader) {
+    void draw(const Shader &shader) {
         for (GLuint i = 0; i < this->meshes.size(); i++) {
             this->meshes[i].draw(shader);
         }
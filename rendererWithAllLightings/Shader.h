@@ -92,6 +92,10 @@ public:
         
     }
     
+    // Owns the program, so it can't be copied
+    Shader( const Shader & ) = delete;
+    Shader &operator=( const Shader & ) = delete;
+    
     // Uses the current shader
     void Use() {
         glUseProgram( this->Program );
@@ -99,7 +103,7 @@ public:
     
     ~Shader() {
         if(Program != 0)                           // delete only if successfully created
-            glDeleteShader(Program);      // delete program
+            glDeleteProgram(Program);     // delete program
     }
 };
 